@@ -0,0 +1,261 @@
+#include "base/columnfile.h"
+
+#include <deque>
+#include <limits>
+
+namespace ev {
+
+namespace {
+
+void DecodeKey(const ColumnFileSchema& schema, uint32_t field,
+               const StringRefOrNull& value, ColumnFileKey& key) {
+  const auto column = schema.Find(field);
+  key.type = column ? column->type : kColumnTypeBinary;
+  key.is_null = value.IsNull();
+
+  if (key.is_null) return;
+
+  switch (key.type) {
+    case kColumnTypeInt:
+      key.int_value = schema.GetInt(field, value.StringRef());
+      break;
+
+    case kColumnTypeFloat:
+      key.float_value = schema.GetFloat(field, value.StringRef());
+      break;
+
+    default:
+      key.string_value.assign(value.StringRef().begin(),
+                              value.StringRef().end());
+      break;
+  }
+}
+
+bool KeysEqual(const std::vector<ColumnFileKey>& lhs,
+               const std::vector<ColumnFileKey>& rhs) {
+  for (size_t i = 0; i < lhs.size(); ++i) {
+    if (lhs[i] < rhs[i] || rhs[i] < lhs[i]) return false;
+  }
+
+  return true;
+}
+
+}  // namespace
+
+bool ColumnFileKey::operator<(const ColumnFileKey& rhs) const {
+  if (is_null != rhs.is_null) return is_null;
+  if (is_null) return false;
+
+  switch (type) {
+    case kColumnTypeInt:
+      return int_value < rhs.int_value;
+
+    case kColumnTypeFloat:
+      return float_value < rhs.float_value;
+
+    default:
+      return string_value < rhs.string_value;
+  }
+}
+
+void ColumnFileAggregate::State::Merge(const State& other) {
+  if (!other.count) return;
+
+  if (!count) {
+    *this = other;
+    return;
+  }
+
+  count += other.count;
+  min = std::min(min, other.min);
+  max = std::max(max, other.max);
+  sum += other.sum;
+}
+
+ColumnFileAggregate::ColumnFileAggregate(ColumnFileReader input)
+    : input_(std::move(input)) {}
+
+void ColumnFileAggregate::AddGroupBy(uint32_t field) {
+  group_by_.emplace_back(field);
+}
+
+void ColumnFileAggregate::AddGroupBy(const StringRef& name) {
+  AddGroupBy(input_.Schema().ColumnId(name));
+}
+
+void ColumnFileAggregate::AddAggregate(ColumnFileAggregateFunction function,
+                                       uint32_t field) {
+  aggregates_.emplace_back(function, field);
+}
+
+void ColumnFileAggregate::AddAggregate(ColumnFileAggregateFunction function,
+                                       const StringRef& name) {
+  AddAggregate(function, input_.Schema().ColumnId(name));
+}
+
+std::vector<ColumnFileAggregate::Group> ColumnFileAggregate::Execute(
+    ThreadPool& thread_pool) {
+  // Load the schema and the segment index before the segments are processed
+  // concurrently.
+  input_.Schema();
+  const auto segment_count = input_.SegmentCount();
+
+  Groups groups;
+
+  const auto merge = [this, &groups](Groups partial) {
+    for (auto& group : partial) {
+      auto i = groups.find(group.first);
+
+      if (i == groups.end()) {
+        groups.emplace(std::move(group.first), std::move(group.second));
+        continue;
+      }
+
+      for (size_t j = 0; j < aggregates_.size(); ++j)
+        i->second[j].Merge(group.second[j]);
+    }
+  };
+
+  // Limit the number of segments whose partial results are held in memory.
+  const auto max_pending = std::max<size_t>(thread_pool.Size() * 2, 1);
+
+  std::deque<std::future<Groups>> pending;
+
+  for (size_t i = 0; i < segment_count; ++i) {
+    pending.emplace_back(
+        thread_pool.Launch([this, i] { return ExecuteSegment(i); }));
+
+    if (pending.size() >= max_pending) {
+      merge(pending.front().get());
+      pending.pop_front();
+    }
+  }
+
+  for (auto& partial : pending) merge(partial.get());
+
+  if (group_by_.empty() && groups.empty())
+    groups[std::vector<ColumnFileKey>()].resize(aggregates_.size());
+
+  std::vector<Group> result;
+  result.reserve(groups.size());
+
+  for (const auto& group : groups) {
+    Group output;
+    output.key = group.first;
+
+    for (size_t i = 0; i < aggregates_.size(); ++i) {
+      const auto& state = group.second[i];
+
+      switch (aggregates_[i].first) {
+        case kColumnFileAggregateCount:
+          output.values.emplace_back(state.count);
+          break;
+
+        case kColumnFileAggregateMin:
+          output.values.emplace_back(
+              state.count ? state.min
+                          : std::numeric_limits<double>::quiet_NaN());
+          break;
+
+        case kColumnFileAggregateMax:
+          output.values.emplace_back(
+              state.count ? state.max
+                          : std::numeric_limits<double>::quiet_NaN());
+          break;
+
+        case kColumnFileAggregateSum:
+          output.values.emplace_back(state.sum);
+          break;
+      }
+    }
+
+    result.emplace_back(std::move(output));
+  }
+
+  return result;
+}
+
+ColumnFileAggregate::Groups ColumnFileAggregate::ExecuteSegment(
+    size_t index) {
+  const auto& schema = input_.Schema();
+
+  // The columns to read, and the position of each group-by and aggregate
+  // column in that list.
+  std::vector<uint32_t> fields(group_by_);
+  for (const auto& aggregate : aggregates_)
+    fields.emplace_back(aggregate.second);
+  std::sort(fields.begin(), fields.end());
+  fields.erase(std::unique(fields.begin(), fields.end()), fields.end());
+
+  const auto field_index = [&fields](uint32_t field) {
+    return std::lower_bound(fields.begin(), fields.end(), field) -
+           fields.begin();
+  };
+
+  std::vector<size_t> group_by_index;
+  for (const auto field : group_by_)
+    group_by_index.emplace_back(field_index(field));
+
+  std::vector<size_t> aggregate_index;
+  for (const auto& aggregate : aggregates_)
+    aggregate_index.emplace_back(field_index(aggregate.second));
+
+  ColumnFileReader reader(input_.SegmentInput(index));
+  reader.SetColumnFilter(fields.begin(), fields.end());
+
+  Groups result;
+
+  std::vector<StringRefOrNull> values(fields.size(), nullptr);
+  std::vector<ColumnFileKey> key(group_by_.size());
+  std::vector<ColumnFileKey> previous_key;
+  std::vector<State>* states = nullptr;
+
+  while (!reader.End()) {
+    const auto& row = reader.GetRow();
+
+    std::fill(values.begin(), values.end(), nullptr);
+    for (const auto& value : row)
+      values[field_index(value.first)] = value.second;
+
+    for (size_t i = 0; i < group_by_.size(); ++i)
+      DecodeKey(schema, group_by_[i], values[group_by_index[i]], key[i]);
+
+    // Consecutive rows usually belong to the same group, so only look up the
+    // group when the key changes.
+    if (!states || !KeysEqual(key, previous_key)) {
+      states = &result[key];
+      if (states->empty()) states->resize(aggregates_.size());
+      previous_key = key;
+    }
+
+    for (size_t i = 0; i < aggregates_.size(); ++i) {
+      const auto& value = values[aggregate_index[i]];
+      if (value.IsNull()) continue;
+
+      auto& state = (*states)[i];
+
+      if (aggregates_[i].first == kColumnFileAggregateCount) {
+        ++state.count;
+        continue;
+      }
+
+      const auto number = schema.GetFloat(aggregates_[i].second,
+                                          value.StringRef());
+
+      if (!state.count) {
+        state.min = number;
+        state.max = number;
+      } else {
+        state.min = std::min(state.min, number);
+        state.max = std::max(state.max, number);
+      }
+
+      state.sum += number;
+      ++state.count;
+    }
+  }
+
+  return result;
+}
+
+}  // namespace ev
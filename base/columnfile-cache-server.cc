@@ -0,0 +1,503 @@
+#include "base/columnfile.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <kj/debug.h>
+
+#include "base/columnfile-internal.h"
+#include "base/file.h"
+#include "base/string.h"
+
+namespace ev {
+
+using namespace columnfile_internal;
+
+namespace {
+
+// Maximum number of fields in a single request.  Every field is returned as a
+// file descriptor, and the kernel limits the number of descriptors passed in
+// a single message.
+const size_t kMaxFieldsPerRequest = 64;
+
+const size_t kMaxMessageSize = 65536;
+
+// A request is followed by `field_count` 32 bit field IDs, and then by the
+// path of the file.
+struct Request {
+  uint64_t device;
+  uint64_t inode;
+  uint64_t size;
+  int64_t mtime_ns;
+  uint64_t offset;
+  uint32_t field_count;
+  uint32_t path_size;
+};
+
+// A response is followed by `field_count` instances of `ResponseField`, and
+// then by an error message.  A memfd holding the data of each field is
+// passed along with the response.
+struct Response {
+  uint32_t field_count;
+  uint32_t error_size;
+};
+
+struct ResponseField {
+  uint32_t field;
+  uint32_t reserved;
+  uint64_t size;
+};
+
+void SendMessage(int socket, const std::string& data,
+                 const std::vector<int>& fds) {
+  struct iovec iov;
+  iov.iov_base = const_cast<char*>(data.data());
+  iov.iov_len = data.size();
+
+  struct msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+
+  std::vector<char> control;
+
+  if (!fds.empty()) {
+    control.resize(CMSG_SPACE(sizeof(int) * fds.size()));
+    message.msg_control = control.data();
+    message.msg_controllen = control.size();
+
+    auto header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(header), fds.data(), sizeof(int) * fds.size());
+  }
+
+  KJ_SYSCALL(sendmsg(socket, &message, MSG_NOSIGNAL));
+}
+
+// Receives a message, along with any file descriptors passed with it.
+// Returns false if the peer has closed the connection.
+bool ReceiveMessage(int socket, std::string& data,
+                    std::vector<kj::AutoCloseFd>& fds) {
+  data.resize(kMaxMessageSize);
+  fds.clear();
+
+  struct iovec iov;
+  iov.iov_base = &data[0];
+  iov.iov_len = data.size();
+
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * kMaxFieldsPerRequest));
+
+  struct msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control.data();
+  message.msg_controllen = control.size();
+
+  ssize_t size;
+  KJ_SYSCALL(size = recvmsg(socket, &message, MSG_CMSG_CLOEXEC));
+
+  for (auto header = CMSG_FIRSTHDR(&message); header;
+       header = CMSG_NXTHDR(&message, header)) {
+    if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+      continue;
+
+    const auto count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+    for (size_t i = 0; i < count; ++i) {
+      int fd;
+      memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(fd));
+      fds.emplace_back(fd);
+    }
+  }
+
+  if (!size) return false;
+
+  KJ_REQUIRE(!(message.msg_flags & (MSG_TRUNC | MSG_CTRUNC)),
+             "Message truncated");
+
+  data.resize(size);
+
+  return true;
+}
+
+struct sockaddr_un SocketAddress(const char* path) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+
+  KJ_REQUIRE(strlen(path) < sizeof(address.sun_path), "Socket path too long",
+             path);
+  strcpy(address.sun_path, path);
+
+  return address;
+}
+
+}  // namespace
+
+struct ColumnFileCacheServer::Entry {
+  kj::AutoCloseFd fd;
+  uint64_t size;
+};
+
+std::string ColumnFileCacheSocketPath() {
+  if (const auto path = getenv("COLUMNFILE_CACHE_SOCKET")) return path;
+
+  return StringPrintf("/tmp/columnfile-cache-%u.sock",
+                      static_cast<unsigned int>(getuid()));
+}
+
+ColumnFileCacheServer::ColumnFileCacheServer(const char* socket_path,
+                                             size_t capacity)
+    : socket_path_(socket_path), capacity_(capacity), stopping_(false) {
+  const auto address = SocketAddress(socket_path);
+
+  int fd;
+  KJ_SYSCALL(fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0));
+  socket_ = kj::AutoCloseFd(fd);
+
+  if (-1 == unlink(socket_path) && errno != ENOENT)
+    KJ_FAIL_SYSCALL("unlink", errno, socket_path);
+
+  KJ_SYSCALL(bind(socket_, reinterpret_cast<const struct sockaddr*>(&address),
+                  sizeof(address)),
+             socket_path);
+  KJ_SYSCALL(listen(socket_, 64));
+}
+
+ColumnFileCacheServer::~ColumnFileCacheServer() {
+  unlink(socket_path_.c_str());
+}
+
+void ColumnFileCacheServer::Run() {
+  while (!stopping_) {
+    const auto fd = accept4(socket_, nullptr, nullptr, SOCK_CLOEXEC);
+
+    if (fd == -1) {
+      if (stopping_) break;
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      KJ_FAIL_SYSCALL("accept4", errno);
+    }
+
+    kj::AutoCloseFd client(fd);
+
+    struct ucred credentials;
+    socklen_t credentials_size = sizeof(credentials);
+    KJ_SYSCALL(getsockopt(client, SOL_SOCKET, SO_PEERCRED, &credentials,
+                          &credentials_size));
+
+    // Clients can read any file this process can read, so only serve the
+    // user running the server.
+    if (credentials.uid != getuid()) continue;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    clients_.emplace(fd);
+
+    // The thread takes ownership of the socket.  kj::AutoCloseFd can't be
+    // captured, since its destructor may throw.
+    client.release();
+    std::thread([this, fd] { ServeClient(kj::AutoCloseFd(fd)); }).detach();
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  clients_done_.wait(lock, [this] { return clients_.empty(); });
+}
+
+void ColumnFileCacheServer::Stop() {
+  stopping_ = true;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  shutdown(socket_, SHUT_RDWR);
+  for (const auto fd : clients_) shutdown(fd, SHUT_RDWR);
+}
+
+ColumnFileCache::Statistics ColumnFileCacheServer::GetStatistics() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return statistics_;
+}
+
+void ColumnFileCacheServer::ServeClient(kj::AutoCloseFd client) {
+  // Files opened for this client, by path.
+  std::unordered_map<std::string, kj::AutoCloseFd> files;
+
+  std::string request;
+  std::vector<kj::AutoCloseFd> request_fds;
+
+  try {
+    while (ReceiveMessage(client, request, request_fds)) {
+      std::vector<std::pair<uint32_t, std::shared_ptr<Entry>>> fields;
+      std::string error;
+
+      try {
+        fields = HandleRequest(request, files);
+      } catch (kj::Exception e) {
+        error = e.getDescription().cStr();
+        fields.clear();
+      }
+
+      Response response;
+      response.field_count = fields.size();
+      response.error_size = error.size();
+
+      std::string message(reinterpret_cast<const char*>(&response),
+                          sizeof(response));
+      std::vector<int> fds;
+
+      for (const auto& field : fields) {
+        ResponseField response_field;
+        response_field.field = field.first;
+        response_field.reserved = 0;
+        response_field.size = field.second->size;
+
+        message.append(reinterpret_cast<const char*>(&response_field),
+                       sizeof(response_field));
+        fds.emplace_back(field.second->fd);
+      }
+
+      message.append(error);
+
+      SendMessage(client, message, fds);
+    }
+  } catch (kj::Exception e) {
+    // The client has gone away, or sent something unexpected.
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  clients_.erase(client.get());
+  if (clients_.empty()) clients_done_.notify_all();
+}
+
+std::vector<std::pair<uint32_t, std::shared_ptr<ColumnFileCacheServer::Entry>>>
+ColumnFileCacheServer::HandleRequest(
+    const std::string& request,
+    std::unordered_map<std::string, kj::AutoCloseFd>& files) {
+  KJ_REQUIRE(request.size() >= sizeof(Request), request.size());
+
+  Request header;
+  memcpy(&header, request.data(), sizeof(header));
+
+  KJ_REQUIRE(header.field_count <= kMaxFieldsPerRequest, header.field_count);
+  KJ_REQUIRE(request.size() == sizeof(header) +
+                                   header.field_count * sizeof(uint32_t) +
+                                   header.path_size,
+             request.size());
+
+  std::vector<uint32_t> fields(header.field_count);
+  memcpy(fields.data(), request.data() + sizeof(header),
+         fields.size() * sizeof(uint32_t));
+
+  const std::string path(
+      request.data() + sizeof(header) + fields.size() * sizeof(uint32_t),
+      header.path_size);
+
+  ColumnFileCacheKey key;
+
+  // Open the file, or reopen it if it has been replaced since it was opened.
+  auto& fd = files[path];
+  for (size_t attempt = 0;; ++attempt) {
+    if (fd == nullptr) fd = OpenFile(path.c_str(), O_RDONLY);
+
+    KJ_REQUIRE(FileCacheKey(fd, key), "Not a regular file", path);
+
+    if (key.device == header.device && key.inode == header.inode &&
+        key.size == header.size && key.mtime_ns == header.mtime_ns)
+      break;
+
+    KJ_REQUIRE(attempt == 0, "File differs from the client's", path);
+    fd = nullptr;
+  }
+
+  key.offset = header.offset;
+
+  std::vector<std::pair<uint32_t, std::shared_ptr<Entry>>> result;
+
+  SegmentHeader segment;
+  std::string segment_header;
+
+  for (const auto field : fields) {
+    key.field = field;
+
+    std::shared_ptr<Entry> entry;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+
+      const auto i = index_.find(key);
+
+      if (i != index_.end()) {
+        ++statistics_.hits;
+        entries_.splice(entries_.begin(), entries_, i->second);
+        entry = i->second->second;
+      } else {
+        ++statistics_.misses;
+      }
+    }
+
+    if (!entry) {
+      if (segment_header.empty()) {
+        uint8_t size_buffer[4];
+        PRead(fd, size_buffer, sizeof(size_buffer), header.offset);
+
+        segment_header.resize(GetHeaderSize(size_buffer));
+        PRead(fd, &segment_header[0], segment_header.size(),
+              header.offset + sizeof(size_buffer));
+
+        ParseSegmentHeader(segment_header, segment);
+      }
+
+      auto data_offset = header.offset + 4 + segment_header.size();
+      auto data_size = std::numeric_limits<uint64_t>::max();
+
+      for (const auto& segment_field : segment.fields) {
+        if (segment_field.first == field) {
+          data_size = segment_field.second;
+          break;
+        }
+
+        data_offset += segment_field.second;
+      }
+
+      KJ_REQUIRE(data_size != std::numeric_limits<uint64_t>::max(),
+                 "Field not in segment", field, header.offset);
+
+      std::string compressed(data_size, 0);
+      PRead(fd, &compressed[0], data_size, data_offset);
+
+      const auto data = Decompress(compressed, segment.compression);
+
+      // Sealed memfds can't be modified by clients, so they can be shared
+      // between them.
+      entry = std::make_shared<Entry>();
+      int memfd;
+      KJ_SYSCALL(memfd = memfd_create("columnfile-cache",
+                                      MFD_CLOEXEC | MFD_ALLOW_SEALING));
+      entry->fd = kj::AutoCloseFd(memfd);
+      entry->size = data.size();
+
+      WriteAll(entry->fd, StringRef(data.begin(), data.size()));
+      KJ_SYSCALL(fcntl(entry->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+                                                   F_SEAL_WRITE | F_SEAL_SEAL));
+
+      std::unique_lock<std::mutex> lock(mutex_);
+
+      const auto i = index_.find(key);
+
+      // Another client may have loaded the same field in the meantime.
+      if (i != index_.end()) {
+        entry = i->second->second;
+      } else if (entry->size <= capacity_) {
+        entries_.emplace_front(key, entry);
+        index_.emplace(key, entries_.begin());
+
+        ++statistics_.insertions;
+        statistics_.size += entry->size;
+
+        while (statistics_.size > capacity_) {
+          const auto& evicted = entries_.back();
+
+          statistics_.size -= evicted.second->size;
+          ++statistics_.evictions;
+
+          index_.erase(evicted.first);
+          entries_.pop_back();
+        }
+      }
+    }
+
+    result.emplace_back(field, std::move(entry));
+  }
+
+  return result;
+}
+
+std::unique_ptr<ColumnFileCacheClient> ColumnFileCacheClient::Connect(
+    const char* socket_path) {
+  const auto address = SocketAddress(socket_path);
+
+  int fd;
+  KJ_SYSCALL(fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0));
+  kj::AutoCloseFd socket(fd);
+
+  if (-1 == connect(socket, reinterpret_cast<const struct sockaddr*>(&address),
+                    sizeof(address))) {
+    if (errno == ENOENT || errno == ECONNREFUSED) return nullptr;
+    KJ_FAIL_SYSCALL("connect", errno, socket_path);
+  }
+
+  return std::make_unique<ColumnFileCacheClient>(std::move(socket));
+}
+
+std::vector<std::pair<uint32_t, kj::Array<const char>>>
+ColumnFileCacheClient::Fetch(const std::string& path,
+                             const ColumnFileCacheKey& segment,
+                             const std::vector<uint32_t>& fields) {
+  std::vector<std::pair<uint32_t, kj::Array<const char>>> result;
+  result.reserve(fields.size());
+
+  std::string message;
+  std::vector<kj::AutoCloseFd> fds;
+
+  for (size_t i = 0; i < fields.size(); i += kMaxFieldsPerRequest) {
+    const auto count = std::min(kMaxFieldsPerRequest, fields.size() - i);
+
+    Request request;
+    request.device = segment.device;
+    request.inode = segment.inode;
+    request.size = segment.size;
+    request.mtime_ns = segment.mtime_ns;
+    request.offset = segment.offset;
+    request.field_count = count;
+    request.path_size = path.size();
+
+    message.assign(reinterpret_cast<const char*>(&request), sizeof(request));
+    message.append(reinterpret_cast<const char*>(&fields[i]),
+                   count * sizeof(uint32_t));
+    message.append(path);
+
+    SendMessage(socket_, message, {});
+
+    KJ_REQUIRE(ReceiveMessage(socket_, message, fds),
+               "Cache server closed the connection");
+    KJ_REQUIRE(message.size() >= sizeof(Response), message.size());
+
+    Response response;
+    memcpy(&response, message.data(), sizeof(response));
+
+    const auto error_offset =
+        sizeof(response) + response.field_count * sizeof(ResponseField);
+    KJ_REQUIRE(message.size() == error_offset + response.error_size,
+               message.size());
+
+    if (response.error_size) {
+      KJ_FAIL_REQUIRE("Cache server error",
+                      message.substr(error_offset, response.error_size));
+    }
+
+    KJ_REQUIRE(response.field_count == count, response.field_count, count);
+    KJ_REQUIRE(fds.size() == count, fds.size(), count);
+
+    for (size_t j = 0; j < count; ++j) {
+      ResponseField field;
+      memcpy(&field, message.data() + sizeof(response) + j * sizeof(field),
+             sizeof(field));
+
+      auto data = ReadFD(fds[j]);
+      KJ_REQUIRE(data.size() == field.size, data.size(), field.size);
+
+      result.emplace_back(field.field, std::move(data));
+    }
+  }
+
+  return result;
+}
+
+}  // namespace ev
@@ -0,0 +1,133 @@
+#include "base/columnfile.h"
+
+#include <sys/stat.h>
+
+#include "base/columnfile-internal.h"
+
+namespace ev {
+
+bool columnfile_internal::FileCacheKey(int fd, ColumnFileCacheKey& key) {
+  struct stat st;
+  KJ_SYSCALL(fstat(fd, &st));
+
+  if (!S_ISREG(st.st_mode)) return false;
+
+  key.device = st.st_dev;
+  key.inode = st.st_ino;
+  key.size = st.st_size;
+  key.mtime_ns = st.st_mtim.tv_sec * INT64_C(1000000000) + st.st_mtim.tv_nsec;
+
+  return true;
+}
+
+size_t ColumnFileCacheKey::Hash::operator()(
+    const ColumnFileCacheKey& key) const {
+  uint64_t result = key.inode;
+  result = result * 0x9e3779b97f4a7c15ULL + key.device;
+  result = result * 0x9e3779b97f4a7c15ULL + key.offset;
+  result = result * 0x9e3779b97f4a7c15ULL + key.field;
+  return result ^ (result >> 32);
+}
+
+ColumnFileCache& ColumnFileCache::Global() {
+  static ColumnFileCache* cache = new ColumnFileCache(kDefaultCapacity);
+  return *cache;
+}
+
+ColumnFileCache::ColumnFileCache(size_t capacity) : capacity_(capacity) {}
+
+void ColumnFileCache::SetCapacity(size_t capacity) {
+  capacity_ = capacity;
+
+  for (auto& shard : shards_) {
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    Evict(shard);
+  }
+}
+
+std::shared_ptr<const kj::Array<const char>> ColumnFileCache::Find(
+    const ColumnFileCacheKey& key) {
+  auto& shard = ShardFor(key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+
+  const auto i = shard.index.find(key);
+
+  if (i == shard.index.end()) {
+    ++shard.statistics.misses;
+    return nullptr;
+  }
+
+  ++shard.statistics.hits;
+  shard.entries.splice(shard.entries.begin(), shard.entries, i->second);
+
+  return i->second->second;
+}
+
+void ColumnFileCache::Insert(
+    const ColumnFileCacheKey& key,
+    std::shared_ptr<const kj::Array<const char>> data) {
+  const auto size = data->size();
+  if (size > capacity_ / kShardCount) return;
+
+  auto& shard = ShardFor(key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+
+  // Another reader may have inserted the same data in the meantime.
+  if (shard.index.count(key)) return;
+
+  shard.entries.emplace_front(key, std::move(data));
+  shard.index.emplace(key, shard.entries.begin());
+
+  ++shard.statistics.insertions;
+  shard.statistics.size += size;
+
+  Evict(shard);
+}
+
+void ColumnFileCache::Clear() {
+  for (auto& shard : shards_) {
+    std::unique_lock<std::mutex> lock(shard.mutex);
+
+    shard.statistics.evictions += shard.entries.size();
+    shard.statistics.size = 0;
+    shard.index.clear();
+    shard.entries.clear();
+  }
+}
+
+ColumnFileCache::Statistics ColumnFileCache::GetStatistics() {
+  Statistics result;
+
+  for (auto& shard : shards_) {
+    std::unique_lock<std::mutex> lock(shard.mutex);
+
+    result.hits += shard.statistics.hits;
+    result.misses += shard.statistics.misses;
+    result.insertions += shard.statistics.insertions;
+    result.evictions += shard.statistics.evictions;
+    result.size += shard.statistics.size;
+  }
+
+  return result;
+}
+
+ColumnFileCache::Shard& ColumnFileCache::ShardFor(
+    const ColumnFileCacheKey& key) {
+  return shards_[ColumnFileCacheKey::Hash()(key) % kShardCount];
+}
+
+void ColumnFileCache::Evict(Shard& shard) {
+  const auto shard_capacity = capacity_ / kShardCount;
+
+  while (shard.statistics.size > shard_capacity) {
+    const auto& entry = shard.entries.back();
+
+    shard.statistics.size -= entry.second->size();
+    ++shard.statistics.evictions;
+
+    shard.index.erase(entry.first);
+    shard.entries.pop_back();
+  }
+}
+
+}  // namespace ev
@@ -2,8 +2,15 @@
 #define BASE_COLUMNFILE_INTERNAL_H_ 1
 
 #include <cstdint>
+#include <memory>
+#include <random>
 #include <string>
+#include <vector>
 
+#include <kj/array.h>
+#include <kj/io.h>
+
+#include "base/columnfile.h"
 #include "base/stringref.h"
 
 namespace ev {
@@ -17,6 +24,28 @@ enum Codes : uint8_t {
   kCodeNull = 0xff,
 };
 
+// A segment header consists of the compression scheme, the field count, and
+// an (index, size) pair for every field, all encoded with `PutUInt()`.  Any
+// bytes remaining in the header after the field list are header extensions,
+// each encoded as a (tag, size) pair followed by `size` bytes of data.
+// Readers skip extensions with unknown tags.
+//
+// Segments without any fields carry only extensions, and are used for file
+// level metadata.
+enum HeaderExtension : uint32_t {
+  // Serialized `ColumnFileSchema`.
+  kHeaderExtensionSchema = 1,
+
+  // Number of rows in the segment, encoded with `PutUInt()`.  This is the
+  // value count of the segment's longest field.
+  kHeaderExtensionRowCount = 2,
+
+  // Name of a checkpoint written by `ColumnFileWriter::Checkpoint()`.  Only
+  // appears in segments without fields.  A segment may hold several, if a
+  // checkpoint covers several inputs.
+  kHeaderExtensionCheckpoint = 3,
+};
+
 inline uint32_t GetUInt(StringRef& input) {
   auto begin = reinterpret_cast<const uint8_t*>(input.begin());
   auto i = begin;
@@ -75,6 +104,157 @@ inline void PutInt(std::string& output, int32_t value) {
   PutUInt(output, (value << 1) ^ (value >> sign_shift));
 }
 
+inline void PutHeaderExtension(std::string& output, HeaderExtension tag,
+                               const StringRef& data) {
+  PutUInt(output, tag);
+  PutUInt(output, data.size());
+  output.append(data.begin(), data.end());
+}
+
+struct SegmentHeader {
+  ColumnFileCompression compression = kColumnFileCompressionNone;
+
+  // (index, size) pairs for each field in the segment.
+  std::vector<std::pair<uint32_t, uint32_t>> fields;
+
+  // Total size of the field data following the header.
+  uint64_t data_size = 0;
+
+  // Serialized schema, if the segment carries one.
+  StringRef schema;
+
+  // Number of rows in the segment, or 0 if the header doesn't say.
+  uint32_t row_count = 0;
+
+  // Set if the segment is a checkpoint.  Names may be empty.
+  bool is_checkpoint = false;
+  std::vector<StringRef> checkpoints;
+};
+
+// Parses a segment header, not including the leading 4 byte header size.
+inline void ParseSegmentHeader(StringRef data, SegmentHeader& header) {
+  header.compression = static_cast<ColumnFileCompression>(GetUInt(data));
+
+  const auto field_count = GetUInt(data);
+  KJ_REQUIRE(field_count <= data.size(), field_count, data.size());
+
+  header.fields.resize(field_count);
+  header.data_size = 0;
+
+  for (auto& field : header.fields) {
+    field.first = GetUInt(data);
+    field.second = GetUInt(data);
+    header.data_size += field.second;
+  }
+
+  header.schema = StringRef();
+  header.row_count = 0;
+  header.is_checkpoint = false;
+  header.checkpoints.clear();
+
+  while (!data.empty()) {
+    const auto tag = GetUInt(data);
+    const auto size = GetUInt(data);
+    KJ_REQUIRE(size <= data.size(), "truncated header extension", tag, size);
+
+    const StringRef value(data.data(), size);
+    data.Consume(size);
+
+    switch (tag) {
+      case kHeaderExtensionSchema:
+        header.schema = value;
+        break;
+
+      case kHeaderExtensionRowCount: {
+        auto row_count = value;
+        header.row_count = GetUInt(row_count);
+      } break;
+
+      case kHeaderExtensionCheckpoint:
+        header.is_checkpoint = true;
+        header.checkpoints.emplace_back(value);
+        break;
+
+      default:
+        break;
+    }
+  }
+}
+
+// Builds a segment header, including the leading 4 byte header size.
+inline std::string BuildSegmentHeader(
+    const std::vector<std::pair<uint32_t, ev::StringRef>>& fields,
+    ColumnFileCompression compression, const StringRef& extensions) {
+  std::string buffer;
+  buffer.resize(4, 0);
+
+  PutUInt(buffer, compression);
+  PutUInt(buffer, fields.size());
+
+  for (auto& field : fields) {
+    PutUInt(buffer, field.first);
+    PutUInt(buffer, field.second.size());
+  }
+
+  buffer.append(extensions.begin(), extensions.end());
+
+  auto buffer_size = buffer.size() - 4;  // Don't count the size itself.
+  buffer[0] = buffer_size >> 24U;
+  buffer[1] = buffer_size >> 16U;
+  buffer[2] = buffer_size >> 8U;
+  buffer[3] = buffer_size;
+
+  return buffer;
+}
+
+// Decodes the 4 byte big-endian size preceding a segment header.
+inline uint32_t GetHeaderSize(const uint8_t* size_buffer) {
+  return (size_buffer[0] << 24) | (size_buffer[1] << 16) |
+         (size_buffer[2] << 8) | size_buffer[3];
+}
+
+// Decompresses the data of a single field.
+kj::Array<const char> Decompress(const StringRef& data,
+                                 ColumnFileCompression compression);
+
+// Compresses and decompresses the data of a single field with
+// `kColumnFileCompressionPixel16`.
+std::string CompressPixel16(const StringRef& data);
+kj::Array<const char> DecompressPixel16(const StringRef& data);
+
+// Counts the rows of a segment whose header lacks a row count, by decoding
+// its field data.
+uint32_t CountRows(const SegmentHeader& header, const char* field_data);
+
+// Sets the file identity fields of `key` from the file open as `fd`.
+// Returns false if the file is not a regular file.
+bool FileCacheKey(int fd, ColumnFileCacheKey& key);
+
+// A connection to a `ColumnFileCacheServer`.
+class ColumnFileCacheClient {
+ public:
+  // Returns nullptr if no server is listening on `socket_path`.
+  static std::unique_ptr<ColumnFileCacheClient> Connect(
+      const char* socket_path);
+
+  ColumnFileCacheClient(kj::AutoCloseFd socket) : socket_(std::move(socket)) {}
+
+  // Returns the decompressed data of `fields` in the segment at
+  // `segment.offset` in the file at `path`.  The file identity in `segment`
+  // must match the file seen by the server.  The data is mapped read-only.
+  std::vector<std::pair<uint32_t, kj::Array<const char>>> Fetch(
+      const std::string& path, const ColumnFileCacheKey& segment,
+      const std::vector<uint32_t>& fields);
+
+ private:
+  kj::AutoCloseFd socket_;
+};
+
+// Returns `count` distinct integers in [0, n), chosen uniformly at random, in
+// ascending order.  Returns all of them if `count` is at least `n`.
+std::vector<uint64_t> SampleIndexes(uint64_t n, size_t count,
+                                    std::mt19937_64& rng);
+
 }  // namespace columnfile_internal
 }  // namespace ev
 
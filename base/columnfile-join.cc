@@ -0,0 +1,172 @@
+#include "base/columnfile.h"
+
+#include <algorithm>
+
+#include <kj/debug.h>
+
+#include "base/hash.h"
+
+namespace ev {
+
+namespace {
+
+// Splits a line of CSV data into fields.  Fields may be quoted, with quotes
+// inside quoted fields escaped by doubling them.
+void ParseCSVLine(StringRef& data, std::vector<std::string>& fields) {
+  fields.clear();
+
+  std::string field;
+  bool quoted = false;
+
+  while (!data.empty()) {
+    const auto ch = data[0];
+    data.Consume(1);
+
+    if (quoted) {
+      if (ch != '"') {
+        field.push_back(ch);
+      } else if (!data.empty() && data[0] == '"') {
+        field.push_back('"');
+        data.Consume(1);
+      } else {
+        quoted = false;
+      }
+    } else if (ch == '"') {
+      quoted = true;
+    } else if (ch == ',') {
+      fields.emplace_back(std::move(field));
+      field.clear();
+    } else if (ch == '\n') {
+      break;
+    } else if (ch != '\r') {
+      field.push_back(ch);
+    }
+  }
+
+  KJ_REQUIRE(!quoted, "Unterminated quoted CSV field");
+
+  fields.emplace_back(std::move(field));
+}
+
+}  // namespace
+
+ColumnFileHashJoin::ColumnFileHashJoin(ColumnFileSelect probe,
+                                       uint32_t probe_key)
+    : probe_(std::move(probe)), probe_key_(probe_key) {
+  probe_.AddSelection(probe_key_);
+}
+
+void ColumnFileHashJoin::SetProbeKeyPattern(const char* pattern) {
+  probe_key_pattern_ = std::make_unique<std::regex>(pattern);
+  KJ_REQUIRE(probe_key_pattern_->mark_count() >= 1,
+             "Pattern has no capture group", pattern);
+}
+
+void ColumnFileHashJoin::AddCSV(const StringRef& data, size_t key_column,
+                                uint32_t field_offset) {
+  StringRef input(data);
+  std::vector<std::string> fields;
+
+  // Skip the header.
+  ParseCSVLine(input, fields);
+
+  while (!input.empty()) {
+    ParseCSVLine(input, fields);
+
+    // Skip blank lines.
+    if (fields.size() == 1 && fields[0].empty()) continue;
+
+    KJ_REQUIRE(key_column < fields.size(), key_column, fields.size());
+
+    BuildRow row;
+    row.key = std::move(fields[key_column]);
+
+    for (size_t i = 0; i < fields.size(); ++i) {
+      if (i == key_column) continue;
+      row.values.emplace_back(field_offset + i, std::move(fields[i]));
+    }
+
+    AddBuildRow(std::move(row));
+  }
+}
+
+void ColumnFileHashJoin::AddColumnFile(ColumnFileReader reader,
+                                       uint32_t key_field,
+                                       uint32_t field_offset) {
+  while (!reader.End()) {
+    BuildRow row;
+    bool have_key = false;
+
+    for (const auto& field : reader.GetRow()) {
+      if (field.second.IsNull()) continue;
+
+      if (field.first == key_field) {
+        row.key = field.second.StringRef().str();
+        have_key = true;
+      } else {
+        row.values.emplace_back(field_offset + field.first,
+                                field.second.StringRef().str());
+      }
+    }
+
+    if (have_key) AddBuildRow(std::move(row));
+  }
+}
+
+void ColumnFileHashJoin::AddBuildRow(BuildRow row) {
+  build_index_.emplace(Hash(row.key), build_rows_.size());
+  build_rows_.emplace_back(std::move(row));
+}
+
+void ColumnFileHashJoin::Execute(
+    ev::concurrency::RegionPool& region_pool,
+    Delegate<void(const std::vector<std::pair<uint32_t, StringRefOrNull>>&)>
+        callback) {
+  std::vector<std::pair<uint32_t, StringRefOrNull>> joined_row;
+  std::cmatch match;
+
+  probe_.Execute(
+      region_pool,
+      [this, &callback, &joined_row, &match](
+          const std::vector<std::pair<uint32_t, StringRefOrNull>>& row) {
+        const auto key_field = std::lower_bound(
+            row.begin(), row.end(), probe_key_,
+            [](const auto& field, uint32_t key) { return field.first < key; });
+
+        if (key_field == row.end() || key_field->first != probe_key_ ||
+            key_field->second.IsNull())
+          return;
+
+        auto key = key_field->second.StringRef();
+
+        if (probe_key_pattern_) {
+          if (!std::regex_search(key.begin(), key.end(), match,
+                                 *probe_key_pattern_) ||
+              !match[1].matched)
+            return;
+
+          key = StringRef(match[1].first, match[1].length());
+        }
+
+        const auto range = build_index_.equal_range(Hash(key));
+
+        for (auto i = range.first; i != range.second; ++i) {
+          const auto& build_row = build_rows_[i->second];
+          if (key != build_row.key) continue;
+
+          joined_row.assign(row.begin(), row.end());
+
+          for (const auto& value : build_row.values)
+            joined_row.emplace_back(value.first, value.second);
+
+          std::sort(joined_row.begin(), joined_row.end(),
+                    [](const auto& lhs, const auto& rhs) {
+                      return lhs.first < rhs.first;
+                    });
+
+          callback(joined_row);
+        }
+      });
+}
+
+}  // namespace ev
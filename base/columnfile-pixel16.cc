@@ -0,0 +1,630 @@
+// Lossless codec for fields holding 16 bit images.
+//
+// The field data is decoded into its values, and each value is coded as a
+// raster of 16 bit samples.  Every row is predicted from its left, upper, or
+// median (LOCO-I) neighbours, whichever leaves the smallest residuals, and
+// the zigzag encoded residuals are Rice coded with a parameter chosen per
+// block of samples.  The image width isn't known to the writer, so it's
+// guessed from the sample correlation, and stored with each value.
+//
+// Fields whose values don't look like 16 bit images are compressed with LZ4.
+//
+// The decoded field data is equivalent to the original, but not byte for
+// byte identical: values are written without prefix sharing.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <endian.h>
+
+#include <kj/array.h>
+#include <kj/debug.h>
+#include <lz4.h>
+
+#if __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "base/columnfile-internal.h"
+
+namespace ev {
+namespace columnfile_internal {
+
+namespace {
+
+enum Pixel16Mode : uint8_t {
+  kPixel16ModeLZ4 = 0,
+  kPixel16ModeImage = 1,
+};
+
+enum Predictor : uint8_t {
+  kPredictorLeft = 0,
+  kPredictorUp = 1,
+  kPredictorMedian = 2,
+};
+
+// Values shorter than this don't make a field image-like on their own.
+const size_t kMinImageSize = 256;
+
+// Range of image widths considered when guessing the width of a value.
+const size_t kMinWidth = 8;
+const size_t kMaxWidth = 8192;
+
+// Number of samples compared when evaluating a candidate width.
+const size_t kWidthSamples = 4096;
+
+// Number of residuals sharing a Rice parameter.
+const size_t kBlockSize = 64;
+
+// Residuals whose quotient reaches this value are stored verbatim.
+const unsigned kEscape = 24;
+
+struct Entry {
+  uint32_t repeat;
+  bool is_null;
+  StringRef value;
+};
+
+// Decodes field data written by `ColumnFileWriter::FieldWriter`.  Values
+// sharing a prefix with their predecessor are joined in `storage`.
+std::vector<Entry> ParseEntries(StringRef data,
+                                std::deque<std::string>& storage) {
+  std::vector<Entry> result;
+  StringRef previous;
+
+  while (!data.empty()) {
+    Entry entry;
+    entry.repeat = GetUInt(data);
+
+    const auto reserved = GetUInt(data);
+    KJ_REQUIRE(reserved == 0, reserved);
+    KJ_REQUIRE(!data.empty());
+
+    const auto b0 = static_cast<uint8_t>(data[0]);
+
+    if (b0 == kCodeNull) {
+      data.Consume(1);
+      entry.is_null = true;
+    } else if ((b0 & 0xc0) == 0xc0) {
+      data.Consume(1);
+      const auto shared_prefix = (b0 & 0x3fU) + 2U;
+      const auto suffix_length = GetUInt(data);
+      KJ_REQUIRE(shared_prefix <= previous.size(), shared_prefix,
+                 previous.size());
+      KJ_REQUIRE(suffix_length <= data.size(), suffix_length, data.size());
+
+      storage.emplace_back(previous.begin(), previous.begin() + shared_prefix);
+      storage.back().append(data.begin(), data.begin() + suffix_length);
+      data.Consume(suffix_length);
+
+      entry.is_null = false;
+      entry.value = storage.back();
+      previous = entry.value;
+    } else {
+      const auto value_size = GetUInt(data);
+      KJ_REQUIRE(value_size <= data.size(), value_size, data.size());
+
+      entry.is_null = false;
+      entry.value = StringRef(data.begin(), value_size);
+      data.Consume(value_size);
+      previous = entry.value;
+    }
+
+    result.emplace_back(entry);
+  }
+
+  return result;
+}
+
+size_t UIntSize(uint32_t value) {
+  if (value < (1 << 7)) return 1;
+  if (value < (1 << 13)) return 2;
+  if (value < (1 << 20)) return 3;
+  if (value < (1 << 27)) return 4;
+  return 5;
+}
+
+inline uint16_t ZigZag(uint16_t residual) {
+  return (residual << 1) ^ -(residual >> 15);
+}
+
+inline uint16_t UnZigZag(uint16_t value) { return (value >> 1) ^ -(value & 1); }
+
+// Samples are compared as signed integers, so the median predictor works
+// the same way for signed and unsigned pixel data.  All arithmetic wraps at
+// 16 bits.
+inline uint16_t PredictMedian(uint16_t a, uint16_t b, uint16_t c) {
+  const auto sa = static_cast<int16_t>(a);
+  const auto sb = static_cast<int16_t>(b);
+  const auto gradient = static_cast<int16_t>(a + b - c);
+  return std::max(std::min(sa, sb), std::min(std::max(sa, sb), gradient));
+}
+
+// Returns the width minimizing the difference between vertically adjacent
+// samples, or `count` if no width divides the sample count.
+size_t GuessWidth(const uint16_t* samples, size_t count) {
+  size_t result = count;
+  double best_cost = std::numeric_limits<double>::max();
+
+  for (size_t width = kMinWidth; width <= kMaxWidth; ++width) {
+    if (width * kMinWidth > count) break;
+    if (count % width) continue;
+
+    const auto step = std::max<size_t>(1, (count - width) / kWidthSamples);
+    uint64_t cost = 0;
+    size_t n = 0;
+
+    for (size_t i = width; i < count; i += step, ++n) {
+      const auto residual = static_cast<int16_t>(samples[i] -
+                                                 samples[i - width]);
+      cost += std::abs(residual);
+    }
+
+    if (static_cast<double>(cost) / n < best_cost) {
+      best_cost = static_cast<double>(cost) / n;
+      result = width;
+    }
+  }
+
+  return result;
+}
+
+// Computes the zigzag encoded residuals of each predictor for `count`
+// samples at `x`.  The left neighbour of `x[i]` is `x[i - 1]`, and the upper
+// one is `x[i - stride]`.
+void PredictRow(const uint16_t* x, size_t count, size_t stride,
+                uint16_t* left, uint16_t* up, uint16_t* median) {
+  size_t i = 0;
+
+#if __SSE2__
+  for (; i + 8 <= count; i += 8) {
+    const auto load = [](const uint16_t* p) {
+      return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    };
+    const auto store = [](uint16_t* p, __m128i residual) {
+      _mm_storeu_si128(
+          reinterpret_cast<__m128i*>(p),
+          _mm_xor_si128(_mm_slli_epi16(residual, 1),
+                        _mm_srai_epi16(residual, 15)));
+    };
+
+    const auto v = load(x + i);
+    const auto a = load(x + i - 1);
+    const auto b = load(x + i - stride);
+    const auto c = load(x + i - stride - 1);
+
+    const auto gradient = _mm_sub_epi16(_mm_add_epi16(a, b), c);
+    const auto prediction =
+        _mm_max_epi16(_mm_min_epi16(a, b),
+                      _mm_min_epi16(_mm_max_epi16(a, b), gradient));
+
+    store(left + i, _mm_sub_epi16(v, a));
+    store(up + i, _mm_sub_epi16(v, b));
+    store(median + i, _mm_sub_epi16(v, prediction));
+  }
+#endif
+
+  for (; i < count; ++i) {
+    const uint16_t a = x[i - 1];
+    const uint16_t b = x[i - stride];
+    const uint16_t c = x[i - stride - 1];
+
+    left[i] = ZigZag(x[i] - a);
+    up[i] = ZigZag(x[i] - b);
+    median[i] = ZigZag(x[i] - PredictMedian(a, b, c));
+  }
+}
+
+uint64_t Cost(const uint16_t* residuals, size_t count) {
+  uint64_t result = 0;
+  for (size_t i = 0; i < count; ++i) result += residuals[i];
+  return result;
+}
+
+// Reconstructs `count` samples at `x` from their zigzag encoded residuals.
+// Samples to the left of and above `x` must already be reconstructed.
+void ReconstructRow(uint16_t* x, const uint16_t* residuals, size_t count,
+                    size_t stride, Predictor predictor) {
+  switch (predictor) {
+    case kPredictorLeft: {
+      auto a = x[-1];
+      for (size_t i = 0; i < count; ++i) {
+        a += UnZigZag(residuals[i]);
+        x[i] = a;
+      }
+    } break;
+
+    case kPredictorUp: {
+      // The upper row is complete, so whole vectors can be reconstructed at
+      // once.
+      size_t i = 0;
+
+#if __SSE2__
+      const auto one = _mm_set1_epi16(1);
+      for (; i + 8 <= count; i += 8) {
+        const auto z = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(residuals + i));
+        const auto residual =
+            _mm_xor_si128(_mm_srli_epi16(z, 1),
+                          _mm_sub_epi16(_mm_setzero_si128(),
+                                        _mm_and_si128(z, one)));
+        const auto b =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i - stride));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(x + i),
+                         _mm_add_epi16(b, residual));
+      }
+#endif
+
+      for (; i < count; ++i) x[i] = x[i - stride] + UnZigZag(residuals[i]);
+    } break;
+
+    case kPredictorMedian: {
+      for (size_t i = 0; i < count; ++i) {
+        x[i] = PredictMedian(x[i - 1], x[i - stride], x[i - stride - 1]) +
+               UnZigZag(residuals[i]);
+      }
+    } break;
+
+    default:
+      KJ_FAIL_REQUIRE("Unknown predictor", predictor);
+  }
+}
+
+class BitWriter {
+ public:
+  explicit BitWriter(std::string& output) : output_(output) {}
+
+  // Appends the low `count` bits of `bits`.  `count` must be at most 56.
+  void Put(uint64_t bits, unsigned count) {
+    buffer_ |= bits << fill_;
+    fill_ += count;
+
+    while (fill_ >= 8) {
+      output_.push_back(buffer_);
+      buffer_ >>= 8;
+      fill_ -= 8;
+    }
+  }
+
+  void Finish() {
+    if (fill_) output_.push_back(buffer_);
+    buffer_ = 0;
+    fill_ = 0;
+  }
+
+ private:
+  std::string& output_;
+
+  uint64_t buffer_ = 0;
+  unsigned fill_ = 0;
+};
+
+class BitReader {
+ public:
+  explicit BitReader(StringRef input)
+      : p_(reinterpret_cast<const uint8_t*>(input.begin())),
+        end_(reinterpret_cast<const uint8_t*>(input.end())) {}
+
+  // Makes at least 56 bits available to `Peek()`.
+  void Refill() {
+    if (fill_ >= 56) return;
+
+    if (end_ - p_ >= 8) {
+      uint64_t word;
+      memcpy(&word, p_, sizeof(word));
+      buffer_ |= le64toh(word) << fill_;
+      p_ += (63 - fill_) >> 3;
+      fill_ |= 56;
+    } else {
+      // Reading past the end yields zero bits; `Finish()` detects it.
+      while (fill_ <= 56) {
+        if (p_ < end_)
+          buffer_ |= static_cast<uint64_t>(*p_++) << fill_;
+        else
+          ++overrun_;
+        fill_ += 8;
+      }
+    }
+  }
+
+  uint64_t Peek() const { return buffer_; }
+
+  void Consume(unsigned count) {
+    buffer_ >>= count;
+    fill_ -= count;
+  }
+
+  void Finish() const { KJ_REQUIRE(fill_ >= overrun_ * 8, "Truncated input"); }
+
+ private:
+  const uint8_t* p_;
+  const uint8_t* end_;
+
+  uint64_t buffer_ = 0;
+  unsigned fill_ = 0;
+  size_t overrun_ = 0;
+};
+
+// Rice codes `residuals` in blocks of `kBlockSize`, each preceded by its 4
+// bit parameter.
+void EncodeResiduals(const std::vector<uint16_t>& residuals,
+                     std::string& output) {
+  BitWriter writer(output);
+
+  for (size_t begin = 0; begin < residuals.size(); begin += kBlockSize) {
+    const auto end = std::min(begin + kBlockSize, residuals.size());
+
+    uint64_t sum = 0;
+    for (auto i = begin; i < end; ++i) sum += residuals[i];
+
+    unsigned k = 0;
+    while (k < 15 && (static_cast<uint64_t>(end - begin) << (k + 1)) <= sum)
+      ++k;
+
+    writer.Put(k, 4);
+
+    for (auto i = begin; i < end; ++i) {
+      const unsigned quotient = residuals[i] >> k;
+
+      if (quotient < kEscape) {
+        const uint64_t remainder = residuals[i] & ((1U << k) - 1);
+        writer.Put(((uint64_t(1) << quotient) - 1) |
+                       (remainder << (quotient + 1)),
+                   quotient + 1 + k);
+      } else {
+        writer.Put((uint64_t(1) << kEscape) - 1, kEscape);
+        writer.Put(residuals[i], 16);
+      }
+    }
+  }
+
+  writer.Finish();
+}
+
+void DecodeResiduals(StringRef input, std::vector<uint16_t>& residuals) {
+  BitReader reader(input);
+
+  for (size_t begin = 0; begin < residuals.size(); begin += kBlockSize) {
+    const auto end = std::min(begin + kBlockSize, residuals.size());
+
+    reader.Refill();
+    const unsigned k = reader.Peek() & 15;
+    reader.Consume(4);
+    const uint64_t mask = (uint64_t(1) << k) - 1;
+
+    for (auto i = begin; i < end; ++i) {
+      reader.Refill();
+
+      const auto bits = reader.Peek();
+      const unsigned quotient =
+          __builtin_ctzll(~bits | (uint64_t(1) << kEscape));
+
+      if (quotient < kEscape) {
+        reader.Consume(quotient + 1);
+        residuals[i] = (quotient << k) | (reader.Peek() & mask);
+        reader.Consume(k);
+      } else {
+        reader.Consume(kEscape);
+        residuals[i] = reader.Peek() & 0xffff;
+        reader.Consume(16);
+      }
+    }
+  }
+
+  reader.Finish();
+}
+
+std::string CompressLZ4(const StringRef& data) {
+  std::string result;
+  PutUInt(result, data.size());
+  result.push_back(kPixel16ModeLZ4);
+
+  const auto data_offset = result.size();
+  result.resize(data_offset + LZ4_compressBound(data.size()));
+
+  const auto compressed_length =
+      LZ4_compress(data.data(), &result[data_offset], data.size());
+  KJ_REQUIRE(data_offset + compressed_length <= result.size());
+  result.resize(data_offset + compressed_length);
+
+  return result;
+}
+
+}  // namespace
+
+std::string CompressPixel16(const StringRef& data) {
+  std::deque<std::string> storage;
+  const auto entries = ParseEntries(data, storage);
+
+  bool has_image = false;
+  for (const auto& entry : entries) {
+    if (entry.is_null) continue;
+    if (entry.value.size() & 1) return CompressLZ4(data);
+    if (entry.value.size() >= kMinImageSize) has_image = true;
+  }
+
+  if (!has_image) return CompressLZ4(data);
+
+  std::string control;
+  std::string predictors;
+  std::vector<uint16_t> residuals;
+  size_t row_count = 0;
+  size_t decompressed_size = 0;
+
+  PutUInt(control, entries.size());
+
+  std::vector<uint16_t> samples;
+  std::vector<uint16_t> left, up, median;
+
+  for (const auto& entry : entries) {
+    PutUInt(control, entry.repeat);
+    decompressed_size += UIntSize(entry.repeat) + 1;
+
+    if (entry.is_null) {
+      PutUInt(control, 0);
+      ++decompressed_size;
+      continue;
+    }
+
+    const auto count = entry.value.size() / 2;
+    PutUInt(control, count + 1);
+    decompressed_size += UIntSize(entry.value.size()) + entry.value.size();
+
+    if (!count) continue;
+
+    // Samples are preceded by a row of zeros, plus one, so that every sample
+    // has a left and upper neighbour.
+    samples.assign(count, 0);
+    memcpy(samples.data(), entry.value.data(), entry.value.size());
+
+    const auto width = GuessWidth(samples.data(), count);
+    PutUInt(control, width);
+
+    samples.insert(samples.begin(), width + 1, 0);
+
+    left.resize(width);
+    up.resize(width);
+    median.resize(width);
+
+    for (size_t offset = 0; offset < count; offset += width) {
+      PredictRow(&samples[width + 1 + offset], width, width, left.data(),
+                 up.data(), median.data());
+
+      const uint64_t costs[] = {Cost(left.data(), width),
+                                Cost(up.data(), width),
+                                Cost(median.data(), width)};
+      const auto predictor = static_cast<Predictor>(
+          std::min_element(std::begin(costs), std::end(costs)) -
+          std::begin(costs));
+      const auto& row = predictor == kPredictorLeft
+                            ? left
+                            : predictor == kPredictorUp ? up : median;
+
+      if (!(row_count % 4)) predictors.push_back(0);
+      predictors.back() |= predictor << (2 * (row_count % 4));
+      ++row_count;
+
+      residuals.insert(residuals.end(), row.begin(), row.end());
+    }
+  }
+
+  std::string result;
+  PutUInt(result, decompressed_size);
+  result.push_back(kPixel16ModeImage);
+  result += control;
+  result += predictors;
+  EncodeResiduals(residuals, result);
+
+  return result;
+}
+
+kj::Array<const char> DecompressPixel16(const StringRef& data) {
+  StringRef input(data);
+  const auto decompressed_size = GetUInt(input);
+
+  KJ_REQUIRE(!input.empty());
+  const auto mode = static_cast<uint8_t>(input[0]);
+  input.Consume(1);
+
+  if (mode == kPixel16ModeLZ4) {
+    auto decompressed_data = kj::heapArray<char>(decompressed_size);
+    auto decompress_result =
+        LZ4_decompress_safe(input.data(), decompressed_data.begin(),
+                            input.size(), decompressed_size);
+    KJ_REQUIRE(decompress_result == static_cast<int>(decompressed_size),
+               decompress_result, decompressed_size);
+
+    return std::move(decompressed_data);
+  }
+
+  KJ_REQUIRE(mode == kPixel16ModeImage, "Unknown pixel codec mode", mode);
+
+  struct Value {
+    uint32_t repeat;
+    uint32_t size;  // Samples plus one, or zero for null values.
+    uint32_t width;
+  };
+
+  const auto value_count = GetUInt(input);
+  KJ_REQUIRE(value_count <= input.size(), value_count, input.size());
+
+  std::vector<Value> values(value_count);
+  size_t row_count = 0;
+  size_t sample_count = 0;
+
+  for (auto& value : values) {
+    value.repeat = GetUInt(input);
+    value.size = GetUInt(input);
+    value.width = 0;
+
+    if (value.size > 1) {
+      const auto count = value.size - 1;
+      value.width = GetUInt(input);
+      KJ_REQUIRE(value.width > 0 && !(count % value.width), count,
+                 value.width);
+
+      row_count += count / value.width;
+      sample_count += count;
+    }
+  }
+
+  KJ_REQUIRE(sample_count <= decompressed_size / 2, sample_count,
+             decompressed_size);
+
+  const auto predictors_size = (row_count + 3) / 4;
+  KJ_REQUIRE(predictors_size <= input.size(), predictors_size, input.size());
+  const auto predictors = reinterpret_cast<const uint8_t*>(input.data());
+  input.Consume(predictors_size);
+
+  std::vector<uint16_t> residuals(sample_count);
+  DecodeResiduals(input, residuals);
+
+  std::string result;
+  result.reserve(decompressed_size);
+
+  std::vector<uint16_t> samples;
+  size_t row = 0;
+  auto residual = residuals.data();
+
+  for (const auto& value : values) {
+    PutUInt(result, value.repeat);
+    PutUInt(result, 0);
+
+    if (!value.size) {
+      result.push_back(kCodeNull);
+      continue;
+    }
+
+    const size_t count = value.size - 1;
+    PutUInt(result, count * 2);
+
+    if (!count) continue;
+
+    const auto width = value.width;
+    samples.assign(width + 1 + count, 0);
+
+    for (size_t offset = 0; offset < count; offset += width, ++row) {
+      const auto predictor = static_cast<Predictor>(
+          (predictors[row / 4] >> (2 * (row % 4))) & 3);
+      ReconstructRow(&samples[width + 1 + offset], residual, width, width,
+                     predictor);
+      residual += width;
+    }
+
+    result.append(reinterpret_cast<const char*>(&samples[width + 1]),
+                  count * 2);
+  }
+
+  KJ_REQUIRE(result.size() == decompressed_size, result.size(),
+             decompressed_size);
+
+  return kj::heapArray<char>(result.data(), result.size());
+}
+
+}  // namespace columnfile_internal
+}  // namespace ev
@@ -1,5 +1,8 @@
 #include "base/columnfile.h"
 
+#include <algorithm>
+#include <numeric>
+
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -12,14 +15,171 @@
 
 #include "base/columnfile-internal.h"
 #include "base/file.h"
+#include "base/future.h"
 #include "base/macros.h"
 
 namespace ev {
 
+namespace columnfile_internal {
+
+kj::Array<const char> Decompress(const StringRef& data,
+                                 ColumnFileCompression compression) {
+  switch (compression) {
+    case kColumnFileCompressionNone:
+      return kj::heapArray<char>(data.data(), data.size());
+
+    case kColumnFileCompressionSnappy: {
+      size_t decompressed_size = 0;
+      KJ_REQUIRE(snappy::GetUncompressedLength(data.data(), data.size(),
+                                               &decompressed_size));
+
+      auto decompressed_data = kj::heapArray<char>(decompressed_size);
+      KJ_REQUIRE(snappy::RawUncompress(data.data(), data.size(),
+                                       decompressed_data.begin()));
+      return std::move(decompressed_data);
+    }
+
+    case kColumnFileCompressionLZ4: {
+      ev::StringRef input(data);
+      auto decompressed_size = GetUInt(input);
+
+      auto decompressed_data = kj::heapArray<char>(decompressed_size);
+      auto decompress_result =
+          LZ4_decompress_safe(input.data(), decompressed_data.begin(),
+                              input.size(), decompressed_size);
+      KJ_REQUIRE(decompress_result == static_cast<int>(decompressed_size),
+                 decompress_result, decompressed_size);
+
+      return std::move(decompressed_data);
+    }
+
+    case kColumnFileCompressionLZMA: {
+      ev::StringRef input(data);
+      auto decompressed_size = GetUInt(input);
+
+      auto decompressed_data = kj::heapArray<char>(decompressed_size);
+
+      lzma_stream ls = LZMA_STREAM_INIT;
+
+      KJ_REQUIRE(LZMA_OK == lzma_stream_decoder(&ls, UINT64_MAX, 0));
+      KJ_DEFER(lzma_end(&ls));
+
+      ls.next_in = reinterpret_cast<const uint8_t*>(input.data());
+      ls.avail_in = input.size();
+      ls.total_in = input.size();
+
+      ls.next_out = reinterpret_cast<uint8_t*>(decompressed_data.begin());
+      ls.avail_out = decompressed_size;
+
+      const auto code_ret = lzma_code(&ls, LZMA_FINISH);
+      KJ_REQUIRE(LZMA_STREAM_END == code_ret, code_ret);
+
+      KJ_REQUIRE(ls.total_out == decompressed_size, ls.total_out,
+                 decompressed_size);
+
+      return std::move(decompressed_data);
+    }
+
+    case kColumnFileCompressionZLIB: {
+      ev::StringRef input(data);
+      auto decompressed_size = GetUInt(input);
+
+      auto decompressed_data = kj::heapArray<char>(decompressed_size);
+
+      z_stream zs;
+      memset(&zs, 0, sizeof(zs));
+
+      KJ_REQUIRE(Z_OK == inflateInit(&zs));
+      KJ_DEFER(inflateEnd(&zs));
+
+      zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+      zs.avail_in = input.size();
+      zs.total_in = input.size();
+
+      zs.next_out = reinterpret_cast<uint8_t*>(decompressed_data.begin());
+      zs.avail_out = decompressed_size;
+
+      const auto inflate_ret = inflate(&zs, Z_FINISH);
+      KJ_REQUIRE(Z_STREAM_END == inflate_ret, inflate_ret);
+
+      KJ_REQUIRE(zs.total_out == decompressed_size, zs.total_out,
+                 decompressed_size);
+
+      return std::move(decompressed_data);
+    }
+
+    case kColumnFileCompressionPixel16:
+      return DecompressPixel16(data);
+
+    default:
+      KJ_FAIL_REQUIRE("Unknown compression scheme", compression);
+  }
+}
+
+namespace {
+
+// Returns the number of values in a field's uncompressed data.
+uint64_t CountValues(StringRef data) {
+  uint64_t result = 0;
+
+  while (!data.empty()) {
+    result += GetUInt(data);
+
+    const auto reserved = GetUInt(data);
+    KJ_REQUIRE(reserved == 0, reserved);
+
+    KJ_REQUIRE(!data.empty());
+    const auto b0 = static_cast<uint8_t>(data[0]);
+
+    if ((b0 & 0xc0) == 0xc0) {
+      data.Consume(1);
+      if (b0 == kCodeNull) continue;
+    }
+
+    const auto size = GetUInt(data);
+    KJ_REQUIRE(size <= data.size(), size, data.size());
+    data.Consume(size);
+  }
+
+  return result;
+}
+
+}  // namespace
+
+uint32_t CountRows(const SegmentHeader& header, const char* field_data) {
+  uint64_t result = 0;
+
+  for (const auto& field : header.fields) {
+    const auto data =
+        Decompress(StringRef(field_data, field.second), header.compression);
+    field_data += field.second;
+
+    result = std::max(result,
+                      CountValues(StringRef(data.begin(), data.size())));
+  }
+
+  return result;
+}
+
+}  // namespace columnfile_internal
+
 namespace {
 
 using namespace columnfile_internal;
 
+struct SegmentIndexEntry {
+  SegmentIndexEntry(uint64_t offset, uint64_t size, uint32_t row_count)
+      : offset(offset), size(size), row_count(row_count) {}
+
+  // Offset of the segment's header size, relative to the start of the input.
+  uint64_t offset;
+
+  // Size of the segment, including its header.
+  uint64_t size;
+
+  uint32_t row_count;
+};
+
 class ColumnFileFdInput : public ColumnFileInput {
  public:
   ColumnFileFdInput(kj::AutoCloseFd fd) : fd_(std::move(fd)) {
@@ -28,6 +188,8 @@ class ColumnFileFdInput : public ColumnFileInput {
     char magic[sizeof(kMagic)];
     Read(fd_, magic, sizeof(kMagic), sizeof(kMagic));
     KJ_REQUIRE(!memcmp(magic, kMagic, sizeof(kMagic)));
+
+    cacheable_ = FileCacheKey(fd_, cache_key_);
   }
 
   ~ColumnFileFdInput() override {}
@@ -44,8 +206,8 @@ class ColumnFileFdInput : public ColumnFileInput {
 
     KJ_SYSCALL(lseek(fd_, sizeof(kMagic), SEEK_SET));
 
-    data_.clear();
     buffer_.clear();
+    header_.fields.clear();
     end_ = false;
   }
 
@@ -55,25 +217,49 @@ class ColumnFileFdInput : public ColumnFileInput {
   // TODO(mortehu): Implement.
   size_t Offset() const override { return 0; }
 
- private:
-  struct FieldMeta {
-    uint32_t index;
-    uint32_t size;
-  };
+  const ColumnFileSchema& Schema() override;
+
+  std::vector<uint32_t> SegmentRowCounts() override;
+
+  void SeekToSegment(size_t index) override;
+
+  std::unique_ptr<ColumnFileInput> SegmentInput(size_t index) override;
+
+  bool SegmentCacheKey(ColumnFileCacheKey& key) override {
+    if (!cacheable_) return false;
+
+    key = cache_key_;
+    key.offset = segment_offset_;
+
+    return true;
+  }
+
+ protected:
+  // Reads every segment header, to load `schema_` and `segments_`.
+  void LoadIndex();
 
   bool end_ = false;
 
-  std::string buffer_;
+  // Identity of the file, and offset of the current segment.
+  ColumnFileCacheKey cache_key_;
+  bool cacheable_ = false;
+  uint64_t segment_offset_ = 0;
 
-  ev::StringRef data_;
+  std::string buffer_;
 
   kj::AutoCloseFd fd_;
 
-  std::vector<FieldMeta> field_meta_;
+  SegmentHeader header_;
 
   // Set to true when the file position is at the end of the field data.  This
   // means we have to seek backwards if we want to re-read the data.
   bool at_field_end_ = false;
+
+  ColumnFileSchema schema_;
+
+  std::vector<SegmentIndexEntry> segments_;
+
+  bool index_loaded_ = false;
 };
 
 class ColumnFileStringInput : public ColumnFileInput {
@@ -86,6 +272,13 @@ class ColumnFileStringInput : public ColumnFileInput {
     data_ = input_data_;
   }
 
+  // Reads segments that are not preceded by the magic string.  The input
+  // takes ownership of `segments`, which may be a non-owning array.
+  ColumnFileStringInput(kj::Array<const char> segments)
+      : buffer_(std::move(segments)),
+        input_data_(buffer_.begin(), buffer_.size()),
+        data_(input_data_) {}
+
   ~ColumnFileStringInput() override {}
 
   bool Next(ColumnFileCompression& compression);
@@ -101,70 +294,107 @@ class ColumnFileStringInput : public ColumnFileInput {
 
   size_t Offset() const override { return input_data_.size() - data_.size(); }
 
+  const ColumnFileSchema& Schema() override;
+
+  std::vector<uint32_t> SegmentRowCounts() override;
+
+  void SeekToSegment(size_t index) override;
+
+  std::unique_ptr<ColumnFileInput> SegmentInput(size_t index) override;
+
+  // Makes segments cacheable, with keys based on `key`.  `key.offset` is the
+  // file offset of the start of the input.
+  void SetCacheKey(const ColumnFileCacheKey& key) {
+    cache_key_ = key;
+    cacheable_ = true;
+  }
+
+  bool SegmentCacheKey(ColumnFileCacheKey& key) override {
+    if (!cacheable_) return false;
+
+    key = cache_key_;
+    key.offset += segment_offset_;
+
+    return true;
+  }
+
  private:
-  struct FieldMeta {
-    const char* data;
-    uint32_t index;
-    uint32_t size;
-  };
+  // Reads every segment header, to load `schema_` and `segments_`.
+  void LoadIndex();
+
+  // Reads the segment header at the start of `data`, and advances `data` past
+  // the header and the field data.  Sets `field_data` to the start of the
+  // field data.
+  static void ReadSegment(ev::StringRef& data, SegmentHeader& header,
+                          const char*& field_data);
+
+  kj::Array<const char> buffer_;
 
   ev::StringRef input_data_;
   ev::StringRef data_;
 
-  std::vector<FieldMeta> field_meta_;
+  SegmentHeader header_;
+  const char* field_data_ = nullptr;
+
+  ColumnFileCacheKey cache_key_;
+  bool cacheable_ = false;
+
+  // Offset of the current segment in `input_data_`.
+  uint64_t segment_offset_ = 0;
+
+  ColumnFileSchema schema_;
+
+  std::vector<SegmentIndexEntry> segments_;
+
+  bool index_loaded_ = false;
 };
 
 bool ColumnFileFdInput::Next(ColumnFileCompression& compression) {
-  KJ_REQUIRE(data_.empty());
+  for (;;) {
+    if (cacheable_) {
+      const auto offset = lseek(fd_, 0, SEEK_CUR);
+      KJ_SYSCALL(offset);
+      segment_offset_ = offset;
+    }
 
-  uint8_t size_buffer[4];
-  auto ret = Read(fd_, size_buffer, 0, 4);
-  if (ret < 4) {
-    end_ = true;
-    KJ_REQUIRE(ret == 0);
-    return false;
-  }
+    uint8_t size_buffer[4];
+    auto ret = Read(fd_, size_buffer, 0, 4);
+    if (ret < 4) {
+      end_ = true;
+      KJ_REQUIRE(ret == 0);
+      return false;
+    }
 
-  uint32_t size = (size_buffer[0] << 24) | (size_buffer[1] << 16) |
-                  (size_buffer[2] << 8) | size_buffer[3];
-  try {
-    buffer_.resize(size);
-  } catch (std::bad_alloc e) {
-    KJ_FAIL_REQUIRE("Buffer allocation failed", size);
-  }
-  Read(fd_, &buffer_[0], size, size);
+    const auto size = GetHeaderSize(size_buffer);
+    try {
+      buffer_.resize(size);
+    } catch (std::bad_alloc e) {
+      KJ_FAIL_REQUIRE("Buffer allocation failed", size);
+    }
+    Read(fd_, &buffer_[0], size, size);
 
-  data_ = buffer_;
+    ParseSegmentHeader(buffer_, header_);
 
-  compression = static_cast<ColumnFileCompression>(GetUInt(data_));
+    // Segments without fields only carry metadata.
+    if (header_.fields.empty()) continue;
 
-  const auto field_count = GetUInt(data_);
+    compression = header_.compression;
 
-  field_meta_.resize(field_count);
+    at_field_end_ = false;
 
-  for (size_t i = 0; i < field_count; ++i) {
-    field_meta_[i].index = GetUInt(data_);
-    field_meta_[i].size = GetUInt(data_);
+    return true;
   }
-
-  at_field_end_ = false;
-
-  return true;
 }
 
 std::vector<std::pair<uint32_t, kj::Array<const char>>> ColumnFileFdInput::Fill(
     const std::unordered_set<uint32_t>& field_filter) {
   std::vector<std::pair<uint32_t, kj::Array<const char>>> result;
 
-  result.reserve(field_filter.empty() ? field_meta_.size()
+  result.reserve(field_filter.empty() ? header_.fields.size()
                                       : field_filter.size());
 
   if (at_field_end_) {
-    off_t reverse_amount = 0;
-
-    for (const auto& f : field_meta_) reverse_amount += f.size;
-
-    KJ_SYSCALL(lseek(fd_, -reverse_amount, SEEK_CUR));
+    KJ_SYSCALL(lseek(fd_, -static_cast<off_t>(header_.data_size), SEEK_CUR));
   }
 
   // Number of bytes to seek before next read.  The purpose of having this
@@ -172,10 +402,10 @@ std::vector<std::pair<uint32_t, kj::Array<const char>>> ColumnFileFdInput::Fill(
   // same file descriptor.
   size_t skip_amount = 0;
 
-  for (const auto& f : field_meta_) {
+  for (const auto& f : header_.fields) {
     // If the field is ignored, skip its data.
-    if (!field_filter.empty() && !field_filter.count(f.index)) {
-      skip_amount += f.size;
+    if (!field_filter.empty() && !field_filter.count(f.first)) {
+      skip_amount += f.second;
       continue;
     }
 
@@ -184,10 +414,10 @@ std::vector<std::pair<uint32_t, kj::Array<const char>>> ColumnFileFdInput::Fill(
       skip_amount = 0;
     }
 
-    auto buffer = kj::heapArray<char>(f.size);
-    Read(fd_, buffer.begin(), f.size, f.size);
+    auto buffer = kj::heapArray<char>(f.second);
+    Read(fd_, buffer.begin(), f.second, f.second);
 
-    result.emplace_back(f.index, std::move(buffer));
+    result.emplace_back(f.first, std::move(buffer));
   }
 
   if (skip_amount > 0) {
@@ -199,52 +429,298 @@ std::vector<std::pair<uint32_t, kj::Array<const char>>> ColumnFileFdInput::Fill(
   return std::move(result);
 }
 
-bool ColumnFileStringInput::Next(ColumnFileCompression& compression) {
-  KJ_REQUIRE(!data_.empty());
+const ColumnFileSchema& ColumnFileFdInput::Schema() {
+  LoadIndex();
+
+  return schema_;
+}
+
+std::vector<uint32_t> ColumnFileFdInput::SegmentRowCounts() {
+  LoadIndex();
+
+  std::vector<uint32_t> result;
+  result.reserve(segments_.size());
+  for (const auto& segment : segments_) result.emplace_back(segment.row_count);
+
+  return result;
+}
+
+void ColumnFileFdInput::SeekToSegment(size_t index) {
+  LoadIndex();
+
+  KJ_REQUIRE(index <= segments_.size(), index, segments_.size());
+
+  if (index == segments_.size()) {
+    KJ_SYSCALL(lseek(fd_, 0, SEEK_END));
+  } else {
+    KJ_SYSCALL(lseek(fd_, segments_[index].offset, SEEK_SET));
+  }
 
-  data_.Consume(4);  // Skip header size we don't need.
+  header_.fields.clear();
+  at_field_end_ = false;
+  end_ = false;
+}
+
+std::unique_ptr<ColumnFileInput> ColumnFileFdInput::SegmentInput(
+    size_t index) {
+  LoadIndex();
 
-  compression = static_cast<ColumnFileCompression>(GetUInt(data_));
+  KJ_REQUIRE(index < segments_.size(), index, segments_.size());
+  const auto& segment = segments_[index];
 
-  const auto field_count = GetUInt(data_);
+  auto buffer = kj::heapArray<char>(segment.size);
+  PRead(fd_, buffer.begin(), segment.size, segment.offset);
 
-  field_meta_.resize(field_count);
+  auto result = std::make_unique<ColumnFileStringInput>(std::move(buffer));
 
-  for (size_t i = 0; i < field_count; ++i) {
-    field_meta_[i].index = GetUInt(data_);
-    field_meta_[i].size = GetUInt(data_);
+  if (cacheable_) {
+    auto key = cache_key_;
+    key.offset = segment.offset;
+    result->SetCacheKey(key);
   }
 
-  for (auto& f : field_meta_) {
-    f.data = data_.begin();
-    data_.Consume(f.size);
+  return std::move(result);
+}
+
+void ColumnFileFdInput::LoadIndex() {
+  if (index_loaded_) return;
+
+  // Walk the segment headers using pread(), so that the current read position
+  // is left undisturbed.
+  off_t offset = sizeof(kMagic);
+  std::string header_buffer;
+  std::string field_data;
+  SegmentHeader header;
+
+  for (;;) {
+    uint8_t size_buffer[4];
+    if (PRead(fd_, size_buffer, 0, 4, offset) < 4) break;
+
+    const auto size = GetHeaderSize(size_buffer);
+    header_buffer.resize(size);
+    PRead(fd_, &header_buffer[0], size, offset + 4);
+
+    ParseSegmentHeader(header_buffer, header);
+
+    if (!header.schema.empty())
+      schema_.Merge(ColumnFileSchema::Parse(header.schema));
+
+    if (!header.fields.empty()) {
+      auto row_count = header.row_count;
+
+      if (!row_count) {
+        field_data.resize(header.data_size);
+        PRead(fd_, &field_data[0], header.data_size, offset + 4 + size);
+        row_count = CountRows(header, field_data.data());
+      }
+
+      segments_.emplace_back(offset, 4 + size + header.data_size, row_count);
+    }
+
+    offset += 4 + size + header.data_size;
   }
 
-  return true;
+  index_loaded_ = true;
+}
+
+void ColumnFileStringInput::ReadSegment(ev::StringRef& data,
+                                        SegmentHeader& header,
+                                        const char*& field_data) {
+  KJ_REQUIRE(data.size() >= 4, data.size());
+  const auto size =
+      GetHeaderSize(reinterpret_cast<const uint8_t*>(data.begin()));
+  data.Consume(4);
+
+  KJ_REQUIRE(size <= data.size(), size, data.size());
+  ParseSegmentHeader(ev::StringRef(data.begin(), size), header);
+  data.Consume(size);
+
+  KJ_REQUIRE(header.data_size <= data.size(), header.data_size, data.size());
+  field_data = data.begin();
+  data.Consume(header.data_size);
+}
+
+bool ColumnFileStringInput::Next(ColumnFileCompression& compression) {
+  while (!data_.empty()) {
+    segment_offset_ = input_data_.size() - data_.size();
+    ReadSegment(data_, header_, field_data_);
+
+    // Segments without fields only carry metadata.
+    if (header_.fields.empty()) continue;
+
+    compression = header_.compression;
+
+    return true;
+  }
+
+  return false;
 }
 
 std::vector<std::pair<uint32_t, kj::Array<const char>>>
 ColumnFileStringInput::Fill(const std::unordered_set<uint32_t>& field_filter) {
   std::vector<std::pair<uint32_t, kj::Array<const char>>> result;
 
-  for (const auto& f : field_meta_) {
-    if (!field_filter.empty() && !field_filter.count(f.index)) continue;
+  auto field_data = field_data_;
+
+  for (const auto& f : header_.fields) {
+    const auto data = field_data;
+    field_data += f.second;
+
+    if (!field_filter.empty() && !field_filter.count(f.first)) continue;
 
     // TODO(mortehu): See if we can use a non-owning array instead, e.g.
     //     kj::Array<const char>(data.begin(), f.second,
     //     kj::NullArrayDisposer());
     //  This way, we wouldn't have to copy all the data.
 
-    auto buffer = kj::heapArray<char>(f.data, f.size);
+    auto buffer = kj::heapArray<char>(data, f.second);
 
-    result.emplace_back(f.index, std::move(buffer));
+    result.emplace_back(f.first, std::move(buffer));
   }
 
   return std::move(result);
 }
 
+const ColumnFileSchema& ColumnFileStringInput::Schema() {
+  LoadIndex();
+
+  return schema_;
+}
+
+std::vector<uint32_t> ColumnFileStringInput::SegmentRowCounts() {
+  LoadIndex();
+
+  std::vector<uint32_t> result;
+  result.reserve(segments_.size());
+  for (const auto& segment : segments_) result.emplace_back(segment.row_count);
+
+  return result;
+}
+
+void ColumnFileStringInput::SeekToSegment(size_t index) {
+  LoadIndex();
+
+  KJ_REQUIRE(index <= segments_.size(), index, segments_.size());
+
+  data_ = input_data_;
+
+  if (index == segments_.size())
+    data_.Consume(data_.size());
+  else
+    data_.Consume(segments_[index].offset);
+}
+
+std::unique_ptr<ColumnFileInput> ColumnFileStringInput::SegmentInput(
+    size_t index) {
+  LoadIndex();
+
+  KJ_REQUIRE(index < segments_.size(), index, segments_.size());
+  const auto& segment = segments_[index];
+
+  auto result = std::make_unique<ColumnFileStringInput>(kj::Array<const char>(
+      input_data_.begin() + segment.offset, segment.size,
+      kj::NullArrayDisposer::instance));
+
+  if (cacheable_) {
+    auto key = cache_key_;
+    key.offset += segment.offset;
+    result->SetCacheKey(key);
+  }
+
+  return std::move(result);
+}
+
+void ColumnFileStringInput::LoadIndex() {
+  if (index_loaded_) return;
+
+  auto data = input_data_;
+  SegmentHeader header;
+  const char* field_data;
+
+  while (!data.empty()) {
+    const auto offset = input_data_.size() - data.size();
+
+    ReadSegment(data, header, field_data);
+
+    if (!header.schema.empty())
+      schema_.Merge(ColumnFileSchema::Parse(header.schema));
+
+    if (!header.fields.empty()) {
+      segments_.emplace_back(
+          offset, input_data_.size() - data.size() - offset,
+          header.row_count ? header.row_count : CountRows(header, field_data));
+    }
+  }
+
+  index_loaded_ = true;
+}
+
+// Reads a file like `ColumnFileFdInput`, except that field data is fetched,
+// already decompressed, from a `ColumnFileCacheServer`.
+class ColumnFileSharedCacheInput : public ColumnFileFdInput {
+ public:
+  ColumnFileSharedCacheInput(kj::AutoCloseFd fd, std::string path,
+                             std::unique_ptr<ColumnFileCacheClient> client)
+      : ColumnFileFdInput(std::move(fd)),
+        path_(std::move(path)),
+        client_(std::move(client)) {}
+
+  bool Next(ColumnFileCompression& compression) override {
+    if (!ColumnFileFdInput::Next(compression)) return false;
+
+    compression = kColumnFileCompressionNone;
+
+    return true;
+  }
+
+  std::vector<std::pair<uint32_t, kj::Array<const char>>> Fill(
+      const std::unordered_set<uint32_t>& field_filter) override {
+    std::vector<uint32_t> fields;
+
+    for (const auto& field : header_.fields) {
+      if (field_filter.empty() || field_filter.count(field.first))
+        fields.emplace_back(field.first);
+    }
+
+    ColumnFileCacheKey segment;
+    KJ_REQUIRE(SegmentCacheKey(segment));
+
+    auto result = client_->Fetch(path_, segment, fields);
+
+    // Move past the field data, as if it had been read.
+    if (!at_field_end_) {
+      KJ_SYSCALL(lseek(fd_, header_.data_size, SEEK_CUR));
+      at_field_end_ = true;
+    }
+
+    return result;
+  }
+
+ private:
+  std::string path_;
+
+  std::unique_ptr<ColumnFileCacheClient> client_;
+};
+
 }  // namespace
 
+const ColumnFileSchema& ColumnFileInput::Schema() {
+  static const ColumnFileSchema kEmptySchema;
+  return kEmptySchema;
+}
+
+std::vector<uint32_t> ColumnFileInput::SegmentRowCounts() {
+  KJ_FAIL_REQUIRE("Input does not support random access");
+}
+
+void ColumnFileInput::SeekToSegment(size_t index) {
+  KJ_FAIL_REQUIRE("Input does not support random access", index);
+}
+
+std::unique_ptr<ColumnFileInput> ColumnFileInput::SegmentInput(size_t index) {
+  KJ_FAIL_REQUIRE("Input does not support random access", index);
+}
+
 std::unique_ptr<ColumnFileInput> ColumnFileReader::FileDescriptorInput(
     kj::AutoCloseFd fd) {
   return std::make_unique<ColumnFileFdInput>(std::move(fd));
@@ -255,6 +731,27 @@ std::unique_ptr<ColumnFileInput> ColumnFileReader::StringInput(
   return std::make_unique<ColumnFileStringInput>(data);
 }
 
+std::unique_ptr<ColumnFileInput> ColumnFileReader::SharedCacheInput(
+    const char* path, const char* socket_path) {
+  auto fd = OpenFile(path, O_RDONLY);
+
+  const auto socket =
+      socket_path ? std::string(socket_path) : ColumnFileCacheSocketPath();
+  auto client = ColumnFileCacheClient::Connect(socket.c_str());
+
+  ColumnFileCacheKey key;
+  if (!client || !FileCacheKey(fd, key))
+    return std::make_unique<ColumnFileFdInput>(std::move(fd));
+
+  // The server opens the file by name, so it needs the absolute path.
+  std::unique_ptr<char, decltype(&free)> absolute_path(
+      realpath(path, nullptr), free);
+  if (!absolute_path) KJ_FAIL_SYSCALL("realpath", errno, path);
+
+  return std::make_unique<ColumnFileSharedCacheInput>(
+      std::move(fd), absolute_path.get(), std::move(client));
+}
+
 ColumnFileReader::ColumnFileReader(std::unique_ptr<ColumnFileInput> input)
     : input_(std::move(input)) {}
 
@@ -320,6 +817,21 @@ const StringRef* ColumnFileReader::Get(uint32_t field) {
   return i->second.Get();
 }
 
+uint32_t ColumnFileReader::GetRun(uint32_t field, StringRefOrNull& value) {
+  auto i = fields_.find(field);
+  if (i == fields_.end() || i->second.End()) return 0;
+
+  const StringRef* data;
+  const auto result = i->second.GetRun(data);
+
+  if (data)
+    value = *data;
+  else
+    value = nullptr;
+
+  return result;
+}
+
 const std::vector<std::pair<uint32_t, StringRefOrNull>>&
 ColumnFileReader::GetRow() {
   row_buffer_.clear();
@@ -351,6 +863,14 @@ ColumnFileReader::GetRow() {
   return row_buffer_;
 }
 
+std::shared_ptr<const kj::Array<const char>> ColumnFileReader::ValueBuffer(
+    uint32_t field) const {
+  const auto i = fields_.find(field);
+  if (i == fields_.end()) return nullptr;
+
+  return i->second.ValueBuffer();
+}
+
 void ColumnFileReader::SeekToStart() {
   input_->SeekToStart();
 
@@ -365,107 +885,130 @@ void ColumnFileReader::SeekToStartOfSegment() {
   Fill(false);
 }
 
-ColumnFileReader::FieldReader::FieldReader(kj::Array<const char> buffer,
-                                           ColumnFileCompression compression)
-    : buffer_(std::move(buffer)), data_(buffer_), compression_(compression) {}
+uint64_t ColumnFileReader::RowCount() {
+  LoadSegmentRows();
 
-void ColumnFileReader::FieldReader::Fill() {
-  switch (compression_) {
-    case kColumnFileCompressionNone:
-      break;
+  return segment_rows_.back();
+}
 
-    case kColumnFileCompressionSnappy: {
-      size_t decompressed_size = 0;
-      KJ_REQUIRE(snappy::GetUncompressedLength(data_.data(), data_.size(),
-                                               &decompressed_size));
+const std::vector<uint64_t>& ColumnFileReader::SegmentRows() {
+  LoadSegmentRows();
 
-      auto decompressed_data = kj::heapArray<char>(decompressed_size);
-      KJ_REQUIRE(snappy::RawUncompress(data_.data(), data_.size(),
-                                       decompressed_data.begin()));
-      buffer_ = std::move(decompressed_data);
+  return segment_rows_;
+}
 
-      data_ = buffer_;
-      compression_ = kColumnFileCompressionNone;
-    } break;
+void ColumnFileReader::SeekToRow(uint64_t row) {
+  LoadSegmentRows();
 
-    case kColumnFileCompressionLZ4: {
-      ev::StringRef input(data_);
-      auto decompressed_size = GetUInt(input);
+  KJ_REQUIRE(row <= segment_rows_.back(), row, segment_rows_.back());
 
-      auto decompressed_data = kj::heapArray<char>(decompressed_size);
-      auto decompress_result =
-          LZ4_decompress_safe(input.data(), decompressed_data.begin(),
-                              input.size(), decompressed_size);
-      KJ_REQUIRE(decompress_result == static_cast<int>(decompressed_size),
-                 decompress_result, decompressed_size);
+  const auto segment =
+      std::upper_bound(segment_rows_.begin(), segment_rows_.end(), row) -
+      segment_rows_.begin() - 1;
 
-      buffer_ = std::move(decompressed_data);
+  input_->SeekToSegment(segment);
 
-      data_ = buffer_;
-      compression_ = kColumnFileCompressionNone;
-    } break;
+  fields_.clear();
+  row_buffer_.clear();
 
-    case kColumnFileCompressionLZMA: {
-      ev::StringRef input(data_);
-      auto decompressed_size = GetUInt(input);
+  if (row == segment_rows_.back()) return;
 
-      auto decompressed_data = kj::heapArray<char>(decompressed_size);
+  Fill();
 
-      lzma_stream ls = LZMA_STREAM_INIT;
+  const auto skip = row - segment_rows_[segment];
 
-      KJ_REQUIRE(LZMA_OK == lzma_stream_decoder(&ls, UINT64_MAX, 0));
+  for (auto& field : fields_) field.second.Skip(skip);
+}
 
-      ls.next_in = reinterpret_cast<const uint8_t*>(input.data());
-      ls.avail_in = input.size();
-      ls.total_in = input.size();
+void ColumnFileReader::ReadRows(
+    uint64_t begin, uint64_t end,
+    Delegate<void(const std::vector<std::pair<uint32_t, StringRefOrNull>>&)>
+        callback) {
+  KJ_REQUIRE(begin <= end, begin, end);
 
-      ls.next_out = reinterpret_cast<uint8_t*>(decompressed_data.begin());
-      ls.avail_out = decompressed_size;
+  SeekToRow(begin);
 
-      const auto code_ret = lzma_code(&ls, LZMA_FINISH);
-      KJ_REQUIRE(LZMA_STREAM_END == code_ret, code_ret);
+  for (auto row = begin; row != end; ++row) {
+    KJ_REQUIRE(!End(), "Row out of range", row);
+    callback(GetRow());
+  }
+}
 
-      KJ_REQUIRE(ls.total_out == decompressed_size, ls.total_out,
-                 decompressed_size);
+void ColumnFileReader::ReadRows(
+    const std::vector<uint64_t>& rows,
+    Delegate<void(const std::vector<std::pair<uint32_t, StringRefOrNull>>&)>
+        callback) {
+  LoadSegmentRows();
 
-      buffer_ = std::move(decompressed_data);
+  uint64_t next_row = 0;
+  uint64_t segment_end = 0;
 
-      data_ = buffer_;
-      compression_ = kColumnFileCompressionNone;
-    } break;
+  for (const auto row : rows) {
+    KJ_REQUIRE(row < segment_rows_.back(), "Row out of range", row);
+    KJ_REQUIRE(row >= next_row, "Rows must be in ascending order", row);
 
-    case kColumnFileCompressionZLIB: {
-      ev::StringRef input(data_);
-      auto decompressed_size = GetUInt(input);
+    if (row < segment_end) {
+      for (auto& field : fields_) field.second.Skip(row - next_row);
+    } else {
+      SeekToRow(row);
+      segment_end =
+          *std::upper_bound(segment_rows_.begin(), segment_rows_.end(), row);
+    }
 
-      auto decompressed_data = kj::heapArray<char>(decompressed_size);
+    next_row = row + 1;
 
-      z_stream zs;
-      memset(&zs, 0, sizeof(zs));
+    // When every field has ended before the end of the segment, the
+    // remaining rows are all NULL.  `GetRow()` would move on to the next
+    // segment.
+    if (EndOfSegment()) {
+      row_buffer_.clear();
+      callback(row_buffer_);
+      continue;
+    }
 
-      KJ_REQUIRE(Z_OK == inflateInit(&zs));
+    callback(GetRow());
+  }
+}
 
-      zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
-      zs.avail_in = input.size();
-      zs.total_in = input.size();
+void ColumnFileReader::Sample(
+    size_t count,
+    Delegate<void(const std::vector<std::pair<uint32_t, StringRefOrNull>>&)>
+        callback,
+    std::mt19937_64& rng) {
+  ReadRows(SampleIndexes(RowCount(), count, rng), std::move(callback));
+}
 
-      zs.next_out = reinterpret_cast<uint8_t*>(decompressed_data.begin());
-      zs.avail_out = decompressed_size;
+void ColumnFileReader::LoadSegmentRows() {
+  if (!segment_rows_.empty()) return;
 
-      const auto inflate_ret = inflate(&zs, LZMA_FINISH);
-      KJ_REQUIRE(Z_STREAM_END == inflate_ret, inflate_ret);
+  const auto row_counts = input_->SegmentRowCounts();
 
-      KJ_REQUIRE(zs.total_out == decompressed_size, zs.total_out,
-                 decompressed_size);
+  segment_rows_.reserve(row_counts.size() + 1);
+  segment_rows_.emplace_back(0);
 
-      buffer_ = std::move(decompressed_data);
+  for (const auto row_count : row_counts)
+    segment_rows_.emplace_back(segment_rows_.back() + row_count);
+}
 
-      data_ = buffer_;
-      compression_ = kColumnFileCompressionNone;
-    } break;
+ColumnFileReader::FieldReader::FieldReader(kj::Array<const char> buffer,
+                                           ColumnFileCompression compression)
+    : shared_buffer_(
+          std::make_shared<const kj::Array<const char>>(std::move(buffer))),
+      data_(*shared_buffer_),
+      compression_(compression) {}
 
-    default:
-      KJ_FAIL_REQUIRE("Unknown compression scheme", compression_);
+ColumnFileReader::FieldReader::FieldReader(
+    std::shared_ptr<const kj::Array<const char>> buffer)
+    : shared_buffer_(std::move(buffer)),
+      data_(*shared_buffer_),
+      compression_(kColumnFileCompressionNone) {}
+
+void ColumnFileReader::FieldReader::Fill() {
+  if (compression_ != kColumnFileCompressionNone) {
+    shared_buffer_ = std::make_shared<const kj::Array<const char>>(
+        Decompress(data_, compression_));
+    data_ = *shared_buffer_;
+    compression_ = kColumnFileCompressionNone;
   }
 
   if (!repeat_) {
@@ -491,13 +1034,20 @@ void ColumnFileReader::FieldReader::Fill() {
         KJ_REQUIRE(shared_prefix <= value_.size(), shared_prefix,
                    value_.size());
 
-        // We just move the old prefix in front of the new suffix, corrupting
-        // whatever data is there; we're not going to read it again anyway.
-        memmove(const_cast<char*>(data_.data()) - shared_prefix, value_.begin(),
-                shared_prefix);
+        KJ_REQUIRE(suffix_length <= data_.size(), suffix_length,
+                   data_.size());
+
+        // Join the prefix and suffix in a separate buffer, since the field
+        // data may be shared with other readers through `ColumnFileCache`.
+        if (value_.data() == prefix_buffer_.data())
+          prefix_buffer_.resize(shared_prefix);
+        else
+          prefix_buffer_.assign(value_.begin(), value_.begin() + shared_prefix);
 
-        value_ = StringRef(data_.begin() - shared_prefix,
-                           shared_prefix + suffix_length);
+        prefix_buffer_.insert(prefix_buffer_.end(), data_.begin(),
+                              data_.begin() + suffix_length);
+
+        value_ = StringRef(prefix_buffer_.data(), prefix_buffer_.size());
         data_.Consume(suffix_length);
         value_is_null_ = false;
       }
@@ -510,6 +1060,37 @@ void ColumnFileReader::FieldReader::Fill() {
   }
 }
 
+std::shared_ptr<const kj::Array<const char>>
+ColumnFileReader::FieldReader::ValueBuffer() const {
+  if (value_is_null_ || compression_ != kColumnFileCompressionNone)
+    return nullptr;
+
+  // Values sharing a prefix with the previous value are joined in
+  // `prefix_buffer_`, which is overwritten by the next such value.
+  const auto& buffer = *shared_buffer_;
+  if (value_.begin() < buffer.begin() || value_.end() > buffer.end())
+    return nullptr;
+
+  return shared_buffer_;
+}
+
+uint64_t ColumnFileReader::FieldReader::Skip(uint64_t count) {
+  uint64_t result = 0;
+
+  while (result < count) {
+    if (!repeat_) {
+      if (data_.empty()) break;
+      Fill();
+    }
+
+    const auto amount = std::min<uint64_t>(repeat_, count - result);
+    repeat_ -= amount;
+    result += amount;
+  }
+
+  return result;
+}
+
 void ColumnFileReader::Fill(bool next) {
   fields_.clear();
 
@@ -519,29 +1100,106 @@ void ColumnFileReader::Fill(bool next) {
 
   KJ_ASSERT(!fields.empty());
 
+  // Decompressed field data is shared through the cache, when the input has
+  // a stable identity.
+  auto& cache = ColumnFileCache::Global();
+  ColumnFileCacheKey cache_key;
+  const auto use_cache = compression_ != kColumnFileCompressionNone &&
+                         cache.Capacity() > 0 &&
+                         input_->SegmentCacheKey(cache_key);
+
+  if (use_cache) {
+    std::vector<std::pair<uint32_t, kj::Array<const char>>> misses;
+
+    for (auto& field : fields) {
+      cache_key.field = field.first;
+
+      if (auto data = cache.Find(cache_key))
+        fields_.emplace(field.first, FieldReader(std::move(data)));
+      else
+        misses.emplace_back(std::move(field));
+    }
+
+    fields.swap(misses);
+  }
+
+  const auto load = [this, use_cache, cache_key](uint32_t field,
+                                                 kj::Array<const char> data) {
+    if (!use_cache) return FieldReader(std::move(data), compression_);
+
+    auto key = cache_key;
+    key.field = field;
+
+    auto buffer = std::make_shared<const kj::Array<const char>>(
+        Decompress(data, compression_));
+    ColumnFileCache::Global().Insert(key, buffer);
+
+    return FieldReader(std::move(buffer));
+  };
+
   if (compression_ == kColumnFileCompressionLZMA) {
     if (!thread_pool_) thread_pool_ = std::make_unique<ThreadPool>();
 
-    std::vector<std::pair<uint32_t, std::future<FieldReader>>> future_fields;
+    std::vector<Future<FieldReader>> future_fields;
+    future_fields.reserve(fields.size());
 
     for (auto& field : fields) {
-      future_fields.emplace_back(
-          field.first, thread_pool_->Launch(
-                           [ this, data = std::move(field.second) ]() mutable {
-                             FieldReader result(std::move(data), compression_);
-                             if (!result.End()) result.Fill();
-                             return result;
-                           }));
+      future_fields.emplace_back(Async(*thread_pool_, [
+        load, id = field.first, data = std::move(field.second)
+      ]() mutable {
+        auto result = load(id, std::move(data));
+        if (!result.End()) result.Fill();
+        return result;
+      }));
     }
 
-    for (auto& field : future_fields)
-      fields_.emplace(field.first, field.second.get());
+    // Waits once for all fields, rather than once per field.
+    auto readers = WhenAll(std::move(future_fields)).Get();
+
+    for (size_t i = 0; i < fields.size(); ++i)
+      fields_.emplace(fields[i].first, std::move(readers[i]));
   } else {
-    for (auto& field : fields) {
-      fields_.emplace(field.first,
-                      FieldReader(std::move(field.second), compression_));
+    for (auto& field : fields)
+      fields_.emplace(field.first, load(field.first, std::move(field.second)));
+  }
+}
+
+std::vector<uint64_t> columnfile_internal::SampleIndexes(
+    uint64_t n, size_t count, std::mt19937_64& rng) {
+  std::vector<uint64_t> result;
+
+  if (count >= n) {
+    result.resize(n);
+    std::iota(result.begin(), result.end(), 0);
+    return result;
+  }
+
+  result.reserve(count);
+
+  // For large samples, select each index with the probability needed to fill
+  // the sample exactly (Knuth's algorithm S).
+  if (count > n / 2) {
+    for (uint64_t i = 0; result.size() < count; ++i) {
+      std::uniform_int_distribution<uint64_t> distribution(0, n - i - 1);
+      if (distribution(rng) < count - result.size()) result.emplace_back(i);
     }
+
+    return result;
   }
+
+  // For small samples, use Floyd's algorithm, which makes one random choice
+  // per sampled index.
+  std::unordered_set<uint64_t> selected;
+
+  for (auto i = n - count; i < n; ++i) {
+    std::uniform_int_distribution<uint64_t> distribution(0, i);
+    if (!selected.emplace(distribution(rng)).second) selected.emplace(i);
+  }
+
+  result.assign(selected.begin(), selected.end());
+  std::sort(result.begin(), result.end());
+
+  return result;
 }
 
 }  // namespace ev
@@ -0,0 +1,105 @@
+#include "base/columnfile.h"
+
+#include <unordered_map>
+#include <unordered_set>
+
+namespace ev {
+
+namespace {
+
+// Calls `callback` with the value, first row and length of every run of
+// values in `field`.  Rows beyond the end of the field's data in a segment are
+// reported as a NULL run.
+void ForEachRun(
+    ColumnFileReader& reader, uint32_t field,
+    Delegate<void(const StringRefOrNull&, uint64_t, uint64_t)> callback) {
+  const auto segment_rows = reader.SegmentRows();
+
+  reader.SetColumnFilter({field});
+
+  for (size_t segment = 0; segment + 1 < segment_rows.size(); ++segment) {
+    auto row = segment_rows[segment];
+    const auto segment_end = segment_rows[segment + 1];
+
+    reader.SeekToRow(row);
+
+    StringRefOrNull value = nullptr;
+
+    while (const auto count = reader.GetRun(field, value)) {
+      callback(value, row, count);
+      row += count;
+    }
+
+    if (row < segment_end) callback(nullptr, row, segment_end - row);
+  }
+
+  reader.SeekToStart();
+}
+
+}  // namespace
+
+std::vector<std::pair<uint64_t, uint64_t>> ColumnFileFilterRuns(
+    ColumnFileReader& reader, uint32_t field,
+    Delegate<bool(const StringRefOrNull&)> filter) {
+  std::vector<std::pair<uint64_t, uint64_t>> result;
+
+  ForEachRun(reader, field, [&result, &filter](const StringRefOrNull& value,
+                                               uint64_t row, uint64_t count) {
+    if (!filter(value)) return;
+
+    if (!result.empty() && result.back().second == row)
+      result.back().second += count;
+    else
+      result.emplace_back(row, row + count);
+  });
+
+  return result;
+}
+
+uint64_t ColumnFileCount(ColumnFileReader& reader, uint32_t field,
+                         Delegate<bool(const StringRefOrNull&)> filter) {
+  uint64_t result = 0;
+
+  ForEachRun(reader, field, [&result, &filter](const StringRefOrNull& value,
+                                               uint64_t row, uint64_t count) {
+    if (filter(value)) result += count;
+  });
+
+  return result;
+}
+
+std::vector<std::string> ColumnFileDistinct(ColumnFileReader& reader,
+                                            uint32_t field) {
+  std::unordered_set<std::string> values;
+
+  ForEachRun(reader, field, [&values](const StringRefOrNull& value,
+                                      uint64_t row, uint64_t count) {
+    if (!value.IsNull()) values.emplace(value.StringRef().str());
+  });
+
+  std::vector<std::string> result(values.begin(), values.end());
+  std::sort(result.begin(), result.end());
+
+  return result;
+}
+
+std::map<std::string, uint64_t> ColumnFileGroupByCount(
+    ColumnFileReader& reader, uint32_t field, uint64_t* null_count) {
+  std::unordered_map<std::string, uint64_t> counts;
+  uint64_t nulls = 0;
+
+  ForEachRun(reader, field,
+             [&counts, &nulls](const StringRefOrNull& value, uint64_t row,
+                               uint64_t count) {
+               if (value.IsNull())
+                 nulls += count;
+               else
+                 counts[value.StringRef().str()] += count;
+             });
+
+  if (null_count) *null_count = nulls;
+
+  return std::map<std::string, uint64_t>(counts.begin(), counts.end());
+}
+
+}  // namespace ev
@@ -0,0 +1,234 @@
+#include "base/columnfile.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <kj/debug.h>
+
+#include "base/columnfile-internal.h"
+#include "base/macros.h"
+#include "base/string.h"
+
+namespace ev {
+
+using namespace columnfile_internal;
+
+namespace {
+
+const char* const kColumnTypeNames[] = {"binary", "string", "int", "float",
+                                        "float-array"};
+
+}  // namespace
+
+const char* ColumnTypeName(ColumnType type) {
+  KJ_REQUIRE(type < ARRAY_SIZE(kColumnTypeNames), type);
+  return kColumnTypeNames[type];
+}
+
+ColumnType ColumnTypeFromName(const StringRef& name) {
+  for (size_t i = 0; i < ARRAY_SIZE(kColumnTypeNames); ++i) {
+    if (name == kColumnTypeNames[i]) return static_cast<ColumnType>(i);
+  }
+
+  KJ_FAIL_REQUIRE("Unknown column type", name);
+}
+
+void ColumnFileSchema::AddColumn(uint32_t id, std::string name,
+                                 ColumnType type, uint32_t dicom_tag) {
+  auto i = std::lower_bound(
+      columns_.begin(), columns_.end(), id,
+      [](const auto& column, uint32_t id) { return column.id < id; });
+
+  if (i == columns_.end() || i->id != id)
+    i = columns_.emplace(i);
+
+  i->id = id;
+  i->name = std::move(name);
+  i->type = type;
+  i->dicom_tag = dicom_tag;
+}
+
+const ColumnFileColumn* ColumnFileSchema::Find(uint32_t id) const {
+  auto i = std::lower_bound(
+      columns_.begin(), columns_.end(), id,
+      [](const auto& column, uint32_t id) { return column.id < id; });
+
+  if (i == columns_.end() || i->id != id) return nullptr;
+
+  return &*i;
+}
+
+const ColumnFileColumn* ColumnFileSchema::Find(const StringRef& name) const {
+  for (const auto& column : columns_) {
+    if (name == column.name) return &column;
+  }
+
+  return nullptr;
+}
+
+const ColumnFileColumn* ColumnFileSchema::FindDICOMTag(
+    uint32_t dicom_tag) const {
+  for (const auto& column : columns_) {
+    if (column.dicom_tag == dicom_tag) return &column;
+  }
+
+  return nullptr;
+}
+
+uint32_t ColumnFileSchema::ColumnId(const StringRef& name) const {
+  auto column = Find(name);
+  KJ_REQUIRE(column != nullptr, "Unknown column", name);
+  return column->id;
+}
+
+void ColumnFileSchema::Merge(const ColumnFileSchema& other) {
+  for (const auto& column : other.columns_)
+    AddColumn(column.id, column.name, column.type, column.dicom_tag);
+}
+
+void ColumnFileSchema::Serialize(std::string& output) const {
+  PutUInt(output, columns_.size());
+
+  for (const auto& column : columns_) {
+    PutUInt(output, column.id);
+    PutUInt(output, column.type);
+    PutUInt(output, column.dicom_tag);
+    PutUInt(output, column.name.size());
+    output.append(column.name);
+  }
+}
+
+ColumnFileSchema ColumnFileSchema::Parse(StringRef data) {
+  ColumnFileSchema result;
+
+  const auto column_count = GetUInt(data);
+  KJ_REQUIRE(column_count <= data.size(), column_count, data.size());
+
+  for (size_t i = 0; i < column_count; ++i) {
+    const auto id = GetUInt(data);
+    const auto type = static_cast<ColumnType>(GetUInt(data));
+    const auto dicom_tag = GetUInt(data);
+    const auto name_size = GetUInt(data);
+    KJ_REQUIRE(name_size <= data.size(), name_size, data.size());
+
+    result.AddColumn(id, std::string(data.begin(), name_size), type,
+                     dicom_tag);
+    data.Consume(name_size);
+  }
+
+  return result;
+}
+
+const ColumnFileColumn& ColumnFileSchema::Require(uint32_t column) const {
+  auto result = Find(column);
+  KJ_REQUIRE(result != nullptr, "Column missing from schema", column);
+  return *result;
+}
+
+int64_t ColumnFileSchema::GetInt(uint32_t column,
+                                 const StringRef& value) const {
+  const auto& definition = Require(column);
+
+  switch (definition.type) {
+    case kColumnTypeInt:
+      switch (value.size()) {
+        case 1:
+          return static_cast<int8_t>(value[0]);
+
+        case 2: {
+          int16_t result;
+          memcpy(&result, value.data(), sizeof(result));
+          return result;
+        }
+
+        case 4: {
+          int32_t result;
+          memcpy(&result, value.data(), sizeof(result));
+          return result;
+        }
+
+        case 8: {
+          int64_t result;
+          memcpy(&result, value.data(), sizeof(result));
+          return result;
+        }
+
+        default:
+          KJ_FAIL_REQUIRE("Unexpected integer size", column, value.size());
+      }
+
+    case kColumnTypeString:
+      return StringToInt64(value.str().c_str());
+
+    default:
+      KJ_FAIL_REQUIRE("Column is not an integer", column, definition.type);
+  }
+}
+
+double ColumnFileSchema::GetFloat(uint32_t column,
+                                  const StringRef& value) const {
+  const auto& definition = Require(column);
+
+  switch (definition.type) {
+    case kColumnTypeFloat:
+      if (value.size() == sizeof(float)) {
+        float result;
+        memcpy(&result, value.data(), sizeof(result));
+        return result;
+      } else {
+        KJ_REQUIRE(value.size() == sizeof(double), column, value.size());
+        double result;
+        memcpy(&result, value.data(), sizeof(result));
+        return result;
+      }
+
+    case kColumnTypeInt:
+      return GetInt(column, value);
+
+    case kColumnTypeString:
+      return StringToDouble(value.str().c_str());
+
+    case kColumnTypeFloatArray: {
+      const auto values = GetFloatArray(column, value);
+      KJ_REQUIRE(values.size() == 1, column, values.size());
+      return values[0];
+    }
+
+    default:
+      KJ_FAIL_REQUIRE("Column is not numeric", column, definition.type);
+  }
+}
+
+std::vector<double> ColumnFileSchema::GetFloatArray(
+    uint32_t column, const StringRef& value) const {
+  const auto& definition = Require(column);
+
+  switch (definition.type) {
+    case kColumnTypeFloatArray: {
+      std::vector<double> result;
+
+      const auto str = value.str();
+      auto begin = str.c_str();
+
+      for (;;) {
+        char* end = nullptr;
+        result.emplace_back(strtod(begin, &end));
+        KJ_REQUIRE(end != begin, "Expected number", column, str);
+        if (!*end) break;
+        KJ_REQUIRE(*end == ',', "Expected comma", column, str);
+        begin = end + 1;
+      }
+
+      return result;
+    }
+
+    case kColumnTypeFloat:
+    case kColumnTypeInt:
+      return {GetFloat(column, value)};
+
+    default:
+      KJ_FAIL_REQUIRE("Column is not numeric", column, definition.type);
+  }
+}
+
+}  // namespace ev
@@ -1,5 +1,11 @@
 #include "base/columnfile.h"
 
+#include <regex>
+#include <unordered_set>
+
+#include "base/columnfile-internal.h"
+#include "base/string.h"
+
 namespace ev {
 
 ColumnFileSelect::ColumnFileSelect(ColumnFileReader input)
@@ -9,11 +15,20 @@ void ColumnFileSelect::AddSelection(uint32_t field) {
   selection_.emplace(field);
 }
 
+void ColumnFileSelect::AddSelection(const StringRef& name) {
+  AddSelection(input_.Schema().ColumnId(name));
+}
+
 void ColumnFileSelect::AddFilter(
     uint32_t field, Delegate<bool(const StringRefOrNull&)> filter) {
   filters_.emplace_back(field, std::move(filter));
 }
 
+void ColumnFileSelect::AddFilter(
+    const StringRef& name, Delegate<bool(const StringRefOrNull&)> filter) {
+  AddFilter(input_.Schema().ColumnId(name), std::move(filter));
+}
+
 void ColumnFileSelect::Execute(
     ev::concurrency::RegionPool& region_pool,
     Delegate<void(const std::vector<std::pair<uint32_t, StringRefOrNull>>&)>
@@ -72,21 +87,19 @@ void ColumnFileSelect::Execute(
       auto in = selected_rows.begin();
       auto out = selected_rows.begin();
 
-      // Iterate over all values in the current segment for the current column.
-      for (uint32_t row_idx = 0; !input_.EndOfSegment(); ++row_idx) {
-        auto row = input_.GetRow();
+      // Iterate over all runs of values in the current segment for the current
+      // column.  The filters are evaluated once per run.
+      uint32_t row_idx = 0;
+      ev::StringRefOrNull value = nullptr;
 
-        if (filter_idx > 0) {
-          // Is row already filtered?
-          if (row_idx < in->index) continue;
-
-          KJ_ASSERT(in->index == row_idx);
-        }
+      while (const auto count = input_.GetRun(field, value)) {
+        const auto run_end = row_idx + count;
 
-        ev::StringRefOrNull value = nullptr;
-        if (row.size() == 1) {
-          KJ_ASSERT(row[0].first == field, row[0].first, field);
-          value = row[0].second;
+        // Skip runs where every row is already filtered.
+        if (filter_idx > 0 &&
+            (in == selected_rows.end() || in->index >= run_end)) {
+          row_idx = run_end;
+          continue;
         }
 
         bool match = true;
@@ -98,34 +111,31 @@ void ColumnFileSelect::Execute(
           }
         }
 
-        if (match) {
-          if (filter_idx == 0) {
+        if (match && filter_selected && !value.IsNull())
+          value = value.StringRef().dup(region);
+
+        if (filter_idx == 0) {
+          for (auto i = row_idx; match && i != run_end; ++i) {
             RowCache row_cache;
-            row_cache.index = row_idx;
+            row_cache.index = i;
 
-            if (filter_selected) {
-              if (value.IsNull())
-                row_cache.data.emplace_back(field, nullptr);
-              else
-                row_cache.data.emplace_back(field,
-                                            value.StringRef().dup(region));
-            }
+            if (filter_selected) row_cache.data.emplace_back(field, value);
 
             selected_rows.emplace_back(std::move(row_cache));
-          } else {
+          }
+        } else {
+          for (; in != selected_rows.end() && in->index < run_end; ++in) {
+            if (!match) continue;
+
             if (out != in) *out = std::move(*in);
 
-            if (filter_selected) {
-              if (value.IsNull())
-                out->data.emplace_back(field, nullptr);
-              else
-                out->data.emplace_back(field, value.StringRef().dup(region));
-            }
+            if (filter_selected) out->data.emplace_back(field, value);
 
             ++out;
-            ++in;
           }
         }
+
+        row_idx = run_end;
       }
 
       if (filter_idx > 0) selected_rows.erase(out, selected_rows.end());
@@ -175,4 +185,130 @@ void ColumnFileSelect::Execute(
   }
 }
 
+void ColumnFileSelect::Sample(
+    size_t count,
+    Delegate<void(const std::vector<std::pair<uint32_t, StringRefOrNull>>&)>
+        callback,
+    std::mt19937_64& rng) {
+  // Ranges of rows passing all filters so far.
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  ranges.emplace_back(0, input_.RowCount());
+
+  for (const auto& filter : filters_) {
+    const auto& function = filter.second;
+    const auto matches = ColumnFileFilterRuns(
+        input_, filter.first,
+        [&function](const StringRefOrNull& value) { return function(value); });
+
+    std::vector<std::pair<uint64_t, uint64_t>> intersection;
+    auto i = ranges.begin();
+    auto j = matches.begin();
+
+    while (i != ranges.end() && j != matches.end()) {
+      const auto begin = std::max(i->first, j->first);
+      const auto end = std::min(i->second, j->second);
+      if (begin < end) intersection.emplace_back(begin, end);
+
+      if (i->second < j->second)
+        ++i;
+      else
+        ++j;
+    }
+
+    ranges.swap(intersection);
+  }
+
+  uint64_t total = 0;
+  for (const auto& range : ranges) total += range.second - range.first;
+
+  // Map the sampled indexes in the concatenated ranges to row numbers.
+  auto rows = columnfile_internal::SampleIndexes(total, count, rng);
+  auto range = ranges.begin();
+  uint64_t range_offset = 0;
+
+  for (auto& row : rows) {
+    while (row - range_offset >= range->second - range->first) {
+      range_offset += range->second - range->first;
+      ++range;
+    }
+
+    row = range->first + (row - range_offset);
+  }
+
+  input_.SetColumnFilter(selection_.begin(), selection_.end());
+  input_.ReadRows(rows, std::move(callback));
+}
+
+Delegate<bool(const StringRefOrNull&)> ColumnFilePrefixFilter(
+    std::string prefix) {
+  return [prefix = std::move(prefix)](const StringRefOrNull& value) {
+    return !value.IsNull() && HasPrefix(value.StringRef(), prefix);
+  };
+}
+
+Delegate<bool(const StringRefOrNull&)> ColumnFileRegexFilter(
+    const char* pattern) {
+  // Shared, since delegates are copied.
+  auto regex = std::make_shared<const std::regex>(pattern);
+
+  return [regex](const StringRefOrNull& value) {
+    if (value.IsNull()) return false;
+
+    const auto str = value.StringRef();
+    return std::regex_search(str.begin(), str.end(), *regex);
+  };
+}
+
+Delegate<bool(const StringRefOrNull&)> ColumnFileRangeFilter(
+    const ColumnFileSchema& schema, uint32_t column, double min, double max) {
+  const auto definition = schema.Find(column);
+  KJ_REQUIRE(definition && (definition->type == kColumnTypeInt ||
+                            definition->type == kColumnTypeFloat),
+             "Range filters on numbers need a numeric column", column);
+
+  return [schema, column, min, max](const StringRefOrNull& value) {
+    if (value.IsNull()) return false;
+
+    const auto number = schema.GetFloat(column, value.StringRef());
+    return number >= min && number <= max;
+  };
+}
+
+Delegate<bool(const StringRefOrNull&)> ColumnFileRangeFilter(std::string min,
+                                                             std::string max) {
+  return [ min = std::move(min), max = std::move(max) ](
+      const StringRefOrNull& value) {
+    if (value.IsNull()) return false;
+
+    const auto str = value.StringRef();
+    return StringRef(min) <= str && str <= StringRef(max);
+  };
+}
+
+Delegate<bool(const StringRefOrNull&)> ColumnFileInFilter(
+    const std::vector<std::string>& values) {
+  auto set = std::make_shared<const std::unordered_set<std::string>>(
+      values.begin(), values.end());
+
+  return [set](const StringRefOrNull& value) {
+    return !value.IsNull() && set->count(value.StringRef().str());
+  };
+}
+
+Delegate<bool(const StringRefOrNull&)> ColumnFileInFilter(
+    const ColumnFileSchema& schema, uint32_t column,
+    const std::vector<int64_t>& values) {
+  const auto definition = schema.Find(column);
+  KJ_REQUIRE(definition && definition->type == kColumnTypeInt,
+             "Integer set filters need an integer column", column);
+
+  auto set = std::make_shared<const std::unordered_set<int64_t>>(
+      values.begin(), values.end());
+
+  return [schema, column, set](const StringRefOrNull& value) {
+    return !value.IsNull() &&
+           set->count(schema.GetInt(column, value.StringRef()));
+  };
+}
+
 }  // namespace ev
@@ -0,0 +1,394 @@
+#include "base/columnfile.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+#include <unistd.h>
+
+#include <kj/debug.h>
+
+#include "base/file.h"
+
+namespace ev {
+
+namespace {
+
+typedef std::vector<std::pair<uint32_t, StringRefOrNull>> Row;
+
+// Maximum number of runs merged into a single file.
+const size_t kMergeFanIn = 16;
+
+// Segments written by the sort are flushed when they reach this size.
+const size_t kSegmentSize = 16 << 20;
+
+// Size of the regions holding run data, in pages.  Runs larger than this
+// overflow to the heap.
+const size_t kRegionPages = 256;
+
+struct SortKey {
+  uint32_t field;
+  bool descending;
+  ColumnType type;
+};
+
+// A key value, decoded so that it can be compared quickly.
+struct KeyValue {
+  bool is_null = true;
+  int64_t int_value = 0;
+  double float_value = 0;
+  StringRef string_value;
+};
+
+// Rows read from the input, held until they are sorted and written.
+struct Run {
+  concurrency::RegionPool::Region region;
+
+  // The values of all rows, concatenated.
+  Row values;
+
+  // Offset of each row in `values`, plus the end offset.
+  std::vector<size_t> row_offsets = {0};
+
+  // The decoded keys of all rows, concatenated.
+  std::vector<KeyValue> keys;
+
+  // Approximate number of bytes held.
+  size_t size = 0;
+
+  size_t RowCount() const { return row_offsets.size() - 1; }
+};
+
+void DecodeKeys(const std::vector<SortKey>& keys,
+                const ColumnFileSchema& schema, Row::const_iterator begin,
+                Row::const_iterator end, KeyValue* output) {
+  for (const auto& key : keys) {
+    auto& value = *output++;
+    value = KeyValue();
+
+    const auto i = std::lower_bound(
+        begin, end, key.field,
+        [](const auto& field, uint32_t id) { return field.first < id; });
+
+    if (i == end || i->first != key.field || i->second.IsNull()) continue;
+
+    value.is_null = false;
+
+    switch (key.type) {
+      case kColumnTypeInt:
+        value.int_value = schema.GetInt(key.field, i->second.StringRef());
+        break;
+
+      case kColumnTypeFloat:
+        value.float_value = schema.GetFloat(key.field, i->second.StringRef());
+        break;
+
+      default:
+        value.string_value = i->second.StringRef();
+        break;
+    }
+  }
+}
+
+// Returns a negative number if `lhs` sorts before `rhs`, a positive number if
+// it sorts after, and zero if the keys are equal.
+int CompareKeys(const std::vector<SortKey>& keys, const KeyValue* lhs,
+                const KeyValue* rhs) {
+  for (const auto& key : keys) {
+    const auto& a = *lhs++;
+    const auto& b = *rhs++;
+
+    int result;
+
+    if (a.is_null || b.is_null) {
+      result = static_cast<int>(b.is_null) - static_cast<int>(a.is_null);
+    } else {
+      switch (key.type) {
+        case kColumnTypeInt:
+          result = (b.int_value < a.int_value) - (a.int_value < b.int_value);
+          break;
+
+        case kColumnTypeFloat:
+          result = (b.float_value < a.float_value) -
+                   (a.float_value < b.float_value);
+          break;
+
+        default:
+          result = (b.string_value < a.string_value) -
+                   (a.string_value < b.string_value);
+          break;
+      }
+    }
+
+    if (result) return key.descending ? -result : result;
+  }
+
+  return 0;
+}
+
+// Writes a row containing every field in `fields`, using NULL for the fields
+// missing from `row`.  Every row of a column file segment must cover the same
+// fields for the fields to stay aligned when read back.
+void PutPaddedRow(ColumnFileWriter& output, const std::vector<uint32_t>& fields,
+                  Row::const_iterator begin, Row::const_iterator end,
+                  Row& buffer) {
+  buffer.clear();
+
+  for (const auto field : fields) {
+    if (begin != end && begin->first == field)
+      buffer.emplace_back(*begin++);
+    else
+      buffer.emplace_back(field, nullptr);
+  }
+
+  output.PutRow(buffer);
+
+  if (output.PendingSize() >= kSegmentSize) output.Flush();
+}
+
+void SortRun(const std::vector<SortKey>& keys,
+             const std::vector<uint32_t>& fields, const Run& run,
+             ColumnFileWriter& output) {
+  std::vector<size_t> order(run.RowCount());
+  for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+
+  const auto key_count = keys.size();
+
+  std::stable_sort(order.begin(), order.end(),
+                   [&keys, &run, key_count](size_t lhs, size_t rhs) {
+                     return CompareKeys(keys, &run.keys[lhs * key_count],
+                                        &run.keys[rhs * key_count]) < 0;
+                   });
+
+  Row buffer;
+
+  for (const auto i : order) {
+    PutPaddedRow(output, fields, run.values.begin() + run.row_offsets[i],
+                 run.values.begin() + run.row_offsets[i + 1], buffer);
+  }
+}
+
+// Opens a temporary file, and calls `write` to fill it.  Returns the file
+// positioned at its start.
+template <typename Function>
+kj::AutoCloseFd WriteTemporary(const std::string& directory,
+                               Function&& write) {
+  ColumnFileWriter output(
+      AnonTemporaryFile(directory.empty() ? nullptr : directory.c_str()));
+  write(output);
+
+  auto fd = output.Finalize();
+  KJ_SYSCALL(lseek(fd, 0, SEEK_SET));
+
+  return fd;
+}
+
+// Merges sorted column files into `output`.  Ties are broken by input order,
+// so that the merge is stable.
+void MergeRuns(const std::vector<SortKey>& keys,
+               const ColumnFileSchema& schema,
+               const std::vector<uint32_t>& fields,
+               std::vector<kj::AutoCloseFd> runs, ColumnFileWriter& output) {
+  struct MergeInput {
+    MergeInput(kj::AutoCloseFd&& fd) : reader(std::move(fd)) {}
+
+    ColumnFileReader reader;
+    Row row;
+    std::vector<KeyValue> keys;
+  };
+
+  std::vector<std::unique_ptr<MergeInput>> inputs;
+  std::vector<size_t> heap;
+
+  const auto advance = [&keys, &schema, &inputs](size_t index) {
+    auto& input = *inputs[index];
+    if (input.reader.End()) return false;
+
+    input.row = input.reader.GetRow();
+    DecodeKeys(keys, schema, input.row.begin(), input.row.end(),
+               input.keys.data());
+
+    return true;
+  };
+
+  // Orders the heap so that the smallest row is at the front.
+  const auto heap_order = [&keys, &inputs](size_t lhs, size_t rhs) {
+    const auto result =
+        CompareKeys(keys, inputs[lhs]->keys.data(), inputs[rhs]->keys.data());
+    return result ? (result > 0) : (lhs > rhs);
+  };
+
+  for (auto& run : runs) {
+    inputs.emplace_back(std::make_unique<MergeInput>(std::move(run)));
+    inputs.back()->keys.resize(keys.size());
+
+    if (advance(inputs.size() - 1)) heap.emplace_back(inputs.size() - 1);
+  }
+
+  std::make_heap(heap.begin(), heap.end(), heap_order);
+
+  Row buffer;
+
+  while (!heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end(), heap_order);
+    const auto index = heap.back();
+    heap.pop_back();
+
+    const auto& row = inputs[index]->row;
+    PutPaddedRow(output, fields, row.begin(), row.end(), buffer);
+
+    if (advance(index)) {
+      heap.emplace_back(index);
+      std::push_heap(heap.begin(), heap.end(), heap_order);
+    }
+  }
+}
+
+}  // namespace
+
+ColumnFileSort::ColumnFileSort(ColumnFileReader input)
+    : input_(std::move(input)) {}
+
+void ColumnFileSort::AddKey(uint32_t field, bool descending) {
+  keys_.emplace_back(field, descending);
+}
+
+void ColumnFileSort::AddKey(const StringRef& name, bool descending) {
+  AddKey(input_.Schema().ColumnId(name), descending);
+}
+
+void ColumnFileSort::Execute(ThreadPool& thread_pool,
+                             ColumnFileWriter& output) {
+  KJ_REQUIRE(!keys_.empty(), "No sort keys");
+
+  const auto& schema = input_.Schema();
+  output.SetSchema(schema);
+
+  std::vector<SortKey> keys;
+  for (const auto& key : keys_) {
+    const auto column = schema.Find(key.first);
+    keys.push_back(SortKey{key.first, key.second,
+                           column ? column->type : kColumnTypeBinary});
+  }
+
+  // One region for each run being spilled, and one for the run being read.
+  // Reading blocks until a region is free, which limits memory use.
+  concurrency::RegionPool region_pool(thread_pool.Size() + 1, kRegionPages);
+
+  // Fields present in any row.  Runs are written with the fields seen so far,
+  // and padded to the full set when merged.
+  std::unordered_set<uint32_t> field_set;
+  std::vector<uint32_t> fields;
+
+  const auto update_fields = [&field_set, &fields] {
+    fields.assign(field_set.begin(), field_set.end());
+    std::sort(fields.begin(), fields.end());
+  };
+
+  std::vector<std::future<kj::AutoCloseFd>> spilled;
+  std::vector<std::future<kj::AutoCloseFd>> merged;
+
+  Run run;
+  run.region = region_pool.GetRegion();
+
+  const auto spill = [this, &thread_pool, &keys, &schema, &fields, &run] {
+    return thread_pool.Launch(
+        [this, &keys, &schema, fields, run = std::move(run)]() mutable {
+          return WriteTemporary(temporary_directory_,
+                                [&](ColumnFileWriter& output) {
+                                  output.SetSchema(schema);
+                                  SortRun(keys, fields, run, output);
+                                });
+        });
+  };
+
+  try {
+    while (!input_.End()) {
+      const auto row_begin = run.values.size();
+
+      for (const auto& value : input_.GetRow()) {
+        field_set.emplace(value.first);
+
+        if (value.second.IsNull()) {
+          run.values.emplace_back(value.first, nullptr);
+        } else {
+          run.values.emplace_back(value.first,
+                                  value.second.StringRef().dup(run.region));
+          run.size += value.second.StringRef().size();
+        }
+      }
+
+      run.row_offsets.emplace_back(run.values.size());
+      run.keys.resize(run.keys.size() + keys.size());
+      DecodeKeys(keys, schema, run.values.begin() + row_begin,
+                 run.values.end(), &run.keys[run.keys.size() - keys.size()]);
+
+      run.size += sizeof(Row::value_type) * (run.values.size() - row_begin) +
+                  sizeof(KeyValue) * keys.size() + sizeof(size_t);
+
+      if (run.size < run_size_) continue;
+
+      update_fields();
+      spilled.emplace_back(spill());
+
+      run = Run();
+      run.region = region_pool.GetRegion();
+    }
+
+    update_fields();
+
+    // Everything fit in a single run, so no temporary files are needed.
+    if (spilled.empty()) {
+      SortRun(keys, fields, run, output);
+      return;
+    }
+
+    spilled.emplace_back(spill());
+
+    // Merge groups of runs in parallel until few enough remain for a single
+    // merge into the output.
+    while (spilled.size() > kMergeFanIn) {
+      for (size_t i = 0; i < spilled.size(); i += kMergeFanIn) {
+        std::vector<kj::AutoCloseFd> group;
+        for (size_t j = i; j < std::min(i + kMergeFanIn, spilled.size()); ++j)
+          group.emplace_back(spilled[j].get());
+
+        if (group.size() == 1) {
+          std::promise<kj::AutoCloseFd> promise;
+          promise.set_value(std::move(group[0]));
+          merged.emplace_back(promise.get_future());
+          continue;
+        }
+
+        merged.emplace_back(thread_pool.Launch([
+          this, &keys, &schema, &fields, group = std::move(group)
+        ]() mutable {
+          return WriteTemporary(temporary_directory_,
+                                [&](ColumnFileWriter& output) {
+                                  output.SetSchema(schema);
+                                  MergeRuns(keys, schema, fields,
+                                            std::move(group), output);
+                                });
+        }));
+      }
+
+      spilled.clear();
+      spilled.swap(merged);
+    }
+
+    std::vector<kj::AutoCloseFd> runs;
+    for (auto& task : spilled) runs.emplace_back(task.get());
+
+    MergeRuns(keys, schema, fields, std::move(runs), output);
+  } catch (...) {
+    // Running tasks refer to the region pool and to local variables.
+    for (auto& task : spilled) {
+      if (task.valid()) task.wait();
+    }
+    for (auto& task : merged) {
+      if (task.valid()) task.wait();
+    }
+    throw;
+  }
+}
+
+}  // namespace ev
@@ -1,5 +1,8 @@
 #include "base/columnfile.h"
 
+#include <cstring>
+#include <unordered_set>
+
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -28,10 +31,13 @@ class ColumnFileFdOutput : public ColumnFileOutput {
   }
 
   void Flush(const std::vector<std::pair<uint32_t, ev::StringRef>>& fields,
-             ColumnFileCompression& compression) override;
+             ColumnFileCompression& compression,
+             const ev::StringRef& extensions) override;
 
   kj::AutoCloseFd Finalize() override { return std::move(fd_); }
 
+  void Sync() override { KJ_SYSCALL(fdatasync(fd_)); }
+
  private:
   kj::AutoCloseFd fd_;
 };
@@ -43,7 +49,8 @@ class ColumnFileStringOutput : public ColumnFileOutput {
   }
 
   void Flush(const std::vector<std::pair<uint32_t, ev::StringRef>>& fields,
-             ColumnFileCompression& compression) override;
+             ColumnFileCompression& compression,
+             const ev::StringRef& extensions) override;
 
   kj::AutoCloseFd Finalize() override { return nullptr; }
 
@@ -53,57 +60,114 @@ class ColumnFileStringOutput : public ColumnFileOutput {
 
 void ColumnFileFdOutput::Flush(
     const std::vector<std::pair<uint32_t, ev::StringRef>>& fields,
-    ColumnFileCompression& compression) {
-  std::string buffer;
-  buffer.resize(4, 0);
-
-  PutUInt(buffer, compression);
-  PutUInt(buffer, fields.size());
-
-  for (auto& field : fields) {
-    PutUInt(buffer, field.first);
-    PutUInt(buffer, field.second.size());
-  }
-
-  auto buffer_size = buffer.size() - 4;  // Don't count the size itself.
-  buffer[0] = buffer_size >> 24U;
-  buffer[1] = buffer_size >> 16U;
-  buffer[2] = buffer_size >> 8U;
-  buffer[3] = buffer_size;
-
-  WriteAll(fd_, buffer);
+    ColumnFileCompression& compression, const ev::StringRef& extensions) {
+  WriteAll(fd_, BuildSegmentHeader(fields, compression, extensions));
 
   for (const auto& field : fields) WriteAll(fd_, field.second);
 }
 
 void ColumnFileStringOutput::Flush(
     const std::vector<std::pair<uint32_t, ev::StringRef>>& fields,
-    ColumnFileCompression& compression) {
-  std::string buffer;
-  buffer.resize(4, 0);
+    ColumnFileCompression& compression, const ev::StringRef& extensions) {
+  output_ += BuildSegmentHeader(fields, compression, extensions);
 
-  PutUInt(buffer, compression);
-  PutUInt(buffer, fields.size());
+  for (const auto& field : fields)
+    output_.append(field.second.begin(), field.second.end());
+}
 
-  for (auto& field : fields) {
-    PutUInt(buffer, field.first);
-    PutUInt(buffer, field.second.size());
-  }
+// Returns the offset of the end of the last complete segment in the file, or
+// of the last checkpoint if there is one, and stores the names of non-empty
+// checkpoints in `checkpoints`.
+off_t FindCheckpointedEnd(int fd, off_t file_size,
+                          std::vector<std::string>& checkpoints) {
+  off_t offset = sizeof(kMagic);
+  off_t complete_end = offset;
+  off_t checkpoint_end = 0;
+
+  std::string header_data;
+  SegmentHeader header;
+
+  while (offset + 4 <= file_size) {
+    uint8_t size_buffer[4];
+    PRead(fd, size_buffer, sizeof(size_buffer), offset);
+
+    // The smallest valid header holds the compression and a field count.
+    const auto header_size = GetHeaderSize(size_buffer);
+    if (header_size < 2 || offset + 4 + header_size > file_size) break;
+
+    // Torn headers may contain anything, so leave room for `GetUInt()` to
+    // read past the end.
+    header_data.assign(header_size + 8, 0);
+    PRead(fd, &header_data[0], header_size, offset + 4);
+
+    try {
+      ParseSegmentHeader(StringRef(header_data.data(), header_size), header);
+    } catch (kj::Exception e) {
+      break;
+    }
 
-  auto buffer_size = buffer.size() - 4;  // Don't count the size itself.
-  buffer[0] = buffer_size >> 24U;
-  buffer[1] = buffer_size >> 16U;
-  buffer[2] = buffer_size >> 8U;
-  buffer[3] = buffer_size;
+    const auto end = offset + 4 + header_size + header.data_size;
+    if (end > static_cast<uint64_t>(file_size)) break;
 
-  output_ += buffer;
+    offset = end;
+    complete_end = end;
 
-  for (const auto& field : fields)
-    output_.append(field.second.begin(), field.second.end());
+    if (header.is_checkpoint) {
+      for (const auto& name : header.checkpoints) {
+        if (!name.empty()) checkpoints.emplace_back(name.str());
+      }
+      checkpoint_end = end;
+    }
+  }
+
+  return checkpoint_end ? checkpoint_end : complete_end;
 }
 
 }  // namespace
 
+std::unique_ptr<ColumnFileOutput> ColumnFileWriter::CheckpointedOutput(
+    const char* path, std::vector<std::string>& checkpoints, int mode) {
+  auto fd = OpenFile(path, O_CREAT | O_RDWR, mode);
+
+  off_t file_size;
+  KJ_SYSCALL(file_size = lseek(fd, 0, SEEK_END));
+
+  checkpoints.clear();
+
+  if (file_size < static_cast<off_t>(sizeof(kMagic))) {
+    // A new file, or one whose creation was interrupted.  Start it with an
+    // unnamed checkpoint, so that data from an interrupted first run is
+    // discarded too.
+    KJ_SYSCALL(ftruncate(fd, 0));
+    KJ_SYSCALL(lseek(fd, 0, SEEK_SET));
+
+    auto output = std::make_unique<ColumnFileFdOutput>(std::move(fd));
+
+    std::string extensions;
+    PutHeaderExtension(extensions, kHeaderExtensionCheckpoint, StringRef());
+
+    auto compression = kColumnFileCompressionNone;
+    output->Flush({}, compression, extensions);
+    output->Sync();
+
+    return std::move(output);
+  }
+
+  char magic[sizeof(kMagic)];
+  PRead(fd, magic, sizeof(magic), 0);
+  KJ_REQUIRE(!memcmp(magic, kMagic, sizeof(kMagic)), "Not a column file",
+             path);
+
+  const auto end = FindCheckpointedEnd(fd, file_size, checkpoints);
+
+  if (end != file_size) {
+    KJ_SYSCALL(ftruncate(fd, end), path);
+    KJ_SYSCALL(fdatasync(fd), path);
+  }
+
+  return std::make_unique<ColumnFileFdOutput>(std::move(fd));
+}
+
 ColumnFileWriter::ColumnFileWriter(std::shared_ptr<ColumnFileOutput> output)
     : output_(std::move(output)) {}
 
@@ -124,6 +188,17 @@ ColumnFileWriter::ColumnFileWriter(std::string& output) {
 
 ColumnFileWriter::~ColumnFileWriter() { Finalize(); }
 
+void ColumnFileWriter::SetSchema(ColumnFileSchema schema) {
+  schema_ = std::move(schema);
+  schema_dirty_ = true;
+}
+
+void ColumnFileWriter::AddColumn(uint32_t id, std::string name,
+                                 ColumnType type, uint32_t dicom_tag) {
+  schema_.AddColumn(id, std::move(name), type, dicom_tag);
+  schema_dirty_ = true;
+}
+
 void ColumnFileWriter::Put(uint32_t column, const StringRef& data) {
   fields_[column].Put(data);
   pending_size_ += data.size();
@@ -164,23 +239,83 @@ void ColumnFileWriter::PutRow(
 }
 
 void ColumnFileWriter::Flush() {
+  if (schema_dirty_) {
+    std::string schema_data;
+    schema_.Serialize(schema_data);
+
+    std::string extensions;
+    PutHeaderExtension(extensions, kHeaderExtensionSchema, schema_data);
+
+    auto compression = kColumnFileCompressionNone;
+    output_->Flush({}, compression, extensions);
+
+    schema_dirty_ = false;
+  }
+
   if (fields_.empty()) return;
 
   std::vector<std::pair<uint32_t, ev::StringRef>> field_data;
   field_data.reserve(fields_.size());
 
+  uint32_t row_count = 0;
+
   for (auto& field : fields_) {
     field.second.Finalize(compression_);
     field_data.emplace_back(field.first, field.second.Data());
+    row_count = std::max(row_count, field.second.Count());
   }
 
-  output_->Flush(field_data, compression_);
+  std::string row_count_data;
+  PutUInt(row_count_data, row_count);
+
+  std::string extensions;
+  PutHeaderExtension(extensions, kHeaderExtensionRowCount, row_count_data);
+
+  output_->Flush(field_data, compression_, extensions);
 
   fields_.clear();
 
   pending_size_ = 0;
 }
 
+std::vector<std::string> ColumnFileWriter::PendingInputs(
+    const std::vector<std::string>& inputs,
+    const std::vector<std::string>& checkpoints) {
+  std::unordered_set<std::string> seen(checkpoints.begin(), checkpoints.end());
+  std::vector<std::string> result;
+
+  for (const auto& input : inputs) {
+    if (seen.emplace(input).second) result.emplace_back(input);
+  }
+
+  return result;
+}
+
+void ColumnFileWriter::Checkpoint(const StringRef& name) {
+  Checkpoint(std::vector<std::string>{name.str()});
+}
+
+void ColumnFileWriter::Checkpoint(const std::vector<std::string>& names) {
+  Flush();
+
+  // The data must be on disk before the checkpoint is, or a crash could leave
+  // a checkpoint after incomplete data.
+  output_->Sync();
+
+  std::string extensions;
+  for (const auto& name : names)
+    PutHeaderExtension(extensions, kHeaderExtensionCheckpoint, name);
+
+  // An empty list still marks the end of the data written so far.
+  if (names.empty())
+    PutHeaderExtension(extensions, kHeaderExtensionCheckpoint, StringRef());
+
+  auto compression = kColumnFileCompressionNone;
+  output_->Flush({}, compression, extensions);
+
+  output_->Sync();
+}
+
 kj::AutoCloseFd ColumnFileWriter::Finalize() {
   if (!output_) return nullptr;
   Flush();
@@ -215,6 +350,7 @@ void ColumnFileWriter::FieldWriter::Put(const StringRef& data) {
   }
 
   ++repeat_;
+  ++count_;
 }
 
 void ColumnFileWriter::FieldWriter::PutNull() {
@@ -222,6 +358,7 @@ void ColumnFileWriter::FieldWriter::PutNull() {
 
   value_is_null_ = true;
   ++repeat_;
+  ++count_;
 }
 
 void ColumnFileWriter::FieldWriter::Flush() {
@@ -343,6 +480,11 @@ void ColumnFileWriter::FieldWriter::Finalize(
       data_.swap(compressed_data);
     } break;
 
+    case kColumnFileCompressionPixel16: {
+      auto compressed_data = CompressPixel16(data_);
+      data_.swap(compressed_data);
+    } break;
+
     default:
       KJ_FAIL_REQUIRE("Unknown compression scheme", compression);
   }
@@ -1,15 +1,24 @@
 #ifndef BASE_COLUMNFILE_H_
 #define BASE_COLUMNFILE_H_ 1
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <kj/debug.h>
 #include <kj/io.h>
 
 #include "base/delegate.h"
+#include "base/random.h"
 #include "base/region.h"
 #include "base/stringref.h"
 #include "base/thread-pool.h"
@@ -49,19 +58,107 @@ enum ColumnFileCompression : uint32_t {
   kColumnFileCompressionLZ4 = 2,
   kColumnFileCompressionLZMA = 3,
   kColumnFileCompressionZLIB = 4,
+
+  // Predictive coding of 16 bit images, for fields such as raw pixel data.
+  // Other fields are compressed with LZ4.
+  kColumnFileCompressionPixel16 = 5,
+};
+
+// Logical types of column values.  The file format stores every value as a
+// byte string; the type only tells readers how to decode it.
+enum ColumnType : uint32_t {
+  kColumnTypeBinary = 0,
+  kColumnTypeString = 1,
+
+  // Little-endian two's complement integer, 1, 2, 4 or 8 bytes wide.
+  kColumnTypeInt = 2,
+
+  // IEEE 754 floating point number, 4 or 8 bytes wide.
+  kColumnTypeFloat = 3,
+
+  // Comma separated decimal numbers, the way DICOM "DS" values are stored.
+  kColumnTypeFloatArray = 4,
+};
+
+// Returns the name of a column type, e.g. "float-array".
+const char* ColumnTypeName(ColumnType type);
+
+// Returns the column type with the given name.  Throws if the name is unknown.
+ColumnType ColumnTypeFromName(const StringRef& name);
+
+struct ColumnFileColumn {
+  uint32_t id = 0;
+
+  std::string name;
+
+  ColumnType type = kColumnTypeBinary;
+
+  // The DICOM tag (group << 16 | element) the column was read from, or 0 if
+  // the column is not derived from a DICOM tag.
+  uint32_t dicom_tag = 0;
+};
+
+// Describes the columns of a column file.  Files may embed a schema, but are
+// not required to.
+class ColumnFileSchema {
+ public:
+  // Adds a column, replacing any existing definition with the same id.
+  void AddColumn(uint32_t id, std::string name, ColumnType type,
+                 uint32_t dicom_tag = 0);
+
+  bool Empty() const { return columns_.empty(); }
+
+  // Returns all columns, ordered by id.
+  const std::vector<ColumnFileColumn>& Columns() const { return columns_; }
+
+  // Returns the column with the given id, name or DICOM tag, or nullptr if no
+  // such column exists.
+  const ColumnFileColumn* Find(uint32_t id) const;
+  const ColumnFileColumn* Find(const StringRef& name) const;
+  const ColumnFileColumn* FindDICOMTag(uint32_t dicom_tag) const;
+
+  // Returns the id of the column with the given name.  Throws if no such
+  // column exists.
+  uint32_t ColumnId(const StringRef& name) const;
+
+  // Adds all columns from `other`, replacing any existing definitions.
+  void Merge(const ColumnFileSchema& other);
+
+  void Serialize(std::string& output) const;
+
+  static ColumnFileSchema Parse(StringRef data);
+
+  // Decodes a value of the given column, using the column's logical type to
+  // select a decoder.  Throws if the column is unknown, or if its type can't
+  // be converted to the requested type.
+  int64_t GetInt(uint32_t column, const StringRef& value) const;
+  double GetFloat(uint32_t column, const StringRef& value) const;
+  std::vector<double> GetFloatArray(uint32_t column,
+                                    const StringRef& value) const;
+
+ private:
+  const ColumnFileColumn& Require(uint32_t column) const;
+
+  std::vector<ColumnFileColumn> columns_;
 };
 
 class ColumnFileOutput {
  public:
   virtual ~ColumnFileOutput() noexcept(false) {}
 
+  // Writes a segment.  `extensions` holds optional segment header fields, in
+  // the format described in `columnfile-internal.h`.  Segments without any
+  // fields carry only file metadata, such as the schema.
   virtual void Flush(
       const std::vector<std::pair<uint32_t, ev::StringRef>>& fields,
-      ColumnFileCompression& compression) = 0;
+      ColumnFileCompression& compression, const ev::StringRef& extensions) = 0;
 
   // Finishes writing the file.  Returns the underlying file descriptor, if
   // available.
   virtual kj::AutoCloseFd Finalize() = 0;
+
+  // Waits until all segments written so far are on stable storage.
+  virtual void Sync() {}
 };
 
 class ColumnFileWriter {
@@ -76,8 +173,29 @@ class ColumnFileWriter {
 
   ~ColumnFileWriter();
 
+  // Opens the file at `path` for appending, creating it if necessary, and
+  // sets `checkpoints` to the names passed to `Checkpoint()` for the file,
+  // in order.
+  //
+  // Everything after the last checkpoint is truncated away, since it was
+  // written by an interrupted run.  If the file has no checkpoints, only a
+  // torn trailing segment is removed.  The schema is written again once
+  // `SetSchema()` or `AddColumn()` is called.
+  static std::unique_ptr<ColumnFileOutput> CheckpointedOutput(
+      const char* path, std::vector<std::string>& checkpoints,
+      int mode = 0666);
+
   void SetCompression(ColumnFileCompression c) { compression_ = c; }
 
+  // Replaces the schema embedded in the file.  The schema is written before
+  // the next segment, and may be extended at any time; readers merge all
+  // schema blocks in a file.
+  void SetSchema(ColumnFileSchema schema);
+
+  // Adds a column to the embedded schema.
+  void AddColumn(uint32_t id, std::string name, ColumnType type,
+                 uint32_t dicom_tag = 0);
+
   // Inserts a value.
   void Put(uint32_t column, const StringRef& data);
   void PutNull(uint32_t column);
@@ -92,6 +210,22 @@ class ColumnFileWriter {
   // Writes all buffered records to the output stream.
   void Flush();
 
+  // Returns the elements of `inputs` that are not among `checkpoints`, in
+  // order and without duplicates.  With one checkpoint per ingested input,
+  // these are the inputs still to be added to the file.
+  static std::vector<std::string> PendingInputs(
+      const std::vector<std::string>& inputs,
+      const std::vector<std::string>& checkpoints);
+
+  // Flushes all buffered records, and records a checkpoint named `name` once
+  // they are on stable storage.  See `CheckpointedOutput()`.
+  void Checkpoint(const StringRef& name);
+
+  // Records a single checkpoint for several inputs, such as the input files
+  // whose rows were added since the previous checkpoint.  This is cheaper
+  // than one checkpoint per input, since each checkpoint waits for the disk.
+  void Checkpoint(const std::vector<std::string>& names);
+
   // Finishes writing the file.  Returns the underlying file descriptor.
   //
   // This function is implicitly called by the destructor.
@@ -110,9 +244,14 @@ class ColumnFileWriter {
 
     StringRef Data() const { return data_; }
 
+    // Returns the number of values put into the field.
+    uint32_t Count() const { return count_; }
+
    private:
     std::string data_;
 
+    uint32_t count_ = 0;
+
     std::string value_;
     bool value_is_null_ = false;
 
@@ -128,6 +267,179 @@ class ColumnFileWriter {
   std::map<uint32_t, FieldWriter> fields_;
 
   size_t pending_size_ = 0;
+
+  ColumnFileSchema schema_;
+
+  // Set when `schema_` has changed since it was last written.
+  bool schema_dirty_ = false;
+};
+
+// Identifies the decompressed data of one field in one segment of a file.
+// Files are identified by device, inode, size and modification time, so that
+// a file replaced on disk gets new keys.
+struct ColumnFileCacheKey {
+  uint64_t device = 0;
+  uint64_t inode = 0;
+  uint64_t size = 0;
+  int64_t mtime_ns = 0;
+
+  // Offset of the segment header in the file.
+  uint64_t offset = 0;
+
+  uint32_t field = 0;
+
+  struct Hash {
+    size_t operator()(const ColumnFileCacheKey& key) const;
+  };
+
+  bool operator==(const ColumnFileCacheKey& rhs) const {
+    return device == rhs.device && inode == rhs.inode && size == rhs.size &&
+           mtime_ns == rhs.mtime_ns && offset == rhs.offset &&
+           field == rhs.field;
+  }
+};
+
+// Process-wide LRU cache of decompressed field data, used by
+// `ColumnFileReader` so that segments read again by another reader in the
+// same process are not decompressed again.  Entries are spread over shards
+// with separate locks, and each shard gets an equal part of the capacity.
+class ColumnFileCache {
+ public:
+  struct Statistics {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t insertions = 0;
+    uint64_t evictions = 0;
+
+    // Bytes of field data held.
+    size_t size = 0;
+  };
+
+  // The default capacity of the global cache.
+  static const size_t kDefaultCapacity = 256 << 20;
+
+  // Returns the cache used by all readers.
+  static ColumnFileCache& Global();
+
+  ColumnFileCache(size_t capacity);
+
+  KJ_DISALLOW_COPY(ColumnFileCache);
+
+  // Sets the number of bytes of field data held, evicting entries as needed.
+  // A capacity of zero disables the cache.
+  void SetCapacity(size_t capacity);
+
+  size_t Capacity() const { return capacity_; }
+
+  // Returns the data for `key`, or nullptr if it's not in the cache.
+  std::shared_ptr<const kj::Array<const char>> Find(
+      const ColumnFileCacheKey& key);
+
+  // Adds data to the cache.  Data larger than a shard's capacity is not
+  // cached.
+  void Insert(const ColumnFileCacheKey& key,
+              std::shared_ptr<const kj::Array<const char>> data);
+
+  // Removes all entries.  Readers holding data keep their references.
+  void Clear();
+
+  Statistics GetStatistics();
+
+ private:
+  static const size_t kShardCount = 16;
+
+  typedef std::list<std::pair<ColumnFileCacheKey,
+                              std::shared_ptr<const kj::Array<const char>>>>
+      EntryList;
+
+  struct Shard {
+    std::mutex mutex;
+
+    // Most recently used entries first.
+    EntryList entries;
+
+    std::unordered_map<ColumnFileCacheKey, EntryList::iterator,
+                       ColumnFileCacheKey::Hash>
+        index;
+
+    Statistics statistics;
+  };
+
+  Shard& ShardFor(const ColumnFileCacheKey& key);
+
+  // Evicts least recently used entries until the shard fits in its part of
+  // the capacity.  Requires the shard's lock to be held.
+  void Evict(Shard& shard);
+
+  std::atomic<size_t> capacity_;
+
+  Shard shards_[kShardCount];
+};
+
+// Returns the socket path of the `ColumnFileCacheServer` used by default:
+// $COLUMNFILE_CACHE_SOCKET if set, otherwise a per-user path in /tmp.
+std::string ColumnFileCacheSocketPath();
+
+// Serves decompressed column file fields to other processes on the same
+// host.  Fields are decompressed into sealed memfds, which are passed to
+// clients over a Unix socket, so that every client maps the same pages
+// instead of decompressing into private memory.  Only clients running as the
+// same user are served.  See `ColumnFileReader::SharedCacheInput()`.
+class ColumnFileCacheServer {
+ public:
+  // Listens on `socket_path`, replacing any existing socket.  Up to
+  // `capacity` bytes of decompressed fields are kept for future requests;
+  // fields that are evicted stay mapped by the clients using them.
+  ColumnFileCacheServer(const char* socket_path, size_t capacity);
+
+  ~ColumnFileCacheServer();
+
+  KJ_DISALLOW_COPY(ColumnFileCacheServer);
+
+  // Serves clients, each on its own thread, until `Stop()` is called.
+  void Run();
+
+  // Makes `Run()` return once all clients are disconnected.
+  void Stop();
+
+  ColumnFileCache::Statistics GetStatistics();
+
+ private:
+  struct Entry;
+
+  typedef std::list<std::pair<ColumnFileCacheKey, std::shared_ptr<Entry>>>
+      EntryList;
+
+  void ServeClient(kj::AutoCloseFd client);
+
+  // Returns the fields requested in a serialized request.
+  std::vector<std::pair<uint32_t, std::shared_ptr<Entry>>> HandleRequest(
+      const std::string& request,
+      std::unordered_map<std::string, kj::AutoCloseFd>& files);
+
+  std::string socket_path_;
+
+  kj::AutoCloseFd socket_;
+
+  size_t capacity_;
+
+  std::atomic<bool> stopping_;
+
+  std::mutex mutex_;
+
+  // Most recently used entries first.
+  EntryList entries_;
+
+  std::unordered_map<ColumnFileCacheKey, EntryList::iterator,
+                     ColumnFileCacheKey::Hash>
+      index_;
+
+  ColumnFileCache::Statistics statistics_;
+
+  // Sockets of connected clients.
+  std::unordered_set<int> clients_;
+
+  std::condition_variable clients_done_;
 };
 
 class ColumnFileInput {
@@ -156,6 +468,30 @@ class ColumnFileInput {
   // Returns the approximate offset, in an unspecified unit.  This value only
   // makes sense when compared to the return value of `Size()`.
   virtual size_t Offset() const = 0;
+
+  // Returns the schema embedded in the input, merged from all of its schema
+  // blocks.  Inputs without a schema return an empty schema.
+  virtual const ColumnFileSchema& Schema();
+
+  // Returns the number of rows in each segment, in input order.  Segments
+  // whose header lacks a row count are decoded to count their rows.  Does not
+  // affect the read position.
+  virtual std::vector<uint32_t> SegmentRowCounts();
+
+  // Moves to just before the segment with the given index, so that the next
+  // call to `Next()` reads it.  Seeking to the segment count moves to the end
+  // of the input.
+  virtual void SeekToSegment(size_t index);
+
+  // Returns an input that reads only the segment with the given index.  The
+  // returned input is independent of this one, so that several segments can
+  // be read concurrently.
+  virtual std::unique_ptr<ColumnFileInput> SegmentInput(size_t index);
+
+  // Sets `key` to identify the current segment in `ColumnFileCache`, leaving
+  // `key.field` unset.  Returns false if the input can't be cached, which is
+  // the default.
+  virtual bool SegmentCacheKey(ColumnFileCacheKey& key) { return false; }
 };
 
 class ColumnFileReader {
@@ -165,6 +501,13 @@ class ColumnFileReader {
 
   static std::unique_ptr<ColumnFileInput> StringInput(ev::StringRef data);
 
+  // Reads the file at `path`, with decompressed field data served from
+  // shared memory by the `ColumnFileCacheServer` listening on `socket_path`,
+  // or on `ColumnFileCacheSocketPath()` if null.  Reads the file directly if
+  // no server is running.
+  static std::unique_ptr<ColumnFileInput> SharedCacheInput(
+      const char* path, const char* socket_path = nullptr);
+
   ColumnFileReader(std::unique_ptr<ColumnFileInput> input);
 
   // Reads a column file as a stream.  If you want to use memory-mapped I/O,
@@ -197,8 +540,23 @@ class ColumnFileReader {
   const StringRef* Peek(uint32_t field);
   const StringRef* Get(uint32_t field);
 
+  // Consumes the next run of identical values in `field`, and stores the
+  // run's value in `value`.  Returns the length of the run, or 0 if the field
+  // has no more values in the current segment; use `End()` to move to the
+  // next segment.  Other fields are not advanced, so this is meant to be used
+  // with a column filter that selects only `field`.
+  uint32_t GetRun(uint32_t field, StringRefOrNull& value);
+
   const std::vector<std::pair<uint32_t, StringRefOrNull>>& GetRow();
 
+  // Returns the buffer holding the value of `field` last returned by
+  // `GetRow()`, `Peek()` or `Get()`.  Holding a reference to the buffer
+  // keeps the value valid after the reader moves on.  Returns nullptr if the
+  // value is null, or isn't stored contiguously in the field data, in which
+  // case it must be copied.
+  std::shared_ptr<const kj::Array<const char>> ValueBuffer(
+      uint32_t field) const;
+
   void SeekToStart();
 
   void SeekToStartOfSegment();
@@ -207,12 +565,64 @@ class ColumnFileReader {
 
   size_t Offset() const { return input_->Offset(); }
 
+  // Returns the schema embedded in the file, or an empty schema if the file
+  // has none.
+  const ColumnFileSchema& Schema() { return input_->Schema(); }
+
+  // Returns the number of rows in the file.
+  uint64_t RowCount();
+
+  // Returns the index of the first row of each segment, followed by the total
+  // row count.
+  const std::vector<uint64_t>& SegmentRows();
+
+  // Returns the number of segments in the file.
+  size_t SegmentCount() { return SegmentRows().size() - 1; }
+
+  // Returns an independent input for reading the segment with the given
+  // index.  See `ColumnFileInput::SegmentInput()`.
+  std::unique_ptr<ColumnFileInput> SegmentInput(size_t index) {
+    return input_->SegmentInput(index);
+  }
+
+  // Moves to the given row, so that the next call to `GetRow()` returns it.
+  // Only the segment containing the row is read, and runs of repeated values
+  // before the row are skipped without being decoded.
+  void SeekToRow(uint64_t row);
+
+  // Calls `callback` for each row in [begin, end).
+  void ReadRows(
+      uint64_t begin, uint64_t end,
+      Delegate<void(const std::vector<std::pair<uint32_t, StringRefOrNull>>&)>
+          callback);
+
+  // Calls `callback` for each of the given rows, which must be in ascending
+  // order.  Rows in the segment being read are reached by skipping forward,
+  // so every segment is decoded at most once.
+  void ReadRows(
+      const std::vector<uint64_t>& rows,
+      Delegate<void(const std::vector<std::pair<uint32_t, StringRefOrNull>>&)>
+          callback);
+
+  // Calls `callback` for `count` distinct rows chosen uniformly at random, in
+  // row order, or for every row if there are fewer.  Only the segments
+  // holding the chosen rows are read.  Pass a generator with a fixed seed to
+  // get a reproducible sample.
+  void Sample(
+      size_t count,
+      Delegate<void(const std::vector<std::pair<uint32_t, StringRefOrNull>>&)>
+          callback,
+      std::mt19937_64& rng = StrongRNG());
+
  private:
   class FieldReader {
    public:
     FieldReader(kj::Array<const char> buffer,
                 ColumnFileCompression compression);
 
+    // Reads decompressed data shared with other readers.
+    FieldReader(std::shared_ptr<const kj::Array<const char>> buffer);
+
     FieldReader(FieldReader&&) = default;
     FieldReader& operator=(FieldReader&&) = default;
 
@@ -236,10 +646,26 @@ class ColumnFileReader {
       return result;
     }
 
+    // Consumes the remainder of the current run.  Returns its length.
+    uint32_t GetRun(const StringRef*& value) {
+      value = Peek();
+      const auto result = repeat_;
+      repeat_ = 0;
+      return result;
+    }
+
+    // Skips up to `count` values.  Returns the number of values skipped.
+    uint64_t Skip(uint64_t count);
+
     void Fill();
 
+    // See `ColumnFileReader::ValueBuffer()`.
+    std::shared_ptr<const kj::Array<const char>> ValueBuffer() const;
+
    private:
-    kj::Array<const char> buffer_;
+    // Decompressed field data.  Shared with other readers through
+    // `ColumnFileCache`, and with users of `ValueBuffer()`.
+    std::shared_ptr<const kj::Array<const char>> shared_buffer_;
 
     StringRef data_;
 
@@ -247,6 +673,10 @@ class ColumnFileReader {
 
     StringRef value_;
     bool value_is_null_ = true;
+
+    // Holds values that share a prefix with the previous value.  A vector
+    // keeps its data in place when the reader is moved.
+    std::vector<char> prefix_buffer_;
     uint32_t array_size_ = 0;
 
     uint32_t repeat_ = 0;
@@ -254,6 +684,9 @@ class ColumnFileReader {
 
   void Fill(bool next = true);
 
+  // Loads `segment_rows_`, unless already loaded.
+  void LoadSegmentRows();
+
   std::unique_ptr<ev::ThreadPool> thread_pool_;
 
   std::unique_ptr<ColumnFileInput> input_;
@@ -265,6 +698,10 @@ class ColumnFileReader {
   std::map<uint32_t, FieldReader> fields_;
 
   std::vector<std::pair<uint32_t, StringRefOrNull>> row_buffer_;
+
+  // The index of the first row of each segment, followed by the total row
+  // count.  Empty until needed.
+  std::vector<uint64_t> segment_rows_;
 };
 
 class ColumnFileSelect {
@@ -273,13 +710,31 @@ class ColumnFileSelect {
 
   void AddSelection(uint32_t field);
 
+  // Selects a column by name, as given by the file's schema.
+  void AddSelection(const StringRef& name);
+
   void AddFilter(uint32_t field, Delegate<bool(const StringRefOrNull&)> filter);
 
+  void AddFilter(const StringRef& name,
+                 Delegate<bool(const StringRefOrNull&)> filter);
+
+  const ColumnFileSchema& Schema() { return input_.Schema(); }
+
   void Execute(
       ev::concurrency::RegionPool& region_pool,
       Delegate<void(const std::vector<std::pair<uint32_t, StringRefOrNull>>&)>
           callback);
 
+  // Calls `callback` for `count` distinct rows chosen uniformly at random
+  // from the rows passing all filters, in row order.  Filters are evaluated
+  // once per run of repeated values, reading only the filtered columns, and
+  // the selected columns are read only for the chosen rows.
+  void Sample(
+      size_t count,
+      Delegate<void(const std::vector<std::pair<uint32_t, StringRefOrNull>>&)>
+          callback,
+      std::mt19937_64& rng = StrongRNG());
+
  private:
   ColumnFileReader input_;
 
@@ -289,6 +744,232 @@ class ColumnFileSelect {
       filters_;
 };
 
+// Common filters for `ColumnFileSelect::AddFilter()`.  None of them match
+// null values.
+
+// Matches values starting with `prefix`.
+Delegate<bool(const StringRefOrNull&)> ColumnFilePrefixFilter(
+    std::string prefix);
+
+// Matches values containing a match for the ECMAScript regular expression
+// `pattern`.
+Delegate<bool(const StringRefOrNull&)> ColumnFileRegexFilter(
+    const char* pattern);
+
+// Matches values of `column` in [min, max], compared as numbers.  The column
+// must have a numeric type in `schema`.
+Delegate<bool(const StringRefOrNull&)> ColumnFileRangeFilter(
+    const ColumnFileSchema& schema, uint32_t column, double min, double max);
+
+// Matches values in [min, max], compared as byte strings.
+Delegate<bool(const StringRefOrNull&)> ColumnFileRangeFilter(std::string min,
+                                                             std::string max);
+
+// Matches values equal to one of `values`.
+Delegate<bool(const StringRefOrNull&)> ColumnFileInFilter(
+    const std::vector<std::string>& values);
+
+// Matches values of the integer column `column` equal to one of `values`,
+// whatever their encoded width.
+Delegate<bool(const StringRefOrNull&)> ColumnFileInFilter(
+    const ColumnFileSchema& schema, uint32_t column,
+    const std::vector<int64_t>& values);
+
+// Joins the rows of a column file (the probe side) with a small table held in
+// memory (the build side).  Build side rows are indexed by the `ev::Hash()` of
+// their key, and probe rows stream from a `ColumnFileSelect`, so filtering and
+// joining happen in a single pass.  Only probe rows with a matching key are
+// emitted (an inner join).
+class ColumnFileHashJoin {
+ public:
+  // Rows are read from `probe`, and matched on the value of `probe_key`.
+  // The key column is read even if it's not selected.
+  ColumnFileHashJoin(ColumnFileSelect probe, uint32_t probe_key);
+
+  // Matches on the first capture group of `pattern` in the probe key value,
+  // rather than on the whole value.  Rows where the pattern doesn't match are
+  // skipped.
+  void SetProbeKeyPattern(const char* pattern);
+
+  // Adds the rows of a CSV file to the build side.  The first line is a
+  // header, and is skipped.  Column `key_column` is the key, and the other
+  // columns are emitted as fields `field_offset + column index`.
+  void AddCSV(const StringRef& data, size_t key_column, uint32_t field_offset);
+
+  // Adds the rows of a column file to the build side.  Field `key_field` is
+  // the key, and the other fields are emitted as `field_offset + field`.
+  void AddColumnFile(ColumnFileReader reader, uint32_t key_field,
+                     uint32_t field_offset);
+
+  // Calls `callback` with every probe row joined with every matching build
+  // row.  The fields of the joined row are sorted.
+  void Execute(
+      ev::concurrency::RegionPool& region_pool,
+      Delegate<void(const std::vector<std::pair<uint32_t, StringRefOrNull>>&)>
+          callback);
+
+ private:
+  struct BuildRow {
+    std::string key;
+
+    // Fields with a NULL value are omitted.
+    std::vector<std::pair<uint32_t, std::string>> values;
+  };
+
+  void AddBuildRow(BuildRow row);
+
+  ColumnFileSelect probe_;
+
+  uint32_t probe_key_;
+
+  std::unique_ptr<std::regex> probe_key_pattern_;
+
+  std::vector<BuildRow> build_rows_;
+
+  // Maps from key hash to index in `build_rows_`.
+  std::unordered_multimap<uint64_t, size_t> build_index_;
+};
+
+enum ColumnFileAggregateFunction : uint32_t {
+  // Number of non-NULL values.
+  kColumnFileAggregateCount = 0,
+  kColumnFileAggregateMin = 1,
+  kColumnFileAggregateMax = 2,
+  kColumnFileAggregateSum = 3,
+};
+
+// A group-by key value, decoded according to the column's schema type.
+// Integer columns use `int_value`, float columns use `float_value`, and all
+// other columns use `string_value`.
+struct ColumnFileKey {
+  ColumnType type = kColumnTypeBinary;
+  bool is_null = true;
+  int64_t int_value = 0;
+  double float_value = 0;
+  std::string string_value;
+
+  bool operator<(const ColumnFileKey& rhs) const;
+};
+
+// Computes aggregates of columns, optionally grouped by the values of other
+// columns.  Segments are aggregated independently on a thread pool, and the
+// partial results are merged.
+class ColumnFileAggregate {
+ public:
+  struct Group {
+    // One value for every group-by column, in the order they were added.
+    std::vector<ColumnFileKey> key;
+
+    // One value for every aggregate, in the order they were added.  Groups
+    // without any non-NULL values for an aggregate have NaN as the minimum
+    // and maximum.
+    std::vector<double> values;
+  };
+
+  ColumnFileAggregate(ColumnFileReader input);
+
+  // Groups rows by the values of the given column.
+  void AddGroupBy(uint32_t field);
+  void AddGroupBy(const StringRef& name);
+
+  // Adds an aggregate of the given column.  Except for counts, values are
+  // decoded as numbers, which requires the column to be in the schema.
+  void AddAggregate(ColumnFileAggregateFunction function, uint32_t field);
+  void AddAggregate(ColumnFileAggregateFunction function,
+                    const StringRef& name);
+
+  // Returns the groups in sorted key order.  If no group-by columns were
+  // added, the result is a single group covering all rows.
+  std::vector<Group> Execute(ThreadPool& thread_pool);
+
+  const ColumnFileSchema& Schema() { return input_.Schema(); }
+
+ private:
+  // Running state of a single aggregate.
+  struct State {
+    uint64_t count = 0;
+    double min = 0;
+    double max = 0;
+    double sum = 0;
+
+    void Merge(const State& other);
+  };
+
+  typedef std::map<std::vector<ColumnFileKey>, std::vector<State>> Groups;
+
+  // Aggregates the segment with the given index.
+  Groups ExecuteSegment(size_t index);
+
+  ColumnFileReader input_;
+
+  std::vector<uint32_t> group_by_;
+
+  std::vector<std::pair<ColumnFileAggregateFunction, uint32_t>> aggregates_;
+};
+
+// Sorts the rows of a column file by one or more key columns, using a bounded
+// amount of memory.  Rows are read into runs, which are sorted and spilled to
+// temporary column files on a thread pool.  The runs are then merged into the
+// output, with groups of runs merged in parallel while there are many.
+class ColumnFileSort {
+ public:
+  ColumnFileSort(ColumnFileReader input);
+
+  // Sorts by the given column, after any previously added keys.  Values are
+  // compared according to the column's schema type, so that integer and float
+  // columns sort numerically.  NULL values sort first.  Rows with equal keys
+  // keep their input order.
+  void AddKey(uint32_t field, bool descending = false);
+  void AddKey(const StringRef& name, bool descending = false);
+
+  // Sets the approximate number of bytes of row data in a single run.  One
+  // run per thread, plus the run being read, may be held in memory at once.
+  void SetRunSize(size_t bytes) { run_size_ = bytes; }
+
+  // Sets the directory for temporary files.  The default is TMPDIR.
+  void SetTemporaryDirectory(std::string path) {
+    temporary_directory_ = std::move(path);
+  }
+
+  // Writes the sorted rows to `output`, along with the input's schema.
+  // Fields missing from a row are written as NULL.
+  void Execute(ThreadPool& thread_pool, ColumnFileWriter& output);
+
+ private:
+  ColumnFileReader input_;
+
+  // (field, descending) pairs.
+  std::vector<std::pair<uint32_t, bool>> keys_;
+
+  size_t run_size_ = 64 << 20;
+
+  std::string temporary_directory_;
+};
+
+// Run-aware operators.  These read a single column run by run, so a run of
+// identical values costs a single predicate evaluation or table update,
+// regardless of its length.  They rewind `reader` and replace its column
+// filter.
+
+// Returns the [begin, end) row ranges whose value in `field` is accepted by
+// `filter`.  Adjacent ranges are merged.
+std::vector<std::pair<uint64_t, uint64_t>> ColumnFileFilterRuns(
+    ColumnFileReader& reader, uint32_t field,
+    Delegate<bool(const StringRefOrNull&)> filter);
+
+// Returns the number of rows whose value in `field` is accepted by `filter`.
+uint64_t ColumnFileCount(ColumnFileReader& reader, uint32_t field,
+                         Delegate<bool(const StringRefOrNull&)> filter);
+
+// Returns the distinct non-NULL values of `field`, in sorted order.
+std::vector<std::string> ColumnFileDistinct(ColumnFileReader& reader,
+                                            uint32_t field);
+
+// Returns the number of rows having each distinct non-NULL value of `field`.
+// If `null_count` is not NULL, the number of NULL values is stored there.
+std::map<std::string, uint64_t> ColumnFileGroupByCount(
+    ColumnFileReader& reader, uint32_t field, uint64_t* null_count = nullptr);
+
 }  // namespace ev
 
 #endif  // !BASE_COLUMNFILE_H_
@@ -1,3 +1,5 @@
+#include <thread>
+
 #include <fcntl.h>
 
 #include <capnp/schema-parser.h>
@@ -150,6 +152,648 @@ TEST_F(ColumnFileTest, WriteTableToString) {
   EXPECT_TRUE(reader.End());
 }
 
+TEST_F(ColumnFileTest, Schema) {
+  std::string buffer;
+
+  ColumnFileWriter writer(buffer);
+  writer.AddColumn(0, "path", kColumnTypeString);
+  writer.AddColumn(1, "rows", kColumnTypeInt);
+  writer.AddColumn(0x0020'1041, "SliceLocation", kColumnTypeFloat,
+                   0x0020'1041);
+
+  const uint32_t rows = 512;
+  const double slice_location = -12.5;
+  writer.Put(0, "a.dcm");
+  writer.Put(1, StringRef(reinterpret_cast<const char*>(&rows), sizeof(rows)));
+  writer.Put(0x0020'1041,
+             StringRef(reinterpret_cast<const char*>(&slice_location),
+                       sizeof(slice_location)));
+  writer.Flush();
+
+  writer.AddColumn(2, "pixel_spacing", kColumnTypeFloatArray);
+  writer.Put(0, "b.dcm");
+  writer.Put(2, "0.5,0.75");
+  writer.Finalize();
+
+  ColumnFileReader reader(buffer);
+
+  const auto& schema = reader.Schema();
+  EXPECT_EQ(4U, schema.Columns().size());
+  EXPECT_EQ(0x0020'1041U, schema.ColumnId("SliceLocation"));
+  EXPECT_EQ(0x0020'1041U, schema.FindDICOMTag(0x0020'1041)->id);
+  EXPECT_EQ(kColumnTypeFloatArray, schema.Find("pixel_spacing")->type);
+  EXPECT_EQ(nullptr, schema.Find("missing"));
+
+  auto row = reader.GetRow();
+  EXPECT_EQ(3U, row.size());
+  EXPECT_EQ("a.dcm", row[0].second.StringRef().str());
+  EXPECT_EQ(512, schema.GetInt(row[1].first, row[1].second.StringRef()));
+  EXPECT_EQ(-12.5, schema.GetFloat(row[2].first, row[2].second.StringRef()));
+
+  row = reader.GetRow();
+  EXPECT_EQ(2U, row.size());
+  const auto spacing =
+      schema.GetFloatArray(row[1].first, row[1].second.StringRef());
+  EXPECT_EQ(2U, spacing.size());
+  EXPECT_EQ(0.75, spacing[1]);
+
+  EXPECT_TRUE(reader.End());
+}
+
+TEST_F(ColumnFileTest, SeekToRow) {
+  std::string buffer;
+
+  ColumnFileWriter writer(buffer);
+
+  for (size_t i = 0; i < 1000; ++i) {
+    writer.Put(0, StringPrintf("%zu", i / 7));
+    writer.Put(1, StringPrintf("row%04zu", i));
+    if ((i % 97) == 96) writer.Flush();
+  }
+
+  writer.Finalize();
+
+  ColumnFileReader reader(buffer);
+  EXPECT_EQ(1000U, reader.RowCount());
+
+  for (const size_t row : {500, 0, 96, 97, 999, 3}) {
+    reader.SeekToRow(row);
+    const auto& data = reader.GetRow();
+    EXPECT_EQ(2U, data.size());
+    EXPECT_EQ(StringPrintf("%zu", row / 7), data[0].second.StringRef().str());
+    EXPECT_EQ(StringPrintf("row%04zu", row), data[1].second.StringRef().str());
+  }
+
+  reader.SeekToRow(1000);
+  EXPECT_TRUE(reader.End());
+
+  size_t next_row = 90;
+  reader.ReadRows(
+      90, 200,
+      [&next_row](
+          const std::vector<std::pair<uint32_t, StringRefOrNull>>& row) {
+        EXPECT_EQ(StringPrintf("row%04zu", next_row++),
+                  row[1].second.StringRef().str());
+      });
+  EXPECT_EQ(200U, next_row);
+}
+
+TEST_F(ColumnFileTest, Cache) {
+  auto tmp_dir = TemporaryDirectory();
+  DirectoryTreeRemover rm_tmp(tmp_dir);
+
+  auto tmp_path = ev::cat(tmp_dir, "/test00");
+  ColumnFileWriter writer(tmp_path.c_str());
+
+  for (size_t i = 0; i < 1000; ++i) {
+    writer.Put(0, StringPrintf("study%03zu/IM-%04zu.dcm", i / 30, i));
+    writer.Put(1, StringPrintf("%zu", i % 30));
+    if ((i % 250) == 249) writer.Flush();
+  }
+
+  writer.Finalize();
+
+  auto& cache = ColumnFileCache::Global();
+  cache.Clear();
+  const auto before = cache.GetStatistics();
+
+  const auto read_all = [&tmp_path] {
+    ColumnFileReader reader(OpenFile(tmp_path.c_str(), O_RDONLY));
+    std::vector<std::string> result;
+    while (!reader.End())
+      result.emplace_back(reader.GetRow()[0].second.StringRef().str());
+    return result;
+  };
+
+  const auto first = read_all();
+  const auto second = read_all();
+
+  const auto after = cache.GetStatistics();
+
+  EXPECT_EQ(1000U, first.size());
+  EXPECT_EQ("study033/IM-0999.dcm", first.back());
+  EXPECT_TRUE(first == second);
+  EXPECT_EQ(8U, after.misses - before.misses);
+  EXPECT_EQ(8U, after.hits - before.hits);
+  EXPECT_LT(0U, after.size);
+
+  cache.SetCapacity(0);
+  EXPECT_EQ(0U, cache.GetStatistics().size);
+  EXPECT_TRUE(first == read_all());
+  cache.SetCapacity(ColumnFileCache::kDefaultCapacity);
+}
+
+TEST_F(ColumnFileTest, SharedCache) {
+  auto tmp_dir = TemporaryDirectory();
+  DirectoryTreeRemover rm_tmp(tmp_dir);
+
+  auto tmp_path = ev::cat(tmp_dir, "/test00");
+  auto socket_path = ev::cat(tmp_dir, "/cache.sock");
+
+  ColumnFileWriter writer(tmp_path.c_str());
+
+  for (size_t i = 0; i < 1000; ++i) {
+    writer.Put(0, StringPrintf("study%03zu/IM-%04zu.dcm", i / 30, i));
+    writer.Put(1, StringPrintf("%zu", i % 30));
+    if ((i % 250) == 249) writer.Flush();
+  }
+
+  writer.Finalize();
+
+  const auto read_all = [&tmp_path, &socket_path] {
+    ColumnFileReader reader(ColumnFileReader::SharedCacheInput(
+        tmp_path.c_str(), socket_path.c_str()));
+    std::vector<std::string> result;
+    while (!reader.End())
+      result.emplace_back(reader.GetRow()[0].second.StringRef().str());
+    return result;
+  };
+
+  // Without a server, the file is read directly.
+  const auto direct = read_all();
+  EXPECT_EQ(1000U, direct.size());
+
+  ColumnFileCacheServer server(socket_path.c_str(), 1 << 20);
+  std::thread server_thread([&server] { server.Run(); });
+
+  const auto first = read_all();
+  const auto second = read_all();
+
+  const auto statistics = server.GetStatistics();
+
+  server.Stop();
+  server_thread.join();
+
+  EXPECT_TRUE(direct == first);
+  EXPECT_TRUE(direct == second);
+  EXPECT_EQ(8U, statistics.misses);
+  EXPECT_EQ(8U, statistics.hits);
+  EXPECT_LT(0U, statistics.size);
+}
+
+TEST_F(ColumnFileTest, ValueBuffer) {
+  std::string buffer;
+
+  ColumnFileWriter writer(buffer);
+  writer.Put(0, "first");
+  writer.Flush();
+  writer.Put(0, "second");
+  writer.Put(0, "second row");
+  writer.PutNull(0);
+  writer.Finalize();
+
+  ColumnFileReader reader(buffer);
+
+  const auto first = reader.GetRow()[0].second.StringRef();
+  const auto first_buffer = reader.ValueBuffer(0);
+  ASSERT_NE(nullptr, first_buffer);
+
+  // The buffer keeps the value valid after the reader moves to the next
+  // segment.
+  EXPECT_EQ("second", reader.GetRow()[0].second.StringRef().str());
+  EXPECT_EQ("first", first.str());
+  EXPECT_NE(nullptr, reader.ValueBuffer(0));
+  EXPECT_NE(first_buffer, reader.ValueBuffer(0));
+
+  // Shares a prefix with the previous value.
+  reader.GetRow();
+  EXPECT_EQ(nullptr, reader.ValueBuffer(0));
+
+  reader.GetRow();
+  EXPECT_EQ(nullptr, reader.ValueBuffer(0));
+
+  EXPECT_TRUE(reader.End());
+}
+
+TEST_F(ColumnFileTest, Checkpoint) {
+  auto tmp_dir = TemporaryDirectory();
+  DirectoryTreeRemover rm_tmp(tmp_dir);
+
+  auto tmp_path = ev::cat(tmp_dir, "/test00");
+  std::vector<std::string> checkpoints;
+
+  {
+    ColumnFileWriter writer(
+        ColumnFileWriter::CheckpointedOutput(tmp_path.c_str(), checkpoints));
+    EXPECT_TRUE(checkpoints.empty());
+
+    writer.AddColumn(0, "path", kColumnTypeString);
+
+    writer.Put(0, "a/1");
+    writer.Put(0, "a/2");
+    writer.Checkpoint("a");
+
+    writer.Put(0, "b/1");
+    writer.Checkpoint("b");
+
+    // Rows written after the last checkpoint are discarded on reopen.
+    writer.Put(0, "c/1");
+  }
+
+  // Simulate a torn write.
+  {
+    auto fd = OpenFile(tmp_path.c_str(), O_WRONLY | O_APPEND);
+    WriteAll(fd, StringRef("\x00\x00\x01\x00\x02", 5));
+  }
+
+  const auto read_all = [&tmp_path] {
+    ColumnFileReader reader(OpenFile(tmp_path.c_str(), O_RDONLY));
+    std::vector<std::string> result;
+    while (!reader.End())
+      result.emplace_back(reader.GetRow()[0].second.StringRef().str());
+    return result;
+  };
+
+  {
+    ColumnFileWriter writer(
+        ColumnFileWriter::CheckpointedOutput(tmp_path.c_str(), checkpoints));
+    EXPECT_EQ(std::vector<std::string>({"a", "b"}), checkpoints);
+    EXPECT_EQ(std::vector<std::string>({"a/1", "a/2", "b/1"}), read_all());
+
+    writer.AddColumn(0, "path", kColumnTypeString);
+    writer.Put(0, "c/1");
+    writer.Checkpoint("c");
+  }
+
+  {
+    ColumnFileWriter writer(
+        ColumnFileWriter::CheckpointedOutput(tmp_path.c_str(), checkpoints));
+    EXPECT_EQ(std::vector<std::string>({"a", "b", "c"}), checkpoints);
+
+    writer.Put(0, "d/1");
+    writer.Put(0, "e/1");
+    writer.Checkpoint(std::vector<std::string>{"d", "e"});
+  }
+
+  ColumnFileWriter::CheckpointedOutput(tmp_path.c_str(), checkpoints);
+  EXPECT_EQ(std::vector<std::string>({"a", "b", "c", "d", "e"}), checkpoints);
+  EXPECT_EQ(
+      std::vector<std::string>({"a/1", "a/2", "b/1", "c/1", "d/1", "e/1"}),
+      read_all());
+
+  EXPECT_EQ(std::vector<std::string>({"f", "g"}),
+            ColumnFileWriter::PendingInputs({"f", "a", "g", "f", "e"},
+                                            checkpoints));
+}
+
+TEST_F(ColumnFileTest, Pixel16) {
+  std::mt19937 rng(1234);
+  std::vector<std::string> images;
+
+  // Smooth gradients with a little noise, some signed and some of odd
+  // widths.
+  for (size_t i = 0; i < 6; ++i) {
+    const size_t width = 40 + i * 13, height = 24 + i;
+    std::string image(width * height * 2, 0);
+
+    for (size_t y = 0; y < height; ++y) {
+      for (size_t x = 0; x < width; ++x) {
+        const int16_t sample =
+            (i & 1 ? -2000 : 1000) + x * 7 + y * 3 + rng() % 5;
+        memcpy(&image[(y * width + x) * 2], &sample, sizeof(sample));
+      }
+    }
+
+    images.emplace_back(std::move(image));
+  }
+
+  // Shares a long prefix with the preceding image.
+  images.emplace_back(images.back());
+  images.back()[images.back().size() - 1] ^= 0x55;
+
+  std::string pixel16_buffer, lz4_buffer;
+
+  for (auto buffer : {&pixel16_buffer, &lz4_buffer}) {
+    ColumnFileWriter writer(*buffer);
+    if (buffer == &pixel16_buffer)
+      writer.SetCompression(kColumnFileCompressionPixel16);
+
+    for (const auto& image : images) {
+      writer.Put(0, "image");
+      writer.Put(1, image);
+    }
+
+    writer.Put(0, "repeat");
+    writer.Put(1, images[0]);
+    writer.PutNull(0);
+    writer.PutNull(1);
+    writer.Put(0, "empty");
+    writer.Put(1, "");
+    writer.Finalize();
+  }
+
+  EXPECT_LT(pixel16_buffer.size(), lz4_buffer.size());
+
+  ColumnFileReader reader(pixel16_buffer);
+
+  for (const auto& image : images) {
+    ASSERT_FALSE(reader.End());
+    auto row = reader.GetRow();
+    ASSERT_EQ(2U, row.size());
+    EXPECT_EQ("image", row[0].second.StringRef().str());
+    EXPECT_EQ(image, row[1].second.StringRef().str());
+  }
+
+  auto row = reader.GetRow();
+  ASSERT_EQ(2U, row.size());
+  EXPECT_EQ(images[0], row[1].second.StringRef().str());
+
+  row = reader.GetRow();
+  ASSERT_EQ(2U, row.size());
+  EXPECT_TRUE(row[0].second.IsNull());
+  EXPECT_TRUE(row[1].second.IsNull());
+
+  row = reader.GetRow();
+  ASSERT_EQ(2U, row.size());
+  EXPECT_EQ("empty", row[0].second.StringRef().str());
+  EXPECT_TRUE(row[1].second.StringRef().empty());
+
+  EXPECT_TRUE(reader.End());
+}
+
+TEST_F(ColumnFileTest, Sample) {
+  std::string buffer;
+
+  ColumnFileWriter writer(buffer);
+
+  for (size_t i = 0; i < 1000; ++i) {
+    writer.Put(0, StringPrintf("study%zu", i / 100));
+    writer.Put(1, StringPrintf("row%04zu", i));
+    if ((i % 97) == 96) writer.Flush();
+  }
+
+  writer.Finalize();
+
+  std::mt19937_64 rng(1234);
+
+  ColumnFileReader reader(buffer);
+  std::vector<std::string> sample;
+  reader.Sample(
+      50,
+      [&sample](const std::vector<std::pair<uint32_t, StringRefOrNull>>& row) {
+        EXPECT_EQ(2U, row.size());
+        sample.emplace_back(row[1].second.StringRef().str());
+      },
+      rng);
+
+  EXPECT_EQ(50U, sample.size());
+  EXPECT_TRUE(std::is_sorted(sample.begin(), sample.end()));
+  EXPECT_TRUE(std::adjacent_find(sample.begin(), sample.end()) ==
+              sample.end());
+
+  ColumnFileSelect select{ColumnFileReader(buffer)};
+  select.AddSelection(1);
+  select.AddFilter(0, [](const StringRefOrNull& value) {
+    return value.StringRef() == "study3";
+  });
+
+  sample.clear();
+  select.Sample(
+      150,
+      [&sample](const std::vector<std::pair<uint32_t, StringRefOrNull>>& row) {
+        EXPECT_EQ(1U, row.size());
+        sample.emplace_back(row[0].second.StringRef().str());
+      },
+      rng);
+
+  EXPECT_EQ(100U, sample.size());
+  EXPECT_EQ("row0300", sample.front());
+  EXPECT_EQ("row0399", sample.back());
+}
+
+TEST_F(ColumnFileTest, SelectFilters) {
+  std::string buffer;
+
+  ColumnFileSchema schema;
+  schema.AddColumn(0, "path", kColumnTypeString);
+  schema.AddColumn(1, "rows", kColumnTypeInt);
+
+  ColumnFileWriter writer(buffer);
+  writer.SetSchema(schema);
+
+  for (int32_t i = 0; i < 100; ++i) {
+    writer.Put(0, StringPrintf("train/%d/sax_%d.dcm", i, i % 3));
+    if (i % 10)
+      writer.Put(1, StringRef(reinterpret_cast<const char*>(&i), sizeof(i)));
+    else
+      writer.PutNull(1);
+  }
+
+  writer.Finalize();
+
+  ColumnFileReader reader(buffer);
+
+  EXPECT_EQ(11U, ColumnFileCount(reader, 0, ColumnFilePrefixFilter("train/1")));
+  EXPECT_EQ(33U, ColumnFileCount(reader, 0,
+                                 ColumnFileRegexFilter("/sax_[2]\\.dcm$")));
+  EXPECT_EQ(2U, ColumnFileCount(reader, 0, ColumnFileRangeFilter(
+                                               "train/10", "train/12")));
+  EXPECT_EQ(2U, ColumnFileCount(reader, 0,
+                                ColumnFileInFilter(std::vector<std::string>{
+                                    "train/5/sax_2.dcm", "train/6/sax_0.dcm",
+                                    "train/6/sax_1.dcm"})));
+
+  // Nulls don't match.
+  EXPECT_EQ(18U, ColumnFileCount(reader, 1,
+                                 ColumnFileRangeFilter(schema, 1, 0, 20)));
+  EXPECT_EQ(2U, ColumnFileCount(reader, 1, ColumnFileInFilter(
+                                               schema, 1, {0, 10, 42, 99})));
+}
+
+TEST_F(ColumnFileTest, RunOperators) {
+  std::string buffer;
+
+  ColumnFileWriter writer(buffer);
+
+  for (size_t i = 0; i < 1000; ++i) {
+    writer.Put(0, StringPrintf("study%zu", i / 100));
+    if (i % 3)
+      writer.Put(1, (i % 10) < 5 ? "1" : "0");
+    else
+      writer.PutNull(1);
+    if ((i % 333) == 332) writer.Flush();
+  }
+
+  writer.Finalize();
+
+  ColumnFileReader reader(buffer);
+
+  const auto ranges =
+      ColumnFileFilterRuns(reader, 0, [](const StringRefOrNull& value) {
+        return value.StringRef() == "study3" || value.StringRef() == "study4";
+      });
+  EXPECT_EQ(1U, ranges.size());
+  EXPECT_EQ(300U, ranges[0].first);
+  EXPECT_EQ(500U, ranges[0].second);
+
+  EXPECT_EQ(334U, ColumnFileCount(reader, 1, [](const StringRefOrNull& value) {
+              return value.IsNull();
+            }));
+
+  const auto distinct = ColumnFileDistinct(reader, 0);
+  EXPECT_EQ(10U, distinct.size());
+  EXPECT_EQ("study0", distinct.front());
+  EXPECT_EQ("study9", distinct.back());
+
+  uint64_t null_count = 0;
+  const auto groups = ColumnFileGroupByCount(reader, 1, &null_count);
+  EXPECT_EQ(2U, groups.size());
+  EXPECT_EQ(333U, groups.at("0"));
+  EXPECT_EQ(333U, groups.at("1"));
+  EXPECT_EQ(334U, null_count);
+}
+
+TEST_F(ColumnFileTest, Aggregate) {
+  std::string buffer;
+
+  ColumnFileWriter writer(buffer);
+  writer.AddColumn(0, "study", kColumnTypeString);
+  writer.AddColumn(1, "frames", kColumnTypeInt);
+  writer.AddColumn(2, "age", kColumnTypeFloat);
+
+  for (size_t i = 0; i < 1000; ++i) {
+    const int32_t frames = i % 30;
+    const double age = i;
+
+    writer.Put(0, StringPrintf("study%zu", i % 4));
+    writer.Put(1, StringRef(reinterpret_cast<const char*>(&frames),
+                            sizeof(frames)));
+    if (i % 5)
+      writer.Put(2,
+                 StringRef(reinterpret_cast<const char*>(&age), sizeof(age)));
+    else
+      writer.PutNull(2);
+
+    if ((i % 77) == 76) writer.Flush();
+  }
+
+  writer.Finalize();
+
+  ColumnFileAggregate aggregate{ColumnFileReader(buffer)};
+  aggregate.AddGroupBy("study");
+  aggregate.AddAggregate(kColumnFileAggregateCount, "age");
+  aggregate.AddAggregate(kColumnFileAggregateMin, "age");
+  aggregate.AddAggregate(kColumnFileAggregateMax, "age");
+  aggregate.AddAggregate(kColumnFileAggregateSum, "frames");
+
+  ThreadPool thread_pool(4);
+  const auto groups = aggregate.Execute(thread_pool);
+
+  EXPECT_EQ(4U, groups.size());
+  EXPECT_EQ("study1", groups[1].key[0].string_value);
+  EXPECT_EQ(200, groups[1].values[0]);
+  EXPECT_EQ(1, groups[1].values[1]);
+  EXPECT_EQ(997, groups[1].values[2]);
+  EXPECT_EQ(3730, groups[1].values[3]);
+}
+
+TEST_F(ColumnFileTest, HashJoin) {
+  std::string buffer;
+
+  ColumnFileWriter writer(buffer);
+
+  for (size_t i = 0; i < 100; ++i) {
+    writer.Put(0, StringPrintf("train/%zu/study/2ch_1/IM-%04zu.dcm", i / 10,
+                               i % 10 + 1));
+    writer.Put(1, StringPrintf("%zu", i));
+  }
+
+  writer.Finalize();
+
+  ColumnFileSelect select{ColumnFileReader(buffer)};
+  select.AddSelection(1);
+  select.AddFilter(0, [](const StringRefOrNull& value) {
+    return HasSuffix(value.StringRef(), "-0001.dcm");
+  });
+
+  ColumnFileHashJoin join(std::move(select), 0);
+  join.SetProbeKeyPattern("[^/]+/([0-9]+)/study/");
+  join.AddCSV("Id,Systole,Diastole\r\n3,10.5,\"20,5\"\r\n42,0,0\r\n", 0, 100);
+
+  std::vector<std::vector<std::pair<uint32_t, std::string>>> rows;
+  concurrency::RegionPool region_pool(1, 2048);
+
+  join.Execute(region_pool,
+               [&rows](const std::vector<std::pair<uint32_t, StringRefOrNull>>&
+                           row) {
+                 rows.emplace_back();
+                 for (const auto& field : row)
+                   rows.back().emplace_back(field.first,
+                                            field.second.StringRef().str());
+               });
+
+  EXPECT_EQ(1U, rows.size());
+  EXPECT_EQ(4U, rows[0].size());
+  EXPECT_EQ(0U, rows[0][0].first);
+  EXPECT_EQ("30", rows[0][1].second);
+  EXPECT_EQ(101U, rows[0][2].first);
+  EXPECT_EQ("10.5", rows[0][2].second);
+  EXPECT_EQ("20,5", rows[0][3].second);
+}
+
+TEST_F(ColumnFileTest, Sort) {
+  std::string buffer;
+
+  ColumnFileWriter writer(buffer);
+  writer.AddColumn(0, "study", kColumnTypeString);
+  writer.AddColumn(1, "slice", kColumnTypeInt);
+
+  for (size_t i = 0; i < 5000; ++i) {
+    const int32_t slice = (i * 7919) % 1000;
+
+    writer.Put(0, StringPrintf("study%zu", i % 3));
+    if (i % 10)
+      writer.Put(1, StringRef(reinterpret_cast<const char*>(&slice),
+                              sizeof(slice)));
+    else
+      writer.PutNull(1);
+
+    if ((i % 500) == 499) writer.Flush();
+  }
+
+  writer.Finalize();
+
+  ColumnFileSort sort{ColumnFileReader(buffer)};
+  sort.AddKey("study", true);
+  sort.AddKey("slice");
+
+  // Force many runs, so that intermediate merges are needed.
+  sort.SetRunSize(2048);
+
+  std::string sorted;
+  ColumnFileWriter output(sorted);
+  ThreadPool thread_pool(4);
+  sort.Execute(thread_pool, output);
+  output.Finalize();
+
+  ColumnFileReader reader(sorted);
+  EXPECT_EQ(kColumnTypeInt, reader.Schema().Find("slice")->type);
+
+  std::string previous_study = "~";
+  int64_t previous_slice = -1;
+  size_t count = 0;
+
+  while (!reader.End()) {
+    const auto& row = reader.GetRow();
+    ASSERT_EQ(2U, row.size());
+
+    const auto study = row[0].second.StringRef().str();
+    const auto slice =
+        row[1].second.IsNull()
+            ? -1
+            : reader.Schema().GetInt(1, row[1].second.StringRef());
+
+    ASSERT_LE(study, previous_study);
+    if (study == previous_study) ASSERT_LE(previous_slice, slice);
+
+    previous_study = study;
+    previous_slice = slice;
+    ++count;
+  }
+
+  EXPECT_EQ(5000U, count);
+}
+
 TEST_F(ColumnFileTest, WriteMessageToString) {
   capnp::SchemaParser schema_parser;
   kj::ArrayPtr<const kj::StringPtr> import_path;
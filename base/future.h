@@ -0,0 +1,705 @@
+#ifndef BASE_FUTURE_H_
+#define BASE_FUTURE_H_ 1
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <kj/common.h>
+#include <kj/debug.h>
+
+#include "base/futex.h"
+#include "base/thread-pool.h"
+
+// Futures for tasks running on a `ThreadPool`, which unlike `std::future` can
+// be continued without blocking a thread.  Example use:
+//
+//   std::vector<ev::Future<Data>> futures;
+//   futures.emplace_back(ev::Async(pool, [] { return Load("a"); }));
+//   futures.emplace_back(ev::Async(pool, [] { return Load("b"); }));
+//
+//   auto sum = ev::WhenAll(std::move(futures))
+//       .Then(pool, [](std::vector<Data> data) { return Sum(data); });
+//
+//   printf("Result: %d\n", sum.Get());
+//
+// A task's function and its result share a single allocation, with a
+// reference count that is released by the task once it has run and by the
+// `Future` once its result has been taken.
+//
+// Tasks are scheduled with `ThreadPool::Launch()`, so a task may run in the
+// calling thread once the pool's backlog is full.  Tasks still queued when
+// the pool is destroyed never run, and like the futures returned by
+// `ThreadPool::Launch()`, theirs hold a `std::future_error` with
+// `std::future_errc::broken_promise`.  So do the futures of continuations of
+// such tasks.
+
+namespace ev {
+
+template <typename T>
+class Future;
+
+template <typename T>
+class Promise;
+
+namespace future_internal {
+
+// Stands in for the result of `void` futures.
+struct Void {};
+
+template <typename T>
+using Value =
+    typename std::conditional<std::is_void<T>::value, Void, T>::type;
+
+// Called once a future is ready, in the thread that made it ready.  Must not
+// block.
+class Callback {
+ public:
+  virtual void Invoke() = 0;
+
+  Callback* next_ = nullptr;
+
+ protected:
+  ~Callback() = default;
+};
+
+class StateBase {
+ public:
+  StateBase() = default;
+
+  KJ_DISALLOW_COPY(StateBase);
+
+  void AddRef() { refs_.fetch_add(1, std::memory_order_relaxed); }
+
+  void Release() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+  }
+
+  bool Ready() const {
+    return ready_.load(std::memory_order_acquire) == kReady;
+  }
+
+  // Blocks until the state is ready.
+  void Wait() {
+    auto ready = ready_.load(std::memory_order_acquire);
+
+    while (ready != kReady) {
+      if (ready == kPending &&
+          !ready_.compare_exchange_weak(ready, kWaiting,
+                                        std::memory_order_acquire)) {
+        continue;
+      }
+
+      futex_wait(ready_, kWaiting);
+      ready = ready_.load(std::memory_order_acquire);
+    }
+  }
+
+  // Arranges for `callback` to be invoked once the state is ready, or invokes
+  // it right away if it already is.  Callbacks are invoked in the order they
+  // were added.
+  void AddCallback(Callback* callback) {
+    auto head = callbacks_.load(std::memory_order_acquire);
+
+    do {
+      if (head == Done()) {
+        callback->Invoke();
+        return;
+      }
+
+      callback->next_ = head;
+    } while (!callbacks_.compare_exchange_weak(head, callback,
+                                               std::memory_order_release,
+                                               std::memory_order_acquire));
+  }
+
+ protected:
+  virtual ~StateBase() {}
+
+  // Publishes the value or error, wakes threads blocked in Wait(), and
+  // invokes the callbacks.  The caller must hold a reference.
+  void MarkReady() {
+    if (ready_.exchange(kReady, std::memory_order_acq_rel) == kWaiting)
+      futex_wake(ready_, INT_MAX);
+
+    auto head = callbacks_.exchange(Done(), std::memory_order_acq_rel);
+
+    Callback* callbacks = nullptr;
+    while (head) {
+      auto next = head->next_;
+      head->next_ = callbacks;
+      callbacks = head;
+      head = next;
+    }
+
+    while (callbacks) {
+      // The callback may free itself.
+      auto next = callbacks->next_;
+      callbacks->Invoke();
+      callbacks = next;
+    }
+  }
+
+  std::exception_ptr error_;
+
+ private:
+  static constexpr uint32_t kPending = 0;
+  static constexpr uint32_t kWaiting = 1;
+  static constexpr uint32_t kReady = 2;
+
+  // Marks the callback list as consumed.
+  static Callback* Done() {
+    return reinterpret_cast<Callback*>(static_cast<uintptr_t>(1));
+  }
+
+  std::atomic<uint32_t> refs_{1};
+
+  // `kWaiting` while some thread is blocked in Wait().
+  std::atomic<uint32_t> ready_{kPending};
+
+  // Callbacks in reverse order, or Done() once invoked.
+  std::atomic<Callback*> callbacks_{nullptr};
+};
+
+// Returns the error held by futures whose task was discarded.
+inline std::exception_ptr BrokenPromise() {
+  return std::make_exception_ptr(
+      std::future_error(std::future_errc::broken_promise));
+}
+
+// Queued in a thread pool to call `state->Run()`.  If the thread pool
+// discards it instead, `state->Abandon()` is called when it's destroyed.
+template <typename S>
+class Runner {
+ public:
+  explicit Runner(S* state) : state_(state) {}
+
+  Runner(Runner&& other) noexcept : state_(other.state_) {
+    other.state_ = nullptr;
+  }
+
+  KJ_DISALLOW_COPY(Runner);
+
+  ~Runner() {
+    if (state_) state_->Abandon();
+  }
+
+  void operator()() {
+    const auto state = state_;
+    state_ = nullptr;
+    state->Run();
+  }
+
+ private:
+  S* state_;
+};
+
+// Returns the result of `f()` as a `Value<T>`.
+template <typename T>
+struct Invoke {
+  template <typename Function>
+  static Value<T> Call(Function& f) {
+    return f();
+  }
+};
+
+template <>
+struct Invoke<void> {
+  template <typename Function>
+  static Void Call(Function& f) {
+    f();
+    return Void();
+  }
+};
+
+template <typename T>
+class State : public StateBase {
+ public:
+  using ValueType = Value<T>;
+
+  ~State() override {
+    if (has_value_) Storage()->~ValueType();
+  }
+
+  void SetValue(ValueType&& value) {
+    new (&storage_) ValueType(std::move(value));
+    has_value_ = true;
+    MarkReady();
+  }
+
+  void SetError(std::exception_ptr error) {
+    error_ = std::move(error);
+    MarkReady();
+  }
+
+  // Stores the result of `f()`, or the exception it throws.
+  template <typename Function>
+  void Fulfill(Function&& f) {
+    try {
+      new (&storage_) ValueType(Invoke<T>::Call(f));
+      has_value_ = true;
+    } catch (...) {
+      error_ = std::current_exception();
+    }
+    MarkReady();
+  }
+
+  // Rethrows the error, if any.  Only valid once ready.
+  ValueType& value() {
+    if (error_) std::rethrow_exception(error_);
+    return *Storage();
+  }
+
+ private:
+  ValueType* Storage() { return reinterpret_cast<ValueType*>(&storage_); }
+
+  typename std::aligned_storage<sizeof(ValueType), alignof(ValueType)>::type
+      storage_;
+
+  bool has_value_ = false;
+};
+
+// Moves the value out of a ready state, rethrowing its error, if any.
+template <typename T>
+T Take(State<T>& state) {
+  return std::move(state.value());
+}
+
+template <>
+inline void Take<void>(State<void>& state) {
+  state.value();
+}
+
+// Calls `f` with the value of a ready state, if it has one.
+template <typename T>
+struct Apply {
+  template <typename Function>
+  static auto Call(Function& f, State<T>& state)
+      -> decltype(f(std::move(state.value()))) {
+    return f(std::move(state.value()));
+  }
+};
+
+template <>
+struct Apply<void> {
+  template <typename Function>
+  static auto Call(Function& f, State<void>& state) -> decltype(f()) {
+    state.value();
+    return f();
+  }
+};
+
+// The result type of continuing a `Future<T>` with `Function`.
+template <typename T, typename Function>
+using ThenResult = decltype(Apply<T>::Call(std::declval<Function&>(),
+                                           std::declval<State<T>&>()));
+
+// A task launched by Async().  Holds one reference for the future and one
+// for the pending call to Run().
+template <typename T, typename Function>
+class TaskState : public State<T> {
+ public:
+  explicit TaskState(Function&& f) : function_(std::forward<Function>(f)) {}
+
+  void Launch(ThreadPool& thread_pool) {
+    this->AddRef();
+    thread_pool.Launch(Runner<TaskState>(this));
+  }
+
+ private:
+  friend class Runner<TaskState>;
+
+  void Run() {
+    this->Fulfill(function_);
+    this->Release();
+  }
+
+  void Abandon() {
+    this->SetError(BrokenPromise());
+    this->Release();
+  }
+
+  typename std::decay<Function>::type function_;
+};
+
+// A continuation added by Future::Then().  Holds one reference for the
+// future, and one until it has run.
+template <typename T, typename Input, typename Function>
+class ContinuationState : public State<T>, public Callback {
+ public:
+  ContinuationState(ThreadPool& thread_pool, State<Input>* input,
+                    Function&& f)
+      : thread_pool_(thread_pool),
+        input_(input),
+        function_(std::forward<Function>(f)) {}
+
+  void Start() {
+    this->AddRef();
+    input_->AddCallback(this);
+  }
+
+ private:
+  friend class Runner<ContinuationState>;
+
+  void Invoke() override {
+    thread_pool_.Launch(Runner<ContinuationState>(this));
+  }
+
+  void Run() {
+    this->Fulfill(
+        [this]() -> T { return Apply<Input>::Call(function_, *input_); });
+
+    input_->Release();
+    input_ = nullptr;
+
+    this->Release();
+  }
+
+  void Abandon() {
+    this->SetError(BrokenPromise());
+
+    input_->Release();
+    input_ = nullptr;
+
+    this->Release();
+  }
+
+  ThreadPool& thread_pool_;
+
+  State<Input>* input_;
+
+  typename std::decay<Function>::type function_;
+};
+
+template <typename T>
+using WhenAllResult = typename std::conditional<std::is_void<T>::value, void,
+                                                std::vector<T>>::type;
+
+// Gathers the values of ready states, or rethrows the first error.
+template <typename T>
+struct Gather {
+  static std::vector<T> Call(const std::vector<State<T>*>& inputs) {
+    std::vector<T> result;
+    result.reserve(inputs.size());
+    for (auto input : inputs) result.emplace_back(std::move(input->value()));
+    return result;
+  }
+};
+
+template <>
+struct Gather<void> {
+  static void Call(const std::vector<State<void>*>& inputs) {
+    for (auto input : inputs) input->value();
+  }
+};
+
+// Becomes ready once all its inputs are.  Holds one reference for the future,
+// and one for each input that isn't ready yet.
+template <typename T>
+class WhenAllState : public State<WhenAllResult<T>> {
+ public:
+  explicit WhenAllState(std::vector<State<T>*> inputs)
+      : inputs_(std::move(inputs)),
+        links_(inputs_.size()),
+        remaining_(inputs_.size() + 1) {}
+
+  ~WhenAllState() override {
+    for (auto input : inputs_) input->Release();
+  }
+
+  void Start() {
+    for (size_t i = 0; i < inputs_.size(); ++i) {
+      this->AddRef();
+      links_[i].owner = this;
+      inputs_[i]->AddCallback(&links_[i]);
+    }
+
+    // Accounts for the inputs that are ready already, including when there
+    // are none.
+    this->AddRef();
+    Arrive();
+  }
+
+ private:
+  struct Link : Callback {
+    void Invoke() override { owner->Arrive(); }
+
+    WhenAllState* owner = nullptr;
+  };
+
+  void Arrive() {
+    if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      this->Fulfill([this] { return Gather<T>::Call(inputs_); });
+    }
+
+    this->Release();
+  }
+
+  std::vector<State<T>*> inputs_;
+  std::vector<Link> links_;
+
+  std::atomic<size_t> remaining_;
+};
+
+// Becomes ready, with the index of the first input to be ready, once any of
+// its inputs is.  Holds one reference for the future, and one for each input
+// that isn't ready yet.
+class WhenAnyState : public State<size_t> {
+ public:
+  explicit WhenAnyState(size_t size) : links_(size) {}
+
+  void Start(const std::vector<StateBase*>& inputs) {
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      AddRef();
+      links_[i].owner = this;
+      links_[i].index = i;
+      inputs[i]->AddCallback(&links_[i]);
+    }
+  }
+
+ private:
+  struct Link : Callback {
+    void Invoke() override { owner->Arrive(index); }
+
+    WhenAnyState* owner = nullptr;
+    size_t index = 0;
+  };
+
+  void Arrive(size_t index) {
+    if (!done_.exchange(true, std::memory_order_acq_rel))
+      SetValue(size_t(index));
+    Release();
+  }
+
+  std::vector<Link> links_;
+
+  std::atomic<bool> done_{false};
+};
+
+}  // namespace future_internal
+
+// The result of an asynchronous computation.  Move-only, like
+// `std::unique_ptr`; taking the result with Get(), or continuing it with
+// Then(), invalidates the future.
+template <typename T>
+class Future {
+ public:
+  Future() = default;
+
+  Future(Future&& other) noexcept : state_(other.state_) {
+    other.state_ = nullptr;
+  }
+
+  Future& operator=(Future&& other) noexcept {
+    std::swap(state_, other.state_);
+    return *this;
+  }
+
+  KJ_DISALLOW_COPY(Future);
+
+  ~Future() {
+    if (state_) state_->Release();
+  }
+
+  // Returns true until the result has been taken.
+  bool Valid() const { return state_ != nullptr; }
+
+  // Returns true if Get() would not block.
+  bool Ready() const {
+    KJ_REQUIRE(Valid());
+    return state_->Ready();
+  }
+
+  // Blocks until the result is available.
+  void Wait() const {
+    KJ_REQUIRE(Valid());
+    state_->Wait();
+  }
+
+  // Blocks until the result is available, and returns it.  Rethrows the
+  // exception thrown by the computation, if any.
+  T Get() {
+    KJ_REQUIRE(Valid());
+
+    Future future(std::move(*this));
+    future.state_->Wait();
+    return future_internal::Take<T>(*future.state_);
+  }
+
+  // Returns a future for the result of calling `f` with this future's value
+  // (or with no arguments, for `void` futures), in `thread_pool`, once it's
+  // available.  If this future holds an exception, `f` isn't called and the
+  // returned future holds the same exception.
+  template <typename Function>
+  Future<future_internal::ThenResult<T, Function>> Then(ThreadPool& thread_pool,
+                                                        Function&& f) {
+    using Result = future_internal::ThenResult<T, Function>;
+
+    KJ_REQUIRE(Valid());
+
+    auto state =
+        new future_internal::ContinuationState<Result, T, Function>(
+            thread_pool, state_, std::forward<Function>(f));
+    state_ = nullptr;
+    state->Start();
+
+    return Future<Result>(state);
+  }
+
+ private:
+  template <typename U>
+  friend class Future;
+
+  friend class Promise<T>;
+
+  template <typename Function>
+  friend Future<typename std::result_of<Function()>::type> Async(
+      ThreadPool& thread_pool, Function&& f);
+
+  template <typename U>
+  friend Future<future_internal::WhenAllResult<U>> WhenAll(
+      std::vector<Future<U>> futures);
+
+  template <typename U>
+  friend Future<size_t> WhenAny(const std::vector<Future<U>>& futures);
+
+  explicit Future(future_internal::State<T>* state) : state_(state) {}
+
+  future_internal::State<T>* state_ = nullptr;
+};
+
+// A value that is set by one thread and consumed through a `Future` by
+// another.  If the promise is destroyed without being fulfilled, its future
+// holds a `std::future_error` with `std::future_errc::broken_promise`.
+template <typename T>
+class Promise {
+ public:
+  Promise() : state_(new future_internal::State<T>) {}
+
+  Promise(Promise&& other) noexcept : state_(other.state_) {
+    other.state_ = nullptr;
+  }
+
+  Promise& operator=(Promise&& other) noexcept {
+    std::swap(state_, other.state_);
+    return *this;
+  }
+
+  KJ_DISALLOW_COPY(Promise);
+
+  ~Promise() {
+    if (!state_) return;
+    if (!fulfilled_) state_->SetError(future_internal::BrokenPromise());
+    state_->Release();
+  }
+
+  // Returns the future for this promise.  Must be called at most once.
+  Future<T> GetFuture() {
+    KJ_REQUIRE(state_ && !future_retrieved_, "Future already retrieved");
+    future_retrieved_ = true;
+    state_->AddRef();
+    return Future<T>(state_);
+  }
+
+  // Fulfills the promise with a value.  Continuations of the future are
+  // scheduled from the calling thread.
+  template <typename U = T,
+            typename std::enable_if<!std::is_void<U>::value>::type* = nullptr>
+  void SetValue(U value) {
+    KJ_REQUIRE(state_ && !fulfilled_, "Promise already fulfilled");
+    fulfilled_ = true;
+    state_->SetValue(std::move(value));
+  }
+
+  template <typename U = T,
+            typename std::enable_if<std::is_void<U>::value>::type* = nullptr>
+  void SetValue() {
+    KJ_REQUIRE(state_ && !fulfilled_, "Promise already fulfilled");
+    fulfilled_ = true;
+    state_->SetValue(future_internal::Void());
+  }
+
+  // Fulfills the promise with an exception, which Future::Get() rethrows.
+  void SetException(std::exception_ptr error) {
+    KJ_REQUIRE(state_ && !fulfilled_, "Promise already fulfilled");
+    fulfilled_ = true;
+    state_->SetError(std::move(error));
+  }
+
+ private:
+  future_internal::State<T>* state_;
+
+  bool future_retrieved_ = false;
+  bool fulfilled_ = false;
+};
+
+// Calls `f` in `thread_pool`, and returns a future for its result.  Unlike
+// `ThreadPool::Launch()`, the function and its result share one allocation.
+template <typename Function>
+Future<typename std::result_of<Function()>::type> Async(ThreadPool& thread_pool,
+                                                        Function&& f) {
+  using Result = typename std::result_of<Function()>::type;
+
+  auto state = new future_internal::TaskState<Result, Function>(
+      std::forward<Function>(f));
+  Future<Result> result(state);
+  state->Launch(thread_pool);
+
+  return result;
+}
+
+// Returns a future that becomes ready once all of `futures` are, with their
+// values in order (or no value, for `void` futures).  If any of them holds an
+// exception, the result holds the exception of the first such future.  No
+// thread is blocked while waiting; the values are gathered by the thread
+// completing the last input.
+template <typename T>
+Future<future_internal::WhenAllResult<T>> WhenAll(
+    std::vector<Future<T>> futures) {
+  std::vector<future_internal::State<T>*> inputs;
+  inputs.reserve(futures.size());
+
+  for (auto& future : futures) {
+    KJ_REQUIRE(future.Valid());
+    inputs.emplace_back(future.state_);
+    future.state_ = nullptr;
+  }
+
+  auto state = new future_internal::WhenAllState<T>(std::move(inputs));
+  Future<future_internal::WhenAllResult<T>> result(state);
+  state->Start();
+
+  return result;
+}
+
+// Returns a future for the index of the first of `futures` to become ready.
+// The futures are not consumed, so the caller can take the ready result, and
+// wait for the others again.
+template <typename T>
+Future<size_t> WhenAny(const std::vector<Future<T>>& futures) {
+  KJ_REQUIRE(!futures.empty());
+
+  std::vector<future_internal::StateBase*> inputs;
+  inputs.reserve(futures.size());
+
+  for (const auto& future : futures) {
+    KJ_REQUIRE(future.Valid());
+    inputs.emplace_back(future.state_);
+  }
+
+  auto state = new future_internal::WhenAnyState(inputs.size());
+  Future<size_t> result(state);
+  state->Start(inputs);
+
+  return result;
+}
+
+}  // namespace ev
+
+#endif  // !BASE_FUTURE_H_
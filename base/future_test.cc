@@ -0,0 +1,195 @@
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/future.h"
+#include "base/thread-pool.h"
+#include "third_party/gtest/gtest.h"
+
+using namespace ev;
+
+TEST(FutureTest, AsyncReturnsResult) {
+  ThreadPool thread_pool(2);
+
+  auto future = Async(thread_pool, [] { return std::string("result"); });
+  EXPECT_EQ("result", future.Get());
+  EXPECT_FALSE(future.Valid());
+
+  std::atomic<bool> ran(false);
+  auto done = Async(thread_pool, [&ran] { ran = true; });
+  done.Get();
+  EXPECT_TRUE(ran);
+
+  // Move-only results.
+  auto pointer = Async(thread_pool, [] { return std::make_unique<int>(5); });
+  EXPECT_EQ(5, *pointer.Get());
+}
+
+TEST(FutureTest, AsyncPropagatesExceptions) {
+  ThreadPool thread_pool(1);
+
+  auto future = Async(thread_pool, []() -> int {
+    throw std::runtime_error("failed");
+  });
+  EXPECT_THROW(future.Get(), std::runtime_error);
+}
+
+TEST(FutureTest, ThenChainsContinuations) {
+  ThreadPool thread_pool(2);
+
+  auto future = Async(thread_pool, [] { return 2; })
+                    .Then(thread_pool, [](int v) { return v * 10; })
+                    .Then(thread_pool, [](int v) { return std::to_string(v); });
+  EXPECT_EQ("20", future.Get());
+
+  std::atomic<int> calls(0);
+  auto chained = Async(thread_pool, [&calls] { ++calls; })
+                     .Then(thread_pool, [&calls] { ++calls; })
+                     .Then(thread_pool, [&calls] { return ++calls; });
+  EXPECT_EQ(3, chained.Get());
+}
+
+TEST(FutureTest, ThenSkipsContinuationOnError) {
+  ThreadPool thread_pool(1);
+
+  bool called = false;
+  auto future = Async(thread_pool, []() -> int {
+                  throw std::runtime_error("failed");
+                }).Then(thread_pool, [&called](int v) {
+    called = true;
+    return v;
+  });
+
+  EXPECT_THROW(future.Get(), std::runtime_error);
+  EXPECT_FALSE(called);
+}
+
+TEST(FutureTest, ThenOnReadyFuture) {
+  ThreadPool thread_pool(1);
+
+  Promise<int> promise;
+  auto future = promise.GetFuture();
+  promise.SetValue(7);
+  EXPECT_TRUE(future.Ready());
+
+  EXPECT_EQ(8, future.Then(thread_pool, [](int v) { return v + 1; }).Get());
+}
+
+TEST(FutureTest, Promise) {
+  ThreadPool thread_pool(1);
+
+  Promise<int> promise;
+  auto future = promise.GetFuture().Then(thread_pool,
+                                         [](int v) { return v * 2; });
+
+  std::thread thread([&promise] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    promise.SetValue(21);
+  });
+
+  EXPECT_EQ(42, future.Get());
+  thread.join();
+
+  Future<void> broken;
+  {
+    Promise<void> promise;
+    broken = promise.GetFuture();
+  }
+  EXPECT_THROW(broken.Get(), std::future_error);
+}
+
+TEST(FutureTest, WhenAll) {
+  ThreadPool thread_pool(4);
+
+  std::vector<Future<int>> futures;
+  for (int i = 0; i < 100; ++i)
+    futures.emplace_back(Async(thread_pool, [i] { return i * i; }));
+
+  auto sum = WhenAll(std::move(futures))
+                 .Then(thread_pool, [](std::vector<int> values) {
+                   int sum = 0;
+                   for (size_t i = 0; i < values.size(); ++i) {
+                     EXPECT_EQ(static_cast<int>(i * i), values[i]);
+                     sum += values[i];
+                   }
+                   return sum;
+                 });
+  EXPECT_EQ(328350, sum.Get());
+
+  EXPECT_TRUE(WhenAll(std::vector<Future<int>>()).Get().empty());
+
+  std::atomic<int> count(0);
+  std::vector<Future<void>> void_futures;
+  for (int i = 0; i < 10; ++i)
+    void_futures.emplace_back(Async(thread_pool, [&count] { ++count; }));
+  WhenAll(std::move(void_futures)).Get();
+  EXPECT_EQ(10, count);
+}
+
+TEST(FutureTest, WhenAllPropagatesFirstException) {
+  ThreadPool thread_pool(4);
+
+  std::vector<Future<int>> futures;
+  futures.emplace_back(Async(thread_pool, [] { return 1; }));
+  futures.emplace_back(Async(thread_pool, []() -> int {
+    throw std::runtime_error("first");
+  }));
+  futures.emplace_back(Async(thread_pool, []() -> int {
+    throw std::logic_error("second");
+  }));
+
+  EXPECT_THROW(WhenAll(std::move(futures)).Get(), std::runtime_error);
+}
+
+TEST(FutureTest, WhenAny) {
+  ThreadPool thread_pool(2);
+
+  Promise<int> slow;
+  std::vector<Future<int>> futures;
+  futures.emplace_back(slow.GetFuture());
+  futures.emplace_back(Async(thread_pool, [] { return 2; }));
+
+  EXPECT_EQ(1U, WhenAny(futures).Get());
+  EXPECT_EQ(2, futures[1].Get());
+
+  // The other futures can still be waited for, or continued.
+  auto doubled = std::move(futures[0]).Then(thread_pool,
+                                            [](int v) { return v * 2; });
+  slow.SetValue(3);
+  EXPECT_EQ(6, doubled.Get());
+}
+
+TEST(FutureTest, BreaksPromisesOfDiscardedTasks) {
+  Future<int> task, continuation, ready_continuation;
+  Future<void> void_task;
+  Promise<int> promise;
+
+  {
+    // Without threads, tasks stay queued until the pool is destroyed.
+    ThreadPool thread_pool(0);
+
+    task = Async(thread_pool, [] { return 1; });
+    void_task = Async(thread_pool, [] {});
+    continuation = Async(thread_pool, [] { return 1; })
+                       .Then(thread_pool, [](int v) { return v + 1; });
+
+    ready_continuation = promise.GetFuture().Then(thread_pool,
+                                                  [](int v) { return v; });
+    promise.SetValue(1);
+  }
+
+  for (auto future : {&task, &continuation, &ready_continuation}) {
+    try {
+      future->Get();
+      ADD_FAILURE() << "Discarded task returned a value";
+    } catch (const std::future_error& e) {
+      EXPECT_EQ(std::future_errc::broken_promise, e.code());
+    }
+  }
+
+  EXPECT_THROW(void_task.Get(), std::future_error);
+}
@@ -0,0 +1,395 @@
+// Image resampling and normalization kernels.
+//
+// Resizing is separable: every output coordinate is a weighted sum of a few
+// consecutive input coordinates, for bilinear interpolation and area
+// averaging alike.  Input rows are converted to floats and resampled
+// horizontally, and the resulting rows are then blended vertically, which
+// is where most of the arithmetic happens, four samples at a time.
+
+#include "base/image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+
+#include <kj/debug.h>
+
+#if __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "base/macros.h"
+#include "base/thread-pool.h"
+
+namespace ev {
+
+namespace {
+
+const char* const kImageSampleTypeNames[] = {"uint16", "int16"};
+
+const char* const kImageResizeMethodNames[] = {"bilinear", "area"};
+
+// The input coordinates contributing to each output coordinate along one
+// axis.
+struct Taps {
+  struct Tap {
+    size_t start;
+    size_t count;
+    size_t weights;  // Offset in `weights`.
+  };
+
+  std::vector<Tap> taps;
+  std::vector<float> weights;
+};
+
+Taps BilinearTaps(size_t input_size, size_t output_size) {
+  Taps result;
+  const double scale = static_cast<double>(input_size) / output_size;
+
+  for (size_t i = 0; i < output_size; ++i) {
+    const auto position = std::min(
+        std::max((i + 0.5) * scale - 0.5, 0.0), input_size - 1.0);
+    const auto start = std::min(static_cast<size_t>(position),
+                                input_size - 1);
+    const float fraction = position - start;
+
+    if (start + 1 == input_size || fraction == 0.0f) {
+      result.taps.push_back(Taps::Tap{start, 1, result.weights.size()});
+      result.weights.push_back(1.0f);
+    } else {
+      result.taps.push_back(Taps::Tap{start, 2, result.weights.size()});
+      result.weights.push_back(1.0f - fraction);
+      result.weights.push_back(fraction);
+    }
+  }
+
+  return result;
+}
+
+Taps AreaTaps(size_t input_size, size_t output_size) {
+  Taps result;
+  const double scale = static_cast<double>(input_size) / output_size;
+
+  for (size_t i = 0; i < output_size; ++i) {
+    const auto begin = i * scale;
+    const auto end = std::min((i + 1) * scale, static_cast<double>(input_size));
+
+    const auto start = std::min(static_cast<size_t>(begin), input_size - 1);
+    const auto stop = std::max(
+        std::min(static_cast<size_t>(std::ceil(end)), input_size), start + 1);
+
+    result.taps.push_back(
+        Taps::Tap{start, stop - start, result.weights.size()});
+
+    for (auto j = start; j < stop; ++j) {
+      const auto coverage =
+          std::min(end, j + 1.0) - std::max(begin, static_cast<double>(j));
+      result.weights.push_back(std::max(coverage, 0.0) / (end - begin));
+    }
+  }
+
+  return result;
+}
+
+Taps MakeTaps(size_t input_size, size_t output_size,
+              ImageResizeMethod method) {
+  switch (method) {
+    case kImageResizeBilinear:
+      return BilinearTaps(input_size, output_size);
+
+    case kImageResizeArea:
+      return AreaTaps(input_size, output_size);
+  }
+
+  KJ_FAIL_REQUIRE("Unknown resize method", method);
+}
+
+// Converts `size` samples of the given type to floats.
+void ConvertRow(ImageSampleType type, const void* input, float* output,
+                size_t size) {
+  size_t i = 0;
+
+  if (type == kImageSampleUInt16) {
+    auto samples = reinterpret_cast<const uint16_t*>(input);
+
+#if __SSE2__
+    const auto zero = _mm_setzero_si128();
+    for (; i + 8 <= size; i += 8) {
+      const auto v =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+      _mm_storeu_ps(output + i,
+                    _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)));
+      _mm_storeu_ps(output + i + 4,
+                    _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)));
+    }
+#endif
+
+    for (; i < size; ++i) output[i] = samples[i];
+  } else {
+    auto samples = reinterpret_cast<const int16_t*>(input);
+
+#if __SSE2__
+    for (; i + 8 <= size; i += 8) {
+      const auto v =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+      // Sign extends by shifting the samples into the upper halves.
+      _mm_storeu_ps(output + i, _mm_cvtepi32_ps(_mm_srai_epi32(
+                                    _mm_unpacklo_epi16(v, v), 16)));
+      _mm_storeu_ps(output + i + 4, _mm_cvtepi32_ps(_mm_srai_epi32(
+                                        _mm_unpackhi_epi16(v, v), 16)));
+    }
+#endif
+
+    for (; i < size; ++i) output[i] = samples[i];
+  }
+}
+
+// Adds `input` multiplied by `weight` to `output`.
+void MultiplyAdd(float* output, const float* input, float weight,
+                 size_t size) {
+  size_t i = 0;
+
+#if __SSE2__
+  const auto w = _mm_set1_ps(weight);
+  for (; i + 4 <= size; i += 4) {
+    _mm_storeu_ps(output + i,
+                  _mm_add_ps(_mm_loadu_ps(output + i),
+                             _mm_mul_ps(_mm_loadu_ps(input + i), w)));
+  }
+#endif
+
+  for (; i < size; ++i) output[i] += input[i] * weight;
+}
+
+// Adds the sum of the `size` samples at `data` to `sum`, and the sum of their
+// squares to `sum_squares`.
+void AddMoments(const float* data, size_t size, double& sum,
+                double& sum_squares) {
+  size_t i = 0;
+
+#if __SSE2__
+  auto sum_v = _mm_setzero_pd();
+  auto sum_squares_v = _mm_setzero_pd();
+
+  for (; i + 4 <= size; i += 4) {
+    const auto v = _mm_loadu_ps(data + i);
+    const auto lo = _mm_cvtps_pd(v);
+    const auto hi = _mm_cvtps_pd(_mm_movehl_ps(v, v));
+
+    sum_v = _mm_add_pd(sum_v, _mm_add_pd(lo, hi));
+    sum_squares_v = _mm_add_pd(
+        sum_squares_v, _mm_add_pd(_mm_mul_pd(lo, lo), _mm_mul_pd(hi, hi)));
+  }
+
+  double lanes[2];
+  _mm_storeu_pd(lanes, sum_v);
+  sum += lanes[0] + lanes[1];
+  _mm_storeu_pd(lanes, sum_squares_v);
+  sum_squares += lanes[0] + lanes[1];
+#endif
+
+  for (; i < size; ++i) {
+    sum += data[i];
+    sum_squares += static_cast<double>(data[i]) * data[i];
+  }
+}
+
+// Replaces each of the `size` samples at `data` with `(sample - offset) *
+// scale`.
+void OffsetAndScale(float* data, size_t size, float offset, float scale) {
+  size_t i = 0;
+
+#if __SSE2__
+  const auto offset_v = _mm_set1_ps(offset);
+  const auto scale_v = _mm_set1_ps(scale);
+
+  for (; i + 4 <= size; i += 4) {
+    _mm_storeu_ps(data + i, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(data + i),
+                                                  offset_v),
+                                       scale_v));
+  }
+#endif
+
+  for (; i < size; ++i) data[i] = (data[i] - offset) * scale;
+}
+
+// Computes the offset and scale standardizing `size` samples with the given
+// moments.  Returns false if their standard deviation is zero.
+bool StandardizingTransform(double sum, double sum_squares, size_t size,
+                            float& offset, float& scale) {
+  const auto mean = sum / size;
+  const auto variance = std::max(sum_squares / size - mean * mean, 0.0);
+  if (!(variance > 0.0)) return false;
+
+  offset = mean;
+  scale = 1.0 / std::sqrt(variance);
+
+  return true;
+}
+
+}  // namespace
+
+ImageSampleType ImageSampleTypeFromName(const StringRef& name) {
+  for (size_t i = 0; i < ARRAY_SIZE(kImageSampleTypeNames); ++i) {
+    if (name == kImageSampleTypeNames[i])
+      return static_cast<ImageSampleType>(i);
+  }
+
+  KJ_FAIL_REQUIRE("Unknown image sample type", name);
+}
+
+ImageResizeMethod ImageResizeMethodFromName(const StringRef& name) {
+  for (size_t i = 0; i < ARRAY_SIZE(kImageResizeMethodNames); ++i) {
+    if (name == kImageResizeMethodNames[i])
+      return static_cast<ImageResizeMethod>(i);
+  }
+
+  KJ_FAIL_REQUIRE("Unknown image resize method", name);
+}
+
+void ResizeImage(const Image16& input, float* output, size_t output_width,
+                 size_t output_height, ImageResizeMethod method) {
+  KJ_REQUIRE(input.width > 0 && input.height > 0, input.width, input.height);
+  KJ_REQUIRE(output_width > 0 && output_height > 0, output_width,
+             output_height);
+
+  const auto columns = MakeTaps(input.width, output_width, method);
+  const auto rows = MakeTaps(input.height, output_height, method);
+
+  // Only input rows contributing to the output are resampled.
+  std::vector<bool> used_rows(input.height, false);
+  for (const auto& tap : rows.taps)
+    std::fill_n(used_rows.begin() + tap.start, tap.count, true);
+
+  std::vector<float> input_row(input.width);
+  std::vector<float> resampled(input.height * output_width);
+
+  const auto sample_data = reinterpret_cast<const char*>(input.data);
+
+  for (size_t y = 0; y < input.height; ++y) {
+    if (!used_rows[y]) continue;
+
+    ConvertRow(input.type, sample_data + y * input.width * sizeof(uint16_t),
+               input_row.data(), input.width);
+
+    auto resampled_row = &resampled[y * output_width];
+
+    for (size_t x = 0; x < output_width; ++x) {
+      const auto& tap = columns.taps[x];
+      const auto weights = &columns.weights[tap.weights];
+
+      float sum = 0.0f;
+      for (size_t i = 0; i < tap.count; ++i)
+        sum += input_row[tap.start + i] * weights[i];
+
+      resampled_row[x] = sum;
+    }
+  }
+
+  for (size_t y = 0; y < output_height; ++y) {
+    const auto& tap = rows.taps[y];
+    const auto weights = &rows.weights[tap.weights];
+    auto output_row = output + y * output_width;
+
+    std::fill_n(output_row, output_width, 0.0f);
+
+    for (size_t i = 0; i < tap.count; ++i) {
+      MultiplyAdd(output_row, &resampled[(tap.start + i) * output_width],
+                  weights[i], output_width);
+    }
+  }
+}
+
+bool ResizeStandardizedImage(const Image16& input, float* output,
+                             size_t output_width, size_t output_height,
+                             ImageResizeMethod method) {
+  KJ_REQUIRE(input.width > 0 && input.height > 0, input.width, input.height);
+
+  double sum = 0.0, sum_squares = 0.0;
+
+  std::vector<float> input_row(input.width);
+  const auto sample_data = reinterpret_cast<const char*>(input.data);
+
+  for (size_t y = 0; y < input.height; ++y) {
+    ConvertRow(input.type, sample_data + y * input.width * sizeof(uint16_t),
+               input_row.data(), input.width);
+    AddMoments(input_row.data(), input.width, sum, sum_squares);
+  }
+
+  ResizeImage(input, output, output_width, output_height, method);
+
+  // The weights of every output sample sum to one, so standardizing the
+  // output with the statistics of the input is the same as resizing the
+  // standardized input.
+  float offset, scale;
+  if (!StandardizingTransform(sum, sum_squares, input.width * input.height,
+                              offset, scale))
+    return false;
+
+  OffsetAndScale(output, output_width * output_height, offset, scale);
+
+  return true;
+}
+
+bool ResizeImages(ThreadPool& thread_pool, const std::vector<Image16>& inputs,
+                  float* output, size_t output_width, size_t output_height,
+                  ImageResizeMethod method, bool standardize) {
+  // Tasks can't be abandoned once launched, so inputs are checked first.
+  KJ_REQUIRE(output_width > 0 && output_height > 0, output_width,
+             output_height);
+  KJ_REQUIRE(method == kImageResizeBilinear || method == kImageResizeArea,
+             method);
+  for (const auto& input : inputs)
+    KJ_REQUIRE(input.width > 0 && input.height > 0, input.width, input.height);
+
+  const auto output_size = output_width * output_height;
+
+  std::vector<std::future<bool>> results;
+  results.reserve(inputs.size());
+
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    results.emplace_back(thread_pool.Launch([&, i] {
+      if (standardize) {
+        return ResizeStandardizedImage(inputs[i], output + i * output_size,
+                                       output_width, output_height, method);
+      }
+
+      ResizeImage(inputs[i], output + i * output_size, output_width,
+                  output_height, method);
+      return true;
+    }));
+  }
+
+  bool all_standardized = true;
+  for (auto& result : results) all_standardized &= result.get();
+
+  return all_standardized;
+}
+
+bool StandardizeImage(float* data, size_t size) {
+  if (!size) return false;
+
+  double sum = 0.0, sum_squares = 0.0;
+  AddMoments(data, size, sum, sum_squares);
+
+  float offset, scale;
+  if (!StandardizingTransform(sum, sum_squares, size, offset, scale))
+    return false;
+
+  OffsetAndScale(data, size, offset, scale);
+
+  return true;
+}
+
+void SubtractMeanImage(float* data, size_t count, size_t size) {
+  if (!count) return;
+
+  std::vector<float> mean(size, 0.0f);
+  for (size_t i = 0; i < count; ++i)
+    MultiplyAdd(mean.data(), data + i * size, 1.0f / count, size);
+
+  for (size_t i = 0; i < count; ++i)
+    MultiplyAdd(data + i * size, mean.data(), -1.0f, size);
+}
+
+}  // namespace ev
@@ -0,0 +1,74 @@
+#ifndef BASE_IMAGE_H_
+#define BASE_IMAGE_H_ 1
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "base/stringref.h"
+
+namespace ev {
+
+class ThreadPool;
+
+enum ImageSampleType : uint32_t {
+  kImageSampleUInt16 = 0,
+  kImageSampleInt16 = 1,
+};
+
+enum ImageResizeMethod : uint32_t {
+  // Linear interpolation between the four nearest samples, with sample
+  // centers aligned like `skimage.transform.resize()` does.
+  kImageResizeBilinear = 0,
+
+  // Averages the input samples covered by each output sample, weighted by
+  // their coverage.  Best suited for reducing images.
+  kImageResizeArea = 1,
+};
+
+// Returns the sample type with the given NumPy name, "uint16" or "int16".
+ImageSampleType ImageSampleTypeFromName(const StringRef& name);
+
+// Returns the resize method with the given name, "bilinear" or "area".
+ImageResizeMethod ImageResizeMethodFromName(const StringRef& name);
+
+// A 16 bit grayscale image in native byte order, stored row by row.
+struct Image16 {
+  ImageSampleType type = kImageSampleUInt16;
+  const void* data = nullptr;
+  size_t width = 0;
+  size_t height = 0;
+};
+
+// Resizes `input`, writing `output_width` * `output_height` samples to
+// `output`.
+void ResizeImage(const Image16& input, float* output, size_t output_width,
+                 size_t output_height, ImageResizeMethod method);
+
+// Like `ResizeImage()`, but first scales the input samples to zero mean and
+// unit variance, like `StandardizeImage()`.  Returns false, leaving the
+// output unscaled, if the standard deviation of the input is zero.
+bool ResizeStandardizedImage(const Image16& input, float* output,
+                             size_t output_width, size_t output_height,
+                             ImageResizeMethod method);
+
+// Resizes all images in `inputs` like `ResizeImage()`, or like
+// `ResizeStandardizedImage()` if `standardize` is true, writing the output
+// images consecutively to `output`.  Images are resized in parallel on
+// `thread_pool`.  Returns false if any image could not be standardized.
+bool ResizeImages(ThreadPool& thread_pool, const std::vector<Image16>& inputs,
+                  float* output, size_t output_width, size_t output_height,
+                  ImageResizeMethod method, bool standardize);
+
+// Subtracts the mean of the `size` samples at `data` from each, and divides
+// them by their standard deviation.  Returns false, leaving the samples
+// unchanged, if the standard deviation is zero.
+bool StandardizeImage(float* data, size_t size);
+
+// Subtracts the mean of `count` consecutive images of `size` samples each
+// from every image, e.g. to emphasize the moving parts of a sequence.
+void SubtractMeanImage(float* data, size_t count, size_t size);
+
+}  // namespace ev
+
+#endif  // !BASE_IMAGE_H_
@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <type_traits>
+#include <vector>
+
+#include "base/image.h"
+#include "base/thread-pool.h"
+#include "third_party/gtest/gtest.h"
+
+using namespace ev;
+
+namespace {
+
+template <typename T>
+Image16 MakeImage(const std::vector<T>& samples, size_t width,
+                  size_t height) {
+  Image16 result;
+  result.type = std::is_signed<T>::value ? kImageSampleInt16
+                                         : kImageSampleUInt16;
+  result.data = samples.data();
+  result.width = width;
+  result.height = height;
+  return result;
+}
+
+}  // namespace
+
+struct ImageTest : public testing::Test {};
+
+TEST_F(ImageTest, ResizeToSameSize) {
+  // Rows of 19 samples take both the vector and the scalar conversion path.
+  const size_t width = 19, height = 3;
+
+  std::vector<uint16_t> unsigned_samples(width * height);
+  std::vector<int16_t> signed_samples(width * height);
+  for (size_t i = 0; i < width * height; ++i) {
+    unsigned_samples[i] = 65535 - i * 1000;
+    signed_samples[i] = static_cast<int16_t>(i * 1000 - 30000);
+  }
+
+  for (const auto method : {kImageResizeBilinear, kImageResizeArea}) {
+    std::vector<float> output(width * height);
+
+    ResizeImage(MakeImage(unsigned_samples, width, height), output.data(),
+                width, height, method);
+    for (size_t i = 0; i < output.size(); ++i)
+      EXPECT_EQ(unsigned_samples[i], output[i]) << i;
+
+    ResizeImage(MakeImage(signed_samples, width, height), output.data(),
+                width, height, method);
+    for (size_t i = 0; i < output.size(); ++i)
+      EXPECT_EQ(signed_samples[i], output[i]) << i;
+  }
+}
+
+TEST_F(ImageTest, ResizeNonSquareImage) {
+  // 4 columns by 2 rows.
+  const std::vector<uint16_t> samples{1, 2, 3, 4,
+                                      5, 6, 7, 8};
+  const auto image = MakeImage(samples, 4, 2);
+
+  for (const auto method : {kImageResizeBilinear, kImageResizeArea}) {
+    // Halving both dimensions averages 2 by 2 blocks.
+    std::vector<float> output(2);
+    ResizeImage(image, output.data(), 2, 1, method);
+    EXPECT_FLOAT_EQ(3.5f, output[0]);
+    EXPECT_FLOAT_EQ(5.5f, output[1]);
+
+    // Keeping the columns and merging the rows.
+    output.resize(4);
+    ResizeImage(image, output.data(), 4, 1, method);
+    EXPECT_FLOAT_EQ(3.0f, output[0]);
+    EXPECT_FLOAT_EQ(4.0f, output[1]);
+    EXPECT_FLOAT_EQ(5.0f, output[2]);
+    EXPECT_FLOAT_EQ(6.0f, output[3]);
+
+    // Keeping the rows and merging the columns.
+    output.resize(2);
+    ResizeImage(image, output.data(), 1, 2, method);
+    EXPECT_FLOAT_EQ(2.5f, output[0]);
+    EXPECT_FLOAT_EQ(6.5f, output[1]);
+  }
+}
+
+TEST_F(ImageTest, ResizeEnlarges) {
+  const std::vector<uint16_t> samples{10, 30};
+  const auto image = MakeImage(samples, 2, 1);
+
+  // Sample centers are aligned, and the edges repeat the outer samples.
+  std::vector<float> output(4 * 2);
+  ResizeImage(image, output.data(), 4, 2, kImageResizeBilinear);
+  for (size_t y = 0; y < 2; ++y) {
+    EXPECT_FLOAT_EQ(10.0f, output[y * 4 + 0]);
+    EXPECT_FLOAT_EQ(15.0f, output[y * 4 + 1]);
+    EXPECT_FLOAT_EQ(25.0f, output[y * 4 + 2]);
+    EXPECT_FLOAT_EQ(30.0f, output[y * 4 + 3]);
+  }
+
+  ResizeImage(image, output.data(), 4, 2, kImageResizeArea);
+  for (size_t y = 0; y < 2; ++y) {
+    EXPECT_FLOAT_EQ(10.0f, output[y * 4 + 0]);
+    EXPECT_FLOAT_EQ(10.0f, output[y * 4 + 1]);
+    EXPECT_FLOAT_EQ(30.0f, output[y * 4 + 2]);
+    EXPECT_FLOAT_EQ(30.0f, output[y * 4 + 3]);
+  }
+}
+
+TEST_F(ImageTest, ResizePreservesConstantImages) {
+  const std::vector<uint16_t> samples(23 * 11, 1234);
+  const auto image = MakeImage(samples, 23, 11);
+
+  for (const auto method : {kImageResizeBilinear, kImageResizeArea}) {
+    std::vector<float> output(9 * 17);
+    ResizeImage(image, output.data(), 9, 17, method);
+    for (const auto v : output) EXPECT_FLOAT_EQ(1234.0f, v);
+
+    output.resize(5 * 4);
+    ResizeImage(image, output.data(), 5, 4, method);
+    for (const auto v : output) EXPECT_FLOAT_EQ(1234.0f, v);
+  }
+}
+
+TEST_F(ImageTest, StandardizeImage) {
+  // 10 samples take both the vector and the scalar path.
+  std::vector<float> data{1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+  ASSERT_TRUE(StandardizeImage(data.data(), data.size()));
+
+  const auto mean =
+      std::accumulate(data.begin(), data.end(), 0.0) / data.size();
+  double variance = 0.0;
+  for (const auto v : data) variance += (v - mean) * (v - mean);
+  variance /= data.size();
+
+  EXPECT_NEAR(0.0, mean, 1e-6);
+  EXPECT_NEAR(1.0, variance, 1e-6);
+  EXPECT_NEAR((1.0 - 5.5) / std::sqrt(8.25), data[0], 1e-6);
+
+  std::vector<float> constant(7, 3.0f);
+  EXPECT_FALSE(StandardizeImage(constant.data(), constant.size()));
+  for (const auto v : constant) EXPECT_EQ(3.0f, v);
+
+  EXPECT_FALSE(StandardizeImage(nullptr, 0));
+}
+
+TEST_F(ImageTest, ResizeStandardizedImage) {
+  const size_t width = 6, height = 4;
+  std::vector<uint16_t> samples(width * height);
+  for (size_t i = 0; i < samples.size(); ++i) samples[i] = (i * 37) % 101;
+  const auto image = MakeImage(samples, width, height);
+
+  // Same as standardizing the input samples.
+  std::vector<float> expected(samples.begin(), samples.end());
+  ASSERT_TRUE(StandardizeImage(expected.data(), expected.size()));
+
+  std::vector<float> output(width * height);
+  ASSERT_TRUE(ResizeStandardizedImage(image, output.data(), width, height,
+                                      kImageResizeBilinear));
+  for (size_t i = 0; i < output.size(); ++i)
+    EXPECT_NEAR(expected[i], output[i], 1e-5) << i;
+
+  // Halving the image averages the standardized input samples.
+  output.resize(3 * 2);
+  ASSERT_TRUE(ResizeStandardizedImage(image, output.data(), 3, 2,
+                                      kImageResizeArea));
+  for (size_t y = 0; y < 2; ++y) {
+    for (size_t x = 0; x < 3; ++x) {
+      const auto top = &expected[2 * y * width + 2 * x];
+      const auto bottom = top + width;
+      EXPECT_NEAR((top[0] + top[1] + bottom[0] + bottom[1]) / 4,
+                  output[y * 3 + x], 1e-5);
+    }
+  }
+
+  const std::vector<uint16_t> constant(width * height, 5);
+  EXPECT_FALSE(ResizeStandardizedImage(MakeImage(constant, width, height),
+                                       output.data(), 3, 2,
+                                       kImageResizeArea));
+}
+
+TEST_F(ImageTest, SubtractMeanImage) {
+  std::vector<float> data{1, 2, 3, 4, 5,
+                          3, 2, 1, 0, 5,
+                          5, 2, 2, 2, 5};
+  SubtractMeanImage(data.data(), 3, 5);
+
+  const std::vector<float> expected{-2, 0, 1, 2, 0,
+                                    0, 0, -1, -2, 0,
+                                    2, 0, 0, 0, 0};
+  for (size_t i = 0; i < data.size(); ++i)
+    EXPECT_NEAR(expected[i], data[i], 1e-6) << i;
+}
+
+TEST_F(ImageTest, ResizeImages) {
+  ThreadPool thread_pool(4);
+
+  std::vector<std::vector<uint16_t>> samples;
+  std::vector<Image16> images;
+  for (size_t i = 0; i < 16; ++i) {
+    samples.emplace_back((i + 1) * (i + 2));
+    std::iota(samples.back().begin(), samples.back().end(), i);
+  }
+
+  // The first image has no variance.
+  std::fill(samples[0].begin(), samples[0].end(), 7);
+
+  for (size_t i = 0; i < samples.size(); ++i)
+    images.emplace_back(MakeImage(samples[i], i + 1, i + 2));
+
+  for (const auto standardize : {false, true}) {
+    std::vector<float> output(images.size() * 3 * 5);
+    EXPECT_EQ(!standardize,
+              ResizeImages(thread_pool, images, output.data(), 3, 5,
+                           kImageResizeBilinear, standardize));
+
+    for (size_t i = standardize ? 1 : 0; i < images.size(); ++i) {
+      std::vector<float> expected(3 * 5);
+      if (standardize) {
+        ResizeStandardizedImage(images[i], expected.data(), 3, 5,
+                                kImageResizeBilinear);
+      } else {
+        ResizeImage(images[i], expected.data(), 3, 5, kImageResizeBilinear);
+      }
+
+      for (size_t j = 0; j < expected.size(); ++j)
+        EXPECT_EQ(expected[j], output[i * expected.size() + j]) << i;
+    }
+  }
+}
@@ -0,0 +1,163 @@
+// Measures how the algorithms in base/parallel.h scale with the number of
+// threads, compared to their serial standard library counterparts.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <err.h>
+#include <getopt.h>
+#include <sysexits.h>
+
+#include <kj/debug.h>
+
+#include "base/parallel.h"
+
+namespace {
+
+int print_help;
+
+struct option kLongOptions[] = {{"repeat", required_argument, nullptr, 'r'},
+                                {"size", required_argument, nullptr, 's'},
+                                {"threads", required_argument, nullptr, 't'},
+                                {"help", no_argument, &print_help, 1},
+                                {nullptr, 0, nullptr, 0}};
+
+// Returns the best time of `repeat` calls to `f`, in seconds.  `reset` is
+// called before each run, and is not timed.
+template <typename Reset, typename Function>
+double Measure(size_t repeat, Reset reset, Function f) {
+  double best = 0.0;
+
+  for (size_t i = 0; i < repeat; ++i) {
+    reset();
+
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    if (!i || elapsed.count() < best) best = elapsed.count();
+  }
+
+  return best;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) try {
+  size_t max_threads = std::thread::hardware_concurrency();
+  size_t size = 10000000;
+  size_t repeat = 3;
+
+  int i;
+  while ((i = getopt_long(argc, argv, "", kLongOptions, 0)) != -1) {
+    if (!i) continue;
+    if (i == '?')
+      errx(EX_USAGE, "Try '%s --help' for more information.", argv[0]);
+
+    switch (i) {
+      case 'r':
+        repeat = strtoul(optarg, nullptr, 0);
+        break;
+
+      case 's':
+        size = strtoul(optarg, nullptr, 0);
+        break;
+
+      case 't':
+        max_threads = strtoul(optarg, nullptr, 0);
+        break;
+    }
+  }
+
+  if (print_help) {
+    printf(
+        "Usage: %s [OPTION]...\n"
+        "\n"
+        "      --repeat=N         run each benchmark N times, and report the "
+        "best\n"
+        "      --size=N           process N elements\n"
+        "      --threads=N        use up to N worker threads\n"
+        "      --help             display this help and exit\n",
+        argv[0]);
+
+    return EXIT_SUCCESS;
+  }
+
+  if (optind != argc) errx(EX_USAGE, "Usage: %s [OPTION]...", argv[0]);
+
+  if (!max_threads || !size || !repeat)
+    errx(EX_USAGE, "--threads, --size and --repeat must be positive");
+
+  std::vector<float> input(size);
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> distribution(0.0f, 1000.0f);
+  for (auto& v : input) v = distribution(rng);
+
+  std::vector<float> data;
+  auto reset = [&] { data = input; };
+
+  auto transform = [](float v) { return std::sqrt(v) * 0.5f - 1.0f; };
+
+  printf("%lu elements, times in ms\n\n", static_cast<unsigned long>(size));
+  printf("%-8s %10s %10s %10s %10s\n", "threads", "for", "reduce",
+         "transform", "sort");
+
+  const auto serial_for = Measure(repeat, reset, [&] {
+    for (auto& v : data) v *= 2.0f;
+  });
+  const auto serial_reduce = Measure(repeat, reset, [&] {
+    volatile double sum = std::accumulate(data.begin(), data.end(), 0.0);
+    (void)sum;
+  });
+  const auto serial_transform = Measure(repeat, reset, [&] {
+    std::transform(data.begin(), data.end(), data.begin(), transform);
+  });
+  const auto serial_sort =
+      Measure(repeat, reset, [&] { std::sort(data.begin(), data.end()); });
+
+  printf("%-8s %10.1f %10.1f %10.1f %10.1f\n", "serial", serial_for * 1e3,
+         serial_reduce * 1e3, serial_transform * 1e3, serial_sort * 1e3);
+
+  std::vector<size_t> thread_counts;
+  for (size_t n = 1; n < max_threads; n *= 2) thread_counts.emplace_back(n);
+  thread_counts.emplace_back(max_threads);
+
+  for (const auto threads : thread_counts) {
+    ev::ThreadPool thread_pool(threads);
+
+    const auto parallel_for = Measure(repeat, reset, [&] {
+      ev::ParallelFor(thread_pool, 0, data.size(),
+                      [&data](size_t i) { data[i] *= 2.0f; }, 65536);
+    });
+    const auto parallel_reduce = Measure(repeat, reset, [&] {
+      volatile double sum = ev::ParallelReduce(
+          thread_pool, 0, data.size(), 0.0,
+          [&data](size_t i) { return data[i]; },
+          [](double a, double b) { return a + b; }, 65536);
+      (void)sum;
+    });
+    const auto parallel_transform = Measure(repeat, reset, [&] {
+      ev::ParallelTransform(thread_pool, data.begin(), data.end(),
+                            data.begin(), transform, 65536);
+    });
+    const auto parallel_sort = Measure(repeat, reset, [&] {
+      ev::ParallelSort(thread_pool, data.begin(), data.end());
+    });
+
+    printf("%-8lu %10.1f %10.1f %10.1f %10.1f\n",
+           static_cast<unsigned long>(threads), parallel_for * 1e3,
+           parallel_reduce * 1e3, parallel_transform * 1e3,
+           parallel_sort * 1e3);
+  }
+} catch (kj::Exception e) {
+  KJ_LOG(FATAL, e);
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,324 @@
+#ifndef BASE_PARALLEL_H_
+#define BASE_PARALLEL_H_ 1
+
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <vector>
+
+#include "base/thread-pool.h"
+
+// Data parallel algorithms running on a `ThreadPool`.
+//
+// Work is split into at most `kParallelChunksPerThread` chunks per thread, so
+// that threads finishing early can pick up more, and chunks of no fewer than
+// `grain_size` elements, so that the cost of scheduling a chunk is amortized.
+// Chunk boundaries only depend on the input size, the grain size and the
+// number of threads, so results of non-associative operations like floating
+// point addition are reproducible for a given thread pool.
+//
+// The calling thread processes one chunk itself, and then blocks until the
+// others have completed.  These functions must therefore not be called from
+// tasks running on the same thread pool, which could end up waiting for
+// chunks queued behind themselves.
+
+namespace ev {
+
+const size_t kParallelChunksPerThread = 4;
+
+namespace parallel_internal {
+
+// Returns the number of chunks to split `size` elements into.
+inline size_t ChunkCount(const ThreadPool& thread_pool, size_t size,
+                         size_t grain_size) {
+  if (!grain_size) grain_size = 1;
+
+  const auto max_chunks = thread_pool.Size() * kParallelChunksPerThread;
+  const auto chunks = size / grain_size;
+
+  return std::max<size_t>(1, std::min(chunks, max_chunks));
+}
+
+// Returns the first element of chunk `index`, when `size` elements are split
+// into `chunks` chunks.
+inline size_t ChunkBegin(size_t size, size_t chunks, size_t index) {
+  // Computes `size * index / chunks` without overflowing.
+  return size / chunks * index + size % chunks * index / chunks;
+}
+
+// Calls `f(index)` for every chunk index in [0, chunks), all but the first in
+// `thread_pool`, and waits for all calls to return.  The first exception
+// thrown is rethrown, after all calls have returned.
+template <typename Function>
+void RunChunks(ThreadPool& thread_pool, size_t chunks, Function& f) {
+  if (chunks == 1) {
+    f(0);
+    return;
+  }
+
+  std::vector<std::future<bool>> results;
+  results.reserve(chunks - 1);
+
+  std::exception_ptr error;
+
+  try {
+    // `ThreadPool` runs tasks in this thread once its backlog is full, in
+    // which case Launch() throws the task's exceptions directly.
+    for (size_t i = 1; i < chunks; ++i) {
+      results.emplace_back(thread_pool.Launch([&f, i] {
+        f(i);
+        return true;
+      }));
+    }
+
+    f(0);
+  } catch (...) {
+    error = std::current_exception();
+  }
+
+  // Chunks refer to `f`, so they must all complete before returning.
+  for (auto& result : results) {
+    try {
+      result.get();
+    } catch (...) {
+      if (!error) error = std::current_exception();
+    }
+  }
+
+  if (error) std::rethrow_exception(error);
+}
+
+// Returns the number of elements taken from `a` among the first `count`
+// elements of the stable merge of the sorted ranges `a` and `b`.
+template <typename Iterator, typename Compare>
+size_t MergeSplit(Iterator a, size_t a_size, Iterator b, size_t b_size,
+                  size_t count, Compare& comp) {
+  auto lo = count > b_size ? count - b_size : 0;
+  auto hi = std::min(count, a_size);
+
+  while (lo < hi) {
+    const auto mid = lo + (hi - lo) / 2;
+    const auto j = count - mid;
+
+    // Equal elements are taken from `a` first, so a[mid] belongs in the
+    // prefix unless b[j - 1] is strictly smaller.
+    if (j > 0 && !comp(b[j - 1], a[mid]))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+}  // namespace parallel_internal
+
+// Calls `f(chunk_begin, chunk_end)` for consecutive subranges covering
+// [begin, end).
+template <typename Function>
+void ParallelForRange(ThreadPool& thread_pool, size_t begin, size_t end,
+                      Function&& f, size_t grain_size = 1) {
+  if (begin >= end) return;
+
+  const auto size = end - begin;
+  const auto chunks =
+      parallel_internal::ChunkCount(thread_pool, size, grain_size);
+
+  auto chunk = [&](size_t index) {
+    f(begin + parallel_internal::ChunkBegin(size, chunks, index),
+      begin + parallel_internal::ChunkBegin(size, chunks, index + 1));
+  };
+
+  parallel_internal::RunChunks(thread_pool, chunks, chunk);
+}
+
+// Calls `f(i)` for every `i` in [begin, end).
+template <typename Function>
+void ParallelFor(ThreadPool& thread_pool, size_t begin, size_t end,
+                 Function&& f, size_t grain_size = 1) {
+  ParallelForRange(thread_pool, begin, end,
+                   [&f](size_t chunk_begin, size_t chunk_end) {
+                     for (auto i = chunk_begin; i != chunk_end; ++i) f(i);
+                   },
+                   grain_size);
+}
+
+// Returns `identity` combined with `map(i)` for every `i` in [begin, end),
+// using `combine(T, T)`, which must be associative.  Each chunk is reduced
+// from `identity`, and the chunk results are then combined in order.
+template <typename T, typename Map, typename Combine>
+T ParallelReduce(ThreadPool& thread_pool, size_t begin, size_t end,
+                 T identity, Map&& map, Combine&& combine,
+                 size_t grain_size = 1) {
+  if (begin >= end) return identity;
+
+  const auto size = end - begin;
+  const auto chunks =
+      parallel_internal::ChunkCount(thread_pool, size, grain_size);
+
+  std::vector<T> partial(chunks, identity);
+
+  auto chunk = [&](size_t index) {
+    const auto chunk_end =
+        begin + parallel_internal::ChunkBegin(size, chunks, index + 1);
+
+    auto value = identity;
+    for (auto i = begin + parallel_internal::ChunkBegin(size, chunks, index);
+         i != chunk_end; ++i)
+      value = combine(std::move(value), map(i));
+
+    partial[index] = std::move(value);
+  };
+
+  parallel_internal::RunChunks(thread_pool, chunks, chunk);
+
+  auto result = std::move(partial[0]);
+  for (size_t i = 1; i < chunks; ++i)
+    result = combine(std::move(result), std::move(partial[i]));
+
+  return result;
+}
+
+// Stores `f(*i)` for every `i` in [first, last) at the corresponding position
+// of `output`, like std::transform().  Both ranges must be random access, and
+// may be the same.  Returns the end of the output range.
+template <typename InputIterator, typename OutputIterator, typename Function>
+OutputIterator ParallelTransform(ThreadPool& thread_pool, InputIterator first,
+                                 InputIterator last, OutputIterator output,
+                                 Function&& f, size_t grain_size = 1024) {
+  const size_t size = std::distance(first, last);
+
+  ParallelForRange(thread_pool, 0, size,
+                   [&](size_t chunk_begin, size_t chunk_end) {
+                     std::transform(first + chunk_begin, first + chunk_end,
+                                    output + chunk_begin, f);
+                   },
+                   grain_size);
+
+  return output + size;
+}
+
+// Sorts [first, last) like std::sort().  Chunks are sorted independently,
+// and then merged pairwise, with each merge split into pieces that are
+// processed in parallel.  The element type must be default constructible,
+// since an auxiliary buffer of the same size as the input is used.
+template <typename RandomIterator,
+          typename Compare = std::less<
+              typename std::iterator_traits<RandomIterator>::value_type>>
+void ParallelSort(ThreadPool& thread_pool, RandomIterator first,
+                  RandomIterator last, Compare comp = Compare(),
+                  size_t grain_size = 16384) {
+  using namespace parallel_internal;
+  using value_type = typename std::iterator_traits<RandomIterator>::value_type;
+
+  const size_t size = std::distance(first, last);
+  const auto chunks = ChunkCount(thread_pool, size, grain_size);
+
+  if (chunks == 1) {
+    std::sort(first, last, comp);
+    return;
+  }
+
+  // Boundaries of the sorted runs; run i is [runs[i], runs[i + 1]).
+  std::vector<size_t> runs;
+  for (size_t i = 0; i <= chunks; ++i)
+    runs.emplace_back(ChunkBegin(size, chunks, i));
+
+  auto sort_chunk = [&](size_t index) {
+    std::sort(first + runs[index], first + runs[index + 1], comp);
+  };
+  RunChunks(thread_pool, chunks, sort_chunk);
+
+  std::vector<value_type> buffer(size);
+
+  // Each merge pass writes to the buffer that wasn't read.
+  bool in_buffer = false;
+
+  // Approximate number of elements merged by each task.
+  const auto piece_size = (size + chunks - 1) / chunks;
+
+  while (runs.size() > 2) {
+    struct Piece {
+      size_t a_begin, a_end;
+      size_t b_begin, b_end;
+      size_t output;
+    };
+
+    std::vector<Piece> pieces;
+    std::vector<size_t> merged_runs;
+
+    for (size_t i = 0; i + 1 < runs.size(); i += 2) {
+      merged_runs.emplace_back(runs[i]);
+
+      // An odd run at the end is just copied.
+      const auto a_begin = runs[i];
+      const auto a_end = runs[i + 1];
+      const auto b_end = (i + 2 < runs.size()) ? runs[i + 2] : a_end;
+
+      const auto a_size = a_end - a_begin;
+      const auto b_size = b_end - a_end;
+      const auto merge_size = a_size + b_size;
+      const auto count =
+          std::max<size_t>(1, (merge_size + piece_size - 1) / piece_size);
+
+      size_t prev_a = 0, prev_count = 0;
+      for (size_t j = 1; j <= count; ++j) {
+        const auto output_count = ChunkBegin(merge_size, count, j);
+
+        size_t a;
+        if (in_buffer) {
+          a = MergeSplit(buffer.begin() + a_begin, a_size,
+                         buffer.begin() + a_end, b_size, output_count, comp);
+        } else {
+          a = MergeSplit(first + a_begin, a_size, first + a_end, b_size,
+                         output_count, comp);
+        }
+
+        pieces.emplace_back(Piece{a_begin + prev_a, a_begin + a,
+                                  a_end + (prev_count - prev_a),
+                                  a_end + (output_count - a),
+                                  a_begin + prev_count});
+
+        prev_a = a;
+        prev_count = output_count;
+      }
+    }
+
+    merged_runs.emplace_back(size);
+
+    auto merge = [&](auto input, auto output, const Piece& piece) {
+      std::merge(std::make_move_iterator(input + piece.a_begin),
+                 std::make_move_iterator(input + piece.a_end),
+                 std::make_move_iterator(input + piece.b_begin),
+                 std::make_move_iterator(input + piece.b_end),
+                 output + piece.output, comp);
+    };
+
+    auto merge_piece = [&](size_t index) {
+      if (in_buffer)
+        merge(buffer.begin(), first, pieces[index]);
+      else
+        merge(first, buffer.begin(), pieces[index]);
+    };
+    RunChunks(thread_pool, pieces.size(), merge_piece);
+
+    runs.swap(merged_runs);
+    in_buffer = !in_buffer;
+  }
+
+  if (in_buffer) {
+    ParallelForRange(thread_pool, 0, size,
+                     [&](size_t chunk_begin, size_t chunk_end) {
+                       std::move(buffer.begin() + chunk_begin,
+                                 buffer.begin() + chunk_end,
+                                 first + chunk_begin);
+                     },
+                     grain_size);
+  }
+}
+
+}  // namespace ev
+
+#endif  // !BASE_PARALLEL_H_
@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "base/parallel.h"
+#include "third_party/gtest/gtest.h"
+
+using namespace ev;
+
+struct ParallelTest : public testing::Test {
+  ParallelTest() : thread_pool(4) {}
+
+  ThreadPool thread_pool;
+};
+
+TEST_F(ParallelTest, ParallelForVisitsEveryIndexOnce) {
+  for (const size_t size : {0, 1, 7, 100, 10000}) {
+    std::vector<std::atomic<int>> visits(size);
+    for (auto& v : visits) v = 0;
+
+    ParallelFor(thread_pool, 0, size, [&visits](size_t i) { ++visits[i]; });
+
+    for (size_t i = 0; i < size; ++i) EXPECT_EQ(1, visits[i]) << i;
+  }
+}
+
+TEST_F(ParallelTest, ParallelForRangeRespectsGrainSize) {
+  std::atomic<size_t> chunks(0), covered(0);
+
+  ParallelForRange(thread_pool, 10, 1010,
+                   [&](size_t begin, size_t end) {
+                     EXPECT_LE(10U, begin);
+                     EXPECT_GE(1010U, end);
+                     EXPECT_LE(300U, end - begin);
+                     ++chunks;
+                     covered += end - begin;
+                   },
+                   300);
+
+  EXPECT_EQ(3U, chunks);
+  EXPECT_EQ(1000U, covered);
+}
+
+TEST_F(ParallelTest, ParallelForPropagatesExceptions) {
+  EXPECT_THROW(ParallelFor(thread_pool, 0, 1000,
+                           [](size_t i) {
+                             if (i == 500) throw std::runtime_error("500");
+                           }),
+               std::runtime_error);
+}
+
+TEST_F(ParallelTest, ParallelReduce) {
+  EXPECT_EQ(0U, ParallelReduce(thread_pool, 5, 5, size_t(0),
+                               [](size_t i) { return i; },
+                               [](size_t a, size_t b) { return a + b; }));
+
+  EXPECT_EQ(499999500000U,
+            ParallelReduce(thread_pool, 0, 1000000, size_t(0),
+                           [](size_t i) { return i; },
+                           [](size_t a, size_t b) { return a + b; }, 1000));
+
+  // Chunk results are combined in order, so non-commutative operations work.
+  const auto digits = ParallelReduce(
+      thread_pool, 0, 20, std::string(),
+      [](size_t i) { return std::to_string(i % 10); },
+      [](std::string a, const std::string& b) { return a + b; });
+  EXPECT_EQ("01234567890123456789", digits);
+}
+
+TEST_F(ParallelTest, ParallelTransform) {
+  std::vector<int> input(100000);
+  std::iota(input.begin(), input.end(), 0);
+
+  std::vector<long> output(input.size());
+  auto end = ParallelTransform(thread_pool, input.begin(), input.end(),
+                               output.begin(), [](int v) { return 3L * v; });
+  EXPECT_TRUE(end == output.end());
+
+  for (size_t i = 0; i < input.size(); ++i)
+    EXPECT_EQ(3L * static_cast<long>(i), output[i]);
+
+  // In place.
+  ParallelTransform(thread_pool, input.begin(), input.end(), input.begin(),
+                    [](int v) { return -v; });
+  for (size_t i = 0; i < input.size(); ++i)
+    EXPECT_EQ(-static_cast<int>(i), input[i]);
+}
+
+TEST_F(ParallelTest, ParallelSort) {
+  std::mt19937 rng(1234);
+
+  for (const size_t size : {0, 1, 2, 1000, 65537, 1000000}) {
+    std::vector<uint32_t> data(size);
+    // Few distinct values, to exercise merges of equal elements.
+    for (auto& v : data) v = rng() % (size / 8 + 1);
+
+    auto expected = data;
+    std::sort(expected.begin(), expected.end());
+
+    ParallelSort(thread_pool, data.begin(), data.end(), std::less<uint32_t>(),
+                 1000);
+    EXPECT_EQ(expected, data) << size;
+  }
+}
+
+TEST_F(ParallelTest, ParallelSortWithComparator) {
+  std::vector<std::string> data;
+  for (size_t i = 0; i < 50000; ++i) data.emplace_back(std::to_string(i));
+
+  std::shuffle(data.begin(), data.end(), std::mt19937(5678));
+
+  auto expected = data;
+  std::sort(expected.begin(), expected.end(), std::greater<std::string>());
+
+  ParallelSort(thread_pool, data.begin(), data.end(),
+               std::greater<std::string>(), 100);
+  EXPECT_EQ(expected, data);
+}
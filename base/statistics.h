@@ -0,0 +1,20 @@
+#ifndef BASE_STATISTICS_H_
+#define BASE_STATISTICS_H_ 1
+
+#include <cstddef>
+
+namespace ev {
+
+// Evaluates the standard normal cumulative distribution function for the
+// `count` values at `input`, writing the results to `output`, which may
+// equal `input`.  The absolute error is below 1e-14.
+void NormalCDF(const double* input, double* output, size_t count);
+
+// Evaluates the cumulative distribution function of the normal distribution
+// with the given mean and standard deviation at 0, 1, 2, ..., `count - 1`.
+void NormalCDFAtIntegers(double mean, double stddev, double* output,
+                         size_t count);
+
+}  // namespace ev
+
+#endif  // !BASE_STATISTICS_H_
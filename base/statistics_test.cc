@@ -0,0 +1,56 @@
+#include <cmath>
+#include <vector>
+
+#include "base/statistics.h"
+#include "third_party/gtest/gtest.h"
+
+using namespace ev;
+
+namespace {
+
+double ReferenceNormalCDF(double x) { return 0.5 * std::erfc(-x / M_SQRT2); }
+
+}  // namespace
+
+struct StatisticsTest : public testing::Test {};
+
+TEST_F(StatisticsTest, NormalCDF) {
+  // An odd count takes both the vector and the scalar path.
+  std::vector<double> input;
+  for (double x = -10.0; x <= 10.0; x += 0.01) input.emplace_back(x);
+  if (!(input.size() % 2)) input.emplace_back(0.123);
+
+  std::vector<double> output(input.size());
+  NormalCDF(input.data(), output.data(), input.size());
+
+  for (size_t i = 0; i < input.size(); ++i)
+    EXPECT_NEAR(ReferenceNormalCDF(input[i]), output[i], 1e-14) << input[i];
+
+  // Arguments beyond the clamping range.
+  const double tails[] = {-1e300, -40.0, 40.0, 1e300};
+  double tail_output[4];
+  NormalCDF(tails, tail_output, 4);
+  EXPECT_NEAR(0.0, tail_output[0], 1e-14);
+  EXPECT_NEAR(0.0, tail_output[1], 1e-14);
+  EXPECT_NEAR(1.0, tail_output[2], 1e-14);
+  EXPECT_NEAR(1.0, tail_output[3], 1e-14);
+
+  const double zero = 0.0;
+  double half;
+  NormalCDF(&zero, &half, 1);
+  EXPECT_EQ(0.5, half);
+
+  // In place.
+  NormalCDF(input.data(), input.data(), input.size());
+  EXPECT_EQ(output, input);
+}
+
+TEST_F(StatisticsTest, NormalCDFAtIntegers) {
+  std::vector<double> output(600);
+  NormalCDFAtIntegers(250.5, 40.0, output.data(), output.size());
+
+  for (size_t i = 0; i < output.size(); ++i) {
+    EXPECT_NEAR(ReferenceNormalCDF((i - 250.5) / 40.0), output[i], 1e-14)
+        << i;
+  }
+}
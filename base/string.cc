@@ -1,6 +1,8 @@
 #include "string.h"
 
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <cstdlib>
 
 #include <err.h>
@@ -9,6 +11,8 @@
 
 #include <kj/debug.h>
 
+#include "base/macros.h"
+
 namespace ev {
 
 std::string StringPrintf(const char* format, ...) {
@@ -160,4 +164,49 @@ std::string FloatToString(const float v) {
   return StringPrintf("%.9g", v);
 }
 
+void AppendFixed(std::string& output, double v, unsigned decimals) {
+  static const double kPowers[] = {1e0, 1e1, 1e2, 1e3, 1e4,
+                                   1e5, 1e6, 1e7, 1e8, 1e9};
+
+  // 2^53, below which the integer and fractional parts of the scaled value
+  // are exact.
+  static const double kMaxScaled = 9007199254740992.0;
+
+  if (decimals < ARRAY_SIZE(kPowers) &&
+      std::fabs(v) * kPowers[decimals] < kMaxScaled) {
+    const auto scaled = std::fabs(v) * kPowers[decimals];
+    auto integer = static_cast<uint64_t>(scaled);
+    const auto fraction = scaled - integer;
+
+    // `scaled` may be off from the exact product by half a unit in the last
+    // place.  Rounding of values that close to halfway between two outputs
+    // depends on their exact binary value, so they're left to printf.
+    if (std::fabs(fraction - 0.5) > std::max(1e-6, std::ldexp(scaled, -52))) {
+      if (fraction > 0.5) ++integer;
+
+      char buffer[32];
+      auto end = buffer + sizeof(buffer);
+      auto p = end;
+
+      for (unsigned i = 0; i < decimals; ++i) {
+        *--p = '0' + integer % 10;
+        integer /= 10;
+      }
+      if (decimals) *--p = '.';
+
+      do {
+        *--p = '0' + integer % 10;
+        integer /= 10;
+      } while (integer);
+
+      if (std::signbit(v)) *--p = '-';
+
+      output.append(p, end);
+      return;
+    }
+  }
+
+  output += StringPrintf("%.*f", decimals, v);
+}
+
 }  // namespace ev
@@ -82,6 +82,11 @@ float StringToFloat(const char* string);
 std::string DoubleToString(const double v);
 std::string FloatToString(const float v);
 
+// Appends `v` to `output` with `decimals` digits after the decimal point,
+// exactly like printf("%.*f").  Values of moderate magnitude are formatted
+// without calling printf.
+void AppendFixed(std::string& output, double v, unsigned decimals);
+
 }  // namespace ev
 
 #endif  // !BASE_STRING_H_
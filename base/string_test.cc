@@ -0,0 +1,64 @@
+#include <cmath>
+#include <limits>
+#include <random>
+
+#include "base/string.h"
+#include "third_party/gtest/gtest.h"
+
+using namespace ev;
+
+namespace {
+
+std::string Fixed(double v, unsigned decimals) {
+  std::string result;
+  AppendFixed(result, v, decimals);
+  return result;
+}
+
+}  // namespace
+
+struct StringTest : public testing::Test {};
+
+TEST_F(StringTest, AppendFixed) {
+  EXPECT_EQ("0", Fixed(0.0, 0));
+  EXPECT_EQ("-0.000", Fixed(-0.0, 3));
+  EXPECT_EQ("3.14", Fixed(3.14159, 2));
+  EXPECT_EQ("-2.72", Fixed(-2.71828, 2));
+  EXPECT_EQ("-0.00", Fixed(-0.001, 2));
+  EXPECT_EQ("1000000.5", Fixed(1000000.5, 1));
+  EXPECT_EQ("0.999999999", Fixed(0.999999999, 9));
+
+  // Halfway cases round like the binary value does.
+  EXPECT_EQ("0.12", Fixed(0.125, 2));
+  EXPECT_EQ("0.38", Fixed(0.375, 2));
+  EXPECT_EQ("2", Fixed(2.5, 0));
+  EXPECT_EQ("0.30", Fixed(0.3, 2));
+
+  std::string output = "x=";
+  AppendFixed(output, 1.5, 3);
+  EXPECT_EQ("x=1.500", output);
+}
+
+TEST_F(StringTest, AppendFixedMatchesPrintf) {
+  // Scaled values beyond 2^53 can't be rounded exactly in double precision.
+  EXPECT_EQ("123456789.123456791", Fixed(123456789.123456789, 9));
+  EXPECT_EQ("98765432.099999994", Fixed(98765432.1, 9));
+  EXPECT_EQ("1234567.123456789", Fixed(1234567.123456789, 9));
+  EXPECT_EQ(StringPrintf("%.2f", 1e20), Fixed(1e20, 2));
+  EXPECT_EQ(StringPrintf("%.12f", M_PI), Fixed(M_PI, 12));
+
+  EXPECT_EQ(StringPrintf("%.3f", std::numeric_limits<double>::infinity()),
+            Fixed(std::numeric_limits<double>::infinity(), 3));
+  EXPECT_EQ(StringPrintf("%.3f", std::nan("")), Fixed(std::nan(""), 3));
+
+  std::mt19937_64 rng(1234);
+  std::uniform_real_distribution<double> mantissa(-1.0, 1.0);
+  std::uniform_int_distribution<int> exponent(-12, 18);
+  std::uniform_int_distribution<unsigned> decimals(0, 11);
+
+  for (size_t i = 0; i < 200000; ++i) {
+    const auto v = mantissa(rng) * std::pow(10.0, exponent(rng));
+    const auto d = decimals(rng);
+    ASSERT_EQ(StringPrintf("%.*f", d, v), Fixed(v, d)) << v << " " << d;
+  }
+}
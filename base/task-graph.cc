@@ -0,0 +1,228 @@
+#include "base/task-graph.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <numeric>
+#include <utility>
+
+#include "base/thread-pool.h"
+
+namespace ev {
+
+namespace {
+
+size_t FindRoot(std::vector<size_t>& parents, size_t i) {
+  while (parents[i] != i) {
+    parents[i] = parents[parents[i]];
+    i = parents[i];
+  }
+  return i;
+}
+
+}  // namespace
+
+TaskGraph::NodeId TaskGraph::AddNode(std::string name,
+                                     std::function<void()> function) {
+  KJ_REQUIRE(!started_);
+
+  nodes_.emplace_back();
+  nodes_.back().name = std::move(name);
+  nodes_.back().function = std::move(function);
+
+  return nodes_.size() - 1;
+}
+
+void TaskGraph::AddDependency(NodeId node, NodeId dependency) {
+  KJ_REQUIRE(!started_);
+  KJ_REQUIRE(node < nodes_.size(), node);
+  KJ_REQUIRE(dependency < nodes_.size(), dependency);
+  KJ_REQUIRE(node != dependency, nodes_[node].name);
+
+  nodes_[node].dependencies.emplace_back(dependency);
+}
+
+void TaskGraph::Produces(NodeId node, TaskGraphChannelBase& channel) {
+  KJ_REQUIRE(!started_);
+  KJ_REQUIRE(node < nodes_.size(), node);
+
+  size_t index = 0;
+  while (index < channels_.size() && channels_[index].get() != &channel)
+    ++index;
+  KJ_REQUIRE(index < channels_.size(), "Channel belongs to another graph");
+
+  channel.producers_.emplace_back(node);
+  nodes_[node].outputs.emplace_back(index);
+}
+
+void TaskGraph::Consumes(NodeId node, TaskGraphChannelBase& channel) {
+  KJ_REQUIRE(!started_);
+  KJ_REQUIRE(node < nodes_.size(), node);
+
+  channel.consumers_.emplace_back(node);
+}
+
+void TaskGraph::Run(ThreadPool& thread_pool) {
+  KJ_REQUIRE(!started_, "A task graph can only be run once");
+  started_ = true;
+
+  // Nodes connected through channels form groups, which are started
+  // together.
+  std::vector<size_t> parents(nodes_.size());
+  std::iota(parents.begin(), parents.end(), 0);
+
+  for (const auto& channel : channels_) {
+    KJ_REQUIRE(!channel->producers_.empty(), "Channel has no producers");
+    KJ_REQUIRE(!channel->consumers_.empty(), "Channel has no consumers");
+
+    // Each producer may put one value after the channel has been cancelled,
+    // which must not block.
+    KJ_REQUIRE(channel->producers_.size() <= channel->capacity_,
+               "Channel capacity is less than the number of producers",
+               channel->producers_.size(), channel->capacity_);
+
+    const auto root = FindRoot(parents, channel->producers_[0]);
+    for (const auto node : channel->producers_)
+      parents[FindRoot(parents, node)] = root;
+    for (const auto node : channel->consumers_)
+      parents[FindRoot(parents, node)] = root;
+  }
+
+  std::vector<size_t> node_groups(nodes_.size());
+  std::vector<std::vector<NodeId>> groups;
+  {
+    std::vector<size_t> root_groups(nodes_.size(), SIZE_MAX);
+    for (NodeId i = 0; i < nodes_.size(); ++i) {
+      auto& group = root_groups[FindRoot(parents, i)];
+      if (group == SIZE_MAX) {
+        group = groups.size();
+        groups.emplace_back();
+      }
+      node_groups[i] = group;
+      groups[group].emplace_back(i);
+    }
+  }
+
+  std::vector<size_t> pending_dependencies(groups.size(), 0);
+  std::vector<std::vector<size_t>> dependents(groups.size());
+
+  for (NodeId i = 0; i < nodes_.size(); ++i) {
+    const auto group = node_groups[i];
+
+    KJ_REQUIRE(groups[group].size() <= thread_pool.Size(),
+               "Too few threads for nodes connected through channels",
+               nodes_[i].name, groups[group].size(), thread_pool.Size());
+
+    for (const auto dependency : nodes_[i].dependencies) {
+      KJ_REQUIRE(node_groups[dependency] != group,
+                 "Nodes connected through channels can't depend on each other",
+                 nodes_[i].name, nodes_[dependency].name);
+
+      ++pending_dependencies[group];
+      dependents[node_groups[dependency]].emplace_back(group);
+    }
+  }
+
+  std::deque<size_t> ready;
+  for (size_t i = 0; i < groups.size(); ++i) {
+    if (!pending_dependencies[i]) ready.emplace_back(i);
+  }
+
+  // Checks for cycles by visiting the groups in dependency order.
+  {
+    auto pending = pending_dependencies;
+    std::deque<size_t> queue(ready);
+    size_t visited = 0;
+
+    for (; !queue.empty(); ++visited) {
+      const auto group = queue.front();
+      queue.pop_front();
+
+      for (const auto dependent : dependents[group]) {
+        if (!--pending[dependent]) queue.emplace_back(dependent);
+      }
+    }
+
+    KJ_REQUIRE(visited == groups.size(), "Task graph has a cycle");
+  }
+
+  std::vector<size_t> pending_producers(channels_.size());
+  std::vector<size_t> running_nodes(groups.size());
+  for (size_t i = 0; i < channels_.size(); ++i)
+    pending_producers[i] = channels_[i]->producers_.size();
+
+  // Completed nodes, reported by the worker threads.
+  std::mutex mutex;
+  std::condition_variable completed_cv;
+  std::vector<std::pair<NodeId, std::exception_ptr>> completed;
+
+  std::exception_ptr error;
+  size_t running = 0;
+  size_t completed_groups = 0;
+
+  while (completed_groups < groups.size()) {
+    // Groups are started in order, so that a large group isn't held back by
+    // smaller ones.
+    while (!error && !ready.empty() &&
+           running + groups[ready.front()].size() <= thread_pool.Size()) {
+      const auto group = ready.front();
+      ready.pop_front();
+
+      running += groups[group].size();
+      running_nodes[group] = groups[group].size();
+
+      for (const auto node : groups[group]) {
+        thread_pool.Launch([this, node, &mutex, &completed_cv, &completed] {
+          std::exception_ptr node_error;
+
+          try {
+            nodes_[node].function();
+          } catch (...) {
+            node_error = std::current_exception();
+          }
+
+          std::unique_lock<std::mutex> lock(mutex);
+          completed.emplace_back(node, std::move(node_error));
+          completed_cv.notify_one();
+        });
+      }
+    }
+
+    if (!running) break;
+
+    std::vector<std::pair<NodeId, std::exception_ptr>> batch;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      completed_cv.wait(lock, [&completed] { return !completed.empty(); });
+      batch.swap(completed);
+    }
+
+    for (auto& node_result : batch) {
+      const auto node = node_result.first;
+      --running;
+
+      if (node_result.second && !error) {
+        error = std::move(node_result.second);
+        for (auto& channel : channels_) channel->Cancel();
+      }
+
+      for (const auto channel : nodes_[node].outputs) {
+        if (!--pending_producers[channel]) channels_[channel]->Finish();
+      }
+
+      const auto group = node_groups[node];
+      if (--running_nodes[group]) continue;
+
+      ++completed_groups;
+
+      for (const auto dependent : dependents[group]) {
+        if (!--pending_dependencies[dependent]) ready.emplace_back(dependent);
+      }
+    }
+  }
+
+  if (error) std::rethrow_exception(error);
+}
+
+}  // namespace ev
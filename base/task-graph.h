@@ -0,0 +1,192 @@
+#ifndef BASE_TASK_GRAPH_H_
+#define BASE_TASK_GRAPH_H_ 1
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <kj/common.h>
+#include <kj/debug.h>
+
+#include "base/concurrency.h"
+
+namespace ev {
+
+class TaskGraph;
+class ThreadPool;
+
+// A bounded queue passing values between nodes of a `TaskGraph`.  Producers
+// block while it's full, so a slow consumer holds back the nodes feeding it.
+class TaskGraphChannelBase {
+ public:
+  virtual ~TaskGraphChannelBase() {}
+
+ protected:
+  explicit TaskGraphChannelBase(uint32_t capacity) : capacity_(capacity) {}
+
+  bool Cancelled() const { return cancelled_.load(); }
+
+  const uint32_t capacity_;
+
+  std::atomic<bool> cancelled_{false};
+
+ private:
+  friend class TaskGraph;
+
+  // Makes Get() return false once the channel is empty.  Called when all
+  // producers have returned.
+  virtual void Finish() = 0;
+
+  // Makes Put() throw, and discards queued values, so that blocked producers
+  // continue.  Called when a node fails.
+  virtual void Cancel() = 0;
+
+  std::vector<size_t> producers_;
+  std::vector<size_t> consumers_;
+};
+
+template <typename T>
+class TaskGraphChannel : public TaskGraphChannelBase {
+ public:
+  // The capacity is rounded up to a power of two, and at least two, since
+  // `BoundedQueue` can't tell a full slot from an empty one otherwise.
+  explicit TaskGraphChannel(uint32_t capacity)
+      : TaskGraphChannelBase(RoundUpToPowerOfTwo(capacity)),
+        queue_(capacity_) {}
+
+  // The queue's cache line aligned members need more alignment than the
+  // default `operator new` guarantees before C++17.
+  static void* operator new(size_t size) {
+    void* result;
+    if (posix_memalign(&result, EV_CACHELINE_SIZE, size))
+      throw std::bad_alloc();
+    return result;
+  }
+
+  static void operator delete(void* ptr) { free(ptr); }
+
+  // Adds a value to the channel, blocking while it's full.  Throws if the
+  // graph has been cancelled.
+  void Put(T value) {
+    KJ_REQUIRE(!Cancelled(), "task graph cancelled");
+    queue_.Enqueue(std::move(value));
+  }
+
+  // Removes a value from the channel, blocking while it's empty.  Returns
+  // false once all producers have returned and the channel is empty, or if
+  // the graph has been cancelled.
+  bool Get(T& value) {
+    if (Cancelled()) return false;
+    return queue_.Dequeue(value);
+  }
+
+ private:
+  static uint32_t RoundUpToPowerOfTwo(uint32_t n) {
+    uint32_t result = 2;
+    while (result < n) result <<= 1;
+    return result;
+  }
+
+  void Finish() override { queue_.Finish(); }
+
+  void Cancel() override {
+    cancelled_ = true;
+    queue_.Finish();
+
+    T value;
+    while (queue_.Dequeue(value)) {
+    }
+  }
+
+  concurrency::BoundedQueue<T, concurrency::BoundedQueueFutexWait> queue_;
+};
+
+// Runs a set of functions, called nodes, on a thread pool.  A node starts
+// once the nodes it depends on have returned, and nodes that don't depend on
+// one another run concurrently.  Nodes may also stream values to one another
+// through channels, in which case they run at the same time.  Example use:
+//
+//   ev::TaskGraph graph;
+//   auto& meshes = graph.AddChannel<Mesh>(4);
+//
+//   auto load = graph.AddNode("load", [&] { data = Load(); });
+//   auto mesh = graph.AddNode("mesh", [&] {
+//     for (const auto& frame : data) meshes.Put(Triangulate(frame));
+//   });
+//   auto draw = graph.AddNode("draw", [&] {
+//     Mesh mesh;
+//     while (meshes.Get(mesh)) Draw(mesh);
+//   });
+//
+//   graph.AddDependency(mesh, load);
+//   graph.Produces(mesh, meshes);
+//   graph.Consumes(draw, meshes);
+//
+//   graph.Run(thread_pool);
+//
+// Each node occupies a thread of the pool while it runs, even when blocked on
+// a channel.  A set of nodes connected through channels is therefore only
+// started when the pool has a free thread for every node in it, and the pool
+// must not be used for anything else while the graph runs.
+class TaskGraph {
+ public:
+  using NodeId = size_t;
+
+  TaskGraph() = default;
+
+  KJ_DISALLOW_COPY(TaskGraph);
+
+  // Adds a node calling `function`.  The name is used in error messages.
+  NodeId AddNode(std::string name, std::function<void()> function);
+
+  // Makes `node` start only after `dependency` has returned.
+  void AddDependency(NodeId node, NodeId dependency);
+
+  // Adds a channel holding up to `capacity` values.  The capacity must be no
+  // less than the number of producers.
+  template <typename T>
+  TaskGraphChannel<T>& AddChannel(uint32_t capacity) {
+    auto channel = std::make_unique<TaskGraphChannel<T>>(capacity);
+    auto& result = *channel;
+    channels_.emplace_back(std::move(channel));
+    return result;
+  }
+
+  // Declares that `node` puts values into `channel`.  The channel is
+  // finished once all its producers have returned.
+  void Produces(NodeId node, TaskGraphChannelBase& channel);
+
+  // Declares that `node` gets values from `channel`.
+  void Consumes(NodeId node, TaskGraphChannelBase& channel);
+
+  // Runs all nodes on `thread_pool`, returning once they have all returned.
+  // If a node throws, channels are cancelled, no more nodes are started, and
+  // the exception is rethrown once the running nodes have returned.  A graph
+  // can only be run once.
+  void Run(ThreadPool& thread_pool);
+
+ private:
+  struct Node {
+    std::string name;
+    std::function<void()> function;
+
+    std::vector<NodeId> dependencies;
+
+    // Indexes of the channels this node produces values for.
+    std::vector<size_t> outputs;
+  };
+
+  std::vector<Node> nodes_;
+  std::vector<std::unique_ptr<TaskGraphChannelBase>> channels_;
+
+  bool started_ = false;
+};
+
+}  // namespace ev
+
+#endif  // !BASE_TASK_GRAPH_H_
@@ -0,0 +1,175 @@
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "base/task-graph.h"
+#include "base/thread-pool.h"
+#include "third_party/gtest/gtest.h"
+
+using namespace ev;
+
+TEST(TaskGraphTest, RunsNodesAfterDependencies) {
+  // A single thread still runs the nodes in dependency order.
+  ThreadPool thread_pool(1);
+
+  TaskGraph graph;
+  std::atomic<int> step(0);
+  int a_step = -1, b_step = -1, c_step = -1, d_step = -1;
+
+  const auto a = graph.AddNode("a", [&] { a_step = step++; });
+  const auto b = graph.AddNode("b", [&] { b_step = step++; });
+  const auto c = graph.AddNode("c", [&] { c_step = step++; });
+  const auto d = graph.AddNode("d", [&] { d_step = step++; });
+
+  graph.AddDependency(b, a);
+  graph.AddDependency(c, a);
+  graph.AddDependency(d, b);
+  graph.AddDependency(d, c);
+
+  graph.Run(thread_pool);
+
+  EXPECT_EQ(4, step);
+  EXPECT_EQ(0, a_step);
+  EXPECT_LT(a_step, b_step);
+  EXPECT_LT(a_step, c_step);
+  EXPECT_EQ(3, d_step);
+}
+
+TEST(TaskGraphTest, RunsIndependentNodesConcurrently) {
+  ThreadPool thread_pool(2);
+
+  TaskGraph graph;
+  std::atomic<int> arrived(0);
+
+  // Each node waits for the other to start, which only works if they run at
+  // the same time.
+  for (int i = 0; i < 2; ++i) {
+    graph.AddNode("node", [&arrived] {
+      ++arrived;
+      while (arrived < 2) std::this_thread::yield();
+    });
+  }
+
+  graph.Run(thread_pool);
+  EXPECT_EQ(2, arrived);
+}
+
+TEST(TaskGraphTest, StreamsThroughChannels) {
+  // A thread for each node connected through channels.
+  ThreadPool thread_pool(3);
+
+  TaskGraph graph;
+  auto& numbers = graph.AddChannel<int>(2);
+  auto& squares = graph.AddChannel<int>(2);
+
+  std::vector<int> output;
+
+  const auto produce = graph.AddNode("produce", [&numbers] {
+    for (int i = 0; i < 1000; ++i) numbers.Put(i);
+  });
+  const auto square = graph.AddNode("square", [&numbers, &squares] {
+    int value;
+    while (numbers.Get(value)) squares.Put(value * value);
+  });
+  const auto collect = graph.AddNode("collect", [&squares, &output] {
+    int value;
+    while (squares.Get(value)) output.emplace_back(value);
+  });
+
+  graph.Produces(produce, numbers);
+  graph.Consumes(square, numbers);
+  graph.Produces(square, squares);
+  graph.Consumes(collect, squares);
+
+  graph.Run(thread_pool);
+
+  ASSERT_EQ(1000U, output.size());
+  for (int i = 0; i < 1000; ++i) EXPECT_EQ(i * i, output[i]);
+}
+
+TEST(TaskGraphTest, AppliesBackpressure) {
+  ThreadPool thread_pool(2);
+
+  TaskGraph graph;
+  auto& channel = graph.AddChannel<int>(4);
+
+  std::atomic<int> produced(0), consumed(0), max_backlog(0);
+
+  const auto produce = graph.AddNode("produce", [&] {
+    for (int i = 0; i < 100; ++i) {
+      channel.Put(i);
+      ++produced;
+    }
+  });
+  const auto consume = graph.AddNode("consume", [&] {
+    int value;
+    while (channel.Get(value)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      max_backlog = std::max<int>(max_backlog, produced - consumed);
+      ++consumed;
+    }
+  });
+
+  graph.Produces(produce, channel);
+  graph.Consumes(consume, channel);
+
+  graph.Run(thread_pool);
+
+  EXPECT_EQ(100, consumed);
+  // The capacity, plus one value held by each side.
+  EXPECT_GE(6, max_backlog);
+}
+
+TEST(TaskGraphTest, CancelsOnError) {
+  ThreadPool thread_pool(2);
+
+  TaskGraph graph;
+  auto& channel = graph.AddChannel<int>(1);
+  bool ran_dependent = false;
+
+  // The producer would block forever once the consumer fails, unless the
+  // channel is cancelled.
+  const auto produce = graph.AddNode("produce", [&channel] {
+    for (;;) channel.Put(0);
+  });
+  const auto consume = graph.AddNode("consume", [&channel] {
+    int value;
+    channel.Get(value);
+    throw std::runtime_error("consume");
+  });
+  const auto dependent =
+      graph.AddNode("dependent", [&ran_dependent] { ran_dependent = true; });
+
+  graph.Produces(produce, channel);
+  graph.Consumes(consume, channel);
+  graph.AddDependency(dependent, consume);
+
+  EXPECT_THROW(graph.Run(thread_pool), std::runtime_error);
+  EXPECT_FALSE(ran_dependent);
+}
+
+TEST(TaskGraphTest, RejectsInvalidGraphs) {
+  ThreadPool thread_pool(4);
+
+  {
+    TaskGraph graph;
+    const auto a = graph.AddNode("a", [] {});
+    const auto b = graph.AddNode("b", [] {});
+    graph.AddDependency(a, b);
+    graph.AddDependency(b, a);
+    EXPECT_ANY_THROW(graph.Run(thread_pool));
+  }
+
+  {
+    // More nodes connected through channels than threads.
+    TaskGraph graph;
+    auto& channel = graph.AddChannel<int>(8);
+    const auto consume = graph.AddNode("consume", [] {});
+    graph.Consumes(consume, channel);
+    for (int i = 0; i < 4; ++i)
+      graph.Produces(graph.AddNode("produce", [] {}), channel);
+    EXPECT_ANY_THROW(graph.Run(thread_pool));
+  }
+}
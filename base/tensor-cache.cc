@@ -0,0 +1,143 @@
+#include "base/tensor-cache.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <kj/debug.h>
+
+#include "base/file.h"
+#include "base/hash.h"
+
+namespace ev {
+
+namespace {
+
+const char kMagic[8] = {'E', 'V', 'T', 'E', 'N', 'S', 'O', 'R'};
+
+const uint32_t kVersion = 1;
+
+// The elements start at this offset, so that they're page aligned when
+// mapped.
+const size_t kDataOffset = 4096;
+
+// Number of trailing bytes of the source file included in its key.
+const size_t kSourceTailSize = 64 * 1024;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t dimensions;
+  uint64_t key;
+  char dtype[16];
+  uint64_t shape[TensorCacheFile::kMaxDimensions];
+  uint64_t data_offset;
+  uint64_t data_size;
+};
+
+static_assert(sizeof(Header) <= kDataOffset, "Header must fit its page");
+
+}  // namespace
+
+uint64_t TensorCacheKey(const char* source_path,
+                        const StringRef& parameters) {
+  auto fd = OpenFile(source_path, O_RDONLY);
+
+  struct stat st;
+  KJ_SYSCALL(fstat(fd.get(), &st), source_path);
+
+  const uint64_t identity[] = {
+      static_cast<uint64_t>(st.st_size),
+      static_cast<uint64_t>(st.st_mtim.tv_sec),
+      static_cast<uint64_t>(st.st_mtim.tv_nsec),
+  };
+
+  std::string key(reinterpret_cast<const char*>(identity), sizeof(identity));
+
+  const size_t tail_size =
+      std::min(static_cast<size_t>(st.st_size), kSourceTailSize);
+  key.resize(key.size() + tail_size);
+  PRead(fd.get(), &key[key.size() - tail_size], tail_size,
+        static_cast<off_t>(st.st_size - tail_size));
+
+  key.append(parameters.data(), parameters.size());
+
+  return Hash(key);
+}
+
+void WriteTensorCache(const char* path, uint64_t key, const StringRef& dtype,
+                      const std::vector<uint64_t>& shape,
+                      const StringRef& data) {
+  KJ_REQUIRE(shape.size() <= TensorCacheFile::kMaxDimensions, shape.size());
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.dimensions = shape.size();
+  header.key = key;
+  KJ_REQUIRE(dtype.size() < sizeof(header.dtype), dtype);
+  memcpy(header.dtype, dtype.data(), dtype.size());
+  std::copy(shape.begin(), shape.end(), header.shape);
+  header.data_offset = kDataOffset;
+  header.data_size = data.size();
+
+  std::string page(kDataOffset, 0);
+  memcpy(&page[0], &header, sizeof(header));
+
+  // Readers never see a partially written file.
+  auto tmp = TemporaryFile(path);
+
+  try {
+    WriteAll(tmp.first.get(), page);
+    WriteAll(tmp.first.get(), data);
+    KJ_SYSCALL(fsync(tmp.first.get()), tmp.second);
+    KJ_SYSCALL(fchmod(tmp.first.get(), 0644), tmp.second);
+    KJ_SYSCALL(rename(tmp.second.c_str(), path), tmp.second, path);
+  } catch (...) {
+    unlink(tmp.second.c_str());
+    throw;
+  }
+}
+
+bool ReadTensorCache(const char* path, uint64_t key, TensorCacheFile& result) {
+  if (-1 == access(path, F_OK)) {
+    if (errno == ENOENT) return false;
+    KJ_FAIL_SYSCALL("access", errno, path);
+  }
+
+  auto buffer = std::make_shared<const kj::Array<const char>>(ReadFile(path));
+
+  Header header;
+  KJ_REQUIRE(buffer->size() >= sizeof(header), "Truncated tensor cache",
+             path);
+  memcpy(&header, buffer->begin(), sizeof(header));
+
+  KJ_REQUIRE(!memcmp(header.magic, kMagic, sizeof(kMagic)),
+             "Not a tensor cache", path);
+  KJ_REQUIRE(header.version == kVersion, "Unsupported tensor cache version",
+             path, header.version);
+
+  if (header.key != key) return false;
+
+  KJ_REQUIRE(header.dimensions <= TensorCacheFile::kMaxDimensions,
+             header.dimensions);
+  KJ_REQUIRE(header.data_offset <= buffer->size() &&
+                 header.data_size <= buffer->size() - header.data_offset,
+             "Truncated tensor cache", path);
+
+  header.dtype[sizeof(header.dtype) - 1] = 0;
+  result.dtype = header.dtype;
+  result.shape.assign(header.shape, header.shape + header.dimensions);
+  result.data =
+      StringRef(buffer->begin() + header.data_offset, header.data_size);
+  result.buffer = std::move(buffer);
+
+  return true;
+}
+
+}  // namespace ev
@@ -0,0 +1,50 @@
+#ifndef BASE_TENSOR_CACHE_H_
+#define BASE_TENSOR_CACHE_H_ 1
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <kj/array.h>
+
+#include "base/stringref.h"
+
+namespace ev {
+
+// A file holding one dense array, e.g. preprocessed training images, so that
+// later runs can memory map it instead of recomputing it.  The file starts
+// with a page sized header giving the element type and shape, and the key it
+// was written with, followed by the elements in row-major order.
+struct TensorCacheFile {
+  static const size_t kMaxDimensions = 8;
+
+  // Element type, as a NumPy type string like "<f4".
+  std::string dtype;
+
+  std::vector<uint64_t> shape;
+
+  // The mapped file, and the element data within it.
+  std::shared_ptr<const kj::Array<const char>> buffer;
+  StringRef data;
+};
+
+// Returns a key identifying the file at `source_path` and the preprocessing
+// `parameters` applied to its contents.  The file is identified by its size,
+// modification time and final 64 KiB, which hold the segment index of a
+// column file, so that its contents needn't be read in full.
+uint64_t TensorCacheKey(const char* source_path, const StringRef& parameters);
+
+// Atomically replaces the file at `path` with a tensor cache file holding
+// `data`, an array of the given type and shape, tagged with `key`.
+void WriteTensorCache(const char* path, uint64_t key, const StringRef& dtype,
+                      const std::vector<uint64_t>& shape,
+                      const StringRef& data);
+
+// Maps the tensor cache file at `path` into memory.  Returns false if the
+// file doesn't exist, or was written with a different key.
+bool ReadTensorCache(const char* path, uint64_t key, TensorCacheFile& result);
+
+}  // namespace ev
+
+#endif  // !BASE_TENSOR_CACHE_H_
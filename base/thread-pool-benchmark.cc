@@ -0,0 +1,186 @@
+// Compares the throughput of `ThreadPool` and `WorkStealingThreadPool`:
+//
+//   flat:    the main thread launches all tasks, then waits for them.
+//   nested:  tasks recursively launch two tasks each, like a parallel
+//            divide and conquer algorithm does.
+//   futures: the main thread launches tasks returning values, and collects
+//            them.
+//
+// Each task spins for `--work` iterations; with small values the benchmark
+// mostly measures scheduling overhead.  Note that `ThreadPool` runs tasks in
+// the launching thread once 256 are queued, which hides its queueing costs
+// when there are fewer cores than threads.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <vector>
+
+#include <err.h>
+#include <getopt.h>
+#include <sysexits.h>
+
+#include <kj/debug.h>
+
+#include "base/thread-pool.h"
+#include "base/work-stealing-thread-pool.h"
+
+namespace {
+
+int print_help;
+
+struct option kLongOptions[] = {{"repeat", required_argument, nullptr, 'r'},
+                                {"tasks", required_argument, nullptr, 'n'},
+                                {"threads", required_argument, nullptr, 't'},
+                                {"work", required_argument, nullptr, 'w'},
+                                {"help", no_argument, &print_help, 1},
+                                {nullptr, 0, nullptr, 0}};
+
+size_t work = 100;
+
+uint64_t DoWork(uint64_t seed) {
+  for (size_t i = 0; i < work; ++i) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    __asm__ __volatile__("" : "+r"(seed));
+  }
+  return seed;
+}
+
+struct Flat {
+  template <typename Pool>
+  void operator()(Pool& pool, size_t tasks) const {
+    for (size_t i = 0; i < tasks; ++i) pool.Launch([i] { DoWork(i); });
+    pool.Wait();
+  }
+};
+
+template <typename Pool>
+void Spawn(Pool& pool, size_t tasks) {
+  DoWork(tasks);
+  if (tasks <= 1) return;
+
+  const auto left = (tasks - 1) / 2;
+  const auto right = tasks - 1 - left;
+
+  if (left) pool.Launch([&pool, left] { Spawn(pool, left); });
+  if (right) pool.Launch([&pool, right] { Spawn(pool, right); });
+}
+
+struct Nested {
+  template <typename Pool>
+  void operator()(Pool& pool, size_t tasks) const {
+    pool.Launch([&pool, tasks] { Spawn(pool, tasks); });
+    pool.Wait();
+  }
+};
+
+struct Futures {
+  template <typename Pool>
+  void operator()(Pool& pool, size_t tasks) const {
+    std::vector<std::future<uint64_t>> results;
+    results.reserve(tasks);
+
+    for (size_t i = 0; i < tasks; ++i)
+      results.emplace_back(pool.Launch([i] { return DoWork(i); }));
+
+    uint64_t sum = 0;
+    for (auto& result : results) sum += result.get();
+    __asm__ __volatile__("" : : "r"(sum));
+  }
+};
+
+// Returns the best time of `repeat` runs, in seconds.
+template <typename Pool, typename Benchmark>
+double Measure(Pool& pool, Benchmark benchmark, size_t tasks, size_t repeat) {
+  double best = 0.0;
+
+  for (size_t i = 0; i < repeat; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    benchmark(pool, tasks);
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    if (!i || elapsed.count() < best) best = elapsed.count();
+  }
+
+  return best;
+}
+
+template <typename Benchmark>
+void Compare(const char* name, Benchmark benchmark, ev::ThreadPool& pool,
+             ev::WorkStealingThreadPool& work_stealing_pool, size_t tasks,
+             size_t repeat) {
+  const auto a = Measure(pool, benchmark, tasks, repeat);
+  const auto b = Measure(work_stealing_pool, benchmark, tasks, repeat);
+
+  printf("%-8s %12.0f %12.0f %7.2fx\n", name, tasks / a, tasks / b, a / b);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) try {
+  size_t threads = std::thread::hardware_concurrency();
+  size_t tasks = 1000000;
+  size_t repeat = 5;
+
+  int i;
+  while ((i = getopt_long(argc, argv, "", kLongOptions, 0)) != -1) {
+    if (!i) continue;
+    if (i == '?')
+      errx(EX_USAGE, "Try '%s --help' for more information.", argv[0]);
+
+    switch (i) {
+      case 'n':
+        tasks = strtoul(optarg, nullptr, 0);
+        break;
+
+      case 'r':
+        repeat = strtoul(optarg, nullptr, 0);
+        break;
+
+      case 't':
+        threads = strtoul(optarg, nullptr, 0);
+        break;
+
+      case 'w':
+        work = strtoul(optarg, nullptr, 0);
+        break;
+    }
+  }
+
+  if (print_help) {
+    printf(
+        "Usage: %s [OPTION]...\n"
+        "\n"
+        "      --repeat=N         run each benchmark N times, and report the "
+        "best\n"
+        "      --tasks=N          launch N tasks per run\n"
+        "      --threads=N        use N worker threads\n"
+        "      --work=N           spin for N iterations in each task\n"
+        "      --help             display this help and exit\n",
+        argv[0]);
+
+    return EXIT_SUCCESS;
+  }
+
+  if (optind != argc) errx(EX_USAGE, "Usage: %s [OPTION]...", argv[0]);
+
+  if (!threads || !tasks || !repeat)
+    errx(EX_USAGE, "--threads, --tasks and --repeat must be positive");
+
+  ev::ThreadPool pool(threads);
+  ev::WorkStealingThreadPool work_stealing_pool(threads);
+
+  printf("%lu threads, %lu tasks of %lu iterations\n\n",
+         static_cast<unsigned long>(threads), static_cast<unsigned long>(tasks),
+         static_cast<unsigned long>(work));
+  printf("%-8s %12s %12s %8s\n", "tasks/s", "ThreadPool", "stealing", "speedup");
+
+  Compare("flat", Flat(), pool, work_stealing_pool, tasks, repeat);
+  Compare("nested", Nested(), pool, work_stealing_pool, tasks, repeat);
+  Compare("futures", Futures(), pool, work_stealing_pool, tasks, repeat);
+} catch (kj::Exception e) {
+  KJ_LOG(FATAL, e);
+  return EXIT_FAILURE;
+}
@@ -4,11 +4,14 @@
 #include <condition_variable>
 #include <cstdlib>
 #include <deque>
+#include <functional>
 #include <future>
 #include <mutex>
 #include <thread>
 #include <vector>
 
+#include <kj/common.h>
+
 #include "base/delegate.h"
 
 namespace ev {
@@ -44,8 +47,9 @@ class ThreadPool {
   KJ_DISALLOW_COPY(ThreadPool);
 
   // Instructs all worker threads to stop, waits for them to stop, then
-  // destroys the thread pool.  Call Wait() before destruction if you want to
-  // ensure all tasks have completed.
+  // destroys the thread pool.  Tasks that haven't started are discarded, as
+  // are tasks launched while discarding them.  Call Wait() before destruction
+  // if you want to ensure all tasks have completed.
   ~ThreadPool() {
     std::unique_lock<std::mutex> lock(mutex_);
     done_ = true;
@@ -56,6 +60,13 @@ class ThreadPool {
       threads_.back().join();
       threads_.pop_back();
     }
+
+    // Destroying a task may launch another, e.g. when it breaks a promise, so
+    // the queue is emptied without holding the lock.
+    std::deque<Delegate<void()>> discarded;
+    lock.lock();
+    discarded.swap(queued_calls_);
+    lock.unlock();
   }
 
   // Schedules a void task for asynchronous execution.
@@ -65,6 +76,7 @@ class ThreadPool {
                 void>::type* = nullptr>
   void Launch(Function&& f) {
     std::unique_lock<std::mutex> lock(mutex_);
+    if (done_) return;
 
     // If we've reached the backlog limit, we just execute in the context of
     // the calling thread.
@@ -93,6 +105,7 @@ class ThreadPool {
     auto result = promise.get_future();
 
     std::unique_lock<std::mutex> lock(mutex_);
+    if (done_) return result;
 
     // If we've reached the backlog limit, we just execute in the context of
     // the calling thread.
@@ -0,0 +1,533 @@
+#ifndef BASE_WORK_STEALING_THREAD_POOL_H_
+#define BASE_WORK_STEALING_THREAD_POOL_H_ 1
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include <kj/common.h>
+
+#include "base/concurrency.h"
+#include "base/futex.h"
+
+namespace ev {
+
+// A single-producer, multi-consumer double-ended queue, as described in "Dynamic
+// Circular Work-Stealing Deque" by Chase and Lev, using the memory orderings
+// from "Correct and Efficient Work-Stealing for Weak Memory Models" by Lê et
+// al.  Only the owning thread may call Push() and Pop(), which work on the
+// bottom end; any thread may call Steal(), which takes from the top end.
+//
+// `T` must be trivially copyable, which is why the thread pool below stores
+// pointers to its tasks.
+template <typename T>
+class ChaseLevDeque {
+ public:
+  explicit ChaseLevDeque(size_t capacity = 256)
+      : array_(new Array(capacity)) {
+    retired_.emplace_back(array_.load(std::memory_order_relaxed));
+  }
+
+  ChaseLevDeque(const ChaseLevDeque&) = delete;
+  ChaseLevDeque& operator=(const ChaseLevDeque&) = delete;
+
+  // Adds a value to the bottom of the deque.  Only the owner may call this.
+  void Push(T value) {
+    const auto bottom = bottom_.load(std::memory_order_relaxed);
+    const auto top = top_.load(std::memory_order_acquire);
+    auto array = array_.load(std::memory_order_relaxed);
+
+    if (bottom - top > array->mask) array = Grow(array, top, bottom);
+
+    array->Put(bottom, value);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+  }
+
+  // Removes the value at the bottom of the deque, i.e. the one pushed most
+  // recently.  Only the owner may call this.  Returns false if the deque is
+  // empty.
+  bool Pop(T& value) {
+    const auto bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    const auto array = array_.load(std::memory_order_relaxed);
+    bottom_.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto top = top_.load(std::memory_order_relaxed);
+
+    if (top > bottom) {
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+      return false;
+    }
+
+    value = array->Get(bottom);
+    if (top < bottom) return true;
+
+    // This is the last value, which thieves may be racing for.
+    const auto won = top_.compare_exchange_strong(
+        top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+    return won;
+  }
+
+  // Removes the value at the top of the deque, i.e. the oldest one.  Returns
+  // false if the deque is empty, or if another thread took the value first.
+  bool Steal(T& value) {
+    auto top = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const auto bottom = bottom_.load(std::memory_order_acquire);
+
+    if (top >= bottom) return false;
+
+    // Arrays are only released by the destructor, so this stays valid even
+    // if the owner grows the deque concurrently.
+    const auto array = array_.load(std::memory_order_acquire);
+    value = array->Get(top);
+
+    return top_.compare_exchange_strong(
+        top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+  }
+
+  // Returns the approximate number of values in the deque.
+  size_t Size() const {
+    const auto bottom = bottom_.load(std::memory_order_relaxed);
+    const auto top = top_.load(std::memory_order_relaxed);
+    return bottom > top ? bottom - top : 0;
+  }
+
+ private:
+  struct Array {
+    explicit Array(size_t capacity)
+        : mask(RoundUpToPowerOfTwo(capacity) - 1),
+          values(new std::atomic<T>[mask + 1]) {}
+
+    static size_t RoundUpToPowerOfTwo(size_t n) {
+      size_t result = 1;
+      while (result < n) result <<= 1;
+      return result;
+    }
+
+    T Get(int64_t index) const {
+      return values[index & mask].load(std::memory_order_relaxed);
+    }
+
+    void Put(int64_t index, T value) {
+      values[index & mask].store(value, std::memory_order_relaxed);
+    }
+
+    const int64_t mask;
+    std::unique_ptr<std::atomic<T>[]> values;
+  };
+
+  Array* Grow(Array* array, int64_t top, int64_t bottom) {
+    auto result = new Array((array->mask + 1) * 2);
+    retired_.emplace_back(result);
+
+    for (auto i = top; i != bottom; ++i) result->Put(i, array->Get(i));
+
+    array_.store(result, std::memory_order_release);
+    return result;
+  }
+
+  // Top and bottom are kept on separate cache lines, since the former is
+  // written by thieves and the latter by the owner.
+  alignas(64) std::atomic<int64_t> top_{0};
+  alignas(64) std::atomic<int64_t> bottom_{0};
+  std::atomic<Array*> array_;
+
+  // Every array ever used, including the current one.
+  std::vector<std::unique_ptr<Array>> retired_;
+};
+
+// A thread pool with the same interface as `ThreadPool`, in which every
+// worker thread has its own task deque.  Tasks launched from a worker thread
+// go to the bottom of that worker's deque, from where it takes them in LIFO
+// order, while idle workers steal from the top of other workers' deques.
+// Tasks launched from other threads go to a shared queue, which workers only
+// look at when their own deque is empty.  This avoids the single lock that
+// every `ThreadPool` task passes through, which dominates when tasks are
+// small.
+//
+// Idle workers spin for a while before sleeping on a futex, so that bursts
+// of short tasks don't pay for a system call each.
+//
+// Unlike `ThreadPool`, there is no backlog limit; all tasks are queued.
+class WorkStealingThreadPool {
+ public:
+  // Constructs a thread pool with the given number of threads.
+  explicit WorkStealingThreadPool(size_t n) {
+    if (!n) n = 1;
+
+    for (size_t i = 0; i < n; ++i)
+      workers_.emplace_back(std::make_unique<Worker>(this, i));
+
+    for (auto& worker : workers_) {
+      threads_.emplace_back(std::thread(std::bind(
+          &WorkStealingThreadPool::ThreadMain, this, worker.get())));
+    }
+  }
+
+  // Constructs a thread pool with the same number of threads as supported by
+  // the hardware.
+  WorkStealingThreadPool()
+      : WorkStealingThreadPool(std::thread::hardware_concurrency()) {}
+
+  KJ_DISALLOW_COPY(WorkStealingThreadPool);
+
+  // Instructs all worker threads to stop, waits for them to stop, then
+  // destroys the thread pool.  Tasks that haven't started are discarded.
+  // Call Wait() before destruction if you want to ensure all tasks have
+  // completed.
+  ~WorkStealingThreadPool() {
+    done_.store(true);
+    work_epoch_.fetch_add(1);
+    futex_wake(work_epoch_, INT_MAX);
+
+    for (auto& thread : threads_) thread.join();
+
+    Task* task;
+    for (auto& worker : workers_) {
+      while (worker->deque.Pop(task)) delete task;
+    }
+    for (auto task : injected_) delete task;
+  }
+
+  // Schedules a void task for asynchronous execution.
+  template <class Function,
+            typename std::enable_if<
+                std::is_void<typename std::result_of<Function()>::type>::value,
+                void>::type* = nullptr>
+  void Launch(Function&& f) {
+    Submit(new FunctionTask<typename std::decay<Function>::type>(
+        std::forward<Function>(f)));
+  }
+
+  // Schedules a task for asynchronous execution.
+  template <class Function,
+            typename std::enable_if<
+                !std::is_void<typename std::result_of<Function()>::type>::value,
+                void>::type* = nullptr>
+  std::future<typename std::result_of<Function()>::type> Launch(Function&& f) {
+    std::promise<typename std::result_of<Function()>::type> promise;
+    auto result = promise.get_future();
+
+    auto call = [ f = std::move(f), promise = std::move(promise) ]() mutable {
+      try {
+        promise.set_value(f());
+      } catch (...) {
+        try {
+          promise.set_exception(std::current_exception());
+        } catch (...) {
+          abort();
+        }
+      }
+    };
+
+    Submit(new FunctionTask<decltype(call)>(std::move(call)));
+
+    return result;
+  }
+
+  // Returns the number of threads in this thread pool.
+  size_t Size() const { return threads_.size(); }
+
+  // Waits for completion of all scheduled tasks, running queued tasks in the
+  // calling thread meanwhile.  Must not be called from a task.
+  void Wait() {
+    for (uint32_t idle = 0; pending_.load() != 0;) {
+      Task* task;
+      if (TakeInjected(nullptr, task) || Steal(nullptr, task)) {
+        RunTask(task);
+        idle = 0;
+        continue;
+      }
+
+      if (++idle < kSpinRounds) {
+        concurrency::CPURelax()(kSpinPause);
+        continue;
+      }
+
+      const auto epoch = completion_epoch_.load();
+      waiters_.fetch_add(1);
+      if (pending_.load() != 0) futex_wait(completion_epoch_, epoch);
+      waiters_.fetch_sub(1);
+      idle = 0;
+    }
+  }
+
+  void Stat() {
+    for (const auto& worker : workers_)
+      printf("thread %lu: %lu (%lu stolen)\n", (unsigned long)worker->index,
+             (unsigned long)worker->exec_count,
+             (unsigned long)worker->steal_count);
+  }
+
+ private:
+  // Tasks are allocated together with their function in a single block, and
+  // queued by pointer.
+  struct Task {
+    virtual ~Task() {}
+    virtual void Run() = 0;
+  };
+
+  template <typename Function>
+  struct FunctionTask : Task {
+    template <typename F>
+    explicit FunctionTask(F&& f) : function(std::forward<F>(f)) {}
+
+    void Run() override { function(); }
+
+    Function function;
+  };
+
+  // Number of unsuccessful attempts to find a task before an idle worker
+  // goes to sleep, and the number of pause instructions between early
+  // attempts.
+  static const uint32_t kSpinRounds = 64;
+  static const uint32_t kSpinPause = 32;
+
+  // Maximum number of tasks moved from the shared queue to a worker's deque
+  // at once, where they can be stolen by other workers.
+  static const size_t kInjectedBatchSize = 32;
+
+  struct Worker {
+    Worker(WorkStealingThreadPool* pool, size_t index)
+        : pool(pool), index(index), random_state(index * 2654435761u + 1) {}
+
+    // The deque's cache line aligned members need more alignment than the
+    // default `operator new` guarantees before C++17.
+    static void* operator new(size_t size) {
+      void* result;
+      if (posix_memalign(&result, 64, size)) throw std::bad_alloc();
+      return result;
+    }
+
+    static void operator delete(void* ptr) { free(ptr); }
+
+    WorkStealingThreadPool* const pool;
+    const size_t index;
+
+    ChaseLevDeque<Task*> deque;
+
+    // Used for picking victims to steal from.
+    uint32_t random_state;
+
+    uint64_t exec_count = 0;
+    uint64_t steal_count = 0;
+  };
+
+  // Returns the worker running on the current thread, if any, in any pool.
+  static Worker*& CurrentWorker() {
+    static thread_local Worker* worker = nullptr;
+    return worker;
+  }
+
+  void Submit(Task* task) {
+    pending_.fetch_add(1, std::memory_order_relaxed);
+
+    auto self = CurrentWorker();
+    if (self && self->pool == this) {
+      self->deque.Push(task);
+    } else {
+      std::unique_lock<std::mutex> lock(injected_mutex_);
+      injected_.push_back(task);
+      injected_size_.store(injected_.size(), std::memory_order_relaxed);
+    }
+
+    WakeOne();
+  }
+
+  // Wakes up a sleeping worker to look for tasks, unless a worker is already
+  // looking, or about to be woken up for that.
+  void WakeOne() {
+    // Orders the enqueued task before reading the counters, pairing with the
+    // decrement in Search() and the fence in Park().
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (searchers_.load(std::memory_order_relaxed) ||
+        !sleepers_.load(std::memory_order_relaxed))
+      return;
+
+    if (wake_pending_.exchange(true)) return;
+
+    work_epoch_.fetch_add(1);
+    futex_wake(work_epoch_, 1);
+  }
+
+  // Takes a task from the shared queue.  If the caller is a worker, some
+  // more tasks are moved to its deque.
+  bool TakeInjected(Worker* self, Task*& task) {
+    if (!injected_size_.load(std::memory_order_relaxed)) return false;
+
+    std::unique_lock<std::mutex> lock(injected_mutex_);
+    if (injected_.empty()) return false;
+
+    task = injected_.front();
+    injected_.pop_front();
+
+    if (self) {
+      for (size_t i = 1; i < kInjectedBatchSize && !injected_.empty(); ++i) {
+        self->deque.Push(injected_.front());
+        injected_.pop_front();
+      }
+    }
+
+    injected_size_.store(injected_.size(), std::memory_order_relaxed);
+
+    return true;
+  }
+
+  // Steals a task from a worker other than `self`, starting at a random
+  // one.
+  bool Steal(Worker* self, Task*& task) {
+    const auto n = workers_.size();
+
+    size_t start;
+    if (self) {
+      auto& x = self->random_state;
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      start = x % n;
+    } else {
+      start = 0;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+      auto& victim = *workers_[(start + i) % n];
+      if (&victim == self) continue;
+
+      if (victim.deque.Steal(task)) {
+        if (self) ++self->steal_count;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // Returns true if any task is queued.
+  bool HasWork() const {
+    if (injected_size_.load(std::memory_order_relaxed)) return true;
+
+    for (const auto& worker : workers_) {
+      if (worker->deque.Size()) return true;
+    }
+
+    return false;
+  }
+
+  void RunTask(Task* task) {
+    task->Run();
+    delete task;
+
+    if (pending_.fetch_sub(1) == 1 && waiters_.load()) {
+      completion_epoch_.fetch_add(1);
+      futex_wake(completion_epoch_, INT_MAX);
+    }
+  }
+
+  // Looks for a task in the shared queue and in other workers' deques,
+  // spinning for a while if there are none.
+  bool Search(Worker* self, Task*& task) {
+    searchers_.fetch_add(1);
+
+    bool found = false;
+    for (uint32_t round = 0; round < kSpinRounds; ++round) {
+      if (TakeInjected(self, task) || Steal(self, task)) {
+        found = true;
+        break;
+      }
+
+      if (done_.load(std::memory_order_relaxed)) break;
+
+      // Yielding lets launching threads make progress on oversubscribed
+      // machines.
+      if (round < kSpinRounds / 2)
+        concurrency::CPURelax()(kSpinPause);
+      else
+        std::this_thread::yield();
+    }
+
+    // If this was the last worker looking for tasks, more may be waiting, so
+    // another one is woken up to keep looking.
+    if (searchers_.fetch_sub(1) == 1 && found) WakeOne();
+
+    return found;
+  }
+
+  // Puts the current worker thread to sleep until a task is launched, or the
+  // thread pool is destroyed.
+  void Park() {
+    const auto epoch = work_epoch_.load();
+
+    sleepers_.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // A pending wakeup may have been meant for a worker that has since
+    // started looking for tasks by itself, so it's consumed here rather than
+    // risk every later wakeup being skipped.
+    if (!HasWork() && !done_.load() && !wake_pending_.exchange(false))
+      futex_wait(work_epoch_, epoch);
+
+    sleepers_.fetch_sub(1);
+    wake_pending_.store(false);
+  }
+
+  // Worker thread entry point.  Runs tasks until `done_' is set to true by
+  // the destructor.
+  void ThreadMain(Worker* self) {
+    CurrentWorker() = self;
+
+    while (!done_.load(std::memory_order_relaxed)) {
+      Task* task;
+
+      if (self->deque.Pop(task) || Search(self, task)) {
+        RunTask(task);
+        ++self->exec_count;
+      } else {
+        Park();
+      }
+    }
+
+    CurrentWorker() = nullptr;
+  }
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+
+  // Tasks launched from threads outside the pool.
+  std::mutex injected_mutex_;
+  std::deque<Task*> injected_;
+  std::atomic<size_t> injected_size_{0};
+
+  // The number of launched tasks that haven't completed.
+  alignas(64) std::atomic<size_t> pending_{0};
+
+  // Incremented to wake up sleeping workers, and the number of them.
+  alignas(64) std::atomic<uint32_t> work_epoch_{0};
+  std::atomic<uint32_t> sleepers_{0};
+
+  // The number of workers looking for tasks in Search(), and whether a
+  // sleeping worker is being woken up to do so.
+  std::atomic<uint32_t> searchers_{0};
+  std::atomic<bool> wake_pending_{false};
+
+  // Incremented to wake up threads in Wait(), and the number of them.
+  alignas(64) std::atomic<uint32_t> completion_epoch_{0};
+  std::atomic<uint32_t> waiters_{0};
+
+  std::atomic<bool> done_{false};
+};
+
+}  // namespace ev
+
+#endif  // !BASE_WORK_STEALING_THREAD_POOL_H_
@@ -0,0 +1,206 @@
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "base/work-stealing-thread-pool.h"
+#include "third_party/gtest/gtest.h"
+
+using namespace ev;
+
+struct WorkStealingThreadPoolTest : public testing::Test {};
+
+TEST_F(WorkStealingThreadPoolTest, DequeOrder) {
+  ChaseLevDeque<intptr_t> deque(4);
+
+  intptr_t value;
+  EXPECT_FALSE(deque.Pop(value));
+  EXPECT_FALSE(deque.Steal(value));
+
+  for (intptr_t i = 0; i < 4; ++i) deque.Push(i);
+  EXPECT_EQ(4U, deque.Size());
+
+  // The owner takes the newest value, and thieves the oldest.
+  ASSERT_TRUE(deque.Pop(value));
+  EXPECT_EQ(3, value);
+  ASSERT_TRUE(deque.Steal(value));
+  EXPECT_EQ(0, value);
+  ASSERT_TRUE(deque.Pop(value));
+  EXPECT_EQ(2, value);
+  ASSERT_TRUE(deque.Steal(value));
+  EXPECT_EQ(1, value);
+
+  EXPECT_FALSE(deque.Pop(value));
+  EXPECT_FALSE(deque.Steal(value));
+  EXPECT_EQ(0U, deque.Size());
+}
+
+TEST_F(WorkStealingThreadPoolTest, DequeGrows) {
+  ChaseLevDeque<intptr_t> deque(2);
+
+  // Wrapping around before growing keeps the values in order.
+  intptr_t value;
+  deque.Push(-1);
+  deque.Push(-2);
+  ASSERT_TRUE(deque.Steal(value));
+  EXPECT_EQ(-1, value);
+
+  for (intptr_t i = 0; i < 1000; ++i) deque.Push(i);
+  EXPECT_EQ(1001U, deque.Size());
+
+  ASSERT_TRUE(deque.Steal(value));
+  EXPECT_EQ(-2, value);
+
+  for (intptr_t i = 999; i >= 500; --i) {
+    ASSERT_TRUE(deque.Pop(value));
+    EXPECT_EQ(i, value);
+  }
+  for (intptr_t i = 0; i < 500; ++i) {
+    ASSERT_TRUE(deque.Steal(value));
+    EXPECT_EQ(i, value);
+  }
+
+  EXPECT_FALSE(deque.Pop(value));
+}
+
+TEST_F(WorkStealingThreadPoolTest, DequeRaces) {
+  static const intptr_t kValues = 200000;
+  static const size_t kThieves = 3;
+
+  // Starts small, so that it grows while thieves are stealing.
+  ChaseLevDeque<intptr_t> deque(2);
+
+  std::unique_ptr<std::atomic<int>[]> taken(new std::atomic<int>[kValues]);
+  for (intptr_t i = 0; i < kValues; ++i) taken[i] = 0;
+
+  std::atomic<bool> done{false};
+  std::vector<std::thread> thieves;
+  for (size_t i = 0; i < kThieves; ++i) {
+    thieves.emplace_back([&] {
+      intptr_t value;
+      while (!done.load()) {
+        if (deque.Steal(value)) ++taken[value];
+      }
+      while (deque.Steal(value)) ++taken[value];
+    });
+  }
+
+  // The owner pops some values and leaves others to the thieves, so that
+  // both ends race for the last value.
+  intptr_t value;
+  for (intptr_t i = 0; i < kValues; ++i) {
+    deque.Push(i);
+    if (i % 3 == 0 && deque.Pop(value)) ++taken[value];
+  }
+  while (deque.Pop(value)) ++taken[value];
+
+  done = true;
+  for (auto& thief : thieves) thief.join();
+
+  for (intptr_t i = 0; i < kValues; ++i) ASSERT_EQ(1, taken[i].load()) << i;
+}
+
+TEST_F(WorkStealingThreadPoolTest, LaunchAndWait) {
+  WorkStealingThreadPool thread_pool(4);
+  EXPECT_EQ(4U, thread_pool.Size());
+
+  // Nothing to wait for.
+  thread_pool.Wait();
+
+  std::atomic<size_t> count{0};
+  for (size_t i = 0; i < 10000; ++i) thread_pool.Launch([&count] { ++count; });
+
+  thread_pool.Wait();
+  EXPECT_EQ(10000U, count.load());
+
+  // The pool can be reused after waiting.
+  for (size_t i = 0; i < 100; ++i) thread_pool.Launch([&count] { ++count; });
+
+  thread_pool.Wait();
+  EXPECT_EQ(10100U, count.load());
+}
+
+TEST_F(WorkStealingThreadPoolTest, LaunchWithResult) {
+  WorkStealingThreadPool thread_pool(2);
+
+  std::vector<std::future<int>> results;
+  for (int i = 0; i < 100; ++i)
+    results.emplace_back(thread_pool.Launch([i] { return i * i; }));
+
+  for (int i = 0; i < 100; ++i) EXPECT_EQ(i * i, results[i].get());
+
+  auto error = thread_pool.Launch([]() -> int {
+    throw std::runtime_error("task failed");
+  });
+  EXPECT_THROW(error.get(), std::runtime_error);
+}
+
+namespace {
+
+// Launches two tasks for each level below `depth`, counting every task.
+void LaunchTree(WorkStealingThreadPool& thread_pool, std::atomic<size_t>& count,
+                unsigned depth) {
+  ++count;
+  if (!depth) return;
+
+  for (int i = 0; i < 2; ++i) {
+    thread_pool.Launch([&thread_pool, &count, depth] {
+      LaunchTree(thread_pool, count, depth - 1);
+    });
+  }
+}
+
+}  // namespace
+
+TEST_F(WorkStealingThreadPoolTest, NestedLaunches) {
+  WorkStealingThreadPool thread_pool(4);
+
+  std::atomic<size_t> count{0};
+  thread_pool.Launch([&] { LaunchTree(thread_pool, count, 14); });
+
+  // Wait() must see the tasks launched from within tasks, which go to the
+  // workers' deques rather than the shared queue.
+  thread_pool.Wait();
+  EXPECT_EQ((1U << 15) - 1, count.load());
+}
+
+TEST_F(WorkStealingThreadPoolTest, WaitRunsTasks) {
+  // A single worker blocked on a task leaves the rest to the waiting thread.
+  WorkStealingThreadPool thread_pool(1);
+
+  std::atomic<bool> started{false}, release{false};
+  thread_pool.Launch([&started, &release] {
+    started = true;
+    while (!release.load()) std::this_thread::yield();
+  });
+
+  while (!started.load()) std::this_thread::yield();
+
+  const auto waiting_thread = std::this_thread::get_id();
+  std::atomic<size_t> on_waiting_thread{0};
+  for (size_t i = 0; i < 100; ++i) {
+    thread_pool.Launch([&on_waiting_thread, waiting_thread] {
+      if (std::this_thread::get_id() == waiting_thread) ++on_waiting_thread;
+    });
+  }
+
+  thread_pool.Launch([&release] { release = true; });
+
+  thread_pool.Wait();
+  EXPECT_EQ(100U, on_waiting_thread.load());
+}
+
+TEST_F(WorkStealingThreadPoolTest, DestroyWithQueuedTasks) {
+  std::atomic<size_t> count{0};
+
+  {
+    WorkStealingThreadPool thread_pool(2);
+    for (size_t i = 0; i < 1000; ++i)
+      thread_pool.Launch([&count] { ++count; });
+  }
+
+  // Tasks that hadn't started are discarded, without leaking.
+  EXPECT_LE(count.load(), 1000U);
+}
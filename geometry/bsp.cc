@@ -1,7 +1,10 @@
 #include <deque>
+#include <iterator>
+#include <numeric>
 
 #include <kj/debug.h>
 
+#include "base/parallel.h"
 #include "geometry/bsp.h"
 
 KDTree::KDTree(const std::vector<XYZ>& points) {
@@ -15,82 +18,131 @@ KDTree::KDTree(const std::vector<XYZ>& points) {
   std::deque<size_t> queue;
   queue.emplace_back(0);
 
-  while (!queue.empty()) {
-    auto& node = nodes_[queue.front()];
-    queue.pop_front();
+  Build(points, nodes_, queue);
+}
 
-    if (node.indices->size() < 2) continue;
-
-    auto max = points[(*node.indices)[0]];
-    auto min = max;
-
-    for (size_t i = 1; i < node.indices->size(); ++i) {
-      const auto& point = points[(*node.indices)[i]];
-
-      if (point.x > max.x)
-        max.x = point.x;
-      else if (point.x < min.x)
-        min.x = point.x;
-      if (point.y > max.y)
-        max.y = point.y;
-      else if (point.y < min.y)
-        min.y = point.y;
-      if (point.z > max.z)
-        max.z = point.z;
-      else if (point.z < min.z)
-        min.z = point.z;
-    }
+KDTree::KDTree(ev::ThreadPool& thread_pool, const std::vector<XYZ>& points) {
+  nodes_.emplace_back();
 
-    const auto xmag = max.x - min.x;
-    const auto ymag = max.y - min.y;
-    const auto zmag = max.z - min.z;
-
-    if (xmag > ymag && xmag > zmag) {
-      if (xmag < 1.0e-3f) continue;
-      node.axis = 0;
-      node.distance = 0.5f * (max.x + min.x);
-    } else if (ymag > zmag) {
-      if (ymag < 1.0e-3f) continue;
-      node.axis = 1;
-      node.distance = 0.5f * (max.y + min.y);
-    } else {
-      if (zmag < 1.0e-3f) continue;
-      node.axis = 2;
-      node.distance = 0.5f * (max.z + min.z);
-    }
+  nodes_[0].indices = std::make_unique<std::vector<uint32_t>>(points.size());
+  std::iota(nodes_[0].indices->begin(), nodes_[0].indices->end(), 0);
+
+  std::deque<size_t> queue;
+  queue.emplace_back(0);
 
-    const auto left_idx = node.left = nodes_.size();
-    const auto right_idx = node.right = nodes_.size() + 1;
+  Build(points, nodes_, queue,
+        thread_pool.Size() * ev::kParallelChunksPerThread);
 
-    auto indices = std::move(node.indices);
-    node.indices = nullptr;
+  // Each remaining subtree is built in a separate node array, with its root
+  // at index 0.
+  const std::vector<size_t> roots(queue.begin(), queue.end());
+  std::vector<std::vector<Node>> subtrees(roots.size());
 
-    const auto axis = node.axis;
-    const auto distance = node.distance;
+  ev::ParallelFor(thread_pool, 0, roots.size(), [&](size_t i) {
+    subtrees[i].emplace_back(std::move(nodes_[roots[i]]));
 
-    // This invalidates `node`.
-    nodes_.emplace_back();
-    nodes_.emplace_back();
+    std::deque<size_t> subtree_queue;
+    subtree_queue.emplace_back(0);
 
-    auto& left = nodes_[left_idx];
-    left.indices = std::move(indices);
+    Build(points, subtrees[i], subtree_queue);
+  });
 
-    auto& right = nodes_[right_idx];
-    right.indices = std::make_unique<std::vector<uint32_t>>();
+  for (size_t i = 0; i < roots.size(); ++i) {
+    auto& subtree = subtrees[i];
 
-    size_t out = 0;
-    for (const auto idx : *left.indices) {
-      if (points[idx].Get(axis) < distance) {
-        (*left.indices)[out++] = idx;
-      } else {
-        right.indices->emplace_back(idx);
-      }
+    // Maps subtree indexes, except for the root, to indexes in `nodes_`.
+    const auto offset = nodes_.size() - 1;
+
+    for (auto& node : subtree) {
+      if (node.indices) continue;
+      node.left += offset;
+      node.right += offset;
     }
 
-    left.indices->resize(out);
+    nodes_[roots[i]] = std::move(subtree[0]);
+    std::move(subtree.begin() + 1, subtree.end(), std::back_inserter(nodes_));
+  }
+}
+
+bool KDTree::SplitNode(const std::vector<XYZ>& points, Node& node, Node& left,
+                       Node& right) {
+  if (node.indices->size() < 2) return false;
+
+  auto max = points[(*node.indices)[0]];
+  auto min = max;
+
+  for (size_t i = 1; i < node.indices->size(); ++i) {
+    const auto& point = points[(*node.indices)[i]];
+
+    if (point.x > max.x)
+      max.x = point.x;
+    else if (point.x < min.x)
+      min.x = point.x;
+    if (point.y > max.y)
+      max.y = point.y;
+    else if (point.y < min.y)
+      min.y = point.y;
+    if (point.z > max.z)
+      max.z = point.z;
+    else if (point.z < min.z)
+      min.z = point.z;
+  }
+
+  const auto xmag = max.x - min.x;
+  const auto ymag = max.y - min.y;
+  const auto zmag = max.z - min.z;
+
+  if (xmag > ymag && xmag > zmag) {
+    if (xmag < 1.0e-3f) return false;
+    node.axis = 0;
+    node.distance = 0.5f * (max.x + min.x);
+  } else if (ymag > zmag) {
+    if (ymag < 1.0e-3f) return false;
+    node.axis = 1;
+    node.distance = 0.5f * (max.y + min.y);
+  } else {
+    if (zmag < 1.0e-3f) return false;
+    node.axis = 2;
+    node.distance = 0.5f * (max.z + min.z);
+  }
+
+  left.indices = std::move(node.indices);
+  node.indices = nullptr;
+
+  right.indices = std::make_unique<std::vector<uint32_t>>();
+
+  size_t out = 0;
+  for (const auto idx : *left.indices) {
+    if (points[idx].Get(node.axis) < node.distance) {
+      (*left.indices)[out++] = idx;
+    } else {
+      right.indices->emplace_back(idx);
+    }
+  }
+
+  left.indices->resize(out);
+
+  KJ_REQUIRE(!left.indices->empty());
+  KJ_REQUIRE(!right.indices->empty());
+
+  return true;
+}
+
+void KDTree::Build(const std::vector<XYZ>& points, std::vector<Node>& nodes,
+                   std::deque<size_t>& queue, size_t max_queue_size) {
+  while (!queue.empty() && queue.size() < max_queue_size) {
+    const auto idx = queue.front();
+    queue.pop_front();
+
+    Node left, right;
+    if (!SplitNode(points, nodes[idx], left, right)) continue;
+
+    const auto left_idx = nodes[idx].left = nodes.size();
+    const auto right_idx = nodes[idx].right = nodes.size() + 1;
 
-    KJ_REQUIRE(!left.indices->empty());
-    KJ_REQUIRE(!right.indices->empty());
+    // This invalidates references to `nodes`.
+    nodes.emplace_back(std::move(left));
+    nodes.emplace_back(std::move(right));
 
     queue.push_back(left_idx);
     queue.push_back(right_idx);
@@ -1,15 +1,26 @@
 #ifndef BASE_BSP_H_
 #define BASE_BSP_H_ 1
 
+#include <deque>
+#include <limits>
 #include <memory>
 #include <vector>
 
 #include "geometry/vector.h"
 
+namespace ev {
+class ThreadPool;
+}  // namespace ev
+
 class KDTree {
  public:
   KDTree(const std::vector<XYZ>& points);
 
+  // Builds the upper levels of the tree serially, and the subtrees below them
+  // in parallel.  The resulting tree answers queries like the one built by
+  // the serial constructor.
+  KDTree(ev::ThreadPool& thread_pool, const std::vector<XYZ>& points);
+
   std::vector<uint32_t> QuerySphere(const XYZ& center, float radius);
 
  private:
@@ -23,6 +34,18 @@ class KDTree {
     uint32_t right = 0;
   };
 
+  // Chooses a splitting plane for `node`, and moves its points to `left` and
+  // `right`.  Returns false, leaving `node` a leaf, if it has fewer than two
+  // points, or they are too close together to be split.
+  static bool SplitNode(const std::vector<XYZ>& points, Node& node, Node& left,
+                        Node& right);
+
+  // Splits the nodes in `queue` and their descendants, breadth first, until
+  // `queue` is empty or holds `max_queue_size` nodes.
+  static void Build(const std::vector<XYZ>& points, std::vector<Node>& nodes,
+                    std::deque<size_t>& queue,
+                    size_t max_queue_size = std::numeric_limits<size_t>::max());
+
   std::vector<Node> nodes_;
 };
 
@@ -21,7 +21,10 @@
 
 #include "base/columnfile.h"
 #include "base/file.h"
+#include "base/parallel.h"
 #include "base/string.h"
+#include "base/task-graph.h"
+#include "base/thread-pool.h"
 #include "geometry/bsp.h"
 #include "geometry/marching-cubes.h"
 #include "programs/3dviz/x11.h"
@@ -70,14 +73,6 @@ static GLuint create_gradient_texture(void) {
 }
 */
 
-template <typename T>
-T To(const ev::StringRef& data) {
-  T result;
-  KJ_REQUIRE(data.size() == sizeof(result), data.size());
-  memcpy(&result, data.data(), sizeof(result));
-  return result;
-}
-
 struct Image {
   size_t rows = 0;
   size_t cols = 0;
@@ -101,23 +96,63 @@ struct Dataset {
   std::vector<Image> ch4;
 };
 
+// Returns the schema of column files written before the schema was embedded
+// in the file.
+ev::ColumnFileSchema LegacyDICOMSchema() {
+  ev::ColumnFileSchema result;
+
+  result.AddColumn(0, "path", ev::kColumnTypeString);
+  result.AddColumn(1, "pixel_type", ev::kColumnTypeString);
+  result.AddColumn(2, "rows", ev::kColumnTypeInt);
+  result.AddColumn(3, "cols", ev::kColumnTypeInt);
+  result.AddColumn(4, "pixels", ev::kColumnTypeBinary);
+  result.AddColumn(0x0018'5100, "PatientPosition", ev::kColumnTypeString,
+                   0x0018'5100);
+  result.AddColumn(0x0020'0032, "ImagePositionPatient",
+                   ev::kColumnTypeFloatArray, 0x0020'0032);
+  result.AddColumn(0x0020'0037, "ImageOrientationPatient",
+                   ev::kColumnTypeFloatArray, 0x0020'0037);
+  result.AddColumn(0x0020'1041, "SliceLocation", ev::kColumnTypeFloat,
+                   0x0020'1041);
+  result.AddColumn(0x0028'0030, "PixelSpacing", ev::kColumnTypeFloatArray,
+                   0x0028'0030);
+
+  return result;
+}
+
 Dataset LoadDICOMs(std::string prefix) {
-  ev::ColumnFileSelect select(
-      ev::ColumnFileReader(ev::OpenFile("data/dicoms.col", O_RDONLY)));
-
-  select.AddSelection(0);
-  select.AddSelection(1);
-  select.AddSelection(2);
-  select.AddSelection(3);
-  select.AddSelection(4);
-  select.AddSelection(0x0018'5100);  // Patient position.
-  select.AddSelection(0x0020'0032);  // Image position.
-  select.AddSelection(0x0020'0037);  // Image plane cosines.
-  select.AddSelection(0x0020'1041);
-  select.AddSelection(0x0028'0030);  // Pixel spacing.
+  ev::ColumnFileReader reader(ev::OpenFile("data/dicoms.col", O_RDONLY));
+
+  auto schema = reader.Schema();
+  if (schema.Empty()) schema = LegacyDICOMSchema();
+
+  const auto path_column = schema.ColumnId("path");
+  const auto type_column = schema.ColumnId("pixel_type");
+  const auto rows_column = schema.ColumnId("rows");
+  const auto cols_column = schema.ColumnId("cols");
+  const auto pixels_column = schema.ColumnId("pixels");
+  const auto patient_position_column = schema.ColumnId("PatientPosition");
+  const auto image_position_column = schema.ColumnId("ImagePositionPatient");
+  const auto image_orientation_column =
+      schema.ColumnId("ImageOrientationPatient");
+  const auto slice_location_column = schema.ColumnId("SliceLocation");
+  const auto pixel_spacing_column = schema.ColumnId("PixelSpacing");
+
+  ev::ColumnFileSelect select(std::move(reader));
+
+  select.AddSelection(path_column);
+  select.AddSelection(type_column);
+  select.AddSelection(rows_column);
+  select.AddSelection(cols_column);
+  select.AddSelection(pixels_column);
+  select.AddSelection(patient_position_column);
+  select.AddSelection(image_position_column);
+  select.AddSelection(image_orientation_column);
+  select.AddSelection(slice_location_column);
+  select.AddSelection(pixel_spacing_column);
 
   // Filter for paths listed in `inputs`.
-  select.AddFilter(0, [&prefix](const ev::StringRefOrNull& path) {
+  select.AddFilter(path_column, [&prefix](const ev::StringRefOrNull& path) {
     return ev::HasPrefix(path.StringRef(), prefix);
   });
 
@@ -127,32 +162,38 @@ Dataset LoadDICOMs(std::string prefix) {
 
   select.Execute(
       region_pool,
-      [&result](const std::vector<std::pair<uint32_t, ev::StringRefOrNull>>& row) {
+      [&](const std::vector<std::pair<uint32_t, ev::StringRefOrNull>>& row) {
         std::unordered_map<uint32_t, ev::StringRefOrNull> data;
         for (const auto& kv : row) data.emplace(kv.first, kv.second);
 
         Image image;
 
-        const auto path = data.at(0).StringRef();
-        const auto type = data.at(1).StringRef().str();
-        image.rows = To<uint32_t>(data.at(2).StringRef());
-        image.cols = To<uint32_t>(data.at(3).StringRef());
-        const auto& pixel_data = data.at(4).StringRef();
+        const auto path = data.at(path_column).StringRef();
+        const auto type = data.at(type_column).StringRef().str();
+        image.rows =
+            schema.GetInt(rows_column, data.at(rows_column).StringRef());
+        image.cols =
+            schema.GetInt(cols_column, data.at(cols_column).StringRef());
+        const auto& pixel_data = data.at(pixels_column).StringRef();
 
-        const auto patient_position = data.at(0x0018'5100).StringRef().str();
+        const auto patient_position =
+            data.at(patient_position_column).StringRef().str();
         KJ_REQUIRE(patient_position == "HFS", patient_position);
 
-        const auto image_position = data.at(0x0020'0032).StringRef().str();
-        KJ_REQUIRE(3 == sscanf(image_position.c_str(), "%f,%f,%f",
-                               &image.position.x, &image.position.y,
-                               &image.position.z));
-        const auto image_orientation = data.at(0x0020'0037).StringRef().str();
-        KJ_REQUIRE(6 == sscanf(image_orientation.c_str(), "%f,%f,%f,%f,%f,%f",
-                               &image.row_direction.x, &image.row_direction.y,
-                               &image.row_direction.z, &image.col_direction.x,
-                               &image.col_direction.y, &image.col_direction.z));
-        image.row_direction = image.row_direction.normalize();
-        image.col_direction = image.col_direction.normalize();
+        const auto image_position = schema.GetFloatArray(
+            image_position_column, data.at(image_position_column).StringRef());
+        KJ_REQUIRE(image_position.size() == 3, image_position.size());
+        image.position =
+            XYZ(image_position[0], image_position[1], image_position[2]);
+
+        const auto image_orientation =
+            schema.GetFloatArray(image_orientation_column,
+                                 data.at(image_orientation_column).StringRef());
+        KJ_REQUIRE(image_orientation.size() == 6, image_orientation.size());
+        image.row_direction = XYZ(image_orientation[0], image_orientation[1],
+                                  image_orientation[2]).normalize();
+        image.col_direction = XYZ(image_orientation[3], image_orientation[4],
+                                  image_orientation[5]).normalize();
 
 #if 0
         fprintf(stderr, "Position: %.3f, %.3f, %.3f\n", image.position.x,
@@ -165,12 +206,14 @@ Dataset LoadDICOMs(std::string prefix) {
                 image.col_direction.z);
 #endif
 
-        image.stack_position =
-            std::round(To<double>(data.at(0x0020'1041).StringRef()));
+        image.stack_position = std::round(schema.GetFloat(
+            slice_location_column, data.at(slice_location_column).StringRef()));
 
-        const auto& pixel_spacing = data.at(0x0028'0030).StringRef().str();
-        KJ_REQUIRE(2 == sscanf(pixel_spacing.c_str(), "%f,%f",
-                               &image.row_spacing, &image.col_spacing));
+        const auto pixel_spacing = schema.GetFloatArray(
+            pixel_spacing_column, data.at(pixel_spacing_column).StringRef());
+        KJ_REQUIRE(pixel_spacing.size() == 2, pixel_spacing.size());
+        image.row_spacing = pixel_spacing[0];
+        image.col_spacing = pixel_spacing[1];
 
         image.data.resize(image.rows * image.cols);
 
@@ -218,11 +261,12 @@ Dataset LoadDICOMs(std::string prefix) {
   return result;
 }
 
-void DeduplicateVertices(std::vector<XYZ>& vertices,
+void DeduplicateVertices(ev::ThreadPool& thread_pool,
+                         std::vector<XYZ>& vertices,
                          std::vector<XYZ>& normals,
                          std::vector<uint32_t>& indices,
                          float margin = 0.0001f) {
-  KDTree bsp(vertices);
+  KDTree bsp(thread_pool, vertices);
 
   std::vector<XYZ> output_vertices, output_normals;
 
@@ -348,8 +392,6 @@ void ColorObjects(size_t vertex_count, const std::vector<uint32_t>& indices,
     object.emplace_back(indices[i + 1]);
     object.emplace_back(indices[i + 2]);
   }
-
-  fprintf(stderr, "%zu objects ", groups.size());
 }
 
 struct LeftVentricle {
@@ -517,7 +559,8 @@ double ScoreLeftVentricle(const LeftVentricle& lv, const std::vector<XYZ>& point
 }
 #endif
 
-Scene LoadScene(const std::vector<Image>& images, const Image& ch2, const Image& ch4, bool foo) {
+// Builds a deduplicated triangle mesh of the volume in `images`.
+Scene MeshScene(ev::ThreadPool& thread_pool, const std::vector<Image>& images) {
   Scene result;
 
   const auto rows = images[0].rows;
@@ -542,25 +585,25 @@ Scene LoadScene(const std::vector<Image>& images, const Image& ch2, const Image&
   float cutoff = 0.0f;
   {
     auto foo = field;
-    std::sort(foo.begin(), foo.end());
+    ev::ParallelSort(thread_pool, foo.begin(), foo.end());
     cutoff = foo[foo.size() * 85 / 100];
   }
 
-  std::transform(field.begin(), field.end(), field.begin(),
-                 [cutoff](const auto v) { return v - cutoff; });
+  ev::ParallelTransform(thread_pool, field.begin(), field.end(), field.begin(),
+                        [cutoff](const auto v) { return v - cutoff; });
 
-  fprintf(stderr, "Triangulating... ");
+  // Scenes are meshed concurrently, so every message is a single line.
   Triangulate(field.data(), cols, rows, images.size(), result.vertices, result.normals,
               result.indices);
-  fprintf(stderr, "done (%zu vertices).\n", result.vertices.size());
+  fprintf(stderr, "Triangulated %zu vertices.\n", result.vertices.size());
 
   KJ_REQUIRE(result.indices.size() > 0);
   KJ_REQUIRE(result.vertices.size() < std::numeric_limits<uint32_t>::max(),
              result.vertices.size());
 
-  fprintf(stderr, "Deduplicating... ");
-  DeduplicateVertices(result.vertices, result.normals, result.indices);
-  fprintf(stderr, "done (%zu vertices).\n", result.vertices.size());
+  DeduplicateVertices(thread_pool, result.vertices, result.normals,
+                      result.indices);
+  fprintf(stderr, "Deduplicated to %zu vertices.\n", result.vertices.size());
 
   const auto y_scale =
       (images.back().stack_position - images.front().stack_position) /
@@ -577,21 +620,27 @@ Scene LoadScene(const std::vector<Image>& images, const Image& ch2, const Image&
       row_direction * images.front().cols * 0.5f + col_direction * images.front().rows * 0.5f/* + axial_direction * images.size() * 0.5f*/;
   result.up = axial_direction.normalize();
 
-  std::transform(result.vertices.begin(), result.vertices.end(),
-                 result.vertices.begin(),
-                 [rows, cols, y_scale, origin, row_direction, col_direction,
-                  axial_direction](auto v) {
-                   auto point = origin;
-                   point += row_direction * v.x;
-                   point += col_direction * v.y;
-                   point += axial_direction * v.z;
-                   return point;
-                 });
-
-  fprintf(stderr, "Coloring... ");
+  ev::ParallelTransform(
+      thread_pool, result.vertices.begin(), result.vertices.end(),
+      result.vertices.begin(),
+      [rows, cols, y_scale, origin, row_direction, col_direction,
+       axial_direction](auto v) {
+        auto point = origin;
+        point += row_direction * v.x;
+        point += col_direction * v.y;
+        point += axial_direction * v.z;
+        return point;
+      });
+
+  return result;
+}
+
+// Removes the connected parts of the mesh that can't be the left ventricle,
+// and fits a left ventricle model.
+void FilterScene(Scene& result, const std::vector<Image>& images, const Image& ch2, const Image& ch4) {
   std::vector<std::vector<uint32_t>> objects;
   ColorObjects(result.vertices.size(), result.indices, objects);
-  fprintf(stderr, "done.\n");
+  fprintf(stderr, "Colored %zu objects.\n", objects.size());
 
   // Image planes for alternate (non-stack) views.
   const auto ch2_plane = ch2.row_direction.cross(ch2.col_direction);
@@ -654,8 +703,6 @@ Scene LoadScene(const std::vector<Image>& images, const Image& ch2, const Image&
   result.lv.axis = result.up;
   result.lv.length = (images.back().position - images.front().position).magnitude();
   result.lv.top_radius = 30.0f;
-
-  return result;
 }
 
 void DrawLeftVentricle(const LeftVentricle& lv) {
@@ -706,21 +753,54 @@ int main(int argc, char** argv) try {
   auto dataset = LoadDICOMs(argv[1]);
   KJ_REQUIRE(dataset.sax.size() >= 2, dataset.sax.size());
 
-  std::vector<Scene> scenes;
+  ev::ThreadPool thread_pool;
+
+  std::vector<Scene> scenes(30);
+
+  // Frames are meshed and filtered by separate stages, so that filtering one
+  // frame overlaps with meshing the next.  The stages get their own threads,
+  // since meshing uses `thread_pool` for data parallel work.
+  struct Frame {
+    size_t index = 0;
+    std::vector<Image> images;
+    Scene scene;
+  };
+
+  ev::TaskGraph graph;
+  auto& meshed_frames = graph.AddChannel<std::unique_ptr<Frame>>(2);
+
+  const auto mesh = graph.AddNode("mesh", [&] {
+    for (size_t frame = 0; frame < scenes.size(); ++frame) {
+      auto item = std::make_unique<Frame>();
+      item->index = frame;
 
-  for (size_t frame = 0; frame < 30; ++frame) {
-    std::vector<Image> scene_images;
+      for (size_t i = frame; i < dataset.sax.size(); i += 30) {
+        if (i >= 30 && (dataset.sax[i].position - dataset.sax[i - 30].position).magnitude() < 5.0f) {
+          continue;
+        }
 
-    for (size_t i = frame; i < dataset.sax.size(); i += 30) {
-      if (i >= 30 && (dataset.sax[i].position - dataset.sax[i - 30].position).magnitude() < 5.0f) {
-        continue;
+        item->images.emplace_back(dataset.sax[i]);
       }
 
-      scene_images.emplace_back(dataset.sax[i]);
+      item->scene = MeshScene(thread_pool, item->images);
+      meshed_frames.Put(std::move(item));
     }
+  });
 
-    scenes.emplace_back(LoadScene(scene_images, dataset.ch2[frame], dataset.ch4[frame], frame == 0));
-  }
+  const auto filter = graph.AddNode("filter", [&] {
+    std::unique_ptr<Frame> item;
+    while (meshed_frames.Get(item)) {
+      FilterScene(item->scene, item->images, dataset.ch2[item->index],
+                  dataset.ch4[item->index]);
+      scenes[item->index] = std::move(item->scene);
+    }
+  });
+
+  graph.Produces(mesh, meshed_frames);
+  graph.Consumes(filter, meshed_frames);
+
+  ev::ThreadPool stage_pool(2);
+  graph.Run(stage_pool);
 
   float sum_x = 0.0f, sum_y = 0.0f;
   size_t count = 0;
@@ -0,0 +1,88 @@
+// Serves decompressed column file fields from shared memory to readers
+// opened with `ColumnFileReader::SharedCacheInput()`.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include <err.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sysexits.h>
+
+#include <kj/debug.h>
+
+#include "base/columnfile.h"
+
+namespace {
+
+int print_help;
+
+struct option kLongOptions[] = {
+    {"capacity", required_argument, nullptr, 'c'},
+    {"socket", required_argument, nullptr, 's'},
+    {"help", no_argument, &print_help, 1},
+    {nullptr, 0, nullptr, 0}};
+
+}  // namespace
+
+int main(int argc, char** argv) try {
+  std::string socket_path = ev::ColumnFileCacheSocketPath();
+  size_t capacity = size_t(4) << 30;
+
+  int i;
+  while ((i = getopt_long(argc, argv, "", kLongOptions, 0)) != -1) {
+    if (!i) continue;
+    if (i == '?')
+      errx(EX_USAGE, "Try '%s --help' for more information.", argv[0]);
+
+    switch (i) {
+      case 'c': {
+        char* end;
+        capacity = strtoull(optarg, &end, 0) << 20;
+        if (*end) errx(EX_USAGE, "Invalid capacity '%s'", optarg);
+      } break;
+
+      case 's':
+        socket_path = optarg;
+        break;
+    }
+  }
+
+  if (print_help) {
+    printf(
+        "Usage: %s [OPTION]...\n"
+        "\n"
+        "      --capacity=MIB     cache at most MIB mebibytes of field data\n"
+        "      --socket=PATH      listen on PATH instead of %s\n"
+        "      --help             display this help and exit\n",
+        argv[0], ev::ColumnFileCacheSocketPath().c_str());
+
+    return EXIT_SUCCESS;
+  }
+
+  if (optind != argc) errx(EX_USAGE, "Usage: %s [OPTION]...", argv[0]);
+
+  // Handle termination signals on a dedicated thread, so that the server can
+  // remove its socket on exit.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  KJ_REQUIRE(0 == pthread_sigmask(SIG_BLOCK, &signals, nullptr));
+
+  ev::ColumnFileCacheServer server(socket_path.c_str(), capacity);
+
+  std::thread signal_thread([&server, &signals] {
+    int signal;
+    sigwait(&signals, &signal);
+    server.Stop();
+  });
+  signal_thread.detach();
+
+  server.Run();
+} catch (kj::Exception e) {
+  KJ_LOG(FATAL, e);
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,191 @@
+// Writes a submission CSV holding the cumulative distribution of the
+// diastole and systole volumes of each study, like create-submission.py.
+// Each input line holds a study number, the diastole and systole means, and
+// the diastole and systole standard deviations, separated by tabs.  Only
+// the first prediction of each study is used.  Studies are formatted in
+// parallel.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <err.h>
+#include <getopt.h>
+#include <sysexits.h>
+
+#include <kj/debug.h>
+
+#include "base/cat.h"
+#include "base/file.h"
+#include "base/statistics.h"
+#include "base/string.h"
+#include "base/thread-pool.h"
+
+namespace {
+
+// Number of values in each distribution, for volumes 0, 1, ..., 599 ml.
+const size_t kVolumes = 600;
+
+// Studies formatted by each task.
+const size_t kStudiesPerTask = 32;
+
+int print_help;
+
+struct option kLongOptions[] = {{"threads", required_argument, nullptr, 't'},
+                                {"help", no_argument, &print_help, 1},
+                                {nullptr, 0, nullptr, 0}};
+
+struct Prediction {
+  uint64_t study;
+
+  // Diastole, then systole.
+  double mean[2];
+  double stddev[2];
+};
+
+double ParseDouble(const ev::StringRef& value) {
+  return ev::StringToDouble(ev::Trim(value.str()).c_str());
+}
+
+// Adds the first prediction of each study in the file at `path` to
+// `predictions`.
+void ReadPredictions(const char* path,
+                     std::map<uint64_t, Prediction>& predictions) {
+  KJ_CONTEXT(path);
+
+  const auto data = ev::ReadFile(path);
+  const ev::StringRef text(data.begin(), data.size());
+
+  size_t line_number = 0;
+
+  for (const auto& line : ev::Explode(text, "\n")) {
+    ++line_number;
+    if (ev::Trim(line.str()).empty()) continue;
+
+    const auto fields = ev::Explode(line, "\t");
+    KJ_REQUIRE(fields.size() >= 5, "Too few fields", line_number);
+
+    Prediction prediction;
+    prediction.study = ev::StringToUInt64(ev::Trim(fields[0].str()));
+    prediction.mean[0] = ParseDouble(fields[1]);
+    prediction.mean[1] = ParseDouble(fields[2]);
+    prediction.stddev[0] = ParseDouble(fields[3]);
+    prediction.stddev[1] = ParseDouble(fields[4]);
+
+    KJ_REQUIRE(prediction.stddev[0] > 0 && prediction.stddev[1] > 0,
+               "Standard deviation must be positive", line_number);
+
+    predictions.emplace(prediction.study, prediction);
+  }
+}
+
+// Formats a probability like create-submission.py.
+void AppendProbability(std::string& output, double p) {
+  if (p < 0.001)
+    output += '0';
+  else if (p > 0.999)
+    output += '1';
+  else
+    ev::AppendFixed(output, p, 3);
+}
+
+// Returns the CSV lines of the given predictions.
+std::string FormatPredictions(const Prediction* begin, const Prediction* end) {
+  static const char* const kPhases[] = {"_Diastole", "_Systole"};
+
+  std::string result;
+  double cdf[kVolumes];
+
+  for (auto prediction = begin; prediction != end; ++prediction) {
+    for (size_t phase = 0; phase < 2; ++phase) {
+      ev::NormalCDFAtIntegers(prediction->mean[phase],
+                              prediction->stddev[phase], cdf, kVolumes);
+
+      ev::cat_to(&result, prediction->study, kPhases[phase]);
+
+      for (size_t i = 0; i < kVolumes; ++i) {
+        result += ',';
+        AppendProbability(result, cdf[i]);
+      }
+
+      result += '\n';
+    }
+  }
+
+  return result;
+}
+
+void Write(const std::string& data) {
+  if (data.size() != fwrite(data.data(), 1, data.size(), stdout))
+    err(EXIT_FAILURE, "Write failed");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) try {
+  size_t thread_count = std::thread::hardware_concurrency();
+
+  int i;
+  while ((i = getopt_long(argc, argv, "", kLongOptions, 0)) != -1) {
+    if (!i) continue;
+    if (i == '?')
+      errx(EX_USAGE, "Try '%s --help' for more information.", argv[0]);
+
+    switch (i) {
+      case 't': {
+        char* end;
+        thread_count = strtoul(optarg, &end, 0);
+        if (*end || !thread_count)
+          errx(EX_USAGE, "Invalid thread count '%s'", optarg);
+      } break;
+    }
+  }
+
+  if (print_help) {
+    printf(
+        "Usage: %s [OPTION]... PREDICTIONS...\n"
+        "\n"
+        "      --threads=N        use N threads for formatting\n"
+        "      --help             display this help and exit\n",
+        argv[0]);
+
+    return EXIT_SUCCESS;
+  }
+
+  std::map<uint64_t, Prediction> prediction_map;
+  for (; optind < argc; ++optind) ReadPredictions(argv[optind], prediction_map);
+
+  std::vector<Prediction> predictions;
+  predictions.reserve(prediction_map.size());
+  for (const auto& kv : prediction_map) predictions.emplace_back(kv.second);
+
+  std::string header = "Id";
+  for (size_t i = 0; i < kVolumes; ++i) ev::cat_to(&header, ",P", i);
+  header += '\n';
+  Write(header);
+
+  ev::ThreadPool thread_pool(thread_count);
+  std::vector<std::future<std::string>> chunks;
+
+  for (size_t i = 0; i < predictions.size(); i += kStudiesPerTask) {
+    const auto begin = predictions.data() + i;
+    const auto end =
+        begin + std::min(kStudiesPerTask, predictions.size() - i);
+
+    chunks.emplace_back(thread_pool.Launch(
+        [begin, end] { return FormatPredictions(begin, end); }));
+  }
+
+  // Chunks are written in order, as they complete.
+  for (auto& chunk : chunks) Write(chunk.get());
+
+  if (fflush(stdout)) err(EXIT_FAILURE, "Write failed");
+} catch (kj::Exception e) {
+  KJ_LOG(FATAL, e);
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,349 @@
+#include "programs/load-dicom/dicom.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <kj/debug.h>
+
+namespace dicom {
+
+namespace {
+
+const uint32_t kUndefinedLength = 0xffffffff;
+
+const uint32_t kTagItem = 0xfffe'e000;
+const uint32_t kTagItemDelimitation = 0xfffe'e00d;
+const uint32_t kTagSequenceDelimitation = 0xfffe'e0dd;
+
+struct DictionaryEntry {
+  uint32_t tag;
+  char vr[3];
+  const char* keyword;
+};
+
+// Tags found in the cardiac MRI studies we load.  Sorted by tag.
+const DictionaryEntry kDictionary[] = {
+    {0x0008'0005, "CS", "SpecificCharacterSet"},
+    {0x0008'0008, "CS", "ImageType"},
+    {0x0008'0012, "DA", "InstanceCreationDate"},
+    {0x0008'0013, "TM", "InstanceCreationTime"},
+    {0x0008'0016, "UI", "SOPClassUID"},
+    {0x0008'0018, "UI", "SOPInstanceUID"},
+    {0x0008'0020, "DA", "StudyDate"},
+    {0x0008'0021, "DA", "SeriesDate"},
+    {0x0008'0022, "DA", "AcquisitionDate"},
+    {0x0008'0023, "DA", "ContentDate"},
+    {0x0008'0030, "TM", "StudyTime"},
+    {0x0008'0031, "TM", "SeriesTime"},
+    {0x0008'0032, "TM", "AcquisitionTime"},
+    {0x0008'0033, "TM", "ContentTime"},
+    {0x0008'0050, "SH", "AccessionNumber"},
+    {0x0008'0060, "CS", "Modality"},
+    {0x0008'0070, "LO", "Manufacturer"},
+    {0x0008'0080, "LO", "InstitutionName"},
+    {0x0008'0090, "PN", "ReferringPhysicianName"},
+    {0x0008'1030, "LO", "StudyDescription"},
+    {0x0008'103e, "LO", "SeriesDescription"},
+    {0x0008'1090, "LO", "ManufacturerModelName"},
+    {0x0010'0010, "PN", "PatientName"},
+    {0x0010'0020, "LO", "PatientID"},
+    {0x0010'0030, "DA", "PatientBirthDate"},
+    {0x0010'0040, "CS", "PatientSex"},
+    {0x0010'1010, "AS", "PatientAge"},
+    {0x0010'1020, "DS", "PatientSize"},
+    {0x0010'1030, "DS", "PatientWeight"},
+    {0x0018'0020, "CS", "ScanningSequence"},
+    {0x0018'0021, "CS", "SequenceVariant"},
+    {0x0018'0022, "CS", "ScanOptions"},
+    {0x0018'0023, "CS", "MRAcquisitionType"},
+    {0x0018'0024, "SH", "SequenceName"},
+    {0x0018'0025, "CS", "AngioFlag"},
+    {0x0018'0050, "DS", "SliceThickness"},
+    {0x0018'0080, "DS", "RepetitionTime"},
+    {0x0018'0081, "DS", "EchoTime"},
+    {0x0018'0083, "DS", "NumberOfAverages"},
+    {0x0018'0084, "DS", "ImagingFrequency"},
+    {0x0018'0085, "SH", "ImagedNucleus"},
+    {0x0018'0086, "IS", "EchoNumbers"},
+    {0x0018'0087, "DS", "MagneticFieldStrength"},
+    {0x0018'0088, "DS", "SpacingBetweenSlices"},
+    {0x0018'0091, "IS", "EchoTrainLength"},
+    {0x0018'0093, "DS", "PercentSampling"},
+    {0x0018'0094, "DS", "PercentPhaseFieldOfView"},
+    {0x0018'0095, "DS", "PixelBandwidth"},
+    {0x0018'1000, "LO", "DeviceSerialNumber"},
+    {0x0018'1020, "LO", "SoftwareVersions"},
+    {0x0018'1030, "LO", "ProtocolName"},
+    {0x0018'1060, "DS", "TriggerTime"},
+    {0x0018'1088, "IS", "HeartRate"},
+    {0x0018'1090, "IS", "CardiacNumberOfImages"},
+    {0x0018'1094, "IS", "TriggerWindow"},
+    {0x0018'1100, "DS", "ReconstructionDiameter"},
+    {0x0018'1250, "SH", "ReceiveCoilName"},
+    {0x0018'1251, "SH", "TransmitCoilName"},
+    {0x0018'1310, "US", "AcquisitionMatrix"},
+    {0x0018'1312, "CS", "InPlanePhaseEncodingDirection"},
+    {0x0018'1314, "DS", "FlipAngle"},
+    {0x0018'1316, "DS", "SAR"},
+    {0x0018'5100, "CS", "PatientPosition"},
+    {0x0020'000d, "UI", "StudyInstanceUID"},
+    {0x0020'000e, "UI", "SeriesInstanceUID"},
+    {0x0020'0010, "SH", "StudyID"},
+    {0x0020'0011, "IS", "SeriesNumber"},
+    {0x0020'0012, "IS", "AcquisitionNumber"},
+    {0x0020'0013, "IS", "InstanceNumber"},
+    {0x0020'0032, "DS", "ImagePositionPatient"},
+    {0x0020'0037, "DS", "ImageOrientationPatient"},
+    {0x0020'0052, "UI", "FrameOfReferenceUID"},
+    {0x0020'1040, "LO", "PositionReferenceIndicator"},
+    {0x0020'1041, "DS", "SliceLocation"},
+    {0x0028'0002, "US", "SamplesPerPixel"},
+    {0x0028'0004, "CS", "PhotometricInterpretation"},
+    {0x0028'0008, "IS", "NumberOfFrames"},
+    {0x0028'0010, "US", "Rows"},
+    {0x0028'0011, "US", "Columns"},
+    {0x0028'0030, "DS", "PixelSpacing"},
+    {0x0028'0100, "US", "BitsAllocated"},
+    {0x0028'0101, "US", "BitsStored"},
+    {0x0028'0102, "US", "HighBit"},
+    {0x0028'0103, "US", "PixelRepresentation"},
+    {0x0028'0106, "US", "SmallestImagePixelValue"},
+    {0x0028'0107, "US", "LargestImagePixelValue"},
+    {0x0028'1050, "DS", "WindowCenter"},
+    {0x0028'1051, "DS", "WindowWidth"},
+    {0x0028'1055, "LO", "WindowCenterWidthExplanation"},
+    {0x7fe0'0010, "OW", "PixelData"},
+};
+
+const DictionaryEntry* FindDictionaryEntry(uint32_t tag) {
+  const auto end = kDictionary + sizeof(kDictionary) / sizeof(kDictionary[0]);
+
+  const auto i = std::lower_bound(kDictionary, end, tag,
+                                  [](const DictionaryEntry& entry,
+                                     uint32_t tag) { return entry.tag < tag; });
+
+  return (i != end && i->tag == tag) ? i : nullptr;
+}
+
+uint16_t GetUInt16(ev::StringRef& data) {
+  KJ_REQUIRE(data.size() >= 2, "Unexpected end of file");
+  const auto bytes = reinterpret_cast<const uint8_t*>(data.data());
+  data.Consume(2);
+  return bytes[0] | (bytes[1] << 8);
+}
+
+uint32_t GetUInt32(ev::StringRef& data) {
+  KJ_REQUIRE(data.size() >= 4, "Unexpected end of file");
+  const auto bytes = reinterpret_cast<const uint8_t*>(data.data());
+  data.Consume(4);
+  return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) |
+         (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+uint32_t GetTag(ev::StringRef& data) {
+  const uint32_t group = GetUInt16(data);
+  return (group << 16) | GetUInt16(data);
+}
+
+// Returns true if values of `vr` have a 32 bit length in explicit VR
+// encoding, preceded by two reserved bytes.
+bool HasLongLength(const char* vr) {
+  static const char* const kLongVRs[] = {"OB", "OD", "OF", "OL", "OW", "SQ",
+                                         "UC", "UN", "UR", "UT"};
+
+  for (const auto long_vr : kLongVRs) {
+    if (vr[0] == long_vr[0] && vr[1] == long_vr[1]) return true;
+  }
+
+  return false;
+}
+
+void ReadElement(ev::StringRef& data, bool explicit_vr, Element& element);
+
+// Skips the items of a sequence of undefined length, up to and including
+// the sequence delimitation item.
+void SkipSequence(ev::StringRef& data, bool explicit_vr) {
+  for (;;) {
+    const auto tag = GetTag(data);
+    const auto length = GetUInt32(data);
+
+    if (tag == kTagSequenceDelimitation) return;
+
+    KJ_REQUIRE(tag == kTagItem, "Expected sequence item", tag);
+
+    if (length != kUndefinedLength) {
+      KJ_REQUIRE(length <= data.size(), "Unexpected end of file");
+      data.Consume(length);
+      continue;
+    }
+
+    Element element;
+
+    for (;;) {
+      ev::StringRef peek(data);
+      if (GetTag(peek) == kTagItemDelimitation) {
+        data = peek;
+        GetUInt32(data);
+        break;
+      }
+
+      ReadElement(data, explicit_vr, element);
+    }
+  }
+}
+
+void ReadElement(ev::StringRef& data, bool explicit_vr, Element& element) {
+  element.tag = GetTag(data);
+
+  uint32_t length;
+
+  if (explicit_vr) {
+    KJ_REQUIRE(data.size() >= 2, "Unexpected end of file");
+    element.vr[0] = data[0];
+    element.vr[1] = data[1];
+    data.Consume(2);
+
+    if (HasLongLength(element.vr)) {
+      GetUInt16(data);  // Reserved.
+      length = GetUInt32(data);
+    } else {
+      length = GetUInt16(data);
+    }
+  } else {
+    const auto entry = FindDictionaryEntry(element.tag);
+    element.vr[0] = entry ? entry->vr[0] : 'U';
+    element.vr[1] = entry ? entry->vr[1] : 'N';
+
+    length = GetUInt32(data);
+  }
+
+  if (length == kUndefinedLength) {
+    KJ_REQUIRE(element.tag != kTagPixelData,
+               "Encapsulated pixel data is not supported");
+
+    // Only sequences, and unknown elements holding sequences, may have an
+    // undefined length.
+    KJ_REQUIRE(element.HasVR("SQ") || element.HasVR("UN"),
+               "Undefined length", element.tag);
+
+    SkipSequence(data, explicit_vr);
+
+    element.vr[0] = 'S';
+    element.vr[1] = 'Q';
+    element.value = ev::StringRef();
+
+    return;
+  }
+
+  KJ_REQUIRE(length <= data.size(), "Unexpected end of file", element.tag,
+             length);
+  element.value = ev::StringRef(data.data(), length);
+  data.Consume(length);
+}
+
+}  // namespace
+
+std::vector<Element> Parse(ev::StringRef data) {
+  static const char kMagic[] = "DICM";
+  static const size_t kPreambleSize = 128;
+
+  // Files without a preamble and file meta information are implicit VR.
+  bool explicit_vr = false;
+
+  if (data.size() >= kPreambleSize + 4 &&
+      !memcmp(data.data() + kPreambleSize, kMagic, 4)) {
+    data.Consume(kPreambleSize + 4);
+
+    // The file meta information is always explicit VR little endian.
+    std::string transfer_syntax;
+    Element element;
+
+    for (;;) {
+      ev::StringRef peek(data);
+      if (peek.size() < 4 || (GetTag(peek) >> 16) != 0x0002) break;
+
+      ReadElement(data, true, element);
+
+      if (element.tag == kTagTransferSyntaxUID) {
+        transfer_syntax = element.value.str();
+
+        // UIDs are padded to an even length with a NUL byte.
+        while (!transfer_syntax.empty() &&
+               (transfer_syntax.back() == '\0' ||
+                transfer_syntax.back() == ' '))
+          transfer_syntax.pop_back();
+      }
+    }
+
+    if (transfer_syntax == "1.2.840.10008.1.2.1") {
+      explicit_vr = true;
+    } else {
+      KJ_REQUIRE(transfer_syntax == "1.2.840.10008.1.2",
+                 "Unsupported transfer syntax", transfer_syntax);
+    }
+  }
+
+  std::vector<Element> result;
+
+  while (!data.empty()) {
+    Element element;
+    ReadElement(data, explicit_vr, element);
+
+    if (element.HasVR("SQ")) continue;
+
+    result.emplace_back(element);
+  }
+
+  return result;
+}
+
+const char* KeywordForTag(uint32_t tag) {
+  const auto entry = FindDictionaryEntry(tag);
+  return entry ? entry->keyword : nullptr;
+}
+
+const Element* Find(const std::vector<Element>& elements, uint32_t tag) {
+  for (const auto& element : elements) {
+    if (element.tag == tag) return &element;
+  }
+
+  return nullptr;
+}
+
+int64_t GetInt(const Element& element) {
+  auto data = element.value;
+
+  if (element.HasVR("US")) {
+    KJ_REQUIRE(data.size() == 2, element.tag, data.size());
+    return GetUInt16(data);
+  } else if (element.HasVR("SS")) {
+    KJ_REQUIRE(data.size() == 2, element.tag, data.size());
+    return static_cast<int16_t>(GetUInt16(data));
+  } else if (element.HasVR("UL")) {
+    KJ_REQUIRE(data.size() == 4, element.tag, data.size());
+    return GetUInt32(data);
+  } else if (element.HasVR("SL")) {
+    KJ_REQUIRE(data.size() == 4, element.tag, data.size());
+    return static_cast<int32_t>(GetUInt32(data));
+  } else if (element.HasVR("IS")) {
+    auto text = data.str();
+    KJ_REQUIRE(text.find('\\') == std::string::npos, "Multiple values",
+               element.tag);
+
+    char* end;
+    const auto result = strtoll(text.c_str(), &end, 10);
+    KJ_REQUIRE(end != text.c_str(), "Invalid integer string", element.tag);
+
+    // Values are padded with spaces to an even length.
+    while (*end == ' ') ++end;
+    KJ_REQUIRE(!*end, "Invalid integer string", element.tag, text);
+
+    return result;
+  }
+
+  KJ_FAIL_REQUIRE("Not an integer element", element.tag);
+}
+
+}  // namespace dicom
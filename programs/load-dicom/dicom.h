@@ -0,0 +1,58 @@
+#ifndef PROGRAMS_LOAD_DICOM_DICOM_H_
+#define PROGRAMS_LOAD_DICOM_DICOM_H_ 1
+
+#include <cstdint>
+#include <vector>
+
+#include "base/stringref.h"
+
+namespace dicom {
+
+// Tags are stored as (group << 16) | element.
+const uint32_t kTagTransferSyntaxUID = 0x0002'0010;
+const uint32_t kTagSamplesPerPixel = 0x0028'0002;
+const uint32_t kTagNumberOfFrames = 0x0028'0008;
+const uint32_t kTagRows = 0x0028'0010;
+const uint32_t kTagColumns = 0x0028'0011;
+const uint32_t kTagBitsAllocated = 0x0028'0100;
+const uint32_t kTagPixelRepresentation = 0x0028'0103;
+const uint32_t kTagPixelData = 0x7fe0'0010;
+
+struct Element {
+  uint32_t tag = 0;
+
+  // Two letter value representation, such as "DS" or "US".
+  char vr[2] = {'U', 'N'};
+
+  // The raw value, pointing into the file data.
+  ev::StringRef value;
+
+  bool HasVR(const char* other) const {
+    return vr[0] == other[0] && vr[1] == other[1];
+  }
+};
+
+// Parses the data set of a DICOM file with native (uncompressed) little
+// endian pixel data, in explicit or implicit VR.  Returns the top level
+// elements in file order, excluding the file meta information.  Sequences
+// are skipped.  In implicit VR files, the VR of tags missing from the
+// built-in dictionary is "UN".
+//
+// Throws an exception for malformed files and for unsupported transfer
+// syntaxes.
+std::vector<Element> Parse(ev::StringRef data);
+
+// Returns the keyword of `tag`, such as "PixelSpacing", or nullptr if `tag`
+// is missing from the built-in dictionary.
+const char* KeywordForTag(uint32_t tag);
+
+// Returns the element with the given tag, or nullptr.
+const Element* Find(const std::vector<Element>& elements, uint32_t tag);
+
+// Returns the value of a single-valued US, UL, SS, SL or IS element.  Throws
+// an exception if the element is of another type, or has several values.
+int64_t GetInt(const Element& element);
+
+}  // namespace dicom
+
+#endif  // !PROGRAMS_LOAD_DICOM_DICOM_H_
@@ -0,0 +1,251 @@
+#include <string>
+
+#include <kj/debug.h>
+
+#include "programs/load-dicom/dicom.h"
+#include "third_party/gtest/gtest.h"
+
+using namespace dicom;
+
+namespace {
+
+const char kExplicitVRLittleEndian[] = "1.2.840.10008.1.2.1";
+const char kImplicitVRLittleEndian[] = "1.2.840.10008.1.2";
+
+const uint32_t kUndefinedLength = 0xffffffff;
+
+void PutUInt16(std::string& out, uint16_t v) {
+  out.push_back(v & 0xff);
+  out.push_back(v >> 8);
+}
+
+void PutUInt32(std::string& out, uint32_t v) {
+  PutUInt16(out, v & 0xffff);
+  PutUInt16(out, v >> 16);
+}
+
+void PutTag(std::string& out, uint32_t tag) {
+  PutUInt16(out, tag >> 16);
+  PutUInt16(out, tag & 0xffff);
+}
+
+// Appends an element in explicit VR encoding.
+void PutExplicit(std::string& out, uint32_t tag, const char* vr,
+                 const std::string& value) {
+  PutTag(out, tag);
+  out.append(vr, 2);
+
+  const std::string long_vrs[] = {"OB", "OW", "SQ", "UN", "UT"};
+  bool long_length = false;
+  for (const auto& long_vr : long_vrs) long_length |= long_vr == vr;
+
+  if (long_length) {
+    PutUInt16(out, 0);
+    PutUInt32(out, value.size());
+  } else {
+    PutUInt16(out, value.size());
+  }
+
+  out += value;
+}
+
+// Appends an element in implicit VR encoding.
+void PutImplicit(std::string& out, uint32_t tag, const std::string& value) {
+  PutTag(out, tag);
+  PutUInt32(out, value.size());
+  out += value;
+}
+
+std::string UInt16Value(uint16_t v) {
+  std::string result;
+  PutUInt16(result, v);
+  return result;
+}
+
+// Returns the preamble and file meta information of a file with the given
+// transfer syntax.
+std::string Header(const std::string& transfer_syntax) {
+  std::string result(128, '\0');
+  result += "DICM";
+
+  auto uid = transfer_syntax;
+  if (uid.size() % 2) uid.push_back('\0');
+
+  PutExplicit(result, 0x0002'0001, "OB", std::string("\0\1", 2));
+  PutExplicit(result, kTagTransferSyntaxUID, "UI", uid);
+
+  return result;
+}
+
+ev::StringRef Ref(const std::string& data) {
+  return ev::StringRef(data.data(), data.size());
+}
+
+}  // namespace
+
+TEST(DicomTest, ParsesExplicitVR) {
+  auto data = Header(kExplicitVRLittleEndian);
+  PutExplicit(data, 0x0008'0060, "CS", "MR");
+  PutExplicit(data, kTagRows, "US", UInt16Value(2));
+  PutExplicit(data, kTagColumns, "US", UInt16Value(3));
+  PutExplicit(data, 0x0028'0030, "DS", "1.5\\2.5 ");
+  PutExplicit(data, kTagPixelData, "OW", std::string(12, 'x'));
+
+  const auto elements = Parse(Ref(data));
+
+  // The file meta information is left out.
+  ASSERT_EQ(5U, elements.size());
+  EXPECT_EQ(0x0008'0060U, elements[0].tag);
+  EXPECT_TRUE(elements[0].HasVR("CS"));
+  EXPECT_EQ("MR", elements[0].value.str());
+
+  ASSERT_NE(nullptr, Find(elements, kTagRows));
+  EXPECT_EQ(2, GetInt(*Find(elements, kTagRows)));
+  EXPECT_EQ(3, GetInt(*Find(elements, kTagColumns)));
+
+  EXPECT_TRUE(elements[3].HasVR("DS"));
+  EXPECT_EQ("1.5\\2.5 ", elements[3].value.str());
+
+  const auto pixels = Find(elements, kTagPixelData);
+  ASSERT_NE(nullptr, pixels);
+  EXPECT_EQ(12U, pixels->value.size());
+
+  EXPECT_STREQ("PixelSpacing", KeywordForTag(0x0028'0030));
+  EXPECT_EQ(nullptr, KeywordForTag(0x0009'1001));
+}
+
+TEST(DicomTest, ParsesImplicitVR) {
+  for (const auto with_header : {false, true}) {
+    std::string data;
+    if (with_header) data = Header(kImplicitVRLittleEndian);
+
+    PutImplicit(data, kTagRows, UInt16Value(256));
+    PutImplicit(data, 0x0020'0013, "12");
+    PutImplicit(data, 0x0009'1001, "private");
+
+    const auto elements = Parse(Ref(data));
+
+    ASSERT_EQ(3U, elements.size());
+
+    // VRs come from the dictionary.
+    EXPECT_TRUE(elements[0].HasVR("US"));
+    EXPECT_EQ(256, GetInt(elements[0]));
+    EXPECT_TRUE(elements[1].HasVR("IS"));
+    EXPECT_EQ(12, GetInt(elements[1]));
+    EXPECT_TRUE(elements[2].HasVR("UN"));
+    EXPECT_EQ("private", elements[2].value.str());
+  }
+}
+
+TEST(DicomTest, SkipsSequences) {
+  for (const auto explicit_vr : {false, true}) {
+    auto data = Header(explicit_vr ? kExplicitVRLittleEndian
+                                   : kImplicitVRLittleEndian);
+
+    const auto put = [&data, explicit_vr](uint32_t tag, const char* vr,
+                                          const std::string& value) {
+      if (explicit_vr)
+        PutExplicit(data, tag, vr, value);
+      else
+        PutImplicit(data, tag, value);
+    };
+
+    put(kTagRows, "US", UInt16Value(4));
+
+    // A sequence of undefined length, holding an item of undefined length,
+    // an item of defined length, and an empty item of undefined length.
+    PutTag(data, 0x0008'1140);
+    if (explicit_vr) {
+      data += "SQ";
+      PutUInt16(data, 0);
+    }
+    PutUInt32(data, kUndefinedLength);
+
+    PutTag(data, 0xfffe'e000);
+    PutUInt32(data, kUndefinedLength);
+    put(0x0008'1150, "UI", "1.2.3.4 ");
+    put(0x0008'1155, "UI", "5.6");
+    PutTag(data, 0xfffe'e00d);
+    PutUInt32(data, 0);
+
+    PutTag(data, 0xfffe'e000);
+    PutUInt32(data, 4);
+    data += "abcd";
+
+    PutTag(data, 0xfffe'e000);
+    PutUInt32(data, kUndefinedLength);
+    PutTag(data, 0xfffe'e00d);
+    PutUInt32(data, 0);
+
+    PutTag(data, 0xfffe'e0dd);
+    PutUInt32(data, 0);
+
+    // A sequence of defined length.  In implicit VR, sequences of defined
+    // length can only be recognized through the dictionary.
+    if (explicit_vr) {
+      std::string item;
+      PutTag(item, 0xfffe'e000);
+      PutUInt32(item, 0);
+      PutExplicit(data, 0x0008'1111, "SQ", item);
+    }
+
+    put(kTagColumns, "US", UInt16Value(5));
+
+    const auto elements = Parse(Ref(data));
+
+    ASSERT_EQ(2U, elements.size()) << explicit_vr;
+    EXPECT_EQ(4, GetInt(elements[0]));
+    EXPECT_EQ(kTagColumns, elements[1].tag);
+    EXPECT_EQ(5, GetInt(elements[1]));
+  }
+}
+
+TEST(DicomTest, RejectsTruncatedInput) {
+  auto data = Header(kExplicitVRLittleEndian);
+  PutExplicit(data, kTagRows, "US", UInt16Value(2));
+  PutExplicit(data, kTagPixelData, "OW", std::string(16, 'x'));
+
+  ASSERT_EQ(2U, Parse(Ref(data)).size());
+
+  // Cutting the file anywhere after the file meta information, except
+  // between the two elements, leaves an incomplete element.
+  const auto header_size = Header(kExplicitVRLittleEndian).size();
+  const auto boundary = header_size + 10;
+  for (size_t size = header_size + 1; size < data.size(); ++size) {
+    if (size == boundary) continue;
+    EXPECT_ANY_THROW(Parse(ev::StringRef(data.data(), size))) << size;
+  }
+
+  // An undefined length sequence without a delimiter.
+  auto sequence = Header(kExplicitVRLittleEndian);
+  PutTag(sequence, 0x0008'1140);
+  sequence += "SQ";
+  PutUInt16(sequence, 0);
+  PutUInt32(sequence, kUndefinedLength);
+  PutTag(sequence, 0xfffe'e000);
+  PutUInt32(sequence, kUndefinedLength);
+  PutExplicit(sequence, 0x0008'1150, "UI", "1.2");
+
+  EXPECT_ANY_THROW(Parse(Ref(sequence)));
+}
+
+TEST(DicomTest, RejectsUnsupportedFiles) {
+  // JPEG baseline.
+  EXPECT_ANY_THROW(Parse(Ref(Header("1.2.840.10008.1.2.4.50"))));
+
+  // Encapsulated pixel data.
+  auto data = Header(kExplicitVRLittleEndian);
+  PutTag(data, kTagPixelData);
+  data += "OB";
+  PutUInt16(data, 0);
+  PutUInt32(data, kUndefinedLength);
+  EXPECT_ANY_THROW(Parse(Ref(data)));
+
+  // Multiple values.
+  Element element;
+  element.tag = 0x0020'0013;
+  element.vr[0] = 'I';
+  element.vr[1] = 'S';
+  element.value = ev::StringRef("1\\2", 3);
+  EXPECT_ANY_THROW(GetInt(element));
+}
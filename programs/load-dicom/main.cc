@@ -0,0 +1,379 @@
+// Loads DICOM files into a column file, with the column layout written by
+// scripts/load-dicom.py.  Files are parsed in parallel, and rows are written
+// in input order.  Files already listed in the output's manifest are
+// skipped, so an interrupted load resumes where it stopped.  Files that fail
+// to load are left out of the manifest, and are retried by the next load.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <err.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sysexits.h>
+
+#include <kj/debug.h>
+
+#include "base/columnfile.h"
+#include "base/file.h"
+#include "base/string.h"
+#include "base/thread-pool.h"
+#include "programs/load-dicom/dicom.h"
+
+namespace {
+
+enum Column : uint32_t {
+  kColumnPath = 0,
+  kColumnPixelType = 1,
+  kColumnRows = 2,
+  kColumnCols = 3,
+  kColumnPixels = 4,
+};
+
+// Rows per segment, as written by the Python loader.
+const size_t kFlushInterval = 100;
+
+int print_help;
+
+struct option kLongOptions[] = {
+    {"checkpoint-interval", required_argument, nullptr, 'c'},
+    {"output-path", required_argument, nullptr, 'o'},
+    {"threads", required_argument, nullptr, 't'},
+    {"help", no_argument, &print_help, 1},
+    {nullptr, 0, nullptr, 0}};
+
+// A row ready to be written, with the definitions of the DICOM columns it
+// uses.
+struct ParsedFile {
+  // Set if the file holds no 2D image, or can't be parsed.
+  std::string error;
+
+  std::vector<std::pair<uint32_t, std::string>> values;
+
+  std::vector<ev::ColumnFileColumn> columns;
+};
+
+// Integers are stored as 32 bit values, like the Python loader does.
+std::string IntValue(int64_t value) {
+  KJ_REQUIRE(value == static_cast<int32_t>(value), value);
+  const int32_t narrow = value;
+  return std::string(reinterpret_cast<const char*>(&narrow), sizeof(narrow));
+}
+
+std::string FloatValue(double value) {
+  return std::string(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Returns the value of a string element, without padding.
+ev::StringRef TrimString(ev::StringRef value) {
+  while (!value.empty() && (value.back() == ' ' || value.back() == '\0'))
+    value.ConsumeTail(1);
+  return value;
+}
+
+// Parses a decimal string, such as a DS value.  Returns false if `text` is
+// not a number.
+bool ParseDouble(const std::string& text, double& result) {
+  char* end;
+  result = strtod(text.c_str(), &end);
+  if (end == text.c_str()) return false;
+  while (*end == ' ') ++end;
+  return !*end;
+}
+
+// Adds the value of `element` to `file`, converted the way pydicom values
+// are converted by the Python loader.  Elements pydicom represents as lists,
+// except multi-valued DS, are skipped.  Binary elements are skipped too.
+void AddElement(const dicom::Element& element, ParsedFile& file) {
+  static const char* const kStringVRs[] = {"AE", "AS", "CS", "DA", "DT",
+                                           "LO", "LT", "PN", "SH", "ST",
+                                           "TM", "UC", "UI", "UR", "UT"};
+
+  ev::ColumnType type;
+  std::string value;
+
+  const auto text = TrimString(element.value);
+  const auto multi_valued = text.contains("\\");
+
+  if (element.HasVR("DS")) {
+    if (text.empty()) return;
+
+    std::vector<double> values;
+
+    for (const auto& part : ev::Explode(text, "\\")) {
+      double v;
+      if (!ParseDouble(part.str(), v)) return;
+      values.emplace_back(v);
+    }
+
+    if (values.size() == 1) {
+      type = ev::kColumnTypeFloat;
+      value = FloatValue(values[0]);
+    } else {
+      type = ev::kColumnTypeFloatArray;
+
+      for (const auto v : values) {
+        if (!value.empty()) value.push_back(',');
+        value += ev::StringPrintf("%.19g", v);
+      }
+    }
+  } else if (element.HasVR("IS") || element.HasVR("US") ||
+             element.HasVR("SS") || element.HasVR("UL") ||
+             element.HasVR("SL")) {
+    if (element.HasVR("IS") && (multi_valued || text.empty())) return;
+
+    int64_t v;
+    try {
+      v = dicom::GetInt(element);
+    } catch (kj::Exception e) {
+      return;
+    }
+
+    type = ev::kColumnTypeInt;
+    value = IntValue(v);
+  } else if (element.HasVR("FL") || element.HasVR("FD")) {
+    const auto size = element.HasVR("FL") ? sizeof(float) : sizeof(double);
+    if (element.value.size() != size) return;
+
+    double v;
+    if (size == sizeof(float)) {
+      float f;
+      memcpy(&f, element.value.data(), sizeof(f));
+      v = f;
+    } else {
+      memcpy(&v, element.value.data(), sizeof(v));
+    }
+
+    type = ev::kColumnTypeFloat;
+    value = FloatValue(v);
+  } else {
+    bool is_string = false;
+    for (const auto vr : kStringVRs) is_string |= element.HasVR(vr);
+
+    if (!is_string || multi_valued) return;
+
+    type = ev::kColumnTypeString;
+    value = text.str();
+  }
+
+  ev::ColumnFileColumn column;
+  column.id = element.tag;
+  column.type = type;
+  column.dicom_tag = element.tag;
+
+  if (const auto keyword = dicom::KeywordForTag(element.tag))
+    column.name = keyword;
+  else
+    column.name = ev::StringPrintf("%08x", element.tag);
+
+  file.columns.emplace_back(std::move(column));
+  file.values.emplace_back(element.tag, std::move(value));
+}
+
+ParsedFile ParseFile(const std::string& path) {
+  ParsedFile result;
+
+  try {
+    const auto data = ev::ReadFD(ev::OpenFile(path.c_str(), O_RDONLY));
+    const auto elements =
+        dicom::Parse(ev::StringRef(data.begin(), data.size()));
+
+    const auto rows = dicom::Find(elements, dicom::kTagRows);
+    const auto cols = dicom::Find(elements, dicom::kTagColumns);
+    const auto bits = dicom::Find(elements, dicom::kTagBitsAllocated);
+    const auto pixels = dicom::Find(elements, dicom::kTagPixelData);
+
+    if (!rows || !cols || !bits || !pixels) {
+      result.error = "No image";
+      return result;
+    }
+
+    const auto samples = dicom::Find(elements, dicom::kTagSamplesPerPixel);
+    const auto frames = dicom::Find(elements, dicom::kTagNumberOfFrames);
+
+    if ((samples && dicom::GetInt(*samples) != 1) ||
+        (frames && dicom::GetInt(*frames) != 1)) {
+      result.error = "Not a 2D image";
+      return result;
+    }
+
+    const auto representation =
+        dicom::Find(elements, dicom::kTagPixelRepresentation);
+    const auto is_signed =
+        representation && dicom::GetInt(*representation) == 1;
+
+    const auto bits_allocated = dicom::GetInt(*bits);
+    KJ_REQUIRE(bits_allocated == 8 || bits_allocated == 16 ||
+                   bits_allocated == 32,
+               bits_allocated);
+
+    const auto row_count = dicom::GetInt(*rows);
+    const auto col_count = dicom::GetInt(*cols);
+    const size_t pixel_size = row_count * col_count * (bits_allocated / 8);
+
+    KJ_REQUIRE(pixels->value.size() >= pixel_size, pixels->value.size(),
+               pixel_size);
+
+    result.values.emplace_back(kColumnPath, path);
+    result.values.emplace_back(
+        kColumnPixelType,
+        ev::StringPrintf("%sint%d", is_signed ? "" : "u",
+                         static_cast<int>(bits_allocated)));
+    result.values.emplace_back(kColumnRows, IntValue(row_count));
+    result.values.emplace_back(kColumnCols, IntValue(col_count));
+    result.values.emplace_back(kColumnPixels,
+                               std::string(pixels->value.data(), pixel_size));
+
+    for (const auto& element : elements) AddElement(element, result);
+  } catch (kj::Exception e) {
+    result.error = e.getDescription().cStr();
+    result.values.clear();
+    result.columns.clear();
+  }
+
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) try {
+  std::string output_path = "data/dicoms.col";
+  size_t checkpoint_interval = 1000;
+  size_t thread_count = std::thread::hardware_concurrency();
+
+  int i;
+  while ((i = getopt_long(argc, argv, "", kLongOptions, 0)) != -1) {
+    if (!i) continue;
+    if (i == '?')
+      errx(EX_USAGE, "Try '%s --help' for more information.", argv[0]);
+
+    switch (i) {
+      case 'c':
+        checkpoint_interval = ev::StringToUInt64(optarg);
+        break;
+
+      case 'o':
+        output_path = optarg;
+        break;
+
+      case 't':
+        thread_count = ev::StringToUInt64(optarg);
+        break;
+    }
+  }
+
+  if (print_help) {
+    printf(
+        "Usage: %s [OPTION]... FILE...\n"
+        "\n"
+        "      --checkpoint-interval=N  files to load between checkpoints\n"
+        "      --output-path=PATH       append to PATH instead of "
+        "data/dicoms.col\n"
+        "      --threads=N              parse files on N threads\n"
+        "      --help                   display this help and exit\n",
+        argv[0]);
+
+    return EXIT_SUCCESS;
+  }
+
+  KJ_REQUIRE(checkpoint_interval > 0);
+  KJ_REQUIRE(thread_count > 0);
+
+  std::vector<std::string> manifest;
+  ev::ColumnFileWriter output(
+      ev::ColumnFileWriter::CheckpointedOutput(output_path.c_str(), manifest));
+
+  // Pixel data makes up most of the output, and compresses best with the
+  // image codec.  The other columns fall back to LZ4.
+  output.SetCompression(ev::kColumnFileCompressionPixel16);
+
+  // Keep the column definitions of earlier loads.
+  auto schema =
+      ev::ColumnFileReader(ev::OpenFile(output_path.c_str(), O_RDONLY))
+          .Schema();
+
+  schema.AddColumn(kColumnPath, "path", ev::kColumnTypeString);
+  schema.AddColumn(kColumnPixelType, "pixel_type", ev::kColumnTypeString);
+  schema.AddColumn(kColumnRows, "rows", ev::kColumnTypeInt);
+  schema.AddColumn(kColumnCols, "cols", ev::kColumnTypeInt);
+  schema.AddColumn(kColumnPixels, "pixels", ev::kColumnTypeBinary);
+  output.SetSchema(schema);
+
+  const auto inputs = ev::ColumnFileWriter::PendingInputs(
+      std::vector<std::string>(argv + optind, argv + argc), manifest);
+
+  ev::ThreadPool thread_pool(thread_count);
+
+  // Parsed files waiting to be written, in input order.  Bounded, to limit
+  // the memory held by pixel data.
+  std::deque<std::future<ParsedFile>> pending;
+  const auto max_pending = thread_count * 4;
+
+  // Files loaded since the last checkpoint.
+  std::vector<std::string> loaded;
+  size_t next_input = 0;
+  size_t row_count = 0;
+  std::vector<std::pair<uint32_t, ev::StringRefOrNull>> row;
+
+  const auto write_next = [&] {
+    auto file = pending.front().get();
+    pending.pop_front();
+
+    const auto& path = inputs[next_input++];
+
+    if (!file.error.empty()) {
+      fprintf(stderr, "%s: %s\n", path.c_str(), file.error.c_str());
+      return;
+    }
+
+    // The first file using a column decides its type.
+    for (auto& column : file.columns) {
+      if (schema.Find(column.id)) continue;
+
+      schema.AddColumn(column.id, column.name, column.type, column.dicom_tag);
+      output.AddColumn(column.id, std::move(column.name), column.type,
+                       column.dicom_tag);
+    }
+
+    std::sort(file.values.begin(), file.values.end(),
+              [](const auto& lhs, const auto& rhs) {
+                return lhs.first < rhs.first;
+              });
+
+    row.clear();
+    for (const auto& value : file.values)
+      row.emplace_back(value.first, value.second);
+
+    output.PutRow(row);
+    if (!(++row_count % kFlushInterval)) output.Flush();
+
+    loaded.emplace_back(path);
+
+    if (loaded.size() == checkpoint_interval) {
+      output.Checkpoint(loaded);
+      loaded.clear();
+    }
+  };
+
+  for (const auto& path : inputs) {
+    if (pending.size() >= max_pending) write_next();
+
+    pending.emplace_back(
+        thread_pool.Launch([&path] { return ParseFile(path); }));
+  }
+
+  while (!pending.empty()) write_next();
+
+  output.Checkpoint(loaded);
+  output.Finalize();
+} catch (kj::Exception e) {
+  KJ_LOG(FATAL, e);
+  return EXIT_FAILURE;
+}
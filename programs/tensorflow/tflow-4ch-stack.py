@@ -6,8 +6,6 @@ import csv
 import dsb2
 import numpy as np
 import re
-import skimage.transform
-import struct
 import sys
 import tensorflow as tf
 
@@ -45,49 +43,38 @@ def ReadTrainingLabels():
 # Maps from training instance ("study") to 2D images.
 images = {}
 
-# Given a row from the column file, read the stored image into the
-# `images` dictionary.
-def LoadTrainingInstance(row):
+# Stores a batch of resized images in the `images` dictionary.
+def LoadTrainingBatch(fields, pixels):
   global images
 
-  m = TRAINING_PATH_FILTER.search(row[0]).groups()
-  study = int(m[0])
-  frame = int(m[1]) - 1
+  for path, image in zip(fields[0L], pixels):
+    m = TRAINING_PATH_FILTER.search(path).groups()
+    study = int(m[0])
+    frame = int(m[1]) - 1
 
-  assert row[1] == 'uint16', row[1]
+    if not study in images:
+      images[study] = np.zeros(shape=(30, IMAGE_SIZE, IMAGE_SIZE), dtype=np.float32)
 
-  width = struct.unpack('<I', row[2])[0]
-  height = struct.unpack('<I', row[3])[0]
+    images[study][frame, :, :] = image
 
-  pixels = np.fromstring(row[4], dtype=np.uint16, count=width * height)
-
-  # Reinterpret 1D array as 2D image.
-  pixels = pixels.reshape([width, height])
-
-  # Resize to standard size.
-  pixels = skimage.transform.resize(pixels, [IMAGE_SIZE, IMAGE_SIZE])
-
-  if not study in images:
-    images[study] = np.zeros(shape=(30, IMAGE_SIZE, IMAGE_SIZE), dtype=np.float32)
-
-  images[study][frame, :, :] = pixels
-
-dsb2.ColumnFile_select(
+dsb2.ColumnFile_select_images(
     'data/dicoms.col',
-    [0L, 1L, 2L, 3L, 4L],
-    [(0L, lambda s: TRAINING_PATH_FILTER.search(s))],
-    LoadTrainingInstance)
-
-# Standardize the image data (set mean = 0, and stddev = 1).
-for key, pixels in images.iteritems():
-  # First subtract the mean image from all 30 images.  This should make parts
-  # that aren't moving less prominent.
-  pixels -= np.mean(pixels, axis=0)
-
-  stddev = np.std(pixels)
-  assert stddev > 0, stddev
-  mean = np.mean(pixels)
-  images[key] = (pixels - mean) / stddev
+    [0L],
+    [(0L, 'regex', TRAINING_PATH_FILTER.pattern)],
+    (4L, 1L, 3L, 2L),
+    (IMAGE_SIZE, IMAGE_SIZE),
+    'bilinear',
+    False,
+    256L,
+    LoadTrainingBatch)
+
+# Standardize the image data (set mean = 0, and stddev = 1).  The mean image
+# is first subtracted from all 30 images.  This should make parts that aren't
+# moving less prominent.
+studies = list(images.keys())
+stacks = np.stack([images[study] for study in studies])
+dsb2.Image_standardize_stacks(stacks, True)
+images = dict(zip(studies, stacks))
 
 np_images = np.ndarray(
         shape=(len(images), 30, IMAGE_SIZE, IMAGE_SIZE), dtype=np.float32)
@@ -6,8 +6,6 @@ import csv
 import dsb2
 import numpy as np
 import re
-import skimage.transform
-import struct
 import tensorflow as tf
 
 parser = argparse.ArgumentParser(description='DSB2 Neural Net Model')
@@ -47,38 +45,41 @@ def ReadTrainingLabels():
 # Maps from training instance ("study") to 2D images.
 images = {}
 
-# Given a row from the column file, read the stored image into the
-# `images` dictionary.
-def LoadTrainingInstance(row):
+# Stores a batch of standardized, resized images in the `images` dictionary.
+def LoadTrainingBatch(fields, pixels):
   global images
 
-  study = int(TRAINING_PATH_FILTER.search(row[0]).groups()[0])
-
-  assert row[1] == 'uint16', row[1]
-
-  width = struct.unpack('<I', row[2])[0]
-  height = struct.unpack('<I', row[3])[0]
-
-  pixels = np.fromstring(row[4], dtype=np.uint16, count=width * height)
-
-  # Standardize the image data (set mean = 0, and stddev = 1).
-  stddev = np.std(pixels)
-  assert stddev > 0, stddev
-  pixels = (pixels - np.mean(pixels)) / stddev
-
-  # Reinterpret 1D array as 2D image.
-  pixels = pixels.reshape([width, height])
-
-  # Resize to standard size.
-  pixels = skimage.transform.resize(pixels, [IMAGE_SIZE, IMAGE_SIZE])
-
-  images[study] = pixels
-
-dsb2.ColumnFile_select(
-    'data/dicoms.col',
-    [0L, 1L, 2L, 3L, 4L],
-    [(0L, lambda s: TRAINING_PATH_FILTER.search(s))],
-    LoadTrainingInstance)
+  for path, image in zip(fields[0L], pixels):
+    study = int(TRAINING_PATH_FILTER.search(path).groups()[0])
+    images[study] = image
+
+# Preprocessed images are cached, and recomputed when data/dicoms.col or the
+# preprocessing changes.
+CACHE_PARAMETERS = '%s %d standardize bilinear rows-cols' % (TRAINING_PATH_FILTER.pattern, IMAGE_SIZE)
+CACHE_PATH = 'data/tflow-minimal-%s-%s.tensors'
+
+cached_studies = dsb2.TensorCache_open(CACHE_PATH % (args.view, 'studies'), 'data/dicoms.col', CACHE_PARAMETERS)
+cached_images = dsb2.TensorCache_open(CACHE_PATH % (args.view, 'images'), 'data/dicoms.col', CACHE_PARAMETERS)
+
+if cached_studies is not None and cached_images is not None:
+  images = dict(zip(cached_studies, cached_images))
+else:
+  dsb2.ColumnFile_select_images(
+      'data/dicoms.col',
+      [0L],
+      [(0L, 'regex', TRAINING_PATH_FILTER.pattern)],
+      (4L, 1L, 3L, 2L),
+      (IMAGE_SIZE, IMAGE_SIZE),
+      'bilinear',
+      True,
+      256L,
+      LoadTrainingBatch)
+
+  studies = sorted(images.keys())
+  dsb2.TensorCache_write(CACHE_PATH % (args.view, 'studies'), 'data/dicoms.col', CACHE_PARAMETERS,
+                         np.array(studies, dtype=np.int64))
+  dsb2.TensorCache_write(CACHE_PATH % (args.view, 'images'), 'data/dicoms.col', CACHE_PARAMETERS,
+                         np.stack([images[study] for study in studies]))
 
 np_images = np.ndarray(
         shape=(len(images), IMAGE_SIZE, IMAGE_SIZE), dtype=np.float32)
@@ -74,7 +74,7 @@ def LoadTrainingInstance(row):
 dsb2.ColumnFile_select(
     'data/dicoms.col',
     [0L, 0x00100040L, 0x00101010L],
-    [(0L, lambda s: TRAINING_PATH_FILTER.search(s))],
+    [(0L, 'regex', TRAINING_PATH_FILTER.pattern)],
     LoadTrainingInstance)
 
 X = []
@@ -0,0 +1,105 @@
+#include "python/buffer.h"
+
+#include <kj/debug.h>
+
+#include "python/object.h"
+
+namespace ev_python {
+
+namespace {
+
+// Exports a range of a shared buffer through the buffer protocol.
+struct BufferObject {
+  PyObject_HEAD
+
+  std::shared_ptr<const kj::Array<const char>>* buffer;
+
+  const char* data;
+  Py_ssize_t size;
+};
+
+int BufferGetBuffer(PyObject* self, Py_buffer* view, int flags) {
+  auto object = reinterpret_cast<BufferObject*>(self);
+
+  return PyBuffer_FillInfo(view, self, const_cast<char*>(object->data),
+                           object->size, 1 /* readonly */, flags);
+}
+
+void BufferDealloc(PyObject* self) {
+  auto object = reinterpret_cast<BufferObject*>(self);
+  delete object->buffer;
+  PyObject_Del(self);
+}
+
+// Filled in by BufferType(), since the slots differ between Python 2 and 3.
+PyBufferProcs buffer_procs;
+
+PyTypeObject buffer_type = {
+    PyVarObject_HEAD_INIT(nullptr, 0)
+    "dsb2.ColumnFileBuffer",  // tp_name
+    sizeof(BufferObject),     // tp_basicsize
+    0,                        // tp_itemsize
+    BufferDealloc,            // tp_dealloc
+    0,                        // tp_print, or tp_vectorcall_offset
+    nullptr,                  // tp_getattr
+    nullptr,                  // tp_setattr
+    nullptr,                  // tp_compare, or tp_as_async
+    nullptr,                  // tp_repr
+    nullptr,                  // tp_as_number
+    nullptr,                  // tp_as_sequence
+    nullptr,                  // tp_as_mapping
+    nullptr,                  // tp_hash
+    nullptr,                  // tp_call
+    nullptr,                  // tp_str
+    nullptr,                  // tp_getattro
+    nullptr,                  // tp_setattro
+    &buffer_procs,            // tp_as_buffer
+#if PY_MAJOR_VERSION < 3
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER,  // tp_flags
+#else
+    Py_TPFLAGS_DEFAULT,  // tp_flags
+#endif
+    "Read-only view of decoded column file data.",  // tp_doc
+};
+
+PyTypeObject* BufferType() {
+  static bool ready = false;
+
+  // Only called with the GIL held, so no further locking is needed.
+  if (!ready) {
+    buffer_procs.bf_getbuffer = BufferGetBuffer;
+
+    KJ_REQUIRE(0 == PyType_Ready(&buffer_type));
+    ready = true;
+  }
+
+  return &buffer_type;
+}
+
+}  // namespace
+
+PyObject* MakeMemoryView(std::shared_ptr<const kj::Array<const char>> buffer,
+                         const ev::StringRef& data) {
+  KJ_REQUIRE(data.begin() >= buffer->begin() && data.end() <= buffer->end());
+
+  auto object = PyObject_New(BufferObject, BufferType());
+  if (!object) return nullptr;
+
+  object->buffer =
+      new std::shared_ptr<const kj::Array<const char>>(std::move(buffer));
+  object->data = data.data();
+  object->size = data.size();
+
+  ScopedObject owner(reinterpret_cast<PyObject*>(object));
+
+  return PyMemoryView_FromObject(owner.get());
+}
+
+PyObject* MakeMemoryView(const ev::StringRef& data) {
+  auto buffer = std::make_shared<const kj::Array<const char>>(
+      kj::heapArray<char>(data.data(), data.size()));
+
+  return MakeMemoryView(buffer, *buffer);
+}
+
+}  // namespace ev_python
@@ -0,0 +1,24 @@
+#ifndef PYTHON_BUFFER_H_
+#define PYTHON_BUFFER_H_ 1
+
+#include <memory>
+
+#include <Python.h>
+#include <kj/array.h>
+
+#include "base/stringref.h"
+
+namespace ev_python {
+
+// Returns a read-only memoryview of `data`, which must lie within `buffer`.
+// The view holds a reference to `buffer`, so the data stays valid for as
+// long as the view, or any object created from it, is alive.
+PyObject* MakeMemoryView(std::shared_ptr<const kj::Array<const char>> buffer,
+                         const ev::StringRef& data);
+
+// Returns a read-only memoryview of a copy of `data`.
+PyObject* MakeMemoryView(const ev::StringRef& data);
+
+}  // namespace ev_python
+
+#endif  // !PYTHON_BUFFER_H_
@@ -1,9 +1,24 @@
 #include "python/columnfile.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 #include <memory>
+#include <new>
+#include <thread>
+
+#include <endian.h>
 
 #include "base/columnfile.h"
+#include "base/concurrency.h"
 #include "base/file.h"
+#include "base/image.h"
+#include "base/string.h"
+#include "base/thread-pool.h"
+#include "python/buffer.h"
+#include "python/gil.h"
 #include "python/object.h"
 #include "python/string.h"
 
@@ -33,6 +48,338 @@ ev_python::ScopedObject ObjectForRow(
   return result;
 }
 
+// Returns the column identified by a column number or name.
+uint32_t GetColumn(const ev::ColumnFileSchema& schema, PyObject* column) {
+  if (PyLong_Check(column)) return PyLong_AsUnsignedLong(column);
+#if PY_MAJOR_VERSION < 3
+  if (PyInt_Check(column)) return PyInt_AsLong(column);
+#endif
+  return schema.ColumnId(ev_python::GetString(column));
+}
+
+ev_python::ScopedObject ObjectForKey(const ev::ColumnFileKey& key) {
+  if (key.is_null) {
+    Py_INCREF(Py_None);
+    return ev_python::ScopedObject(Py_None);
+  }
+
+  switch (key.type) {
+    case ev::kColumnTypeInt:
+      return ev_python::ScopedObject(PyLong_FromLongLong(key.int_value));
+
+    case ev::kColumnTypeFloat:
+      return ev_python::ScopedObject(PyFloat_FromDouble(key.float_value));
+
+    default:
+      return ev_python::ScopedObject(PyBytes_FromStringAndSize(
+          key.string_value.data(), key.string_value.size()));
+  }
+}
+
+// Returns a generator seeded with `seed`, or with a value drawn from the shared
+// strong generator if `seed` is None, so that unseeded samples differ.
+std::mt19937_64 MakeRNG(PyObject* seed) {
+  if (seed == Py_None) return std::mt19937_64(ev::StrongRNG()());
+
+  KJ_REQUIRE(PyLong_Check(seed), "Seed must be long or None");
+  return std::mt19937_64(PyLong_AsUnsignedLongLong(seed));
+}
+
+// The values of one column in a batch of rows read by `read_columns()`.
+class ColumnBatch {
+ public:
+  // Decodes int and float columns into 64 bit values, and other columns into
+  // bytes objects.
+  ColumnBatch(uint32_t column, const ev::ColumnFileSchema& schema)
+      : column_(column) {
+    if (const auto definition = schema.Find(column)) {
+      if (definition->type == ev::kColumnTypeInt) {
+        kind_ = kInt;
+        dtype_ = "int64";
+        value_size_ = sizeof(int64_t);
+      } else if (definition->type == ev::kColumnTypeFloat) {
+        kind_ = kFloat;
+        dtype_ = "float64";
+        value_size_ = sizeof(double);
+      }
+    }
+  }
+
+  // Stores the values as they are, each forming an array of the given NumPy
+  // type and shape.
+  ColumnBatch(uint32_t column, std::string dtype, std::vector<long> shape,
+              size_t value_size)
+      : column_(column),
+        kind_(kFixed),
+        dtype_(std::move(dtype)),
+        shape_(std::move(shape)),
+        value_size_(value_size) {}
+
+  uint32_t Column() const { return column_; }
+
+  // Returns the number of values added.
+  size_t Size() const { return nulls_.size(); }
+
+  // Removes all values.
+  void Clear() {
+    data_.clear();
+    values_.clear();
+    nulls_.clear();
+    has_null_ = false;
+  }
+
+  // Adds a value.  Must be called without the GIL held.
+  void Add(const ev::StringRefOrNull* value,
+           const ev::ColumnFileSchema& schema) {
+    const auto is_null = !value || value->IsNull();
+    nulls_.push_back(is_null);
+    has_null_ |= is_null;
+
+    if (kind_ == kObject) {
+      values_.emplace_back(is_null ? std::string()
+                                   : value->StringRef().str());
+      return;
+    }
+
+    const auto offset = data_.size();
+    data_.resize(offset + value_size_, 0);
+    if (is_null) return;
+
+    const auto str = value->StringRef();
+
+    switch (kind_) {
+      case kInt: {
+        const int64_t v = schema.GetInt(column_, str);
+        memcpy(&data_[offset], &v, sizeof(v));
+      } break;
+
+      case kFloat: {
+        const double v = schema.GetFloat(column_, str);
+        memcpy(&data_[offset], &v, sizeof(v));
+      } break;
+
+      default:
+        KJ_REQUIRE(str.size() == value_size_, column_, str.size(),
+                   value_size_);
+        memcpy(&data_[offset], str.data(), str.size());
+    }
+  }
+
+  // Returns the values as a NumPy array, or as a masked array if there are
+  // nulls.  Arrays of fixed size values are read-only views of the decoded
+  // data, which they take over; call `Clear()` before adding more values.
+  ev_python::ScopedObject ToArray(PyObject* numpy) {
+    ev_python::ScopedObject result;
+
+    if (kind_ == kObject) {
+      ev_python::ScopedObject list(PyList_New(values_.size()));
+      if (!list) return list;
+
+      for (size_t i = 0; i < values_.size(); ++i) {
+        PyObject* item;
+        if (nulls_[i]) {
+          Py_INCREF(Py_None);
+          item = Py_None;
+        } else {
+          item = PyBytes_FromStringAndSize(values_[i].data(),
+                                           values_[i].size());
+          if (!item) return ev_python::ScopedObject();
+        }
+        PyList_SET_ITEM(list.get(), i, item);
+      }
+
+      result.reset(
+          PyObject_CallMethod(numpy, "array", "Os", list.get(), "O"));
+      return result;
+    }
+
+    ev_python::ScopedObject shape(PyTuple_New(shape_.size() + 1));
+    if (!shape) return shape;
+    PyTuple_SET_ITEM(shape.get(), 0, PyLong_FromSize_t(nulls_.size()));
+    for (size_t i = 0; i < shape_.size(); ++i)
+      PyTuple_SET_ITEM(shape.get(), i + 1, PyLong_FromLong(shape_[i]));
+
+    ev_python::ScopedObject data(
+        MakeArray(numpy, dtype_.c_str(), std::move(data_)));
+    if (!data) return data;
+
+    result.reset(PyObject_CallMethod(data.get(), "reshape", "O", shape.get()));
+    if (!result || !has_null_) return result;
+
+    // Nulls mask every element of their value.
+    size_t elements = 1;
+    for (const auto size : shape_) elements *= size;
+
+    std::vector<char> mask_data;
+    mask_data.reserve(nulls_.size() * elements);
+    for (const auto is_null : nulls_)
+      mask_data.resize(mask_data.size() + elements, is_null);
+
+    ev_python::ScopedObject mask(
+        MakeArray(numpy, "bool", std::move(mask_data)));
+    if (!mask) return mask;
+
+    ev_python::ScopedObject shaped_mask(
+        PyObject_CallMethod(mask.get(), "reshape", "O", shape.get()));
+    if (!shaped_mask) return shaped_mask;
+
+    ev_python::ScopedObject ma(PyObject_GetAttrString(numpy, "ma"));
+    if (!ma) return ma;
+
+    return ev_python::ScopedObject(PyObject_CallMethod(
+        ma.get(), "masked_array", "OO", result.get(), shaped_mask.get()));
+  }
+
+ private:
+  enum Kind {
+    kInt,
+    kFloat,
+    kFixed,
+    kObject,
+  };
+
+  // Owns a vector whose elements are exported as a kj::Array, and is deleted
+  // along with the array.
+  class VectorDisposer final : public kj::ArrayDisposer {
+   public:
+    // Returns an array of the elements of `data`, without copying them.
+    static kj::Array<const char> Release(std::vector<char>&& data) {
+      if (data.empty()) return kj::heapArray<char>(0);
+
+      const auto disposer = new VectorDisposer(std::move(data));
+      return kj::Array<const char>(disposer->data_.data(),
+                                   disposer->data_.size(), *disposer);
+    }
+
+   private:
+    explicit VectorDisposer(std::vector<char>&& data)
+        : data_(std::move(data)) {}
+
+    void disposeImpl(void*, size_t, size_t, size_t,
+                     void (*)(void*)) const override {
+      delete this;
+    }
+
+    std::vector<char> data_;
+  };
+
+  // Returns a read-only NumPy array of the given type viewing `data`, which
+  // the array takes over.
+  static PyObject* MakeArray(PyObject* numpy, const char* dtype,
+                             std::vector<char>&& data) {
+    auto buffer = std::make_shared<const kj::Array<const char>>(
+        VectorDisposer::Release(std::move(data)));
+    ev_python::ScopedObject view(ev_python::MakeMemoryView(buffer, *buffer));
+    if (!view) return nullptr;
+
+    return PyObject_CallMethod(numpy, "frombuffer", "Os", view.get(), dtype);
+  }
+
+  uint32_t column_;
+
+  Kind kind_ = kObject;
+
+  std::string dtype_;
+  std::vector<long> shape_;
+  size_t value_size_ = 0;
+
+  std::vector<char> data_;
+  std::vector<std::string> values_;
+
+  std::vector<char> nulls_;
+  bool has_null_ = false;
+};
+
+// Appends a `ColumnBatch` to `batches` for each item in `columns`, which is
+// a column number or name, or a (column, dtype, shape) tuple describing fixed
+// size values.  Returns false if a Python exception was raised.
+bool GetColumnBatches(PyObject* columns, const ev::ColumnFileSchema& schema,
+                      PyObject* numpy, std::vector<ColumnBatch>& batches) {
+  ev_python::ScopedObject iterator(PyObject_GetIter(columns));
+  if (!iterator) return false;
+
+  for (;;) {
+    ev_python::ScopedObject item(PyIter_Next(iterator.get()));
+    if (!item) break;
+
+    if (!PyTuple_Check(item.get())) {
+      batches.emplace_back(GetColumn(schema, item.get()), schema);
+      continue;
+    }
+
+    KJ_REQUIRE(3 == PyTuple_GET_SIZE(item.get()),
+               PyTuple_GET_SIZE(item.get()));
+
+    const auto column = GetColumn(schema, PyTuple_GET_ITEM(item.get(), 0));
+    auto dtype = ev_python::GetString(PyTuple_GET_ITEM(item.get(), 1));
+
+    ev_python::ScopedObject dtype_object(
+        PyObject_CallMethod(numpy, "dtype", "s", dtype.c_str()));
+    if (!dtype_object) return false;
+    ev_python::ScopedObject item_size(
+        PyObject_GetAttrString(dtype_object.get(), "itemsize"));
+    if (!item_size) return false;
+
+    size_t value_size = PyLong_AsLong(item_size.get());
+    std::vector<long> shape;
+
+    ev_python::ScopedObject shape_iterator(
+        PyObject_GetIter(PyTuple_GET_ITEM(item.get(), 2)));
+    if (!shape_iterator) return false;
+
+    for (;;) {
+      ev_python::ScopedObject size(PyIter_Next(shape_iterator.get()));
+      if (!size) break;
+
+      shape.emplace_back(PyLong_AsLong(size.get()));
+      if (PyErr_Occurred()) return false;
+      KJ_REQUIRE(shape.back() > 0, shape.back());
+      value_size *= shape.back();
+    }
+
+    batches.emplace_back(column, std::move(dtype), std::move(shape),
+                         value_size);
+  }
+
+  return !PyErr_Occurred();
+}
+
+// Adds the values of `row` to `batches`.  Must be called without the GIL
+// held.
+void AddRow(const std::vector<std::pair<uint32_t, ev::StringRefOrNull>>& row,
+            const ev::ColumnFileSchema& schema,
+            std::vector<ColumnBatch>& batches) {
+  // Rows are sorted by column.
+  for (auto& batch : batches) {
+    const auto i = std::lower_bound(
+        row.begin(), row.end(), batch.Column(),
+        [](const auto& lhs, uint32_t column) { return lhs.first < column; });
+
+    batch.Add(i != row.end() && i->first == batch.Column() ? &i->second
+                                                            : nullptr,
+              schema);
+  }
+}
+
+// Returns a dict mapping the column of each batch to its values, as
+// returned by `ColumnBatch::ToArray()`.
+ev_python::ScopedObject ObjectForBatches(std::vector<ColumnBatch>& batches,
+                                         PyObject* numpy) {
+  ev_python::ScopedObject result(PyDict_New());
+  if (!result) return result;
+
+  for (auto& batch : batches) {
+    ev_python::ScopedObject key(PyLong_FromLong(batch.Column()));
+    auto array = batch.ToArray(numpy);
+    if (!key || !array) return ev_python::ScopedObject();
+
+    if (PyDict_SetItem(result.get(), key.get(), array.get()))
+      return ev_python::ScopedObject();
+  }
+
+  return result;
+}
+
 class ColumnFileReaderImpl : public ColumnFileReader {
  public:
   ColumnFileReaderImpl(ev::ColumnFileReader reader)
@@ -92,6 +439,162 @@ class ColumnFileReaderImpl : public ColumnFileReader {
     }
   }
 
+  PyObject* get_row_views() override {
+    try {
+      const auto& row = reader_.GetRow();
+      if (row.empty()) Py_RETURN_NONE;
+
+      ev_python::ScopedObject result(PyDict_New());
+      if (!result) return nullptr;
+
+      for (const auto& kv : row) {
+        ev_python::ScopedObject key(PyLong_FromLong(kv.first));
+        ev_python::ScopedObject value;
+
+        if (kv.second.IsNull()) {
+          Py_INCREF(Py_None);
+          value.reset(Py_None);
+        } else if (auto buffer = reader_.ValueBuffer(kv.first)) {
+          value.reset(ev_python::MakeMemoryView(std::move(buffer),
+                                                kv.second.StringRef()));
+        } else {
+          value.reset(ev_python::MakeMemoryView(kv.second.StringRef()));
+        }
+
+        if (!key || !value) return nullptr;
+
+        if (PyDict_SetItem(result.get(), key.get(), value.get()))
+          return nullptr;
+      }
+
+      return result.release();
+    } catch (kj::Exception e) {
+      PyErr_Format(PyExc_RuntimeError, "get_row_views() failed: %s:%d: %s",
+                   e.getFile(), e.getLine(), e.getDescription().cStr());
+
+      return nullptr;
+    }
+  }
+
+  PyObject* read_columns(PyObject* columns, PyObject* max_rows) override {
+    try {
+      KJ_REQUIRE(PyLong_Check(max_rows), "Row count must be long");
+      const auto row_limit = PyLong_AsUnsignedLongLong(max_rows);
+
+      ev_python::ScopedObject numpy(PyImport_ImportModule("numpy"));
+      if (!numpy) return nullptr;
+
+      const auto& schema = reader_.Schema();
+      std::vector<ColumnBatch> batches;
+      if (!GetColumnBatches(columns, schema, numpy.get(), batches))
+        return nullptr;
+
+      size_t row_count = 0;
+
+      {
+        ev_python::ScopedGILRelease gil_release;
+
+        while (row_count < row_limit && !reader_.End()) {
+          AddRow(reader_.GetRow(), schema, batches);
+          ++row_count;
+        }
+      }
+
+      if (!row_count) Py_RETURN_NONE;
+
+      return ObjectForBatches(batches, numpy.get()).release();
+    } catch (kj::Exception e) {
+      PyErr_Format(PyExc_RuntimeError, "read_columns() failed: %s:%d: %s",
+                   e.getFile(), e.getLine(), e.getDescription().cStr());
+
+      return nullptr;
+    }
+  }
+
+  PyObject* schema() override {
+    try {
+      const auto& columns = reader_.Schema().Columns();
+
+      ev_python::ScopedObject result(PyList_New(columns.size()));
+      if (!result) return nullptr;
+
+      for (size_t i = 0; i < columns.size(); ++i) {
+        const auto& column = columns[i];
+
+        auto item = Py_BuildValue(
+            "(ksskk)", static_cast<unsigned long>(column.id),
+            column.name.c_str(), ev::ColumnTypeName(column.type),
+            static_cast<unsigned long>(column.dicom_tag));
+        if (!item) return nullptr;
+
+        PyList_SET_ITEM(result.get(), i, item);
+      }
+
+      return result.release();
+    } catch (kj::Exception e) {
+      PyErr_Format(PyExc_RuntimeError, "schema() failed: %s:%d: %s",
+                   e.getFile(), e.getLine(), e.getDescription().cStr());
+
+      return nullptr;
+    }
+  }
+
+  PyObject* row_count() override {
+    try {
+      return PyLong_FromUnsignedLongLong(reader_.RowCount());
+    } catch (kj::Exception e) {
+      PyErr_Format(PyExc_RuntimeError, "row_count() failed: %s:%d: %s",
+                   e.getFile(), e.getLine(), e.getDescription().cStr());
+
+      return nullptr;
+    }
+  }
+
+  PyObject* seek_to_row(PyObject* row) override {
+    try {
+      KJ_REQUIRE(PyLong_Check(row), "Row argument must be long");
+      reader_.SeekToRow(PyLong_AsUnsignedLongLong(row));
+    } catch (kj::Exception e) {
+      PyErr_Format(PyExc_RuntimeError, "seek_to_row() failed: %s:%d: %s",
+                   e.getFile(), e.getLine(), e.getDescription().cStr());
+
+      return nullptr;
+    }
+
+    Py_RETURN_NONE;
+  }
+
+  PyObject* sample(PyObject* count, PyObject* seed) override {
+    try {
+      KJ_REQUIRE(PyLong_Check(count), "Count argument must be long");
+
+      ev_python::ScopedObject result(PyList_New(0));
+      if (!result) return nullptr;
+
+      auto rng = MakeRNG(seed);
+
+      reader_.Sample(
+          PyLong_AsUnsignedLongLong(count),
+          [&result](
+              const std::vector<std::pair<uint32_t, ev::StringRefOrNull>>&
+                  row) {
+            auto item = ObjectForRow(row);
+            if (PyList_Append(result.get(), item.get())) throw PythonError();
+          },
+          rng);
+
+      return result.release();
+    } catch (PythonError) {
+      // Exception already set.
+      return nullptr;
+    } catch (kj::Exception e) {
+      PyErr_Format(PyExc_RuntimeError, "sample() failed: %s:%d: %s",
+                   e.getFile(), e.getLine(), e.getDescription().cStr());
+
+      return nullptr;
+    }
+  }
+
   PyObject* size() override {
     try {
       return PyLong_FromLong(reader_.Size());
@@ -124,8 +627,8 @@ ColumnFileReader::~ColumnFileReader() {}
 
 ColumnFileReader* ColumnFileReader::open(const char* path) {
   try {
-    return new ColumnFileReaderImpl(ev::ColumnFileReader::FileDescriptorInput(
-        ev::OpenFile(path, O_RDONLY)));
+    return new ColumnFileReaderImpl(
+        ev::ColumnFileReader::SharedCacheInput(path));
   } catch (kj::Exception e) {
     PyErr_Format(PyExc_RuntimeError, "Error opening column file: %s:%d: %s",
                  e.getFile(), e.getLine(), e.getDescription().cStr());
@@ -133,83 +636,905 @@ ColumnFileReader* ColumnFileReader::open(const char* path) {
   }
 }
 
-PyObject* ColumnFile_select(PyObject* path, PyObject* fields, PyObject* filters,
-                            PyObject* callback) {
-  try {
-    KJ_REQUIRE(PyCallable_Check(callback));
+namespace {
 
-    ev::ColumnFileSelect select(ev::ColumnFileReader(
-        ev::OpenFile(ev_python::GetString(path).c_str(), O_RDONLY)));
+// Rows decoded by the producer thread of a `ColumnFileIteratorImpl`, with
+// copies of their values.
+struct RowBatch {
+  struct Field {
+    uint32_t column;
+    bool is_null;
+    size_t offset;
+    size_t size;
+  };
 
-    ev_python::ScopedObject field_iterator(PyObject_GetIter(fields));
-    if (!field_iterator) return nullptr;
+  // Copies `row` into the batch.
+  void Add(const std::vector<std::pair<uint32_t, ev::StringRefOrNull>>& row) {
+    for (const auto& kv : row) {
+      if (kv.second.IsNull()) {
+        fields.push_back(Field{kv.first, true, 0, 0});
+        continue;
+      }
 
-    for (;;) {
-      ev_python::ScopedObject item(PyIter_Next(field_iterator.get()));
-      if (!item) break;
+      const auto str = kv.second.StringRef();
+      fields.push_back(Field{kv.first, false, data.size(), str.size()});
+      data.append(str.data(), str.size());
+    }
 
-      KJ_REQUIRE(PyLong_Check(item.get()));
-      select.AddSelection(PyLong_AsLong(item.get()));
+    row_ends.emplace_back(fields.size());
+  }
+
+  size_t RowCount() const { return row_ends.size(); }
+
+  // Returns row `i` as a dict, like `ColumnFileReader.get_row()`.
+  ev_python::ScopedObject ObjectForRow(size_t i) const {
+    ev_python::ScopedObject result(PyDict_New());
+    if (!result) return result;
+
+    for (auto j = i ? row_ends[i - 1] : 0; j < row_ends[i]; ++j) {
+      const auto& field = fields[j];
+
+      ev_python::ScopedObject key(PyLong_FromLong(field.column));
+      ev_python::ScopedObject value;
+
+      if (field.is_null) {
+        Py_INCREF(Py_None);
+        value.reset(Py_None);
+      } else {
+        value.reset(PyBytes_FromStringAndSize(data.data() + field.offset,
+                                              field.size));
+      }
+
+      if (!key || !value) return ev_python::ScopedObject();
+
+      if (PyDict_SetItem(result.get(), key.get(), value.get()))
+        return ev_python::ScopedObject();
     }
 
-    ev_python::ScopedObject filter_iterator(PyObject_GetIter(filters));
-    if (!filter_iterator) return nullptr;
+    return result;
+  }
 
-    for (;;) {
-      ev_python::ScopedObject item(PyIter_Next(filter_iterator.get()));
-      if (!item) break;
+  std::string data;
+  std::vector<Field> fields;
 
-      KJ_REQUIRE(PyTuple_Check(item.get()));
-      KJ_REQUIRE(2 == PyTuple_GET_SIZE(item.get()),
-                 PyTuple_GET_SIZE(item.get()));
+  // One past the last field of each row.
+  std::vector<size_t> row_ends;
+
+  // Set if the producer failed after the rows in this batch.
+  std::string error;
+};
 
-      const auto field_index = PyTuple_GetItem(item.get(), 0);
-      KJ_REQUIRE(PyLong_Check(field_index));
+class ColumnFileIteratorImpl : public ColumnFileIterator {
+ public:
+  ColumnFileIteratorImpl(ev::ColumnFileReader reader, size_t batch_size,
+                         uint32_t depth)
+      : reader_(std::move(reader)), batch_size_(batch_size), queue_(depth) {
+    producer_ = std::thread(&ColumnFileIteratorImpl::Produce, this);
+  }
 
-      const auto filter_function = PyTuple_GetItem(item.get(), 1);
-      KJ_REQUIRE(PyCallable_Check(filter_function));
+  // The queue's cache line aligned members need more alignment than the
+  // default `operator new` guarantees before C++17.
+  static void* operator new(size_t size) {
+    void* result;
+    if (posix_memalign(&result, EV_CACHELINE_SIZE, size))
+      throw std::bad_alloc();
+    return result;
+  }
 
-      select.AddFilter(
-          PyLong_AsLong(field_index),
-          [filter_function](const ev::StringRefOrNull& value) mutable {
-            ev_python::ScopedObject arg;
+  static void operator delete(void* ptr) { free(ptr); }
 
-            if (value.IsNull()) {
-              Py_INCREF(Py_None);
-              arg.reset(Py_None);
-            } else {
-              const auto str = value.StringRef();
-              arg.reset(PyUnicode_FromStringAndSize(str.data(), str.size()));
-            }
+  ~ColumnFileIteratorImpl() override {
+    ev_python::ScopedGILRelease gil_release;
 
-            ev_python::ScopedObject result(PyObject_CallFunctionObjArgs(
-                filter_function, arg.get(), nullptr));
+    // The producer may be waiting for a free slot, so keep draining the
+    // queue until it notices it should stop.
+    stop_ = true;
+    std::unique_ptr<RowBatch> batch;
+    while (queue_.Dequeue(batch)) {
+    }
 
-            if (!result) throw PythonError();
+    producer_.join();
+  }
 
-            return PyObject_IsTrue(result.get());
-          });
+  PyObject* next_row() override {
+    while (!batch_ || row_ == batch_->RowCount()) {
+      if (batch_ && !batch_->error.empty()) {
+        PyErr_Format(PyExc_RuntimeError, "next_row() failed: %s",
+                     batch_->error.c_str());
+        return nullptr;
+      }
+
+      if (done_) {
+        PyErr_SetNone(PyExc_StopIteration);
+        return nullptr;
+      }
+
+      {
+        ev_python::ScopedGILRelease gil_release;
+        done_ = !queue_.Dequeue(batch_);
+      }
+
+      if (done_) batch_.reset();
+      row_ = 0;
     }
 
-    ev::concurrency::RegionPool region_pool(1, 2048);
+    return batch_->ObjectForRow(row_++).release();
+  }
 
-    select.Execute(
-        region_pool,
-        [callback](
-            const std::vector<std::pair<uint32_t, ev::StringRefOrNull>>& row) {
-          auto arg = ObjectForRow(row);
-          ev_python::ScopedObject result(PyObject_CallFunctionObjArgs(
-              callback, arg.get(), nullptr));
-          if (!result) throw PythonError();
-        });
+ private:
+  // Decodes rows into batches ahead of the consumer, until the end of the
+  // table, an error, or destruction.
+  void Produce() {
+    while (!stop_) {
+      auto batch = std::make_unique<RowBatch>();
 
-    Py_RETURN_NONE;
-  } catch (PythonError) {
-    // Exception already set.
-    return nullptr;
-  } catch (kj::Exception e) {
-    PyErr_Format(PyExc_RuntimeError, "ColumnFile_select failed: %s:%d: %s",
-                 e.getFile(), e.getLine(), e.getDescription().cStr());
-    return nullptr;
+      try {
+        while (batch->RowCount() < batch_size_ && !reader_.End())
+          batch->Add(reader_.GetRow());
+      } catch (kj::Exception e) {
+        batch->error = kj::str(e.getFile(), ":", e.getLine(), ": ",
+                               e.getDescription()).cStr();
+      }
+
+      if (!batch->RowCount() && batch->error.empty()) break;
+
+      const auto last = !batch->error.empty() || reader_.End();
+      queue_.Enqueue(std::move(batch));
+      if (last) break;
+    }
+
+    queue_.Finish();
   }
+
+  ev::ColumnFileReader reader_;
+
+  const size_t batch_size_;
+
+  ev::concurrency::BoundedQueue<std::unique_ptr<RowBatch>,
+                                ev::concurrency::BoundedQueueFutexWait>
+      queue_;
+
+  std::atomic<bool> stop_{false};
+
+  std::thread producer_;
+
+  // The batch being consumed, and the index of its next row.
+  std::unique_ptr<RowBatch> batch_;
+  size_t row_ = 0;
+
+  bool done_ = false;
+};
+
+}  // namespace
+
+ColumnFileIterator::~ColumnFileIterator() {}
+
+ColumnFileIterator* ColumnFileIterator::open(const char* path,
+                                             PyObject* columns,
+                                             PyObject* batch_size,
+                                             PyObject* depth) {
+  try {
+    KJ_REQUIRE(PyLong_Check(batch_size), "Batch size must be long");
+    KJ_REQUIRE(PyLong_Check(depth), "Depth must be long");
+
+    const auto rows = PyLong_AsUnsignedLong(batch_size);
+    const auto batches = PyLong_AsUnsignedLong(depth);
+    if (PyErr_Occurred()) return nullptr;
+    KJ_REQUIRE(rows > 0, "Batch size must be positive");
+    KJ_REQUIRE(batches > 0 && batches <= (1U << 16), "Invalid depth",
+               batches);
+
+    ev::ColumnFileReader reader(ev::ColumnFileReader::SharedCacheInput(path));
+
+    if (columns != Py_None) {
+      ev_python::ScopedObject iterator(PyObject_GetIter(columns));
+      if (!iterator) return nullptr;
+
+      std::vector<uint32_t> column_ids;
+
+      for (;;) {
+        ev_python::ScopedObject item(PyIter_Next(iterator.get()));
+        if (!item) break;
+
+        column_ids.emplace_back(GetColumn(reader.Schema(), item.get()));
+      }
+
+      if (PyErr_Occurred()) return nullptr;
+
+      reader.SetColumnFilter(column_ids.begin(), column_ids.end());
+    }
+
+    // The queue size must be a power of two, so round up the depth.
+    uint32_t queue_size = 1;
+    while (queue_size < batches) queue_size <<= 1;
+
+    return new ColumnFileIteratorImpl(std::move(reader), rows, queue_size);
+  } catch (kj::Exception e) {
+    PyErr_Format(PyExc_RuntimeError, "Error opening column file: %s:%d: %s",
+                 e.getFile(), e.getLine(), e.getDescription().cStr());
+    return nullptr;
+  }
+}
+
+namespace {
+
+bool IsNumber(PyObject* object) {
+#if PY_MAJOR_VERSION < 3
+  if (PyInt_Check(object)) return true;
+#endif
+  return PyLong_Check(object) || PyFloat_Check(object);
+}
+
+// Returns the filter described by `item`, a (column, kind, arguments...)
+// tuple.  See `ColumnFile_select()` for the filter kinds.
+ev::Delegate<bool(const ev::StringRefOrNull&)> GetDeclarativeFilter(
+    const ev::ColumnFileSchema& schema, uint32_t column, PyObject* item) {
+  const auto size = PyTuple_GET_SIZE(item);
+  const auto kind = ev_python::GetString(PyTuple_GET_ITEM(item, 1));
+
+  if (kind == "prefix" || kind == "regex") {
+    KJ_REQUIRE(size == 3, kind, size);
+    const auto argument = ev_python::GetString(PyTuple_GET_ITEM(item, 2));
+
+    if (kind == "prefix") return ev::ColumnFilePrefixFilter(argument);
+    return ev::ColumnFileRegexFilter(argument.c_str());
+  }
+
+  if (kind == "range") {
+    KJ_REQUIRE(size == 4, kind, size);
+    const auto min = PyTuple_GET_ITEM(item, 2);
+    const auto max = PyTuple_GET_ITEM(item, 3);
+
+    // Numeric bounds may be None, for an unbounded range.
+    if ((min == Py_None || IsNumber(min)) &&
+        (max == Py_None || IsNumber(max))) {
+      const auto infinity = std::numeric_limits<double>::infinity();
+      return ev::ColumnFileRangeFilter(
+          schema, column, min == Py_None ? -infinity : PyFloat_AsDouble(min),
+          max == Py_None ? infinity : PyFloat_AsDouble(max));
+    }
+
+    return ev::ColumnFileRangeFilter(ev_python::GetString(min),
+                                     ev_python::GetString(max));
+  }
+
+  if (kind == "in") {
+    KJ_REQUIRE(size == 3, kind, size);
+    const auto definition = schema.Find(column);
+    const auto is_int =
+        definition && definition->type == ev::kColumnTypeInt;
+
+    std::vector<std::string> strings;
+    std::vector<int64_t> ints;
+
+    ev_python::ScopedObject iterator(
+        PyObject_GetIter(PyTuple_GET_ITEM(item, 2)));
+    if (!iterator) throw PythonError();
+
+    for (;;) {
+      ev_python::ScopedObject value(PyIter_Next(iterator.get()));
+      if (!value) break;
+
+      if (is_int) {
+        ints.emplace_back(PyLong_AsLongLong(value.get()));
+        if (PyErr_Occurred()) throw PythonError();
+      } else {
+        strings.emplace_back(ev_python::GetString(value.get()));
+      }
+    }
+
+    if (PyErr_Occurred()) throw PythonError();
+
+    if (is_int) return ev::ColumnFileInFilter(schema, column, ints);
+    return ev::ColumnFileInFilter(strings);
+  }
+
+  KJ_FAIL_REQUIRE("Unknown filter kind", kind);
+}
+
+// Creates a `ColumnFileSelect` for the file at `path`, with the field list and
+// filter list used by `ColumnFile_select()`.  If `fields` is null, no fields
+// are selected.  Sets `has_callbacks`, if given, to whether any filter is a
+// Python function.
+ev::ColumnFileSelect MakeSelect(PyObject* path, PyObject* fields,
+                                PyObject* filters,
+                                bool* has_callbacks = nullptr) {
+  ev::ColumnFileSelect select(ev::ColumnFileReader(
+      ev::ColumnFileReader::SharedCacheInput(
+          ev_python::GetString(path).c_str())));
+
+  if (has_callbacks) *has_callbacks = false;
+
+  if (fields) {
+    ev_python::ScopedObject field_iterator(PyObject_GetIter(fields));
+    if (!field_iterator) throw PythonError();
+
+    for (;;) {
+      ev_python::ScopedObject item(PyIter_Next(field_iterator.get()));
+      if (!item) break;
+
+      select.AddSelection(GetColumn(select.Schema(), item.get()));
+    }
+  }
+
+  ev_python::ScopedObject filter_iterator(PyObject_GetIter(filters));
+  if (!filter_iterator) throw PythonError();
+
+  for (;;) {
+    ev_python::ScopedObject item(PyIter_Next(filter_iterator.get()));
+    if (!item) break;
+
+    KJ_REQUIRE(PyTuple_Check(item.get()));
+    KJ_REQUIRE(2 <= PyTuple_GET_SIZE(item.get()),
+               PyTuple_GET_SIZE(item.get()));
+
+    const auto field_index =
+        GetColumn(select.Schema(), PyTuple_GetItem(item.get(), 0));
+
+    const auto filter_function = PyTuple_GetItem(item.get(), 1);
+
+    if (!PyCallable_Check(filter_function)) {
+      select.AddFilter(field_index, GetDeclarativeFilter(select.Schema(),
+                                                         field_index,
+                                                         item.get()));
+      continue;
+    }
+
+    KJ_REQUIRE(2 == PyTuple_GET_SIZE(item.get()),
+               PyTuple_GET_SIZE(item.get()));
+
+    if (has_callbacks) *has_callbacks = true;
+
+    select.AddFilter(
+        field_index,
+        [filter_function](const ev::StringRefOrNull& value) mutable {
+          ev_python::ScopedObject arg;
+
+          if (value.IsNull()) {
+            Py_INCREF(Py_None);
+            arg.reset(Py_None);
+          } else {
+            const auto str = value.StringRef();
+            arg.reset(PyUnicode_FromStringAndSize(str.data(), str.size()));
+          }
+
+          ev_python::ScopedObject result(PyObject_CallFunctionObjArgs(
+              filter_function, arg.get(), nullptr));
+
+          if (!result) throw PythonError();
+
+          return PyObject_IsTrue(result.get());
+        });
+  }
+
+  return select;
+}
+
+// The images read by `ColumnFile_select_images()` for a batch of rows.
+class ImageBatch {
+ public:
+  // `image` is a (pixels, sample_type, width, height) tuple of columns, and
+  // `shape` a (height, width) tuple.
+  ImageBatch(PyObject* image, PyObject* shape, PyObject* method,
+             const ev::ColumnFileSchema& schema)
+      : method_(ev::ImageResizeMethodFromName(
+            ev_python::GetString(method))) {
+    KJ_REQUIRE(PyTuple_Check(image) && 4 == PyTuple_GET_SIZE(image),
+               "Image must be a (pixels, sample_type, width, height) tuple");
+
+    for (size_t i = 0; i < 4; ++i)
+      columns_[i] = GetColumn(schema, PyTuple_GET_ITEM(image, i));
+
+    unsigned long height, width;
+    if (!PyArg_ParseTuple(shape, "kk", &height, &width)) throw PythonError();
+    KJ_REQUIRE(height > 0 && width > 0, height, width);
+
+    output_height_ = height;
+    output_width_ = width;
+  }
+
+  void AddSelections(ev::ColumnFileSelect& select) const {
+    for (const auto column : columns_) select.AddSelection(column);
+  }
+
+  size_t Size() const { return images_.size(); }
+
+  void Clear() {
+    images_.clear();
+    pixels_.clear();
+  }
+
+  // Adds the image of `row`.  Must be called without the GIL held.
+  void Add(const std::vector<std::pair<uint32_t, ev::StringRefOrNull>>& row,
+           const ev::ColumnFileSchema& schema) {
+    const auto pixels = Get(row, kPixels);
+    const auto sample_type = Get(row, kSampleType);
+
+    ev::Image16 image;
+    image.type = ev::ImageSampleTypeFromName(sample_type);
+    image.width = GetDimension(row, kWidth, schema);
+    image.height = GetDimension(row, kHeight, schema);
+
+    KJ_REQUIRE(pixels.size() >=
+                   image.width * image.height * sizeof(uint16_t),
+               "Image data too short", pixels.size(), image.width,
+               image.height);
+
+    // Row values are only valid until the next row is read.
+    pixels_.emplace_back(pixels.str());
+    images_.emplace_back(image);
+  }
+
+  // Returns the images as a float32 array of shape (images, height, width),
+  // optionally standardized one by one before they are resized.  The GIL is released while the
+  // images are resized on `thread_pool`.
+  ev_python::ScopedObject ToArray(PyObject* numpy, ev::ThreadPool& thread_pool,
+                                  bool standardize) {
+    ev_python::ScopedObject result(PyObject_CallMethod(
+        numpy, "empty", "((kkk)s)", static_cast<unsigned long>(Size()),
+        static_cast<unsigned long>(output_height_),
+        static_cast<unsigned long>(output_width_), "float32"));
+    if (!result) return result;
+
+    Py_buffer view;
+    if (-1 == PyObject_GetBuffer(result.get(), &view,
+                                 PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS))
+      return ev_python::ScopedObject();
+
+    auto output = reinterpret_cast<float*>(view.buf);
+    bool all_standardized = true;
+
+    try {
+      ev_python::ScopedGILRelease gil_release;
+
+      // Set here, since adding pixels may move those of short images.
+      for (size_t i = 0; i < images_.size(); ++i)
+        images_[i].data = pixels_[i].data();
+
+      all_standardized =
+          ev::ResizeImages(thread_pool, images_, output, output_width_,
+                           output_height_, method_, standardize);
+    } catch (...) {
+      PyBuffer_Release(&view);
+      throw;
+    }
+
+    PyBuffer_Release(&view);
+
+    KJ_REQUIRE(all_standardized, "Image has no variance");
+
+    return result;
+  }
+
+ private:
+  enum Field { kPixels, kSampleType, kWidth, kHeight };
+
+  ev::StringRef Get(
+      const std::vector<std::pair<uint32_t, ev::StringRefOrNull>>& row,
+      Field field) const {
+    // Rows are sorted by column.
+    const auto i = std::lower_bound(
+        row.begin(), row.end(), columns_[field],
+        [](const auto& lhs, uint32_t column) { return lhs.first < column; });
+
+    KJ_REQUIRE(i != row.end() && i->first == columns_[field] &&
+                   !i->second.IsNull(),
+               "Image field is null", columns_[field]);
+
+    return i->second.StringRef();
+  }
+
+  // Returns a dimension stored as an int column, or as a 32 bit little
+  // endian binary value.
+  size_t GetDimension(
+      const std::vector<std::pair<uint32_t, ev::StringRefOrNull>>& row,
+      Field field, const ev::ColumnFileSchema& schema) const {
+    const auto value = Get(row, field);
+
+    const auto definition = schema.Find(columns_[field]);
+    if (definition && definition->type == ev::kColumnTypeInt) {
+      const auto result = schema.GetInt(columns_[field], value);
+      KJ_REQUIRE(result > 0, "Invalid image dimension", result);
+      return result;
+    }
+
+    KJ_REQUIRE(value.size() == sizeof(uint32_t), "Invalid image dimension",
+               value.size());
+    uint32_t result;
+    memcpy(&result, value.data(), sizeof(result));
+    result = le32toh(result);
+    KJ_REQUIRE(result > 0, "Invalid image dimension", result);
+
+    return result;
+  }
+
+  uint32_t columns_[4];
+
+  ev::ImageResizeMethod method_;
+  size_t output_height_ = 0;
+  size_t output_width_ = 0;
+
+  std::vector<ev::Image16> images_;
+  std::vector<std::string> pixels_;
+};
+
+}  // namespace
+
+PyObject* ColumnFile_select(PyObject* path, PyObject* fields, PyObject* filters,
+                            PyObject* callback) {
+  try {
+    KJ_REQUIRE(PyCallable_Check(callback));
+
+    bool has_callbacks;
+    auto select = MakeSelect(path, fields, filters, &has_callbacks);
+
+    ev::concurrency::RegionPool region_pool(1, 2048);
+
+    // Unless filters call into Python, the GIL is only held while calling
+    // `callback`.
+    std::unique_ptr<ev_python::ScopedGILRelease> gil_release;
+    if (!has_callbacks)
+      gil_release = std::make_unique<ev_python::ScopedGILRelease>();
+
+    select.Execute(
+        region_pool,
+        [callback](
+            const std::vector<std::pair<uint32_t, ev::StringRefOrNull>>& row) {
+          ev_python::ScopedGILAcquire gil_acquire;
+          auto arg = ObjectForRow(row);
+          ev_python::ScopedObject result(PyObject_CallFunctionObjArgs(
+              callback, arg.get(), nullptr));
+          if (!result) throw PythonError();
+        });
+
+    Py_RETURN_NONE;
+  } catch (PythonError) {
+    // Exception already set.
+    return nullptr;
+  } catch (kj::Exception e) {
+    PyErr_Format(PyExc_RuntimeError, "ColumnFile_select failed: %s:%d: %s",
+                 e.getFile(), e.getLine(), e.getDescription().cStr());
+    return nullptr;
+  }
+}
+
+PyObject* ColumnFile_select_batches(PyObject* path, PyObject* fields,
+                                    PyObject* filters, PyObject* batch_size,
+                                    PyObject* callback) {
+  try {
+    KJ_REQUIRE(PyCallable_Check(callback));
+    KJ_REQUIRE(PyLong_Check(batch_size), "Batch size must be long");
+
+    const auto max_rows = PyLong_AsUnsignedLongLong(batch_size);
+    KJ_REQUIRE(max_rows > 0);
+
+    ev_python::ScopedObject numpy(PyImport_ImportModule("numpy"));
+    if (!numpy) return nullptr;
+
+    bool has_callbacks;
+    auto select = MakeSelect(path, nullptr, filters, &has_callbacks);
+    KJ_REQUIRE(!has_callbacks, "Filters must be declarative");
+
+    const auto& schema = select.Schema();
+    std::vector<ColumnBatch> batches;
+    if (!GetColumnBatches(fields, schema, numpy.get(), batches))
+      return nullptr;
+
+    for (const auto& batch : batches) select.AddSelection(batch.Column());
+
+    size_t row_count = 0;
+
+    const auto flush = [&] {
+      auto arg = ObjectForBatches(batches, numpy.get());
+      if (!arg) throw PythonError();
+
+      ev_python::ScopedObject result(
+          PyObject_CallFunctionObjArgs(callback, arg.get(), nullptr));
+      if (!result) throw PythonError();
+
+      for (auto& batch : batches) batch.Clear();
+      row_count = 0;
+    };
+
+    ev::concurrency::RegionPool region_pool(1, 2048);
+
+    {
+      ev_python::ScopedGILRelease gil_release;
+
+      select.Execute(
+          region_pool,
+          [&](const std::vector<std::pair<uint32_t, ev::StringRefOrNull>>&
+                  row) {
+            AddRow(row, schema, batches);
+            if (++row_count < max_rows) return;
+
+            ev_python::ScopedGILAcquire gil_acquire;
+            flush();
+          });
+    }
+
+    if (row_count) flush();
+
+    Py_RETURN_NONE;
+  } catch (PythonError) {
+    // Exception already set.
+    return nullptr;
+  } catch (kj::Exception e) {
+    PyErr_Format(PyExc_RuntimeError,
+                 "ColumnFile_select_batches failed: %s:%d: %s", e.getFile(),
+                 e.getLine(), e.getDescription().cStr());
+    return nullptr;
+  }
+}
+
+PyObject* ColumnFile_select_images(PyObject* path, PyObject* fields,
+                                   PyObject* filters, PyObject* image,
+                                   PyObject* shape, PyObject* method,
+                                   PyObject* standardize, PyObject* batch_size,
+                                   PyObject* callback) {
+  try {
+    KJ_REQUIRE(PyCallable_Check(callback));
+    KJ_REQUIRE(PyLong_Check(batch_size), "Batch size must be long");
+
+    const auto max_rows = PyLong_AsUnsignedLongLong(batch_size);
+    KJ_REQUIRE(max_rows > 0);
+
+    const auto standardize_images = PyObject_IsTrue(standardize);
+    if (standardize_images == -1) return nullptr;
+
+    ev_python::ScopedObject numpy(PyImport_ImportModule("numpy"));
+    if (!numpy) return nullptr;
+
+    bool has_callbacks;
+    auto select = MakeSelect(path, nullptr, filters, &has_callbacks);
+    KJ_REQUIRE(!has_callbacks, "Filters must be declarative");
+
+    const auto& schema = select.Schema();
+    std::vector<ColumnBatch> batches;
+    if (!GetColumnBatches(fields, schema, numpy.get(), batches))
+      return nullptr;
+
+    ImageBatch images(image, shape, method, schema);
+
+    for (const auto& batch : batches) select.AddSelection(batch.Column());
+    images.AddSelections(select);
+
+    ev::ThreadPool thread_pool;
+
+    const auto flush = [&] {
+      auto field_arg = ObjectForBatches(batches, numpy.get());
+      if (!field_arg) throw PythonError();
+
+      auto image_arg =
+          images.ToArray(numpy.get(), thread_pool, standardize_images);
+      if (!image_arg) throw PythonError();
+
+      ev_python::ScopedObject result(PyObject_CallFunctionObjArgs(
+          callback, field_arg.get(), image_arg.get(), nullptr));
+      if (!result) throw PythonError();
+
+      for (auto& batch : batches) batch.Clear();
+      images.Clear();
+    };
+
+    ev::concurrency::RegionPool region_pool(1, 2048);
+
+    {
+      ev_python::ScopedGILRelease gil_release;
+
+      select.Execute(
+          region_pool,
+          [&](const std::vector<std::pair<uint32_t, ev::StringRefOrNull>>&
+                  row) {
+            AddRow(row, schema, batches);
+            images.Add(row, schema);
+            if (images.Size() < max_rows) return;
+
+            ev_python::ScopedGILAcquire gil_acquire;
+            flush();
+          });
+    }
+
+    if (images.Size()) flush();
+
+    Py_RETURN_NONE;
+  } catch (PythonError) {
+    // Exception already set.
+    return nullptr;
+  } catch (kj::Exception e) {
+    PyErr_Format(PyExc_RuntimeError,
+                 "ColumnFile_select_images failed: %s:%d: %s", e.getFile(),
+                 e.getLine(), e.getDescription().cStr());
+    return nullptr;
+  }
+}
+
+PyObject* ColumnFile_sample(PyObject* path, PyObject* fields, PyObject* filters,
+                            PyObject* count, PyObject* seed,
+                            PyObject* callback) {
+  try {
+    KJ_REQUIRE(PyCallable_Check(callback));
+    KJ_REQUIRE(PyLong_Check(count), "Count argument must be long");
+
+    auto select = MakeSelect(path, fields, filters);
+    auto rng = MakeRNG(seed);
+
+    select.Sample(
+        PyLong_AsUnsignedLongLong(count),
+        [callback](
+            const std::vector<std::pair<uint32_t, ev::StringRefOrNull>>& row) {
+          auto arg = ObjectForRow(row);
+          ev_python::ScopedObject result(PyObject_CallFunctionObjArgs(
+              callback, arg.get(), nullptr));
+          if (!result) throw PythonError();
+        },
+        rng);
+
+    Py_RETURN_NONE;
+  } catch (PythonError) {
+    // Exception already set.
+    return nullptr;
+  } catch (kj::Exception e) {
+    PyErr_Format(PyExc_RuntimeError, "ColumnFile_sample failed: %s:%d: %s",
+                 e.getFile(), e.getLine(), e.getDescription().cStr());
+    return nullptr;
+  }
+}
+
+PyObject* ColumnFile_join(PyObject* path, PyObject* fields, PyObject* filters,
+                          PyObject* key, PyObject* key_pattern,
+                          PyObject* build_path, PyObject* build_key,
+                          PyObject* field_offset, PyObject* callback) {
+  try {
+    KJ_REQUIRE(PyCallable_Check(callback));
+    KJ_REQUIRE(PyLong_Check(field_offset), "Field offset must be long");
+
+    auto select = MakeSelect(path, fields, filters);
+    const auto key_field = GetColumn(select.Schema(), key);
+
+    ev::ColumnFileHashJoin join(std::move(select), key_field);
+
+    if (key_pattern != Py_None)
+      join.SetProbeKeyPattern(ev_python::GetString(key_pattern).c_str());
+
+    const auto build_path_string = ev_python::GetString(build_path);
+    const auto offset = PyLong_AsUnsignedLong(field_offset);
+
+    if (ev::HasSuffix(build_path_string, ".csv")) {
+      KJ_REQUIRE(PyLong_Check(build_key), "CSV key column must be long");
+      join.AddCSV(ev::ReadFile(build_path_string.c_str()),
+                  PyLong_AsUnsignedLong(build_key), offset);
+    } else {
+      ev::ColumnFileReader build_reader(
+          ev::OpenFile(build_path_string.c_str(), O_RDONLY));
+      const auto build_key_field =
+          GetColumn(build_reader.Schema(), build_key);
+      join.AddColumnFile(std::move(build_reader), build_key_field, offset);
+    }
+
+    ev::concurrency::RegionPool region_pool(1, 2048);
+
+    join.Execute(
+        region_pool,
+        [callback](
+            const std::vector<std::pair<uint32_t, ev::StringRefOrNull>>& row) {
+          auto arg = ObjectForRow(row);
+          ev_python::ScopedObject result(PyObject_CallFunctionObjArgs(
+              callback, arg.get(), nullptr));
+          if (!result) throw PythonError();
+        });
+
+    Py_RETURN_NONE;
+  } catch (PythonError) {
+    // Exception already set.
+    return nullptr;
+  } catch (kj::Exception e) {
+    PyErr_Format(PyExc_RuntimeError, "ColumnFile_join failed: %s:%d: %s",
+                 e.getFile(), e.getLine(), e.getDescription().cStr());
+    return nullptr;
+  }
+}
+
+PyObject* ColumnFile_aggregate(PyObject* path, PyObject* group_by,
+                               PyObject* aggregates) {
+  try {
+    ev::ColumnFileAggregate aggregate(ev::ColumnFileReader(
+        ev::OpenFile(ev_python::GetString(path).c_str(), O_RDONLY)));
+
+    ev_python::ScopedObject group_by_iterator(PyObject_GetIter(group_by));
+    if (!group_by_iterator) return nullptr;
+
+    for (;;) {
+      ev_python::ScopedObject item(PyIter_Next(group_by_iterator.get()));
+      if (!item) break;
+
+      aggregate.AddGroupBy(GetColumn(aggregate.Schema(), item.get()));
+    }
+
+    ev_python::ScopedObject aggregate_iterator(PyObject_GetIter(aggregates));
+    if (!aggregate_iterator) return nullptr;
+
+    for (;;) {
+      ev_python::ScopedObject item(PyIter_Next(aggregate_iterator.get()));
+      if (!item) break;
+
+      KJ_REQUIRE(PyTuple_Check(item.get()));
+      KJ_REQUIRE(2 == PyTuple_GET_SIZE(item.get()),
+                 PyTuple_GET_SIZE(item.get()));
+
+      const auto function_name =
+          ev_python::GetString(PyTuple_GetItem(item.get(), 0));
+      ev::ColumnFileAggregateFunction function;
+
+      if (function_name == "count") {
+        function = ev::kColumnFileAggregateCount;
+      } else if (function_name == "min") {
+        function = ev::kColumnFileAggregateMin;
+      } else if (function_name == "max") {
+        function = ev::kColumnFileAggregateMax;
+      } else if (function_name == "sum") {
+        function = ev::kColumnFileAggregateSum;
+      } else {
+        KJ_FAIL_REQUIRE("Unknown aggregate function", function_name);
+      }
+
+      aggregate.AddAggregate(
+          function,
+          GetColumn(aggregate.Schema(), PyTuple_GetItem(item.get(), 1)));
+    }
+
+    ev::ThreadPool thread_pool;
+    const auto groups = aggregate.Execute(thread_pool);
+
+    ev_python::ScopedObject result(PyList_New(groups.size()));
+    if (!result) return nullptr;
+
+    for (size_t i = 0; i < groups.size(); ++i) {
+      const auto& group = groups[i];
+
+      ev_python::ScopedObject key(PyTuple_New(group.key.size()));
+      if (!key) return nullptr;
+      for (size_t j = 0; j < group.key.size(); ++j)
+        PyTuple_SET_ITEM(key.get(), j, ObjectForKey(group.key[j]).release());
+
+      ev_python::ScopedObject values(PyTuple_New(group.values.size()));
+      if (!values) return nullptr;
+      for (size_t j = 0; j < group.values.size(); ++j)
+        PyTuple_SET_ITEM(values.get(), j,
+                         PyFloat_FromDouble(group.values[j]));
+
+      PyList_SET_ITEM(result.get(), i,
+                      PyTuple_Pack(2, key.get(), values.get()));
+    }
+
+    return result.release();
+  } catch (kj::Exception e) {
+    PyErr_Format(PyExc_RuntimeError, "ColumnFile_aggregate failed: %s:%d: %s",
+                 e.getFile(), e.getLine(), e.getDescription().cStr());
+    return nullptr;
+  }
+}
+
+PyObject* ColumnFile_set_cache_capacity(PyObject* capacity) {
+  if (!PyLong_Check(capacity)) {
+    PyErr_SetString(PyExc_TypeError, "Capacity must be long");
+    return nullptr;
+  }
+
+  ev::ColumnFileCache::Global().SetCapacity(
+      PyLong_AsUnsignedLongLong(capacity));
+
+  Py_RETURN_NONE;
+}
+
+PyObject* ColumnFile_cache_statistics() {
+  const auto statistics = ev::ColumnFileCache::Global().GetStatistics();
+
+  return Py_BuildValue(
+      "{sKsKsKsKsK}", "hits",
+      static_cast<unsigned long long>(statistics.hits), "misses",
+      static_cast<unsigned long long>(statistics.misses), "insertions",
+      static_cast<unsigned long long>(statistics.insertions), "evictions",
+      static_cast<unsigned long long>(statistics.evictions), "size",
+      static_cast<unsigned long long>(statistics.size));
 }
@@ -1,9 +1,19 @@
 #include "python/columnfile.h"
 
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include <kj/debug.h>
 
 #include "base/columnfile.h"
+#include "python/gil.h"
 #include "python/object.h"
+#include "python/string.h"
 
 namespace {
 
@@ -15,6 +25,12 @@ class ColumnFileImpl : public ColumnFile {
   ColumnFileImpl(kj::AutoCloseFd&& fd)
       : region_pool_(1, 1), column_file_writer_(std::move(fd)) {}
 
+  ColumnFileImpl(std::unique_ptr<ev::ColumnFileOutput> output,
+                 std::vector<std::string> manifest)
+      : region_pool_(1, 1),
+        column_file_writer_(std::move(output)),
+        manifest_(std::move(manifest)) {}
+
   ~ColumnFileImpl() noexcept {}
 
   PyObject* save_double_as_float() override {
@@ -34,15 +50,38 @@ class ColumnFileImpl : public ColumnFile {
     Py_RETURN_NONE;
   }
 
+  PyObject* add_column(PyObject* column, PyObject* name, PyObject* type,
+                       PyObject* dicom_tag) override;
+
   PyObject* add_row(PyObject* row) override;
 
+  PyObject* add_rows(PyObject* columns) override;
+
   PyObject* flush() override;
 
+  PyObject* checkpoint(PyObject* inputs) override;
+
+  PyObject* manifest() override;
+
+  PyObject* pending_inputs(PyObject* inputs) override;
+
   PyObject* finish() override;
 
  private:
+  // Converts a value for `column` to its column file representation.
+  ev::StringRefOrNull GetValue(uint32_t column, PyObject* item,
+                               ev::concurrency::RegionPool::Region& region);
+
+  // Writes all buffered rows.  The GIL is released while the data is
+  // compressed, so other Python threads can run.
+  void FlushWithoutGIL();
+
   ev::concurrency::RegionPool region_pool_;
 
+  // Serializes access to the writer, which is also used while the GIL is
+  // released.  Never wait for the GIL while holding this lock.
+  std::mutex mutex_;
+
   ev::ColumnFileWriter column_file_writer_;
 
   bool save_double_as_float_ = false;
@@ -52,60 +91,466 @@ class ColumnFileImpl : public ColumnFile {
 
   // Number of unflushed rows.
   size_t unflushed_ = 0;
+
+  // Inputs recorded by `checkpoint()`.
+  std::vector<std::string> manifest_;
 };
 
-PyObject* ColumnFileImpl::add_row(PyObject* row) {
+// Appends the strings in the sequence `sequence` to `output`.  Returns false
+// if a Python exception was raised.
+bool GetStrings(PyObject* sequence, std::vector<std::string>& output) {
+  ev_python::ScopedObject iterator(PyObject_GetIter(sequence));
+  if (!iterator.get()) return false;
+
+  for (;;) {
+    ev_python::ScopedObject item(PyIter_Next(iterator.get()));
+    if (!item.get()) break;
+
+    output.emplace_back(ev_python::GetString(item.get()));
+  }
+
+  return !PyErr_Occurred();
+}
+
+// Values of one column passed to `add_rows()`.  Arrays are read through the
+// buffer protocol, so values can be fetched without the GIL.
+class BatchColumn {
+ public:
+  BatchColumn(uint32_t column) : column_(column) {
+    memset(&view_, 0, sizeof(view_));
+    memset(&mask_, 0, sizeof(mask_));
+  }
+
+  // Must be destroyed with the GIL held.
+  ~BatchColumn() {
+    if (view_.obj) PyBuffer_Release(&view_);
+    if (mask_.obj) PyBuffer_Release(&mask_);
+  }
+
+  BatchColumn(const BatchColumn&) = delete;
+  BatchColumn& operator=(const BatchColumn&) = delete;
+
+  uint32_t Column() const { return column_; }
+
+  // Reads `values`, which is an array or a sequence of values accepted by
+  // `get_value`.  Returns false if a Python exception was raised.
+  template <typename GetValue>
+  bool Init(PyObject* values, GetValue&& get_value);
+
+  size_t Size() const { return size_; }
+
+  // Returns the value for `row`.  Doesn't use the Python API.
+  ev::StringRefOrNull Get(size_t row, bool save_double_as_float);
+
+ private:
+  enum Kind { kObjects, kInt, kFloat, kBinary };
+
+  // Returns the struct module format character of `view`, or 0 if elements
+  // are not native integers or floats.
+  static char ScalarFormat(const Py_buffer& view);
+
+  // Returns true if the elements of each row of `view` are contiguous, and
+  // sets `row_size` to their size in bytes.
+  static bool RowsAreContiguous(const Py_buffer& view, size_t& row_size);
+
+  bool InitMask(PyObject* values);
+
+  int64_t GetInt(const char* data) const;
+
+  uint32_t column_;
+
+  Kind kind_ = kObjects;
+
+  size_t size_ = 0;
+
+  // kObjects: the converted values, and references to the objects they
+  // point into.
+  std::vector<ev::StringRefOrNull> values_;
+  std::vector<ev_python::ScopedObject> references_;
+
+  // Other kinds: the array data, and its optional mask.
+  Py_buffer view_;
+  char format_ = 0;
+  size_t value_size_ = 0;
+
+  Py_buffer mask_;
+  size_t mask_size_ = 0;
+
+  // Encoding of the most recent numeric value.
+  char scratch_[sizeof(int64_t)];
+};
+
+template <typename GetValue>
+bool BatchColumn::Init(PyObject* values, GetValue&& get_value) {
+  if (!PyObject_CheckBuffer(values) || PyBytes_Check(values) ||
+      PyUnicode_Check(values)) {
+    ev_python::ScopedObject sequence(
+        PySequence_Fast(values, "Column values must be a sequence"));
+    if (!sequence) return false;
+
+    size_ = PySequence_Fast_GET_SIZE(sequence.get());
+    values_.reserve(size_);
+    references_.reserve(size_);
+
+    for (size_t i = 0; i < size_; ++i) {
+      auto item = PySequence_Fast_GET_ITEM(sequence.get(), i);
+
+      // Keeps byte strings alive even if the sequence changes while the GIL
+      // is released.
+      Py_INCREF(item);
+      references_.emplace_back(item);
+
+      values_.emplace_back(get_value(column_, item));
+    }
+
+    return true;
+  }
+
+  if (-1 == PyObject_GetBuffer(values, &view_, PyBUF_RECORDS_RO)) return false;
+
+  KJ_REQUIRE(view_.ndim >= 1, "Column arrays need at least one dimension",
+             column_);
+  size_ = view_.shape[0];
+
+  format_ = ScalarFormat(view_);
+
+  if (view_.ndim == 1 && format_) {
+    kind_ = (format_ == 'f' || format_ == 'd') ? kFloat : kInt;
+  } else {
+    KJ_REQUIRE(RowsAreContiguous(view_, value_size_),
+               "Array rows must be contiguous", column_);
+    kind_ = kBinary;
+  }
+
+  return InitMask(values);
+}
+
+char BatchColumn::ScalarFormat(const Py_buffer& view) {
+  const char* format = view.format ? view.format : "B";
+
+  // Native byte order, which is what the column file stores.
+  if (*format == '@' || *format == '=' || *format == '<') ++format;
+
+  if (!format[0] || format[1] || !strchr("bBhHiIlLqQ?fd", format[0]))
+    return 0;
+
+  return format[0];
+}
+
+bool BatchColumn::RowsAreContiguous(const Py_buffer& view, size_t& row_size) {
+  row_size = view.itemsize;
+
+  for (int i = view.ndim; i-- > 1;) {
+    if (view.strides && view.strides[i] != static_cast<Py_ssize_t>(row_size))
+      return false;
+    row_size *= view.shape[i];
+  }
+
+  return true;
+}
+
+bool BatchColumn::InitMask(PyObject* values) {
+  // NumPy masked arrays export their data without the mask.
+  if (!PyObject_HasAttrString(values, "mask")) return true;
+
+  ev_python::ScopedObject mask(PyObject_GetAttrString(values, "mask"));
+  if (!mask) return false;
+
+  if (-1 == PyObject_GetBuffer(mask.get(), &mask_, PyBUF_RECORDS_RO))
+    return false;
+
+  KJ_REQUIRE(mask_.itemsize == 1, "Unsupported mask type", column_);
+
+  if (mask_.ndim == 0) {
+    // `numpy.ma.nomask`, or a mask shared by all rows.
+    mask_size_ = 1;
+  } else {
+    KJ_REQUIRE(mask_.shape[0] == static_cast<Py_ssize_t>(size_),
+               "Mask doesn't match array", column_);
+    KJ_REQUIRE(RowsAreContiguous(mask_, mask_size_),
+               "Mask rows must be contiguous", column_);
+  }
+
+  return true;
+}
+
+int64_t BatchColumn::GetInt(const char* data) const {
+  switch (view_.itemsize) {
+    case 1:
+      if (format_ == 'b') return *reinterpret_cast<const int8_t*>(data);
+      return *reinterpret_cast<const uint8_t*>(data);
+
+    case 2:
+      if (format_ == 'h') return *reinterpret_cast<const int16_t*>(data);
+      return *reinterpret_cast<const uint16_t*>(data);
+
+    case 4:
+      if (islower(format_)) return *reinterpret_cast<const int32_t*>(data);
+      return *reinterpret_cast<const uint32_t*>(data);
+
+    case 8: {
+      const auto value = *reinterpret_cast<const int64_t*>(data);
+      KJ_REQUIRE(islower(format_) || value >= 0, "Integer out of range",
+                 column_);
+      return value;
+    }
+  }
+
+  KJ_FAIL_REQUIRE("Unsupported integer size", column_, view_.itemsize);
+}
+
+ev::StringRefOrNull BatchColumn::Get(size_t row, bool save_double_as_float) {
+  if (kind_ == kObjects) return values_[row];
+
+  if (mask_.obj) {
+    auto mask = reinterpret_cast<const char*>(mask_.buf);
+    if (mask_.ndim) mask += row * mask_.strides[0];
+
+    for (size_t i = 0; i < mask_size_; ++i) {
+      if (mask[i]) return nullptr;
+    }
+  }
+
+  const auto data =
+      reinterpret_cast<const char*>(view_.buf) + row * view_.strides[0];
+
+  switch (kind_) {
+    case kInt: {
+      // Stored as 32 bit values where possible, like `add_row()` does.
+      const auto value = GetInt(data);
+
+      if (value == static_cast<int32_t>(value)) {
+        const int32_t narrow = value;
+        memcpy(scratch_, &narrow, sizeof(narrow));
+        return ev::StringRef(scratch_, sizeof(narrow));
+      }
+
+      memcpy(scratch_, &value, sizeof(value));
+      return ev::StringRef(scratch_, sizeof(value));
+    }
+
+    case kFloat: {
+      double value;
+      if (format_ == 'f')
+        value = *reinterpret_cast<const float*>(data);
+      else
+        value = *reinterpret_cast<const double*>(data);
+
+      if (save_double_as_float) {
+        const float narrow = value;
+        memcpy(scratch_, &narrow, sizeof(narrow));
+        return ev::StringRef(scratch_, sizeof(narrow));
+      }
+
+      memcpy(scratch_, &value, sizeof(value));
+      return ev::StringRef(scratch_, sizeof(value));
+    }
+
+    default:
+      return ev::StringRef(data, value_size_);
+  }
+}
+
+PyObject* ColumnFileImpl::add_column(PyObject* column, PyObject* name,
+                                     PyObject* type, PyObject* dicom_tag) {
   try {
-    ev_python::ScopedObject iterator(PyObject_GetIter(row));
-    if (!iterator.get()) return nullptr;
+    KJ_REQUIRE(PyLong_Check(column), "Column argument must be long");
+    KJ_REQUIRE(PyLong_Check(dicom_tag), "DICOM tag argument must be long");
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    column_file_writer_.AddColumn(
+        PyLong_AsUnsignedLong(column), ev_python::GetString(name),
+        ev::ColumnTypeFromName(ev_python::GetString(type)),
+        PyLong_AsUnsignedLong(dicom_tag));
+  } catch (kj::Exception e) {
+    PyErr_Format(PyExc_RuntimeError,
+                 "Error adding column to columnfile: %s:%d: %s", e.getFile(),
+                 e.getLine(), e.getDescription().cStr());
+    return nullptr;
+  }
+
+  Py_RETURN_NONE;
+}
+
+ev::StringRefOrNull ColumnFileImpl::GetValue(
+    uint32_t column, PyObject* item,
+    ev::concurrency::RegionPool::Region& region) {
+  if (PyBytes_Check(item)) {
+    // The row holds a reference to the bytes object until it's written.
+    return ev::StringRef(PyBytes_AS_STRING(item), PyBytes_GET_SIZE(item));
+  } else if (PyUnicode_Check(item)) {
+    ev_python::ScopedObject bytes(PyUnicode_AsUTF8String(item));
+    KJ_REQUIRE(bytes != nullptr, "Invalid string", column);
+    return ev::StringRef(PyBytes_AS_STRING(bytes.get()),
+                         PyBytes_GET_SIZE(bytes.get()))
+        .dup(region);
+  } else if (item == Py_None) {
+    return nullptr;
+  } else if (PyFloat_Check(item)) {
+    if (!save_double_as_float_) {
+      double v = PyFloat_AS_DOUBLE(item);
+      return ev::StringRef(reinterpret_cast<const char*>(&v), sizeof(v))
+          .dup(region);
+    } else {
+      float v = PyFloat_AS_DOUBLE(item);
+      return ev::StringRef(reinterpret_cast<const char*>(&v), sizeof(v))
+          .dup(region);
+    }
+  } else if (PyLong_Check(item)
+#if PY_MAJOR_VERSION < 3
+             || PyInt_Check(item)
+#endif
+                 ) {
+    // Stored as 32 bit values where possible, which is what existing
+    // readers of the DICOM table expect.
+    const int64_t v = PyLong_AsLongLong(item);
+    KJ_REQUIRE(!PyErr_Occurred(), "Integer out of range", column);
+
+    if (v == static_cast<int32_t>(v)) {
+      const int32_t narrow = v;
+      return ev::StringRef(reinterpret_cast<const char*>(&narrow),
+                           sizeof(narrow))
+          .dup(region);
+    }
+
+    return ev::StringRef(reinterpret_cast<const char*>(&v), sizeof(v))
+        .dup(region);
+  }
 
+  KJ_FAIL_REQUIRE("Unsupported data type", column);
+}
+
+PyObject* ColumnFileImpl::add_row(PyObject* row) {
+  try {
     auto region = region_pool_.GetRegion();
 
     std::vector<std::pair<uint32_t, ev::StringRefOrNull>> row_vec;
 
-    for (uint32_t idx = 0;; ++idx) {
-      ev_python::ScopedObject item(PyIter_Next(iterator.get()));
-      if (!item.get()) break;
-
-      if (PyBytes_Check(item.get())) {
-        row_vec.emplace_back(idx, ev::StringRef(PyBytes_AS_STRING(item.get()),
-                                                PyBytes_GET_SIZE(item.get())));
-      } else if (PyUnicode_Check(item.get())) {
-        ev_python::ScopedObject bytes(PyUnicode_AsUTF8String(item.get()));
-        row_vec.emplace_back(
-            idx, ev::StringRef(PyBytes_AS_STRING(bytes.get()),
-                               PyBytes_GET_SIZE(bytes.get())).dup(region));
-      } else if (item.get() == Py_None) {
-        row_vec.emplace_back(idx, nullptr);
-      } else if (PyFloat_Check(item.get())) {
-        ev::StringRef buffer;
-
-        if (!save_double_as_float_) {
-          double v = PyFloat_AS_DOUBLE(item.get());
-          buffer = ev::StringRef(reinterpret_cast<const char*>(&v), sizeof(v))
-                       .dup(region);
+    if (PyDict_Check(row)) {
+      PyObject* key;
+      PyObject* value;
+      Py_ssize_t pos = 0;
+
+      while (PyDict_Next(row, &pos, &key, &value)) {
+        uint32_t column;
+        if (PyLong_Check(key)) {
+          column = PyLong_AsUnsignedLong(key);
+#if PY_MAJOR_VERSION < 3
+        } else if (PyInt_Check(key)) {
+          column = PyInt_AsLong(key);
+#endif
         } else {
-          float v = PyFloat_AS_DOUBLE(item.get());
-          buffer = ev::StringRef(reinterpret_cast<const char*>(&v), sizeof(v))
-                       .dup(region);
+          KJ_FAIL_REQUIRE("Column must be long");
         }
 
-        row_vec.emplace_back(idx, buffer);
+        row_vec.emplace_back(column, GetValue(column, value, region));
+      }
+
+      std::sort(row_vec.begin(), row_vec.end(),
+                [](const auto& lhs, const auto& rhs) {
+                  return lhs.first < rhs.first;
+                });
+    } else {
+      ev_python::ScopedObject iterator(PyObject_GetIter(row));
+      if (!iterator.get()) return nullptr;
+
+      for (uint32_t idx = 0;; ++idx) {
+        ev_python::ScopedObject item(PyIter_Next(iterator.get()));
+        if (!item.get()) break;
+
+        row_vec.emplace_back(idx, GetValue(idx, item.get(), region));
+      }
+    }
+
+    bool flush_now;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      column_file_writer_.PutRow(row_vec);
+      ++unflushed_;
+      flush_now = autoflush_ && unflushed_ >= flush_interval_;
+    }
+
+    // Other threads need the region while this one waits for the GIL.
+    region = ev::concurrency::RegionPool::Region();
+
+    if (flush_now) FlushWithoutGIL();
+  } catch (kj::Exception e) {
+    PyErr_Format(PyExc_RuntimeError,
+                 "Error adding row to columnfile: %s:%d: %s", e.getFile(),
+                 e.getLine(), e.getDescription().cStr());
+    return nullptr;
+  }
+
+  Py_RETURN_NONE;
+}
+
+PyObject* ColumnFileImpl::add_rows(PyObject* columns) {
+  try {
+    KJ_REQUIRE(PyDict_Check(columns), "Columns must be a dict");
+
+    ev::concurrency::RegionPool region_pool(1, 16);
+    auto region = region_pool.GetRegion();
+
+    const auto get_value = [this, &region](uint32_t column, PyObject* item) {
+      return GetValue(column, item, region);
+    };
+
+    // Destroyed after the GIL is reacquired.
+    std::vector<std::unique_ptr<BatchColumn>> batch;
+
+    PyObject* key;
+    PyObject* value;
+    Py_ssize_t pos = 0;
+
+    while (PyDict_Next(columns, &pos, &key, &value)) {
+      uint32_t column;
+      if (PyLong_Check(key)) {
+        column = PyLong_AsUnsignedLong(key);
+#if PY_MAJOR_VERSION < 3
+      } else if (PyInt_Check(key)) {
+        column = PyInt_AsLong(key);
+#endif
       } else {
-        KJ_FAIL_REQUIRE("Unsupported data type", idx);
+        KJ_FAIL_REQUIRE("Column must be long");
       }
+
+      batch.emplace_back(std::make_unique<BatchColumn>(column));
+      if (!batch.back()->Init(value, get_value)) return nullptr;
+
+      KJ_REQUIRE(batch.back()->Size() == batch.front()->Size(),
+                 "Columns have different lengths", column);
     }
 
-    column_file_writer_.PutRow(row_vec);
-    ++unflushed_;
+    std::sort(batch.begin(), batch.end(),
+              [](const auto& lhs, const auto& rhs) {
+                return lhs->Column() < rhs->Column();
+              });
 
-    if (autoflush_ && unflushed_ >= flush_interval_) {
-      column_file_writer_.Flush();
-      unflushed_ = 0;
+    const size_t row_count = batch.empty() ? 0 : batch.front()->Size();
+
+    ev_python::ScopedGILRelease gil_release;
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::vector<std::pair<uint32_t, ev::StringRefOrNull>> row;
+    row.reserve(batch.size());
+
+    for (size_t i = 0; i < row_count; ++i) {
+      row.clear();
+      for (const auto& column : batch)
+        row.emplace_back(column->Column(),
+                         column->Get(i, save_double_as_float_));
+
+      column_file_writer_.PutRow(row);
+      ++unflushed_;
+
+      if (autoflush_ && unflushed_ >= flush_interval_) {
+        column_file_writer_.Flush();
+        unflushed_ = 0;
+      }
     }
   } catch (kj::Exception e) {
     PyErr_Format(PyExc_RuntimeError,
-                 "Error adding row to columnfile: %s:%d: %s", e.getFile(),
+                 "Error adding rows to columnfile: %s:%d: %s", e.getFile(),
                  e.getLine(), e.getDescription().cStr());
     return nullptr;
   }
@@ -113,10 +558,17 @@ PyObject* ColumnFileImpl::add_row(PyObject* row) {
   Py_RETURN_NONE;
 }
 
+void ColumnFileImpl::FlushWithoutGIL() {
+  ev_python::ScopedGILRelease gil_release;
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  column_file_writer_.Flush();
+  unflushed_ = 0;
+}
+
 PyObject* ColumnFileImpl::flush() {
   try {
-    column_file_writer_.Flush();
-    unflushed_ = 0;
+    FlushWithoutGIL();
   } catch (kj::Exception e) {
     PyErr_Format(PyExc_RuntimeError, "Error flushing columnfile: %s:%d: %s",
                  e.getFile(), e.getLine(), e.getDescription().cStr());
@@ -125,8 +577,76 @@ PyObject* ColumnFileImpl::flush() {
   Py_RETURN_NONE;
 }
 
+PyObject* ColumnFileImpl::checkpoint(PyObject* inputs) {
+  try {
+    std::vector<std::string> names;
+    if (!GetStrings(inputs, names)) return nullptr;
+
+    {
+      ev_python::ScopedGILRelease gil_release;
+      std::lock_guard<std::mutex> lock(mutex_);
+
+      column_file_writer_.Checkpoint(names);
+      unflushed_ = 0;
+    }
+
+    manifest_.insert(manifest_.end(), names.begin(), names.end());
+  } catch (kj::Exception e) {
+    PyErr_Format(PyExc_RuntimeError,
+                 "Error checkpointing columnfile: %s:%d: %s", e.getFile(),
+                 e.getLine(), e.getDescription().cStr());
+    return nullptr;
+  }
+  Py_RETURN_NONE;
+}
+
+PyObject* ColumnFileImpl::manifest() {
+  ev_python::ScopedObject result(PyList_New(manifest_.size()));
+  if (!result) return nullptr;
+
+  for (size_t i = 0; i < manifest_.size(); ++i) {
+    auto item = PyUnicode_FromStringAndSize(manifest_[i].data(),
+                                            manifest_[i].size());
+    if (!item) return nullptr;
+
+    PyList_SET_ITEM(result.get(), i, item);
+  }
+
+  return result.release();
+}
+
+PyObject* ColumnFileImpl::pending_inputs(PyObject* inputs) {
+  try {
+    std::vector<std::string> names;
+    if (!GetStrings(inputs, names)) return nullptr;
+
+    const auto pending = ev::ColumnFileWriter::PendingInputs(names, manifest_);
+
+    ev_python::ScopedObject result(PyList_New(pending.size()));
+    if (!result) return nullptr;
+
+    for (size_t i = 0; i < pending.size(); ++i) {
+      auto item =
+          PyUnicode_FromStringAndSize(pending[i].data(), pending[i].size());
+      if (!item) return nullptr;
+
+      PyList_SET_ITEM(result.get(), i, item);
+    }
+
+    return result.release();
+  } catch (kj::Exception e) {
+    PyErr_Format(PyExc_RuntimeError,
+                 "Error comparing inputs to manifest: %s:%d: %s", e.getFile(),
+                 e.getLine(), e.getDescription().cStr());
+    return nullptr;
+  }
+}
+
 PyObject* ColumnFileImpl::finish() {
   try {
+    ev_python::ScopedGILRelease gil_release;
+    std::lock_guard<std::mutex> lock(mutex_);
+
     column_file_writer_.Finalize();
   } catch (kj::Exception e) {
     PyErr_Format(PyExc_RuntimeError, "Error finalizing columnfile: %s:%d: %s",
@@ -150,6 +670,19 @@ ColumnFile* ColumnFile::create(const char* path) {
   }
 }
 
+ColumnFile* ColumnFile::append(const char* path) {
+  try {
+    std::vector<std::string> manifest;
+    auto output = ev::ColumnFileWriter::CheckpointedOutput(path, manifest);
+    return new ColumnFileImpl(std::move(output), std::move(manifest));
+  } catch (kj::Exception e) {
+    PyErr_Format(PyExc_RuntimeError,
+                 "Error opening columnfile for appending: %s:%d: %s",
+                 e.getFile(), e.getLine(), e.getDescription().cStr());
+    return nullptr;
+  }
+}
+
 ColumnFile* ColumnFile::create_from_fd(int fd) {
   try {
     return new ColumnFileImpl(kj::AutoCloseFd(fd));
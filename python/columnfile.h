@@ -10,17 +10,51 @@ class ColumnFile {
 
   static ColumnFile* create_from_fd(int fd);
 
+  // Opens a table for appending, creating it if necessary.  Rows added after
+  // the last call to checkpoint() by an earlier, interrupted, writer are
+  // discarded.
+  static ColumnFile* append(const char* path);
+
   virtual ~ColumnFile();
 
   virtual PyObject* save_double_as_float() = 0;
 
   virtual PyObject* set_flush_interval(PyObject* interval) = 0;
 
-  // Inserts a complete row into the column file.
+  // Adds a column to the schema stored in the file.  `type` is one of
+  // "binary", "string", "int", "float" and "float-array".  `dicom_tag` is the
+  // DICOM tag the column was extracted from, or 0.
+  virtual PyObject* add_column(PyObject* column, PyObject* name,
+                               PyObject* type, PyObject* dicom_tag) = 0;
+
+  // Inserts a complete row into the column file.  The row is either a
+  // sequence of values for columns 0, 1, 2, ..., or a dict mapping column
+  // numbers to values.  Values are bytes, str, int, float or None.
   virtual PyObject* add_row(PyObject* row) = 0;
 
+  // Inserts a batch of rows, given as a dict mapping column numbers to
+  // sequences of values, one per row.  NumPy arrays are read without
+  // converting their elements to Python objects: one-dimensional integer and
+  // float arrays give int and float values, and rows of other arrays are
+  // stored as binary values.  Masked entries are stored as null.  Other
+  // sequences hold values accepted by add_row().  The GIL is released while
+  // rows are compressed and written, as it is by flush() and checkpoint().
+  virtual PyObject* add_rows(PyObject* columns) = 0;
+
   virtual PyObject* flush() = 0;
 
+  // Flushes all rows, and records the input names in the sequence `inputs`
+  // in the file's manifest once the rows are on disk.
+  virtual PyObject* checkpoint(PyObject* inputs) = 0;
+
+  // Returns the list of input names recorded by checkpoint(), including those
+  // recorded by earlier writers.
+  virtual PyObject* manifest() = 0;
+
+  // Returns the names in the sequence `inputs` that are not in the manifest,
+  // in order and without duplicates.
+  virtual PyObject* pending_inputs(PyObject* inputs) = 0;
+
   virtual PyObject* finish() = 0;
 };
 
@@ -37,12 +71,143 @@ class ColumnFileReader {
 
   virtual PyObject* get_row() = 0;
 
+  // Like get_row(), but returns the values as read-only memoryviews of the
+  // reader's decoded field data, instead of copying them.  A view keeps its
+  // data alive after the reader moves on, so it can be wrapped without
+  // copying, e.g. with numpy.frombuffer().
+  virtual PyObject* get_row_views() = 0;
+
+  // Reads up to `max_rows` rows, and returns a dict mapping each column in
+  // `columns` to a NumPy array of its values, or None at the end of the
+  // table.  Int and float columns become int64 and float64 arrays, and other
+  // columns object arrays of bytes.  A column given as a (column, dtype,
+  // shape) tuple holds fixed size binary values, such as pixel data, and
+  // becomes an array of shape (rows,) + shape.  Nulls are None in object
+  // arrays, and masked in the others.  Numeric arrays are read-only.
+  //
+  // Rows are decoded with the GIL released.  Only the columns selected by
+  // set_column_filter() are decoded, so set it to `columns` to skip the
+  // others.
+  virtual PyObject* read_columns(PyObject* columns, PyObject* max_rows) = 0;
+
+  // Returns the schema stored in the file, as a list of (column, name, type,
+  // dicom_tag) tuples.
+  virtual PyObject* schema() = 0;
+
+  // Returns the number of rows in the table.
+  virtual PyObject* row_count() = 0;
+
+  // Moves to the given row, so that the next call to get_row() returns it.
+  virtual PyObject* seek_to_row(PyObject* row) = 0;
+
+  // Returns a list of `count` distinct rows chosen uniformly at random, in
+  // row order.  `seed` is an integer giving a reproducible sample, or None.
+  virtual PyObject* sample(PyObject* count, PyObject* seed) = 0;
+
   virtual PyObject* size() = 0;
 
   virtual PyObject* offset() = 0;
 };
 
+// Iterates over the rows of a table, like ColumnFileReader.get_row(), while a
+// background thread decodes the following rows.  Use as a Python iterator:
+//
+//   for row in dsb2.ColumnFileIterator.open(path, None, 256, 4):
+//     ...
+class ColumnFileIterator {
+ public:
+  // Opens an existing table for reading.  `columns` is a sequence of column
+  // numbers or names to decode, or None for all columns.  Up to `depth`
+  // batches of `batch_size` rows are decoded ahead of the consumer, with
+  // `depth` rounded up to a power of two.
+  static ColumnFileIterator* open(const char* path, PyObject* columns,
+                                  PyObject* batch_size, PyObject* depth);
+
+  virtual ~ColumnFileIterator();
+
+  // Returns the next row as a dict mapping column numbers to values, or
+  // raises StopIteration at the end of the table.  The GIL is released while
+  // waiting for the background thread.
+  virtual PyObject* next_row() = 0;
+};
+
+// Calls `callback` with a dict mapping column numbers to values for every row
+// passing all filters.  Fields and filter fields may be given as column
+// numbers, or as column names from the file's schema.
+//
+// Filters are (column, function) tuples, where function is called with each
+// value, or None, and returns whether it matches.  Filters evaluated without
+// calling into Python are given as:
+//
+//   (column, "prefix", prefix)  values starting with `prefix`
+//   (column, "regex", pattern)  values containing a match for `pattern`
+//   (column, "range", min, max) values in [min, max], compared as numbers if
+//                               the bounds are numbers or None (unbounded),
+//                               and as byte strings otherwise
+//   (column, "in", values)      values equal to one of `values`
+//
+// None of these match null values.
 PyObject* ColumnFile_select(PyObject* path, PyObject* fields, PyObject* filters,
                             PyObject* callback);
 
+// Like ColumnFile_select(), but calls `callback` with batches of up to
+// `batch_size` rows, as dicts mapping each field to a NumPy array, as
+// returned by ColumnFileReader.read_columns().  Fields may be (column, dtype,
+// shape) tuples.  Filters must not be Python functions, so that the file is
+// read and filtered with the GIL released.
+PyObject* ColumnFile_select_batches(PyObject* path, PyObject* fields,
+                                    PyObject* filters, PyObject* batch_size,
+                                    PyObject* callback);
+
+// Like ColumnFile_select_batches(), but also reads an image from every row,
+// and calls `callback` with two arguments: the dict of field arrays, and a
+// float32 array of shape (rows, height, width) holding the images resized to
+// `shape`, a (height, width) tuple.  `image` is a (pixels, sample_type,
+// width, height) tuple of columns: pixels holds 16 bit samples in native
+// byte order, sample_type is "uint16" or "int16", and the dimensions are int
+// columns or 32 bit little endian values.  `method` is "bilinear" or "area".
+// If `standardize` is true, every image is scaled to zero mean and unit
+// variance before it is resized.  Images are resized in parallel, with the
+// GIL released.
+PyObject* ColumnFile_select_images(PyObject* path, PyObject* fields,
+                                   PyObject* filters, PyObject* image,
+                                   PyObject* shape, PyObject* method,
+                                   PyObject* standardize, PyObject* batch_size,
+                                   PyObject* callback);
+
+// Like ColumnFile_select(), but only calls `callback` for `count` distinct
+// rows chosen uniformly at random from the rows passing the filters.  `seed`
+// is an integer giving a reproducible sample, or None.
+PyObject* ColumnFile_sample(PyObject* path, PyObject* fields, PyObject* filters,
+                            PyObject* count, PyObject* seed,
+                            PyObject* callback);
+
+// Like ColumnFile_select(), but joins every selected row with the rows of a
+// build table having the same key.  The probe key is the value of column
+// `key`, or the first capture group of the regular expression `key_pattern`
+// in that value, unless `key_pattern` is None.  If `build_path` ends with
+// ".csv", the build table is a CSV file whose key is column number
+// `build_key`; otherwise it is a column file.  Build table columns are added
+// to the row with `field_offset` added to their column numbers.
+PyObject* ColumnFile_join(PyObject* path, PyObject* fields, PyObject* filters,
+                          PyObject* key, PyObject* key_pattern,
+                          PyObject* build_path, PyObject* build_key,
+                          PyObject* field_offset, PyObject* callback);
+
+// Computes aggregates over a table.  `group_by` is a sequence of columns, and
+// `aggregates` is a sequence of (function, column) tuples, where function is
+// one of "count", "min", "max" and "sum".  Returns a list of (key, values)
+// tuples, where key holds one value per group-by column, and values holds one
+// number per aggregate.
+PyObject* ColumnFile_aggregate(PyObject* path, PyObject* group_by,
+                               PyObject* aggregates);
+
+// Sets the number of bytes of decompressed field data kept in the
+// process-wide cache shared by all readers.  Zero disables the cache.
+PyObject* ColumnFile_set_cache_capacity(PyObject* capacity);
+
+// Returns a dict with the "hits", "misses", "insertions", "evictions" and
+// "size" statistics of the process-wide cache.
+PyObject* ColumnFile_cache_statistics();
+
 #endif  // !PYTHON_LEVELDB_TABLE_
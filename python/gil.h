@@ -0,0 +1,41 @@
+#ifndef PYTHON_GIL_H_
+#define PYTHON_GIL_H_ 1
+
+#include <Python.h>
+
+namespace ev_python {
+
+// Releases the global interpreter lock for the lifetime of the object, so
+// that other Python threads can run during long computations.  The Python
+// API must not be used while the lock is released.
+class ScopedGILRelease {
+ public:
+  ScopedGILRelease() : state_(PyEval_SaveThread()) {}
+
+  ~ScopedGILRelease() { PyEval_RestoreThread(state_); }
+
+  ScopedGILRelease(const ScopedGILRelease&) = delete;
+  ScopedGILRelease& operator=(const ScopedGILRelease&) = delete;
+
+ private:
+  PyThreadState* state_;
+};
+
+// Acquires the global interpreter lock for the lifetime of the object, e.g.
+// to call back into Python while a `ScopedGILRelease` is in effect.
+class ScopedGILAcquire {
+ public:
+  ScopedGILAcquire() : state_(PyGILState_Ensure()) {}
+
+  ~ScopedGILAcquire() { PyGILState_Release(state_); }
+
+  ScopedGILAcquire(const ScopedGILAcquire&) = delete;
+  ScopedGILAcquire& operator=(const ScopedGILAcquire&) = delete;
+
+ private:
+  PyGILState_STATE state_;
+};
+
+}  // namespace ev_python
+
+#endif  // !PYTHON_GIL_H_
@@ -0,0 +1,69 @@
+#include "python/image.h"
+
+#include <cstring>
+#include <future>
+#include <vector>
+
+#include <kj/debug.h>
+
+#include "base/image.h"
+#include "base/thread-pool.h"
+#include "python/gil.h"
+
+PyObject* Image_standardize_stacks(PyObject* images,
+                                   PyObject* subtract_mean_image) {
+  const auto subtract_mean = PyObject_IsTrue(subtract_mean_image);
+  if (subtract_mean == -1) return nullptr;
+
+  Py_buffer view;
+  if (-1 == PyObject_GetBuffer(images, &view, PyBUF_WRITABLE |
+                                                  PyBUF_C_CONTIGUOUS |
+                                                  PyBUF_FORMAT))
+    return nullptr;
+
+  try {
+    KJ_REQUIRE(view.format && !strcmp(view.format, "f"),
+               "Images must be float32", view.format);
+    KJ_REQUIRE(view.ndim >= 2, "Images must have stack and image axes",
+               view.ndim);
+
+    const size_t stacks = view.shape[0];
+    const size_t count = view.shape[1];
+    const size_t stack_size = stacks ? view.len / view.itemsize / stacks : 0;
+    const size_t image_size = count ? stack_size / count : 0;
+
+    auto data = reinterpret_cast<float*>(view.buf);
+    bool all_standardized = true;
+
+    {
+      ev_python::ScopedGILRelease gil_release;
+      ev::ThreadPool thread_pool;
+
+      std::vector<std::future<bool>> results;
+      results.reserve(stacks);
+
+      for (size_t i = 0; i < stacks; ++i) {
+        results.emplace_back(thread_pool.Launch([=] {
+          const auto stack = data + i * stack_size;
+          if (subtract_mean) ev::SubtractMeanImage(stack, count, image_size);
+          return ev::StandardizeImage(stack, stack_size);
+        }));
+      }
+
+      for (auto& standardized : results)
+        all_standardized &= standardized.get();
+    }
+
+    KJ_REQUIRE(all_standardized, "Image stack has no variance");
+  } catch (kj::Exception e) {
+    PyBuffer_Release(&view);
+    PyErr_Format(PyExc_RuntimeError,
+                 "Image_standardize_stacks failed: %s:%d: %s", e.getFile(),
+                 e.getLine(), e.getDescription().cStr());
+    return nullptr;
+  }
+
+  PyBuffer_Release(&view);
+
+  Py_RETURN_NONE;
+}
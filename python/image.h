@@ -0,0 +1,14 @@
+#ifndef PYTHON_IMAGE_H_
+#define PYTHON_IMAGE_H_ 1
+
+#include <Python.h>
+
+// Standardizes each stack of images in `images`, a writable C-contiguous
+// float32 NumPy array of shape (stacks, images, ...), in place: every stack
+// gets zero mean and unit variance.  If `subtract_mean_image` is true, the
+// mean image of each stack is first subtracted from its images.  Stacks are
+// processed in parallel, with the GIL released.
+PyObject* Image_standardize_stacks(PyObject* images,
+                                   PyObject* subtract_mean_image);
+
+#endif  // !PYTHON_IMAGE_H_
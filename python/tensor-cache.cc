@@ -0,0 +1,107 @@
+#include "python/tensor-cache.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <kj/debug.h>
+
+#include "base/tensor-cache.h"
+#include "python/buffer.h"
+#include "python/gil.h"
+#include "python/object.h"
+#include "python/string.h"
+
+PyObject* TensorCache_write(PyObject* path, PyObject* source_path,
+                            PyObject* parameters, PyObject* array) {
+  Py_buffer view;
+  if (-1 == PyObject_GetBuffer(array, &view, PyBUF_C_CONTIGUOUS))
+    return nullptr;
+
+  try {
+    ev_python::ScopedObject dtype(PyObject_GetAttrString(array, "dtype"));
+    if (!dtype) {
+      PyBuffer_Release(&view);
+      return nullptr;
+    }
+
+    ev_python::ScopedObject dtype_str(
+        PyObject_GetAttrString(dtype.get(), "str"));
+    if (!dtype_str) {
+      PyBuffer_Release(&view);
+      return nullptr;
+    }
+
+    const auto type_name = ev_python::GetString(dtype_str.get());
+    const auto output_path = ev_python::GetString(path);
+    const auto source = ev_python::GetString(source_path);
+    const auto parameter_string = ev_python::GetString(parameters);
+
+    std::vector<uint64_t> shape(view.shape, view.shape + view.ndim);
+
+    {
+      ev_python::ScopedGILRelease gil_release;
+
+      ev::WriteTensorCache(
+          output_path.c_str(),
+          ev::TensorCacheKey(source.c_str(), parameter_string), type_name,
+          shape,
+          ev::StringRef(reinterpret_cast<const char*>(view.buf), view.len));
+    }
+  } catch (kj::Exception e) {
+    PyBuffer_Release(&view);
+    PyErr_Format(PyExc_RuntimeError, "TensorCache_write failed: %s:%d: %s",
+                 e.getFile(), e.getLine(), e.getDescription().cStr());
+    return nullptr;
+  }
+
+  PyBuffer_Release(&view);
+
+  Py_RETURN_NONE;
+}
+
+PyObject* TensorCache_open(PyObject* path, PyObject* source_path,
+                           PyObject* parameters) {
+  try {
+    const auto input_path = ev_python::GetString(path);
+    const auto source = ev_python::GetString(source_path);
+    const auto parameter_string = ev_python::GetString(parameters);
+
+    ev::TensorCacheFile file;
+    bool found;
+
+    {
+      ev_python::ScopedGILRelease gil_release;
+
+      found = ev::ReadTensorCache(
+          input_path.c_str(),
+          ev::TensorCacheKey(source.c_str(), parameter_string), file);
+    }
+
+    if (!found) Py_RETURN_NONE;
+
+    ev_python::ScopedObject numpy(PyImport_ImportModule("numpy"));
+    if (!numpy) return nullptr;
+
+    ev_python::ScopedObject shape(PyTuple_New(file.shape.size()));
+    if (!shape) return nullptr;
+    for (size_t i = 0; i < file.shape.size(); ++i)
+      PyTuple_SET_ITEM(shape.get(), i,
+                       PyLong_FromUnsignedLongLong(file.shape[i]));
+
+    // The view keeps the file mapped for as long as the array is alive.
+    ev_python::ScopedObject view(
+        ev_python::MakeMemoryView(std::move(file.buffer), file.data));
+    if (!view) return nullptr;
+
+    ev_python::ScopedObject data(PyObject_CallMethod(
+        numpy.get(), "frombuffer", "Os", view.get(), file.dtype.c_str()));
+    if (!data) return nullptr;
+
+    return PyObject_CallMethod(data.get(), "reshape", "O", shape.get());
+  } catch (kj::Exception e) {
+    PyErr_Format(PyExc_RuntimeError, "TensorCache_open failed: %s:%d: %s",
+                 e.getFile(), e.getLine(), e.getDescription().cStr());
+    return nullptr;
+  }
+}
@@ -0,0 +1,20 @@
+#ifndef PYTHON_TENSOR_CACHE_H_
+#define PYTHON_TENSOR_CACHE_H_ 1
+
+#include <Python.h>
+
+// Writes `array`, a C-contiguous NumPy array, e.g. of preprocessed float32
+// images, to a tensor cache file at `path`.  The file is tagged with a key
+// derived from the file at `source_path` and `parameters`, a string
+// describing how the array was computed from it.
+PyObject* TensorCache_write(PyObject* path, PyObject* source_path,
+                            PyObject* parameters, PyObject* array);
+
+// Returns the array stored in the tensor cache file at `path` as a read-only
+// NumPy array backed by a memory map of the file, or None if the file
+// doesn't exist, or if `source_path` or `parameters` differ from those the
+// file was written with.
+PyObject* TensorCache_open(PyObject* path, PyObject* source_path,
+                           PyObject* parameters);
+
+#endif  // !PYTHON_TENSOR_CACHE_H_
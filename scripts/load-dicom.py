@@ -11,6 +11,9 @@ parser.add_argument('inputs', metavar='inputs', type=str, nargs='+',
 parser.add_argument('--output-path', metavar='output_path', type=str, nargs='?',
                     help='output path',
                     default='data/dicoms.col')
+parser.add_argument('--checkpoint-interval', metavar='N', type=int,
+                    help='inputs to read between checkpoints',
+                    default=1000)
 args = parser.parse_args()
 
 seen = set()
@@ -20,16 +23,31 @@ images = []
 output = dsb2.ColumnFile_append(args.output_path)
 output.set_flush_interval(100L)
 
-for path in args.inputs:
+output.add_column(0L, 'path', 'string', 0L)
+output.add_column(1L, 'pixel_type', 'string', 0L)
+output.add_column(2L, 'rows', 'int', 0L)
+output.add_column(3L, 'cols', 'int', 0L)
+output.add_column(4L, 'pixels', 'binary', 0L)
+
+columns = set()
+
+def add_dicom_column(idx, tag, column_type):
+  if idx in columns:
+    return
+  columns.add(idx)
+  name = dicom.datadict.keyword_for_tag(tag) or ('%08x' % idx)
+  output.add_column(long(idx), name, column_type, long(idx))
+
+def add_dicom(path):
   image = dicom.read_file(path)
 
   try:
     pixels = image.pixel_array
   except Exception as e:
-    continue
+    return
 
   if len(pixels.shape) != 2:
-    continue
+    return
 
   row = {
       0L: path,
@@ -41,9 +59,17 @@ for path in args.inputs:
 
   for k in image.iterall():
     idx = (k.tag.group << 16) | k.tag.element
-    if isinstance(k.value, basestring) or isinstance(k.value, long) or isinstance(k.value, int) or isinstance(k.value, float):
+    if isinstance(k.value, basestring):
+      add_dicom_column(idx, k.tag, 'string')
+      row[idx] = k.value
+    elif isinstance(k.value, long) or isinstance(k.value, int):
+      add_dicom_column(idx, k.tag, 'int')
+      row[idx] = k.value
+    elif isinstance(k.value, float):
+      add_dicom_column(idx, k.tag, 'float')
       row[idx] = k.value
     elif k.VR == 'DS':
+      add_dicom_column(idx, k.tag, 'float-array')
       row[idx] = ','.join(map(lambda x: '%.19g' % x, k.value))
     else:
       if idx not in seen:
@@ -51,4 +77,18 @@ for path in args.inputs:
         print k
   output.add_row(row)
 
+# Inputs are recorded in the output's manifest when their rows are
+# checkpointed, so only files not yet ingested are read, and an interrupted
+# run resumes after the last checkpoint.
+ingested = []
+
+for path in output.pending_inputs(args.inputs):
+  add_dicom(path)
+  ingested.append(path)
+
+  if len(ingested) >= args.checkpoint_interval:
+    output.checkpoint(ingested)
+    ingested = []
+
+output.checkpoint(ingested)
 output.finish()